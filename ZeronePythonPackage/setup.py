@@ -0,0 +1,38 @@
+# Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+#
+# This file is part of Zerone.
+#
+# Zerone is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Zerone is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+
+import os
+from setuptools import setup, Extension
+
+SRC_DIR = os.path.join('..', 'src')
+SOURCES = ['bgzf.c', 'checkpoint.c', 'counters.c', 'hfile.c', 'hmm.c',
+      'numa.c', 'parse.c', 'predict.c', 'refine.c', 'sam.c', 'segment.c',
+      'shard.c', 'snippets.c', 'trace.c', 'utils.c', 'xxhash.c', 'zerone.c',
+      'zinm.c']
+
+zerone = Extension('zerone',
+      sources = [os.path.join('src', 'pyzerone.c')] +
+         [os.path.join(SRC_DIR, f) for f in SOURCES],
+      include_dirs = [SRC_DIR],
+      extra_compile_args = ['-std=gnu99', '-O3'],
+      libraries = ['z', 'm', 'pthread'])
+
+setup(name = 'zerone',
+      version = '1.0',
+      description = 'ChIP-seq discretization and quality control',
+      license = 'GPLv3',
+      ext_modules = [zerone])
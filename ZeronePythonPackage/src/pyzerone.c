@@ -0,0 +1,964 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Python bindings of Zerone (module 'zerone').
+//
+//   data = zerone.parse(["ctcf1.sam", "ctcf2.sam"], mock=["mock.sam"])
+//   data = zerone.Data(y, sizes=[...], names=[...], nomock=False)
+//   fit = zerone.fit(data, threads=1, starts=1)
+//   fit.Q, fit.p, fit.phi, fit.pem, fit.path, fit.qc()
+//
+// 'Data' accepts any object with the buffer protocol (e.g. a NumPy
+// array) of shape (n, r) or (n,). C-contiguous arrays of 32-bit
+// integers are used without copy; other layouts and integer types
+// are copied. The arrays of a fit are views of the memory of Zerone
+// that keep the fit alive; they are NumPy arrays if NumPy can be
+// imported and read-only memoryviews otherwise. Parsing, fitting and
+// quality control release the GIL, so samples can be processed in
+// parallel threads.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <ctype.h>
+#include <limits.h>
+#include "../../src/parse.h"
+#include "../../src/predict.h"
+#include "../../src/zerone.h"
+
+struct data_t;
+struct fit_t;
+struct view_t;
+typedef struct data_t data_t;
+typedef struct fit_t fit_t;
+typedef struct view_t view_t;
+
+struct data_t {
+   PyObject_HEAD
+   ChIP_t    * ChIP;       // observations //
+   Py_buffer   buf;        // buffer of 'y' (if 'borrowed') //
+   int         borrowed;   // 'y' belongs to the buffer (1) //
+};
+
+struct fit_t {
+   PyObject_HEAD
+   zerone_t  * Z;      // the fit //
+   PyObject  * data;   // owner of 'Z->ChIP' (or NULL) //
+};
+
+struct view_t {
+   PyObject_HEAD
+   PyObject   * owner;       // object that owns the memory //
+   void       * mem;         // first item //
+   char       * format;      // "d" or "i" //
+   int          ndim;        // 1 or 2 //
+   Py_ssize_t   shape[2];    // dimensions //
+   Py_ssize_t   strides[2];  // strides in bytes //
+};
+
+
+//  ----- Globals ----- //
+// The module 'numpy' (or NULL if it cannot be imported).
+PyObject * NUMPY = NULL;
+
+
+//  ---- Declaration of local functions  ---- //
+PyObject * as_array (PyObject *, void *, char *, int, const Py_ssize_t *,
+              const Py_ssize_t *);
+int        copy_items (const Py_buffer *, int *);
+char    ** filename_array (PyObject *, PyObject **);
+PyObject * matrix_view (PyObject *, void *, char *, Py_ssize_t, Py_ssize_t,
+              Py_ssize_t, Py_ssize_t);
+
+
+//  ---- Observations  ---- //
+
+void
+data_dealloc
+(
+   data_t * self
+)
+{
+
+   if (self->ChIP != NULL) {
+      if (self->borrowed) PyBuffer_Release(&self->buf);
+      else free(self->ChIP->y);
+      free(self->ChIP);
+   }
+   Py_TYPE(self)->tp_free((PyObject *) self);
+
+}
+
+
+PyObject *
+data_new
+(
+   PyTypeObject * type,
+   PyObject     * args,
+   PyObject     * kwds
+)
+// SYNOPSIS:
+//   Constructor 'Data(y, sizes=None, names=None, nomock=False)'.
+//   The windows are in the rows of 'y', the profiles in the columns
+//   (the mock first, unless 'nomock' is true). The blocks have the
+//   given 'sizes' (one block by default).
+{
+
+   static char *kwlist[] = {"y", "sizes", "names", "nomock", NULL};
+
+   PyObject *y = NULL;
+   PyObject *sizes = Py_None;
+   PyObject *names = Py_None;
+   int nomock = 0;
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOp", kwlist,
+            &y, &sizes, &names, &nomock)) {
+      return NULL;
+   }
+
+   PyObject *fsizes = NULL;
+   PyObject *fnames = NULL;
+   uint *sz = NULL;
+   const char **nm = NULL;
+   int *copy = NULL;
+
+   data_t *self = (data_t *) type->tp_alloc(type, 0);
+   if (self == NULL) return NULL;
+
+   Py_buffer *buf = &self->buf;
+   if (PyObject_GetBuffer(y, buf, PyBUF_RECORDS_RO) < 0) goto fail;
+   self->borrowed = 1;
+
+   if (buf->ndim < 1 || buf->ndim > 2) {
+      PyErr_SetString(PyExc_ValueError, "y must have 1 or 2 dimensions");
+      goto fail;
+   }
+
+   const Py_ssize_t n = buf->shape[0];
+   const Py_ssize_t s = buf->ndim == 2 ? buf->shape[1] : 1;
+   const Py_ssize_t r = s + (nomock != 0);
+   if (n < 1 || s < 1 || r < 2 || r > 63) {
+      PyErr_SetString(PyExc_ValueError, "y must have at least one row "
+            "and 2 to 63 profiles (including the mock)");
+      goto fail;
+   }
+
+   // Blocks.
+   Py_ssize_t nb = 1;
+   if (sizes != Py_None) {
+      fsizes = PySequence_Fast(sizes, "sizes must be a sequence");
+      if (fsizes == NULL) goto fail;
+      nb = PySequence_Fast_GET_SIZE(fsizes);
+   }
+   if (names != Py_None) {
+      fnames = PySequence_Fast(names, "names must be a sequence");
+      if (fnames == NULL) goto fail;
+      if (PySequence_Fast_GET_SIZE(fnames) != nb) {
+         PyErr_SetString(PyExc_ValueError,
+               "names and sizes have different lengths");
+         goto fail;
+      }
+   }
+   if (nb < 1) {
+      PyErr_SetString(PyExc_ValueError, "sizes must not be empty");
+      goto fail;
+   }
+
+   sz = malloc(nb * sizeof(uint));
+   nm = calloc(nb, sizeof(char *));
+   if (sz == NULL || nm == NULL) {
+      PyErr_NoMemory();
+      goto fail;
+   }
+
+   Py_ssize_t total = 0;
+   for (Py_ssize_t i = 0 ; i < nb ; i++) {
+      long size = n;
+      if (fsizes != NULL) {
+         size = PyLong_AsLong(PySequence_Fast_GET_ITEM(fsizes, i));
+         if (size == -1 && PyErr_Occurred()) goto fail;
+      }
+      if (size < 1) {
+         PyErr_SetString(PyExc_ValueError, "sizes must be positive");
+         goto fail;
+      }
+      sz[i] = size;
+      total += size;
+      if (fnames != NULL) {
+         nm[i] = PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(fnames, i));
+         if (nm[i] == NULL) goto fail;
+      }
+   }
+   if (total != n) {
+      PyErr_SetString(PyExc_ValueError,
+            "the sizes do not add up to the number of rows of y");
+      goto fail;
+   }
+
+   // Use the buffer if it has the layout of 'ChIP->y', otherwise
+   // convert it (the buffer is then released).
+   int *mem = buf->buf;
+   const char *f = buf->format == NULL ? "B" : buf->format;
+   if (*f == '@' || *f == '=') f++;
+   const int is_int = (f[0] == 'i' || f[0] == 'l') && f[1] == '\0';
+   if (!is_int || buf->itemsize != sizeof(int) ||
+         !PyBuffer_IsContiguous(buf, 'C')) {
+      copy = malloc(n*s * sizeof(int));
+      if (copy == NULL) {
+         PyErr_NoMemory();
+         goto fail;
+      }
+      if (copy_items(buf, copy) < 0) goto fail;
+      PyBuffer_Release(buf);
+      self->borrowed = 0;
+      mem = copy;
+   }
+
+   self->ChIP = new_ChIP(r, nb, mem, fnames == NULL ? NULL : nm, sz);
+   if (self->ChIP == NULL) {
+      PyErr_NoMemory();
+      goto fail;
+   }
+   self->ChIP->nomock = nomock != 0;
+
+   Py_XDECREF(fsizes);
+   Py_XDECREF(fnames);
+   free(sz);
+   free(nm);
+
+   return (PyObject *) self;
+
+fail:
+   Py_XDECREF(fsizes);
+   Py_XDECREF(fnames);
+   free(sz);
+   free(nm);
+   free(copy);
+   if (self->borrowed) PyBuffer_Release(buf);
+   self->borrowed = 0;
+   Py_DECREF(self);
+   return NULL;
+
+}
+
+
+PyObject *
+data_get_y
+(
+   data_t * self,
+   void   * closure
+)
+{
+
+   const ChIP_t *ChIP = self->ChIP;
+   const Py_ssize_t s = ChIP->r - ChIP->nomock;
+   return matrix_view((PyObject *) self, ChIP->y, "i", nobs(ChIP), s,
+         s * sizeof(int), sizeof(int));
+
+}
+
+
+PyObject *
+data_get_names
+(
+   data_t * self,
+   void   * closure
+)
+{
+
+   PyObject *list = PyList_New(self->ChIP->nb);
+   if (list == NULL) return NULL;
+
+   for (int i = 0 ; i < self->ChIP->nb ; i++) {
+      PyObject *name = PyUnicode_FromString(self->ChIP->nm + 32*i);
+      if (name == NULL) {
+         Py_DECREF(list);
+         return NULL;
+      }
+      PyList_SET_ITEM(list, i, name);
+   }
+
+   return list;
+
+}
+
+
+PyObject *
+data_get_sizes
+(
+   data_t * self,
+   void   * closure
+)
+{
+
+   PyObject *list = PyList_New(self->ChIP->nb);
+   if (list == NULL) return NULL;
+
+   for (int i = 0 ; i < self->ChIP->nb ; i++) {
+      PyObject *size = PyLong_FromUnsignedLong(self->ChIP->sz[i]);
+      if (size == NULL) {
+         Py_DECREF(list);
+         return NULL;
+      }
+      PyList_SET_ITEM(list, i, size);
+   }
+
+   return list;
+
+}
+
+
+PyObject *
+data_get_nomock
+(
+   data_t * self,
+   void   * closure
+)
+{
+   return PyBool_FromLong(self->ChIP->nomock);
+}
+
+
+PyGetSetDef data_getset[] = {
+   {"y", (getter) data_get_y, NULL,
+      "observations (windows in rows, profiles in columns)", NULL},
+   {"names", (getter) data_get_names, NULL, "names of the blocks", NULL},
+   {"sizes", (getter) data_get_sizes, NULL, "sizes of the blocks", NULL},
+   {"nomock", (getter) data_get_nomock, NULL,
+      "the mock is implicit (no column in y)", NULL},
+   {NULL},
+};
+
+PyTypeObject DataType = {
+   PyVarObject_HEAD_INIT(NULL, 0)
+   .tp_name = "zerone.Data",
+   .tp_doc = "Data(y, sizes=None, names=None, nomock=False)\n\n"
+      "Observations of Zerone (windows in rows, profiles in columns,\n"
+      "the mock first unless 'nomock' is true).",
+   .tp_basicsize = sizeof(data_t),
+   .tp_flags = Py_TPFLAGS_DEFAULT,
+   .tp_new = data_new,
+   .tp_dealloc = (destructor) data_dealloc,
+   .tp_getset = data_getset,
+};
+
+
+//  ---- Fits  ---- //
+
+void
+fit_dealloc
+(
+   fit_t * self
+)
+{
+
+   if (self->Z != NULL) {
+      // 'Z->ChIP' belongs to 'data' (if any).
+      if (self->data != NULL) self->Z->ChIP = NULL;
+      destroy_zerone_all(self->Z);
+   }
+   Py_XDECREF(self->data);
+   Py_TYPE(self)->tp_free((PyObject *) self);
+
+}
+
+
+PyObject *
+fit_get_Q
+(
+   fit_t * self,
+   void  * closure
+)
+{
+
+   // Transitions from state 'i' to state 'j' are in 'Q[i+j*m]'.
+   const Py_ssize_t m = self->Z->m;
+   return matrix_view((PyObject *) self, self->Z->Q, "d", m, m,
+         sizeof(double), m * sizeof(double));
+
+}
+
+
+PyObject *
+fit_get_p
+(
+   fit_t * self,
+   void  * closure
+)
+{
+
+   const Py_ssize_t m = self->Z->m;
+   const Py_ssize_t r = self->Z->r;
+   return matrix_view((PyObject *) self, self->Z->p, "d", m, r+1,
+         (r+1) * sizeof(double), sizeof(double));
+
+}
+
+
+PyObject *
+fit_get_phi
+(
+   fit_t * self,
+   void  * closure
+)
+{
+
+   const Py_ssize_t m = self->Z->m;
+   return matrix_view((PyObject *) self, self->Z->phi, "d",
+         nobs(self->Z->ChIP), m, m * sizeof(double), sizeof(double));
+
+}
+
+
+PyObject *
+fit_get_pem
+(
+   fit_t * self,
+   void  * closure
+)
+{
+
+   const Py_ssize_t m = self->Z->m;
+   return matrix_view((PyObject *) self, self->Z->pem, "d",
+         nobs(self->Z->ChIP), m, m * sizeof(double), sizeof(double));
+
+}
+
+
+PyObject *
+fit_get_path
+(
+   fit_t * self,
+   void  * closure
+)
+{
+
+   const Py_ssize_t n = nobs(self->Z->ChIP);
+   const Py_ssize_t stride = sizeof(int);
+   return as_array((PyObject *) self, self->Z->path, "i", 1, &n, &stride);
+
+}
+
+
+PyObject *
+fit_get_scalar
+(
+   fit_t * self,
+   void  * closure
+)
+{
+
+   const zerone_t *Z = self->Z;
+   const char *name = closure;
+
+   if (strcmp(name, "a") == 0) return PyFloat_FromDouble(Z->a);
+   if (strcmp(name, "pi") == 0) return PyFloat_FromDouble(Z->pi);
+   if (strcmp(name, "loglik") == 0) return PyFloat_FromDouble(Z->l);
+   if (strcmp(name, "iter") == 0) return PyLong_FromLong(Z->iter);
+   return PyBool_FromLong(Z->early);
+
+}
+
+
+PyObject *
+fit_qc
+(
+   fit_t    * self,
+   PyObject * unused
+)
+// SYNOPSIS:
+//   Method 'qc()': return the quality score of the fit and the
+//   features it is computed from (see 'zerone_qc()').
+{
+
+   if (self->Z->path == NULL || self->Z->phi == NULL) {
+      PyErr_SetString(PyExc_ValueError, "the fit was rejected early");
+      return NULL;
+   }
+
+   double feat[5] = {0};
+   double score;
+
+   Py_BEGIN_ALLOW_THREADS
+   score = zerone_qc(self->Z, feat);
+   Py_END_ALLOW_THREADS
+
+   return Py_BuildValue("d(ddddd)", score,
+         feat[0], feat[1], feat[2], feat[3], feat[4]);
+
+}
+
+
+PyGetSetDef fit_getset[] = {
+   {"Q", (getter) fit_get_Q, NULL,
+      "transitions (Q[i,j] from state i to state j)", NULL},
+   {"p", (getter) fit_get_p, NULL,
+      "emission parameters (states in rows, profiles in columns)", NULL},
+   {"phi", (getter) fit_get_phi, NULL, "posterior probabilities", NULL},
+   {"pem", (getter) fit_get_pem, NULL, "emission probabilities", NULL},
+   {"path", (getter) fit_get_path, NULL, "Viterbi path", NULL},
+   {"a", (getter) fit_get_scalar, NULL, "emission parameter a", "a"},
+   {"pi", (getter) fit_get_scalar, NULL, "emission parameter pi", "pi"},
+   {"loglik", (getter) fit_get_scalar, NULL, "log-likelihood", "loglik"},
+   {"iter", (getter) fit_get_scalar, NULL,
+      "number of Baum-Welch cycles", "iter"},
+   {"early", (getter) fit_get_scalar, NULL,
+      "rejected by the early quality control", "early"},
+   {NULL},
+};
+
+PyMethodDef fit_methods[] = {
+   {"qc", (PyCFunction) fit_qc, METH_NOARGS,
+      "qc() -> (score, features)\n\nQuality score of the fit."},
+   {NULL},
+};
+
+PyTypeObject FitType = {
+   PyVarObject_HEAD_INIT(NULL, 0)
+   .tp_name = "zerone.Fit",
+   .tp_doc = "Fit of the Zerone model (see 'zerone.fit()').",
+   .tp_basicsize = sizeof(fit_t),
+   .tp_flags = Py_TPFLAGS_DEFAULT,
+   .tp_dealloc = (destructor) fit_dealloc,
+   .tp_getset = fit_getset,
+   .tp_methods = fit_methods,
+};
+
+
+//  ---- Views of the memory of Zerone  ---- //
+
+void
+view_dealloc
+(
+   view_t * self
+)
+{
+   Py_XDECREF(self->owner);
+   Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+
+int
+view_getbuffer
+(
+   view_t    * self,
+   Py_buffer * buf,
+   int         flags
+)
+// SYNOPSIS:
+//   Export a read-only buffer of the memory (buffer protocol).
+{
+
+   if (flags & PyBUF_WRITABLE) {
+      PyErr_SetString(PyExc_BufferError, "the memory is read-only");
+      buf->obj = NULL;
+      return -1;
+   }
+
+   const Py_ssize_t itemsize = self->format[0] == 'd' ?
+      sizeof(double) : sizeof(int);
+
+   // Strides can be omitted only if the memory is C-contiguous.
+   int contiguous = 1;
+   Py_ssize_t stride = itemsize;
+   for (int i = self->ndim-1 ; i >= 0 ; i--) {
+      if (self->shape[i] > 1 && self->strides[i] != stride) contiguous = 0;
+      stride *= self->shape[i];
+   }
+   if (!contiguous && (flags & PyBUF_STRIDES) != PyBUF_STRIDES) {
+      PyErr_SetString(PyExc_BufferError, "the memory is not contiguous");
+      buf->obj = NULL;
+      return -1;
+   }
+
+   buf->buf = self->mem;
+   buf->obj = (PyObject *) self;
+   Py_INCREF(self);
+   buf->len = stride;
+   buf->readonly = 1;
+   buf->itemsize = itemsize;
+   buf->format = (flags & PyBUF_FORMAT) ? self->format : NULL;
+   buf->ndim = self->ndim;
+   buf->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+   buf->strides = (flags & PyBUF_STRIDES) ? self->strides : NULL;
+   buf->suboffsets = NULL;
+   buf->internal = NULL;
+
+   return 0;
+
+}
+
+
+PyBufferProcs view_as_buffer = {
+   .bf_getbuffer = (getbufferproc) view_getbuffer,
+};
+
+PyTypeObject ViewType = {
+   PyVarObject_HEAD_INIT(NULL, 0)
+   .tp_name = "zerone._View",
+   .tp_doc = "Read-only view of memory owned by Zerone.",
+   .tp_basicsize = sizeof(view_t),
+   .tp_flags = Py_TPFLAGS_DEFAULT,
+   .tp_dealloc = (destructor) view_dealloc,
+   .tp_as_buffer = &view_as_buffer,
+};
+
+
+//  ---- Module  ---- //
+
+PyObject *
+zerone_parse
+(
+   PyObject * module,
+   PyObject * args,
+   PyObject * kwds
+)
+// SYNOPSIS:
+//   Function 'parse(chip, mock=None, window=300, minmapq=20)'.
+//   'chip' and 'mock' are file names or lists of file names.
+{
+
+   static char *kwlist[] = {"chip", "mock", "window", "minmapq", NULL};
+
+   PyObject *chip = NULL;
+   PyObject *mock = Py_None;
+   zerone_parser_args_t pargs = { .window = 300, .minmapq = 20 };
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Oii", kwlist,
+            &chip, &mock, &pargs.window, &pargs.minmapq)) {
+      return NULL;
+   }
+
+   if (pargs.window < 1 || pargs.minmapq < 0) {
+      PyErr_SetString(PyExc_ValueError, "invalid window or minmapq");
+      return NULL;
+   }
+
+   PyObject *keep_chip = NULL;
+   PyObject *keep_mock = NULL;
+   char **chip_fnames = filename_array(chip, &keep_chip);
+   char **mock_fnames = NULL;
+   if (chip_fnames != NULL) {
+      if (mock == Py_None) mock_fnames = calloc(1, sizeof(char *));
+      else mock_fnames = filename_array(mock, &keep_mock);
+      if (mock_fnames == NULL && !PyErr_Occurred()) PyErr_NoMemory();
+   }
+
+   data_t *self = NULL;
+   if (chip_fnames == NULL || mock_fnames == NULL) goto clean_and_return;
+
+   if (chip_fnames[0] == NULL) {
+      PyErr_SetString(PyExc_ValueError, "no ChIP file");
+      goto clean_and_return;
+   }
+
+   ChIP_t *ChIP;
+   Py_BEGIN_ALLOW_THREADS
+   ChIP = parse_input_files(mock_fnames, chip_fnames, pargs);
+   Py_END_ALLOW_THREADS
+
+   if (ChIP == NULL) {
+      PyErr_SetString(PyExc_RuntimeError, "cannot parse the input files");
+      goto clean_and_return;
+   }
+
+   self = (data_t *) DataType.tp_alloc(&DataType, 0);
+   if (self == NULL) {
+      free(ChIP->y);
+      free(ChIP);
+      goto clean_and_return;
+   }
+   self->ChIP = ChIP;
+
+clean_and_return:
+   free(chip_fnames);
+   free(mock_fnames);
+   Py_XDECREF(keep_chip);
+   Py_XDECREF(keep_mock);
+   return (PyObject *) self;
+
+}
+
+
+PyObject *
+zerone_fit
+(
+   PyObject * module,
+   PyObject * args,
+   PyObject * kwds
+)
+// SYNOPSIS:
+//   Function 'fit(data, threads=1, starts=1, earlyqc=False)'. Fit
+//   the model and compute the Viterbi path (see 'do_zerone()').
+{
+
+   static char *kwlist[] = {"data", "threads", "starts", "earlyqc", NULL};
+
+   data_t *data = NULL;
+   zerone_args_t zargs = { .threads = 1, .starts = 1 };
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|iip", kwlist,
+            &DataType, &data, &zargs.threads, &zargs.starts,
+            &zargs.earlyqc)) {
+      return NULL;
+   }
+
+   if (zargs.threads < 1 || zargs.starts < 1) {
+      PyErr_SetString(PyExc_ValueError, "invalid threads or starts");
+      return NULL;
+   }
+
+   fit_t *self = (fit_t *) FitType.tp_alloc(&FitType, 0);
+   if (self == NULL) return NULL;
+
+   zerone_t *Z;
+   Py_BEGIN_ALLOW_THREADS
+   Z = do_zerone(data->ChIP, &zargs);
+   Py_END_ALLOW_THREADS
+
+   if (Z == NULL) {
+      PyErr_SetString(PyExc_RuntimeError, "zerone failure");
+      Py_DECREF(self);
+      return NULL;
+   }
+
+   // The fit shares the observations of the data.
+   self->Z = Z;
+   self->data = (PyObject *) data;
+   Py_INCREF(data);
+
+   return (PyObject *) self;
+
+}
+
+
+PyMethodDef zerone_methods[] = {
+   {"parse", (PyCFunction) zerone_parse, METH_VARARGS | METH_KEYWORDS,
+      "parse(chip, mock=None, window=300, minmapq=20) -> Data\n\n"
+      "Read and bin the mapped reads of the ChIP and mock files."},
+   {"fit", (PyCFunction) zerone_fit, METH_VARARGS | METH_KEYWORDS,
+      "fit(data, threads=1, starts=1, earlyqc=False) -> Fit\n\n"
+      "Fit the Zerone model and compute the Viterbi path."},
+   {NULL},
+};
+
+struct PyModuleDef zerone_module = {
+   PyModuleDef_HEAD_INIT,
+   .m_name = "zerone",
+   .m_doc = "Zerone: ChIP-seq discretization and quality control.",
+   .m_size = -1,
+   .m_methods = zerone_methods,
+};
+
+PyMODINIT_FUNC
+PyInit_zerone
+(void)
+{
+
+   if (PyType_Ready(&DataType) < 0) return NULL;
+   if (PyType_Ready(&FitType) < 0) return NULL;
+   if (PyType_Ready(&ViewType) < 0) return NULL;
+
+   // NumPy is optional.
+   NUMPY = PyImport_ImportModule("numpy");
+   if (NUMPY == NULL) PyErr_Clear();
+
+   PyObject *module = PyModule_Create(&zerone_module);
+   if (module == NULL) return NULL;
+
+   Py_INCREF(&DataType);
+   Py_INCREF(&FitType);
+   if (PyModule_AddObject(module, "Data", (PyObject *) &DataType) < 0 ||
+         PyModule_AddObject(module, "Fit", (PyObject *) &FitType) < 0) {
+      Py_DECREF(module);
+      return NULL;
+   }
+
+   return module;
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+PyObject *
+as_array
+(
+         PyObject   * owner,
+         void       * mem,
+         char       * format,
+         int          ndim,
+   const Py_ssize_t * shape,
+   const Py_ssize_t * strides
+)
+// SYNOPSIS:
+//   Wrap the memory 'mem' of 'owner' in a NumPy array (or in a
+//   memoryview without NumPy). The array keeps 'owner' alive.
+//
+// RETURN:
+//   A new reference, or None if 'mem' is NULL.
+{
+
+   if (mem == NULL) Py_RETURN_NONE;
+
+   view_t *view = (view_t *) ViewType.tp_alloc(&ViewType, 0);
+   if (view == NULL) return NULL;
+
+   view->owner = owner;
+   Py_INCREF(owner);
+   view->mem = mem;
+   view->format = format;
+   view->ndim = ndim;
+   for (int i = 0 ; i < ndim ; i++) {
+      view->shape[i] = shape[i];
+      view->strides[i] = strides[i];
+   }
+
+   PyObject *array = NUMPY == NULL ?
+      PyMemoryView_FromObject((PyObject *) view) :
+      PyObject_CallMethod(NUMPY, "asarray", "O", view);
+   Py_DECREF(view);
+
+   return array;
+
+}
+
+
+PyObject *
+matrix_view
+(
+   PyObject   * owner,
+   void       * mem,
+   char       * format,
+   Py_ssize_t   nrow,
+   Py_ssize_t   ncol,
+   Py_ssize_t   rowstride,
+   Py_ssize_t   colstride
+)
+// SYNOPSIS:
+//   Shortcut of 'as_array()' for matrices.
+{
+
+   const Py_ssize_t shape[2] = {nrow, ncol};
+   const Py_ssize_t strides[2] = {rowstride, colstride};
+   return as_array(owner, mem, format, 2, shape, strides);
+
+}
+
+
+int
+copy_items
+(
+   const Py_buffer * buf,
+         int       * y
+)
+// SYNOPSIS:
+//   Convert the integers of 'buf' (any layout) to C-contiguous
+//   'int' in 'y'.
+//
+// RETURN:
+//   0, or -1 if the type of the items is not supported.
+{
+
+   const char *f = buf->format == NULL ? "B" : buf->format;
+   if (*f == '@' || *f == '=') f++;
+#if PY_LITTLE_ENDIAN
+   else if (*f == '<') f++;
+#else
+   else if (*f == '>') f++;
+#endif
+
+   const char t = f[0];
+   if (f[0] == '\0' || f[1] != '\0' || strchr("bBhHiIlLqQnN", t) == NULL) {
+      PyErr_Format(PyExc_TypeError, "y must contain native integers "
+            "(format '%s')", buf->format == NULL ? "B" : buf->format);
+      return -1;
+   }
+
+   const Py_ssize_t n = buf->shape[0];
+   const Py_ssize_t s = buf->ndim == 2 ? buf->shape[1] : 1;
+   const Py_ssize_t st0 = buf->strides[0];
+   const Py_ssize_t st1 = buf->ndim == 2 ? buf->strides[1] : 0;
+
+   for (Py_ssize_t i = 0 ; i < n ; i++) {
+   for (Py_ssize_t j = 0 ; j < s ; j++) {
+      const char *p = (const char *) buf->buf + i*st0 + j*st1;
+      long long v = 0;
+      switch (buf->itemsize) {
+         case 1: v = t == 'b' ? *(int8_t *) p : *(uint8_t *) p; break;
+         case 2: v = islower(t) ? *(int16_t *) p : *(uint16_t *) p; break;
+         case 4: v = islower(t) ? *(int32_t *) p : *(uint32_t *) p; break;
+         case 8: v = islower(t) ? *(int64_t *) p : (long long)
+                    *(uint64_t *) p; break;
+      }
+      if (v < -1 || v > INT_MAX) {
+         PyErr_SetString(PyExc_ValueError, "y must contain counts "
+               "(or -1 for missing values)");
+         return -1;
+      }
+      y[j+i*s] = v;
+   }
+   }
+
+   return 0;
+
+}
+
+
+char **
+filename_array
+(
+   PyObject  * obj,
+   PyObject ** keep
+)
+// SYNOPSIS:
+//   Convert a file name or a sequence of file names to a
+//   NULL-terminated array. The strings belong to '*keep', which
+//   must be released after use.
+//
+// RETURN:
+//   The array (to be freed), or NULL with an exception set.
+{
+
+   if (PyUnicode_Check(obj)) {
+      *keep = PyTuple_Pack(1, obj);
+   }
+   else {
+      *keep = PySequence_Fast(obj, "file names must be a string "
+            "or a sequence of strings");
+   }
+   if (*keep == NULL) return NULL;
+
+   const Py_ssize_t n = PySequence_Fast_GET_SIZE(*keep);
+   char **fnames = calloc(n+1, sizeof(char *));
+   if (fnames == NULL) {
+      PyErr_NoMemory();
+      return NULL;
+   }
+
+   for (Py_ssize_t i = 0 ; i < n ; i++) {
+      PyObject *item = PySequence_Fast_GET_ITEM(*keep, i);
+      fnames[i] = (char *) PyUnicode_AsUTF8(item);
+      if (fnames[i] == NULL) {
+         free(fnames);
+         return NULL;
+      }
+   }
+
+   return fnames;
+
+}
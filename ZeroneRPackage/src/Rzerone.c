@@ -19,15 +19,24 @@
 #include <R.h>
 #include <Rinternals.h>
 #include <R_ext/Rdynload.h>
-#include "../../src/zerone.h"
+#include "../../src/parse.h"
 #include "../../src/predict.h"
+#include "../../src/zerone.h"
+
 
+//  ---- Declaration of local functions  ---- //
+char ** file_names (SEXP);
+SEXP    fit_to_list (zerone_t *);
+SEXP    ChIP_to_df (const ChIP_t *);
 
-// Register the method 'zerone_R_call()'.
+
+// Register the methods 'zerone_R_call()' and 'zerone_R_files()'.
 SEXP zerone_R_call (SEXP, SEXP, SEXP);
+SEXP zerone_R_files (SEXP, SEXP, SEXP, SEXP, SEXP);
 
 R_CallMethodDef callMethods[] = {
    {"zerone_R_call", (DL_FUNC) &zerone_R_call, 3},
+   {"zerone_R_files", (DL_FUNC) &zerone_R_files, 5},
    {NULL, NULL, 0},
 };
 
@@ -67,32 +76,207 @@ zerone_R_call
       return R_NilValue;
    }
 
-   double *features = malloc(5 * sizeof(double));
-   if (features == NULL) {
-      Rprintf("Rzerone memory error %s:%d\n", __FILE__, __LINE__);
-      return R_NilValue;
-   }
-
    for (size_t i = 1 ; i < r+1 ; i++) {
       int *v = INTEGER(coerceVector(VECTOR_ELT(RY, i), INTSXP));
       for (size_t j = 0 ; j < n ; j++) y[i-1+j*r] = v[j];
    }
 
    ChIP_t *ChIP = new_ChIP(r, nb, y, name, size);
-   zerone_t * zerone = do_zerone(ChIP);
-
-   extract_features(zerone, features);
+   free(name);
+   if (ChIP == NULL) {
+      free(y);
+      Rprintf("Rzerone memory error %s:%d\n", __FILE__, __LINE__);
+      return R_NilValue;
+   }
 
-   free(ChIP);
-   zerone->ChIP = NULL;
+   zerone_t * zerone = do_zerone(ChIP, NULL);
 
    if (zerone == NULL) {
+      free(y);
+      free(ChIP);
       Rprintf("Rzerone error\n");
       return R_NilValue;
    }
 
+   SEXP RETLIST = fit_to_list(zerone);
+   destroy_zerone_all(zerone);
+
+   return RETLIST;
+
+}
+
+SEXP
+zerone_R_files
+(
+   SEXP RMOCK,
+   SEXP RCHIP,
+   SEXP RWINDOW,
+   SEXP RMINMAPQ,
+   SEXP RFIT
+)
+// SYNOPSIS:
+//   Bin the reads of the mock and ChIP files with the parser of
+//   Zerone (SAM/BAM/BED/GEM/WIG). If 'RFIT' is true, fit the model
+//   on the binned data and return the same list as 'zerone_R_call()',
+//   otherwise return the binned data as a data frame that can be
+//   passed to 'zerone()'.
+{
+
+   SEXP RETVAL = R_NilValue;
+
+   zerone_parser_args_t args;
+   args.window = asInteger(RWINDOW);
+   args.minmapq = asInteger(RMINMAPQ);
+
+   char **mock_fnames = file_names(RMOCK);
+   char **ChIP_fnames = file_names(RCHIP);
+   if (mock_fnames == NULL || ChIP_fnames == NULL) {
+      Rprintf("Rzerone memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   ChIP_t *ChIP = parse_input_files(mock_fnames, ChIP_fnames, args);
+   if (ChIP == NULL) {
+      Rprintf("Rzerone error: cannot parse input files\n");
+      goto clean_and_return;
+   }
+
+   if (!asLogical(RFIT)) {
+      RETVAL = ChIP_to_df(ChIP);
+      free(ChIP->y);
+      free(ChIP);
+      goto clean_and_return;
+   }
+
+   // Fit the binned data directly.
+   zerone_t * zerone = do_zerone(ChIP, NULL);
+   if (zerone == NULL) {
+      free(ChIP->y);
+      free(ChIP);
+      Rprintf("Rzerone error\n");
+      goto clean_and_return;
+   }
+
+   RETVAL = fit_to_list(zerone);
+   destroy_zerone_all(zerone);
+
+clean_and_return:
+   free(mock_fnames);
+   free(ChIP_fnames);
+   return RETVAL;
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+char **
+file_names
+(
+   SEXP RFNAMES
+)
+// SYNOPSIS:
+//   Convert a character vector of file names (or 'NULL') to a
+//   NULL-terminated array. The strings belong to R.
+{
+
+   const unsigned int n = isNull(RFNAMES) ? 0 : length(RFNAMES);
+
+   char **fnames = calloc(n+1, sizeof(char *));
+   if (fnames == NULL) return NULL;
+
+   for (int i = 0 ; i < n ; i++) {
+      fnames[i] = (char *) translateChar(STRING_ELT(RFNAMES, i));
+   }
+
+   return fnames;
+
+}
+
+SEXP
+ChIP_to_df
+(
+   const ChIP_t * ChIP
+)
+// SYNOPSIS:
+//   Build the data frame of 'zerone()' from binned data: a factor of
+//   block names, the mock and the ChIP profiles. The mock is 1 in
+//   every window if it is implicit (no mock file).
+{
+
+   const unsigned int n = nobs(ChIP);
+   const unsigned int r = ChIP->r;
+   const unsigned int o = ChIP->nomock;
+   const unsigned int s = r - o;
+
+   SEXP DF;
+   PROTECT(DF = allocVector(VECSXP, r+1));
+
+   // Block names as a factor (sequence names are unique).
+   SEXP SEQNAME;
+   SEXP LEVELS;
+   PROTECT(SEQNAME = allocVector(INTSXP, n));
+   PROTECT(LEVELS = allocVector(STRSXP, ChIP->nb));
+   for (size_t i = 0, k = 0 ; i < ChIP->nb ; i++) {
+      SET_STRING_ELT(LEVELS, i, mkChar(ChIP->nm + 32*i));
+      for (size_t j = 0 ; j < ChIP->sz[i] ; j++) INTEGER(SEQNAME)[k++] = i+1;
+   }
+   setAttrib(SEQNAME, R_LevelsSymbol, LEVELS);
+   setAttrib(SEQNAME, R_ClassSymbol, mkString("factor"));
+   SET_VECTOR_ELT(DF, 0, SEQNAME);
+
+   // The observations are coded "row-wise".
+   for (size_t i = 0 ; i < r ; i++) {
+      SEXP COL;
+      PROTECT(COL = allocVector(INTSXP, n));
+      for (size_t j = 0 ; j < n ; j++) {
+         INTEGER(COL)[j] = i < o ? 1 : ChIP->y[i-o+j*s];
+      }
+      SET_VECTOR_ELT(DF, i+1, COL);
+      UNPROTECT(1);
+   }
+
+   SEXP NAMES;
+   PROTECT(NAMES = allocVector(STRSXP, r+1));
+   SET_STRING_ELT(NAMES, 0, mkChar("seqname"));
+   SET_STRING_ELT(NAMES, 1, mkChar("mock"));
+   for (size_t i = 2 ; i < r+1 ; i++) {
+      char colname[32];
+      sprintf(colname, "chip%zu", i-1);
+      SET_STRING_ELT(NAMES, i, mkChar(colname));
+   }
+   setAttrib(DF, R_NamesSymbol, NAMES);
+
+   // Compact row names (1 to n).
+   SEXP ROWNAMES;
+   PROTECT(ROWNAMES = allocVector(INTSXP, 2));
+   INTEGER(ROWNAMES)[0] = NA_INTEGER;
+   INTEGER(ROWNAMES)[1] = -(int) n;
+   setAttrib(DF, R_RowNamesSymbol, ROWNAMES);
+   setAttrib(DF, R_ClassSymbol, mkString("data.frame"));
+
+   UNPROTECT(5);
+
+   return DF;
+
+}
+
+SEXP
+fit_to_list
+(
+   zerone_t * zerone
+)
+// SYNOPSIS:
+//   Convert the fit to the list returned by 'zerone()'.
+{
+
    // Zerone uses 3 states.
    const unsigned int m = 3;
+   const unsigned int r = zerone->r;
+   const unsigned int n = nobs(zerone->ChIP);
+
+   double features[5] = {0};
+   extract_features(zerone, features);
 
    SEXP Q;
    PROTECT(Q = allocVector(REALSXP, m*m));
@@ -180,8 +364,6 @@ zerone_R_call
 
    UNPROTECT(14);
 
-   destroy_zerone_all(zerone);
-
    return RETLIST;
 
 }
@@ -0,0 +1,366 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <math.h>
+#include "autowin.h"
+#include "numa.h"
+#include "predict.h"
+#include "refine.h"
+
+
+//  ---- Declaration of local functions  ---- //
+zerone_t * fit_window (ChIP_t *, const zerone_t *, double, int);
+ChIP_t   * sample_ChIP (const ChIP_t *, size_t, size_t);
+
+
+
+//  -- Definitions of exported functions  --- //
+
+int
+auto_window
+(
+   const ChIP_t * ChIP,
+         int         window,
+         int         threads,
+   // output //
+         zerone_t ** fit
+)
+// SYNOPSIS:
+//   Fit the model on a subsample of 'ChIP' at every size of
+//   'AUTOWIN_LADDER' (using up to 'threads' threads) and report the
+//   QC score and the features of every size on stderr. 'window' is
+//   the size of the windows of 'ChIP' in bp (for the report).
+//
+// RETURN:
+//   The multiple of the window with the highest QC score (1 if the
+//   score is not defined, i.e. with a single ChIP profile), or -1
+//   in case of failure.
+//
+// SIDE EFFECTS:
+//   If 'fit' is not NULL, '*fit' is set to the fit of the chosen
+//   size on the subsample (without posterior and emission
+//   probabilities), which belongs to the caller.
+{
+
+   const int ladder[AUTOWIN_NSIZES] = AUTOWIN_LADDER;
+
+   int best = -1;
+   double bestQC = 0.0;
+
+   zerone_t *bestZ = NULL; // fit of the best size //
+   zerone_t *prev = NULL;  // fit of the previous size //
+   int Kprev = 0;
+
+   if (fit != NULL) *fit = NULL;
+
+   ChIP_t *sample = sample_ChIP(ChIP, AUTOWIN_SAMPLE, AUTOWIN_CHUNK);
+   if (sample == NULL) return -1;
+
+   for (int i = 0 ; i < AUTOWIN_NSIZES ; i++) {
+
+      const int K = ladder[i];
+      ChIP_t *C = coarsen_ChIP(sample, K);
+      if (C == NULL) {
+         best = -1;
+         goto clean_and_return;
+      }
+
+      // The first size starts from the default initialization.
+      zerone_t *Z = fit_window(C, prev, (double) Kprev / K, threads);
+      if (Z == NULL) {
+         // Skip the size (the function warns).
+         fprintf(stderr, "auto-window: %d bp: no fit\n", K*window);
+         free(C->y);
+         free(C);
+         continue;
+      }
+
+      double feat[5];
+      double QC = zerone_qc(Z, feat);
+      fprintf(stderr, "auto-window: %d bp: QC score %.3f (features: "
+            "%.3f, %.3f, %.3f, %.3f, %.3f)\n", K*window, QC,
+            feat[0], feat[1], feat[2], feat[3], feat[4]);
+
+      // Only the parameters are needed from now on.
+      free(Z->phi);
+      free(Z->pem);
+      Z->phi = Z->pem = NULL;
+
+      // Keep the best fit and the previous one (the same or not).
+      zerone_t *old = prev;
+      zerone_t *oldbest = NULL;
+      // NB: the score is NAN with a single ChIP profile.
+      if (best < 0 || QC > bestQC) {
+         best = K;
+         bestQC = QC;
+         oldbest = bestZ;
+         bestZ = Z;
+      }
+      prev = Z;
+      Kprev = K;
+      if (old != NULL && old != bestZ) destroy_zerone_all(old);
+      if (oldbest != NULL && oldbest != old) destroy_zerone_all(oldbest);
+
+   }
+
+   if (best < 0) {
+      fprintf(stderr, "auto-window: no window size could be fitted\n");
+   }
+   else if (isnan(bestQC)) {
+      fprintf(stderr, "auto-window: no QC score with one ChIP "
+            "profile, keeping %d bp\n", window);
+   }
+   else {
+      fprintf(stderr, "auto-window: using %d bp\n", best*window);
+   }
+
+clean_and_return:
+   if (prev != NULL && prev != bestZ) destroy_zerone_all(prev);
+   if (bestZ != NULL) {
+      if (fit != NULL && best > 0) *fit = bestZ;
+      else destroy_zerone_all(bestZ);
+   }
+   free(sample->y);
+   free(sample);
+   return best;
+
+}
+
+
+
+//  ---- Definitions of local functions  ---- //
+
+zerone_t *
+fit_window
+(
+         ChIP_t   * ChIP,
+   const zerone_t * prev,
+         double     f,
+         int        threads
+)
+// SYNOPSIS:
+//   Run the Baum-Welch algorithm on 'ChIP' and find the Viterbi
+//   path. The mock is fitted on 'ChIP' (see 'do_zerone()'). The
+//   initial parameters are those of 'prev' for windows 'f' times
+//   larger (see 'fine_par()'), or the default ones if 'prev' is
+//   NULL.
+//
+// RETURN:
+//   The fit, or NULL in case of failure.
+//
+// SIDE EFFECTS:
+//   The fit owns 'ChIP', except in case of failure.
+{
+
+   const unsigned int m = 3;
+   const unsigned int r = ChIP->r;
+   const size_t s = r - ChIP->nomock;
+   const size_t n = nobs(ChIP);
+
+   zerone_t * Z    = NULL;
+   bw_t     * bw   = NULL;
+
+   int *mock = malloc(n * sizeof(int));
+   if (mock == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return NULL;
+   }
+   for (size_t i = 0 ; i < n ; i++) {
+      mock[i] = ChIP->nomock ? 1 : ChIP->y[0+i*s];
+   }
+   zinb_par_t *par = mle_zinb(mock, n);
+   free(mock);
+   if (par == NULL) return NULL;
+
+   double Q[9] = {0};
+   double p[3*64] = {0};
+   if (prev == NULL) init_par(par, r, 0, Q, p);
+   else fine_par(prev, f, par, Q, p);
+
+   Z = new_zerone(m, ChIP);
+   if (Z == NULL) goto fail;
+   set_zerone_par(Z, Q, par->a, par->pi, p);
+
+   bw = new_bw(Z);
+   if (bw == NULL) goto fail;
+   if (threads > 1) bw->pool = new_pool(Z, bw, threads);
+
+   int status = 0;
+   while (status == 0 && ++Z->iter < BW_MAXITER) {
+      status = bw_iter(Z, bw);
+   }
+   if (status < 0) goto fail;
+
+   bw_finish(Z, bw);
+   bw = NULL;
+
+   zerone_viterbi(Z);
+   if (Z->path == NULL) goto fail;
+
+   free(par);
+   return Z;
+
+fail:
+   if (bw != NULL) destroy_bw(bw);
+   if (Z != NULL) {
+      Z->ChIP = NULL;
+      destroy_zerone_all(Z);
+   }
+   free(par);
+   return NULL;
+
+}
+
+
+ChIP_t *
+sample_ChIP
+(
+   const ChIP_t * ChIP,
+         size_t   nmax,
+         size_t   len
+)
+// SYNOPSIS:
+//   Draw at most 'nmax / len' chunks of 'len' windows of 'ChIP'
+//   (chunks do not span blocks), with probability proportional to
+//   their number of windows with reads. The draw is systematic, so
+//   the chunks are spread over the time series and every chunk with
+//   enough reads is kept. Sparse inputs are often confined to a few
+//   regions (e.g. subsets of the genome), which a uniform sample
+//   would miss. All the windows are kept if 'ChIP' has no more
+//   than 'nmax'.
+//
+// RETURN:
+//   The subsample, where every chunk is a block, or NULL in case of
+//   failure.
+{
+
+   const size_t s = ChIP->r - ChIP->nomock;
+   const size_t n = nobs(ChIP);
+
+   if (n <= nmax) len = n;
+   if (len < 1) len = 1;
+
+   size_t nchunks = 0;
+   for (int b = 0 ; b < ChIP->nb ; b++) {
+      nchunks += (ChIP->sz[b] + len-1) / len;
+   }
+
+   ChIP_t *new = NULL;
+   int *y = NULL;
+   uint *size = NULL;
+   size_t *start = malloc(nchunks * sizeof(size_t));
+   int *block = malloc(nchunks * sizeof(int));
+   double *weight = malloc(nchunks * sizeof(double));
+   if (start == NULL || block == NULL || weight == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   // Chunks and their number of windows with reads.
+   double total = 0.0;
+   size_t c = 0;
+   size_t k0 = 0;  // first window of the block //
+   for (int b = 0 ; b < ChIP->nb ; b++) {
+      for (size_t i = 0 ; i < ChIP->sz[b] ; i += len, c++) {
+         const size_t i1 = i + len < ChIP->sz[b] ? i + len : ChIP->sz[b];
+         start[c] = k0 + i;
+         block[c] = b;
+         weight[c] = 0.0;
+         for (size_t k = k0 + i ; k < k0 + i1 ; k++) {
+            // Invalid windows (negative values) have no read.
+            int reads = 0;
+            for (size_t j = 0 ; j < s ; j++) reads |= ChIP->y[j+k*s] > 0;
+            weight[c] += reads;
+         }
+         total += weight[c];
+      }
+      k0 += ChIP->sz[b];
+   }
+
+   // No read at all: draw the chunks uniformly.
+   if (total == 0) {
+      for (c = 0 ; c < nchunks ; c++) weight[c] = 1.0;
+      total = nchunks;
+   }
+
+   // Systematic draw: the chunks where the cumulated weight
+   // crosses '(t+1/2) * total / ntake' for 't < ntake'.
+   const size_t ntake = nmax / len > 0 ? nmax / len : 1;
+   size_t nsel = 0;
+   size_t ns = 0;
+   double cum = 0.0;
+   size_t t = 0;
+   for (c = 0 ; c < nchunks ; c++) {
+      cum += weight[c];
+      int hit = n <= nmax;
+      while (t < ntake && (t + 0.5) * total / ntake < cum) {
+         hit = 1;
+         t++;
+      }
+      if (!hit) continue;
+      // The selected chunks are moved to the front.
+      start[nsel] = start[c];
+      block[nsel] = block[c];
+      nsel++;
+   }
+
+   size = malloc(nsel * sizeof(uint));
+   if (size == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   // Sizes of the chunks (the last of a block may be shorter).
+   k0 = 0;
+   for (size_t b = 0, i = 0 ; b < ChIP->nb && i < nsel ; b++) {
+      for ( ; i < nsel && block[i] == b ; i++) {
+         const size_t end = k0 + ChIP->sz[b];
+         size[i] = start[i] + len < end ? len : end - start[i];
+         ns += size[i];
+      }
+      k0 += ChIP->sz[b];
+   }
+
+   y = malloc(ns*s * sizeof(int));
+   if (y == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   new = new_ChIP(ChIP->r, nsel, y, NULL, size);
+   if (new == NULL) goto clean_and_return;
+   new->nomock = ChIP->nomock;
+
+   size_t off = 0; // first window of the chunk in the sample //
+   for (size_t i = 0 ; i < nsel ; i++) {
+      memcpy(new->nm + 32*i, ChIP->nm + 32*block[i], 32);
+      memcpy(y + off*s, ChIP->y + start[i]*s, size[i]*s * sizeof(int));
+      off += size[i];
+   }
+   y = NULL;
+
+clean_and_return:
+   free(y);
+   free(size);
+   free(start);
+   free(block);
+   free(weight);
+   return new;
+
+}
@@ -0,0 +1,45 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _AUTOWIN_H
+#define _AUTOWIN_H
+
+#include "zerone.h"
+
+// Selection of the window size. The input is binned once at the
+// finest size of the ladder (the window given by the user) and the
+// counts of the coarser sizes are sums of consecutive windows (see
+// 'coarsen_ChIP()'). The model is fitted at every size on the same
+// subsample: at most 'AUTOWIN_SAMPLE' windows in chunks of
+// 'AUTOWIN_CHUNK', drawn in proportion of their windows with reads
+// (see 'sample_ChIP()'). Every fit starts from the fit of the
+// previous size (see 'fine_par()'), so it takes few cycles. The
+// size with the highest QC score is kept and its fit is the warm
+// start of the final run (see 'zerone_args_t'), so that the sweep
+// and the final run end up on the same optimum. The sweep costs
+// about 'AUTOWIN_SAMPLE' * (1 + 1/2 + 1/3 + 1/4 + 1/6 + 1/8) windows.
+
+#define AUTOWIN_NSIZES 6
+#define AUTOWIN_LADDER {1, 2, 3, 4, 6, 8}   // multiples of the window //
+#define AUTOWIN_SAMPLE (1 << 20)            // max windows of the sample //
+#define AUTOWIN_CHUNK  (1 << 14)            // windows per chunk //
+
+int      auto_window (const ChIP_t *, int, int, zerone_t **);
+
+#endif
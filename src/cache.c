@@ -0,0 +1,513 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include "cache.h"
+#include "checkpoint.h"
+#include "debug.h"
+#include "xxhash.h"
+
+#define SUCCESS 1
+#define FAILURE 0
+
+#define CACHE_MAGIC "ZRNMOCK1"
+
+// Version of the binning. Change it when the parser
+// output changes, to invalidate the existing entries.
+#define CACHE_VERSION 1
+
+// Temporary files older than this (in seconds) are
+// left over by killed processes and can be removed.
+#define CACHE_STALE 3600
+
+struct entry_t;
+typedef struct entry_t entry_t;
+
+struct entry_t {
+   char     name[256];   // file name //
+   off_t    size;        // file size //
+   time_t   mtime;       // time of last use //
+};
+
+
+//  ---- Declaration of local functions  ---- //
+int      cache_evict (const char *, size_t, const char *);
+int      cmp_mtime (const void *, const void *);
+char   * entry_name (const char *, const char *);
+int      file_digest (const char *, uint32_t *);
+
+
+
+//  -- Definitions of exported functions  --- //
+
+char *
+cache_key
+(
+   char                 * fnames[],
+   zerone_parser_args_t   args
+)
+// SYNOPSIS:
+//   Describe the content of the mock files and the options
+//   of the parser (duplicate reads are always removed). The
+//   names of the files do not matter, but their order does.
+//
+// RETURN:
+//   A newly allocated string, or NULL in case of failure.
+{
+
+   char *key = NULL;
+   size_t sz = 0;
+   FILE *f = open_memstream(&key, &sz);
+   if (f == NULL) {
+      debug_print("%s", "memory error\n");
+      return NULL;
+   }
+
+   fprintf(f, "zerone mock v%d window %d minmapq %d dedup 1\n",
+         CACHE_VERSION, args.window, args.minmapq);
+
+   for (int i = 0 ; fnames[i] != NULL ; i++) {
+      struct stat st;
+      uint32_t digest;
+      if (stat(fnames[i], &st) != 0 || !file_digest(fnames[i], &digest)) {
+         fprintf(stderr, "cannot open file %s\n", fnames[i]);
+         fclose(f);
+         free(key);
+         return NULL;
+      }
+      fprintf(f, "%lld %lld %08x\n", (long long) st.st_size,
+            (long long) st.st_mtime, digest);
+   }
+
+   if (fclose(f) != 0) {
+      free(key);
+      return NULL;
+   }
+
+   return key;
+
+}
+
+
+ChIP_t *
+cache_get
+(
+   const char        *  dir,
+   const char        *  key,
+         zinb_par_t  ** par
+)
+// SYNOPSIS:
+//   Look up the mock profile described by 'key' (see 'cache_key()')
+//   in the cache directory 'dir'. A corrupt entry is a miss.
+//
+// RETURN:
+//   The mock profile (a 'ChIP_t' with one column) or NULL if it is
+//   not in the cache. 'par' is set to the fit of the mock profile,
+//   or to NULL if the fit had failed.
+{
+
+   char *fname = entry_name(dir, key);
+   FILE *f = NULL;
+   void *hstate = NULL;
+   char *ekey = NULL;
+   char *name = NULL;
+   char **nptr = NULL;
+   uint *size = NULL;
+   int *y = NULL;
+   ChIP_t *ChIP = NULL;
+
+   *par = NULL;
+
+   if (fname == NULL) goto clean_and_return;
+
+   // A missing entry is not an error.
+   f = fopen(fname, "r");
+   if (f == NULL) goto clean_and_return;
+
+   hstate = XXH32_init(0);
+   if (hstate == NULL) goto clean_and_return;
+
+   char magic[8];
+   uint32_t keylen;
+   int32_t haspar;
+   double p[3];
+   uint32_t nb;
+
+   if (fread(magic, 8, 1, f) != 1 || memcmp(magic, CACHE_MAGIC, 8) != 0)
+      goto format_error;
+   if (!ckpt_read(f, &keylen, sizeof(uint32_t), hstate)) goto format_error;
+   if (keylen != strlen(key)) goto clean_and_return;
+
+   ekey = malloc(keylen);
+   if (ekey == NULL) {
+      debug_print("%s", "memory error\n");
+      goto clean_and_return;
+   }
+
+   // Different content with the same file name (unlikely).
+   if (!ckpt_read(f, ekey, keylen, hstate)) goto format_error;
+   if (memcmp(ekey, key, keylen) != 0) goto clean_and_return;
+
+   if (!ckpt_read(f, &haspar, sizeof(int32_t), hstate)) goto format_error;
+   if (!ckpt_read(f, p, sizeof(p), hstate)) goto format_error;
+   if (!ckpt_read(f, &nb, sizeof(uint32_t), hstate)) goto format_error;
+
+   name = malloc(32*nb);
+   nptr = malloc(nb * sizeof(char *));
+   size = malloc(nb * sizeof(uint));
+   if (name == NULL || nptr == NULL || size == NULL) {
+      debug_print("%s", "memory error\n");
+      goto clean_and_return;
+   }
+
+   if (!ckpt_read(f, name, 32*nb, hstate)) goto format_error;
+   if (!ckpt_read(f, size, nb * sizeof(uint), hstate)) goto format_error;
+
+   size_t n = 0;
+   for (int i = 0 ; i < nb ; i++) {
+      nptr[i] = name + 32*i;
+      name[32*i+31] = '\0';
+      n += size[i];
+   }
+
+   y = malloc(n * sizeof(int));
+   if (y == NULL) {
+      debug_print("%s", "memory error\n");
+      goto clean_and_return;
+   }
+
+   if (!ckpt_read(f, y, n * sizeof(int), hstate)) goto format_error;
+
+   uint32_t digest;
+   uint32_t expected = XXH32_digest(hstate);
+   hstate = NULL;
+   if (fread(&digest, sizeof(uint32_t), 1, f) != 1 || digest != expected)
+      goto format_error;
+
+   if (haspar) {
+      *par = malloc(sizeof(zinb_par_t));
+      if (*par == NULL) {
+         debug_print("%s", "memory error\n");
+         goto clean_and_return;
+      }
+      (*par)->a = p[0];
+      (*par)->p = p[1];
+      (*par)->pi = p[2];
+   }
+
+   ChIP = new_ChIP(1, nb, y, (const char **) nptr, size);
+   if (ChIP == NULL) {
+      free(*par);
+      *par = NULL;
+      goto clean_and_return;
+   }
+
+   // 'y' now belongs to 'ChIP'.
+   y = NULL;
+
+   // Record the use of the entry for eviction.
+   utime(fname, NULL);
+
+clean_and_return:
+   if (hstate != NULL) free(hstate);
+   if (f != NULL) fclose(f);
+   free(fname);
+   free(ekey);
+   free(name);
+   free(nptr);
+   free(size);
+   free(y);
+   return ChIP;
+
+format_error:
+   fprintf(stderr, "corrupt or truncated file %s\n", fname);
+   goto clean_and_return;
+
+}
+
+
+int
+cache_put
+(
+   const char       * dir,
+   const char       * key,
+   const ChIP_t     * ChIP,
+   const zinb_par_t * par,
+         size_t       maxsize
+)
+// SYNOPSIS:
+//   Store the mock profile 'ChIP' (one column) and its fit 'par'
+//   (NULL if the fit failed) under 'key' in the cache directory
+//   'dir', which is created if needed. If 'maxsize' is not 0, the
+//   least recently used entries are then removed until the cache
+//   takes at most 'maxsize' bytes.
+//
+// RETURN:
+//   SUCCESS (1) or FAILURE (0).
+{
+
+   char *fname = NULL;
+   char *tmpname = NULL;
+   FILE *f = NULL;
+   void *hstate = NULL;
+   int status = FAILURE;
+
+   if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+      fprintf(stderr, "cannot create directory %s\n", dir);
+      return FAILURE;
+   }
+
+   fname = entry_name(dir, key);
+   if (fname == NULL) goto clean_and_return;
+
+   f = open_tmp_file(fname, &tmpname);
+   if (f == NULL) goto clean_and_return;
+
+   hstate = XXH32_init(0);
+   if (hstate == NULL) goto clean_and_return;
+
+   const uint32_t keylen = strlen(key);
+   const int32_t haspar = par != NULL;
+   const double p[3] = {
+      haspar ? par->a : 0, haspar ? par->p : 0, haspar ? par->pi : 0
+   };
+   const uint32_t nb = ChIP->nb;
+   const size_t n = nobs(ChIP);
+
+   if (fwrite(CACHE_MAGIC, 8, 1, f) != 1) goto clean_and_return;
+   if (!ckpt_write(f, &keylen, sizeof(uint32_t), hstate))
+      goto clean_and_return;
+   if (!ckpt_write(f, key, keylen, hstate)) goto clean_and_return;
+   if (!ckpt_write(f, &haspar, sizeof(int32_t), hstate))
+      goto clean_and_return;
+   if (!ckpt_write(f, p, sizeof(p), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, &nb, sizeof(uint32_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, ChIP->nm, 32*nb, hstate)) goto clean_and_return;
+   if (!ckpt_write(f, ChIP->sz, nb * sizeof(uint), hstate))
+      goto clean_and_return;
+   if (!ckpt_write(f, ChIP->y, n * sizeof(int), hstate))
+      goto clean_and_return;
+
+   uint32_t digest = XXH32_digest(hstate);
+   hstate = NULL;
+   if (fwrite(&digest, sizeof(uint32_t), 1, f) != 1) goto clean_and_return;
+
+   status = commit_file(f, tmpname, fname);
+   f = NULL;
+
+   if (status == SUCCESS && maxsize > 0) {
+      cache_evict(dir, maxsize, fname);
+   }
+
+clean_and_return:
+   if (hstate != NULL) free(hstate);
+   if (f != NULL) {
+      fclose(f);
+      unlink(tmpname);
+   }
+   if (status == FAILURE && fname != NULL) {
+      fprintf(stderr, "cannot write file %s\n", fname);
+   }
+   free(tmpname);
+   free(fname);
+   return status;
+
+}
+
+
+
+//  ---- Definitions of local functions  ---- //
+
+int
+cache_evict
+(
+   const char * dir,
+         size_t maxsize,
+   const char * keep
+)
+// SYNOPSIS:
+//   Remove the least recently used entries until the cache takes
+//   at most 'maxsize' bytes, but never remove the file 'keep'. The
+//   directory is locked so that concurrent evictions do not remove
+//   more than needed.
+//
+// RETURN:
+//   SUCCESS (1) or FAILURE (0).
+{
+
+   int status = FAILURE;
+   DIR *d = NULL;
+   entry_t *entries = NULL;
+   int nentries = 0;
+   int maxentries = 0;
+
+   char *lockname = malloc(strlen(dir) + 8);
+   if (lockname == NULL) {
+      debug_print("%s", "memory error\n");
+      return FAILURE;
+   }
+   sprintf(lockname, "%s/.lock", dir);
+
+   int lock = open(lockname, O_RDWR | O_CREAT, 0666);
+   if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+      fprintf(stderr, "cannot lock %s\n", lockname);
+      goto clean_and_return;
+   }
+
+   d = opendir(dir);
+   if (d == NULL) goto clean_and_return;
+
+   const time_t now = time(NULL);
+   const size_t extlen = strlen(CACHE_EXT);
+   size_t total = 0;
+
+   struct dirent *de;
+   while ((de = readdir(d)) != NULL) {
+      char path[4096];
+      struct stat st;
+      if (strlen(de->d_name) >= sizeof(entries->name)) continue;
+      snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+      const char *ext = strstr(de->d_name, CACHE_EXT);
+      if (ext == NULL || stat(path, &st) != 0) continue;
+      if (strlen(ext) != extlen) {
+         // Temporary file (see 'open_tmp_file()').
+         if (now - st.st_mtime > CACHE_STALE) unlink(path);
+         continue;
+      }
+      if (nentries == maxentries) {
+         maxentries = 2*maxentries + 16;
+         entry_t *tmp = realloc(entries, maxentries * sizeof(entry_t));
+         if (tmp == NULL) {
+            debug_print("%s", "memory error\n");
+            goto clean_and_return;
+         }
+         entries = tmp;
+      }
+      strcpy(entries[nentries].name, de->d_name);
+      entries[nentries].size = st.st_size;
+      entries[nentries].mtime = st.st_mtime;
+      total += st.st_size;
+      nentries++;
+   }
+
+   qsort(entries, nentries, sizeof(entry_t), cmp_mtime);
+
+   for (int i = 0 ; i < nentries && total > maxsize ; i++) {
+      char path[4096];
+      snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+      if (strcmp(path, keep) == 0) continue;
+      if (unlink(path) == 0) total -= entries[i].size;
+   }
+
+   status = SUCCESS;
+
+clean_and_return:
+   if (d != NULL) closedir(d);
+   // Closing the file releases the lock.
+   if (lock >= 0) close(lock);
+   free(entries);
+   free(lockname);
+   return status;
+
+}
+
+
+int
+cmp_mtime
+(
+   const void * a,
+   const void * b
+)
+{
+   const time_t ta = ((const entry_t *) a)->mtime;
+   const time_t tb = ((const entry_t *) b)->mtime;
+   return (ta > tb) - (ta < tb);
+}
+
+
+char *
+entry_name
+(
+   const char * dir,
+   const char * key
+)
+// The name of the entry is a 64-bit digest of the key.
+{
+
+   char *fname = malloc(strlen(dir) + 32);
+   if (fname == NULL) {
+      debug_print("%s", "memory error\n");
+      return NULL;
+   }
+
+   const int len = strlen(key);
+   sprintf(fname, "%s/%08x%08x%s", dir, XXH32(key, len, 0),
+         XXH32(key, len, 0x9e3779b1), CACHE_EXT);
+
+   return fname;
+
+}
+
+
+int
+file_digest
+(
+   const char     * fname,
+         uint32_t * digest
+)
+// Digest of the content of the file.
+{
+
+   FILE *f = fopen(fname, "r");
+   if (f == NULL) return FAILURE;
+
+   char *buf = malloc(1 << 20);
+   void *hstate = XXH32_init(0);
+   if (buf == NULL || hstate == NULL) {
+      debug_print("%s", "memory error\n");
+      free(buf);
+      free(hstate);
+      fclose(f);
+      return FAILURE;
+   }
+
+   size_t got;
+   while ((got = fread(buf, 1, 1 << 20, f)) > 0) {
+      XXH32_update(hstate, buf, got);
+   }
+
+   *digest = XXH32_digest(hstate);
+   int status = ferror(f) ? FAILURE : SUCCESS;
+
+   free(buf);
+   fclose(f);
+   return status;
+
+}
@@ -0,0 +1,41 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include "zerone.h"
+
+// Content-addressed cache of binned mock files. An entry holds
+// the mock profile (the merge of the mock files alone) and the
+// fit of its ZINB parameters. Entries are identified by the size,
+// modification time and content digest of every mock file, plus
+// the options of the parser. They are written atomically, so the
+// cache directory can be shared by concurrent processes. When the
+// size of the cache exceeds the limit, the least recently used
+// entries are removed (under a lock on the directory).
+
+#define CACHE_EXT  ".zmock"
+
+char   * cache_key (char **, zerone_parser_args_t);
+ChIP_t * cache_get (const char *, const char *, zinb_par_t **);
+int      cache_put (const char *, const char *, const ChIP_t *,
+                   const zinb_par_t *, size_t);
+
+#endif
@@ -0,0 +1,672 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checkpoint.h"
+#include "debug.h"
+#include "xxhash.h"
+
+#define SUCCESS 1
+#define FAILURE 0
+
+#define BINS_MAGIC "ZRNBINS3"
+#define CKPT_MAGIC "ZRNCKPT4"
+
+// Largest chunk passed to 'XXH32_update()' (which takes an 'int').
+#define HCHUNK (1 << 28)
+
+
+//  ---- Declaration of local functions  ---- //
+char   * ckpt_name (const char *, const char *);
+int64_t  file_gen (const char *);
+
+
+
+//  -- Definitions of exported functions  --- //
+
+int
+write_bins
+(
+   const char        * ckpt,
+   const ChIP_t      * ChIP,
+         bins_info_t   info
+)
+// SYNOPSIS:
+//   Write the binned observations next to the checkpoint 'ckpt'.
+//   This is done once per run, after the input files are parsed.
+//
+// RETURN:
+//   SUCCESS (1) or FAILURE (0).
+{
+
+   char *fname = ckpt_name(ckpt, ".bins");
+   char *tmpname = NULL;
+   FILE *f = NULL;
+   void *hstate = NULL;
+   int status = FAILURE;
+
+   if (fname == NULL) goto clean_and_return;
+
+   f = open_tmp_file(fname, &tmpname);
+   if (f == NULL) goto clean_and_return;
+
+   hstate = XXH32_init(0);
+   if (hstate == NULL) goto clean_and_return;
+
+   const uint32_t gen = info.gen;
+   const uint32_t r = ChIP->r;
+   const uint32_t nb = ChIP->nb;
+   const size_t n = nobs(ChIP);
+   // The implicit profile is not written (see 'ChIP_t').
+   const size_t s = r - ChIP->nomock;
+   const int32_t meta[4] = {info.window, info.minmapq, info.nomock,
+         ChIP->nomock};
+
+   if (fwrite(BINS_MAGIC, 8, 1, f) != 1) goto clean_and_return;
+   if (!ckpt_write(f, &gen, sizeof(uint32_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, &r, sizeof(uint32_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, &nb, sizeof(uint32_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, meta, sizeof(meta), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, ChIP->nm, 32*nb, hstate)) goto clean_and_return;
+   if (!ckpt_write(f, ChIP->sz, nb * sizeof(uint), hstate))
+      goto clean_and_return;
+   if (!ckpt_write(f, ChIP->y, n*s * sizeof(int), hstate))
+      goto clean_and_return;
+
+   uint32_t digest = XXH32_digest(hstate);
+   hstate = NULL;
+   if (fwrite(&digest, sizeof(uint32_t), 1, f) != 1) goto clean_and_return;
+
+   status = commit_file(f, tmpname, fname);
+   f = NULL;
+
+clean_and_return:
+   if (hstate != NULL) free(hstate);
+   if (f != NULL) {
+      fclose(f);
+      unlink(tmpname);
+   }
+   if (status == FAILURE && fname != NULL) {
+      fprintf(stderr, "cannot write file %s\n", fname);
+   }
+   free(tmpname);
+   free(fname);
+   return status;
+
+}
+
+
+ChIP_t *
+read_bins
+(
+   const char        * ckpt,
+         bins_info_t * info
+)
+// SYNOPSIS:
+//   Read the binned observations written by 'write_bins()' and
+//   fill 'info' with the parsing options that produced them.
+//
+// RETURN:
+//   A pointer to a new 'ChIP_t' or NULL in case of failure.
+{
+
+   char *fname = ckpt_name(ckpt, ".bins");
+   FILE *f = NULL;
+   void *hstate = NULL;
+   char *name = NULL;
+   char **nptr = NULL;
+   uint *size = NULL;
+   int *y = NULL;
+   ChIP_t *ChIP = NULL;
+
+   if (fname == NULL) goto clean_and_return;
+
+   f = fopen(fname, "r");
+   if (f == NULL) {
+      fprintf(stderr, "cannot open file %s\n", fname);
+      goto clean_and_return;
+   }
+
+   hstate = XXH32_init(0);
+   if (hstate == NULL) goto clean_and_return;
+
+   char magic[8];
+   uint32_t gen;
+   uint32_t r;
+   uint32_t nb;
+   int32_t meta[4];
+
+   if (fread(magic, 8, 1, f) != 1 || memcmp(magic, BINS_MAGIC, 8) != 0)
+      goto format_error;
+   if (!ckpt_read(f, &gen, sizeof(uint32_t), hstate)) goto format_error;
+   if (!ckpt_read(f, &r, sizeof(uint32_t), hstate)) goto format_error;
+   if (!ckpt_read(f, &nb, sizeof(uint32_t), hstate)) goto format_error;
+   if (!ckpt_read(f, meta, sizeof(meta), hstate)) goto format_error;
+
+   name = malloc(32*nb);
+   nptr = malloc(nb * sizeof(char *));
+   size = malloc(nb * sizeof(uint));
+   if (name == NULL || nptr == NULL || size == NULL) {
+      debug_print("%s", "memory error\n");
+      goto clean_and_return;
+   }
+
+   if (!ckpt_read(f, name, 32*nb, hstate)) goto format_error;
+   if (!ckpt_read(f, size, nb * sizeof(uint), hstate)) goto format_error;
+
+   size_t n = 0;
+   for (int i = 0 ; i < nb ; i++) {
+      nptr[i] = name + 32*i;
+      // Names are always terminated.
+      name[32*i+31] = '\0';
+      n += size[i];
+   }
+
+   // There are 'r' profiles, the first may be implicit.
+   if (meta[3] < 0 || meta[3] > 1 || meta[3] >= r) goto format_error;
+   const size_t s = r - meta[3];
+
+   y = malloc(n*s * sizeof(int));
+   if (y == NULL) {
+      debug_print("%s", "memory error\n");
+      goto clean_and_return;
+   }
+
+   if (!ckpt_read(f, y, n*s * sizeof(int), hstate)) goto format_error;
+
+   uint32_t digest;
+   uint32_t expected = XXH32_digest(hstate);
+   hstate = NULL;
+   if (fread(&digest, sizeof(uint32_t), 1, f) != 1 || digest != expected)
+      goto format_error;
+
+   ChIP = new_ChIP(r, nb, y, (const char **) nptr, size);
+   if (ChIP == NULL) goto clean_and_return;
+
+   // 'y' now belongs to 'ChIP'.
+   y = NULL;
+   ChIP->nomock = meta[3];
+
+   info->window = meta[0];
+   info->minmapq = meta[1];
+   info->nomock = meta[2];
+   info->gen = gen;
+
+clean_and_return:
+   if (hstate != NULL) free(hstate);
+   if (f != NULL) fclose(f);
+   free(fname);
+   free(name);
+   free(nptr);
+   free(size);
+   free(y);
+   return ChIP;
+
+format_error:
+   fprintf(stderr, "corrupt or truncated file %s\n", fname);
+   goto clean_and_return;
+
+}
+
+
+int
+write_checkpoint
+(
+   const char     * ckpt,
+   const zerone_t * Z,
+   const double   * trace
+)
+// SYNOPSIS:
+//   Save the state of the Baum-Welch algorithm after 'Z->iter'
+//   cycles. 'trace' contains the log-likelihood of every cycle.
+//   The cycles of Viterbi training and the number of Baum-Welch
+//   cycles that may follow are saved too, so that a resumed run
+//   keeps the engine and the phase of the fit.
+//   The previous checkpoint is replaced atomically, so a process
+//   killed at any time leaves a consistent checkpoint behind.
+//   The checkpoint also holds a digest of the observations, so
+//   that it is not resumed on the bins of another run, and the
+//   generation 'Z->gen' of the bins it belongs to.
+//
+// RETURN:
+//   SUCCESS (1) or FAILURE (0).
+{
+
+   char *tmpname = NULL;
+   void *hstate = NULL;
+   int status = FAILURE;
+
+   FILE *f = open_tmp_file(ckpt, &tmpname);
+   if (f == NULL) goto clean_and_return;
+
+   hstate = XXH32_init(0);
+   if (hstate == NULL) goto clean_and_return;
+
+   const uint32_t gen = Z->gen;
+   const uint32_t m = Z->m;
+   const uint32_t r = Z->ChIP->r;
+   const uint64_t n = nobs(Z->ChIP);
+   const uint32_t obs = obs_digest(Z->ChIP, r);
+   const int32_t iter = Z->iter;
+   const int32_t phase[2] = {Z->vt, Z->polish};
+   const double par[3] = {Z->a, Z->pi, Z->l};
+
+   if (fwrite(CKPT_MAGIC, 8, 1, f) != 1) goto clean_and_return;
+   if (!ckpt_write(f, &gen, sizeof(uint32_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, &n, sizeof(uint64_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, &r, sizeof(uint32_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, &m, sizeof(uint32_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, &obs, sizeof(uint32_t), hstate))
+      goto clean_and_return;
+   if (!ckpt_write(f, &iter, sizeof(int32_t), hstate))
+      goto clean_and_return;
+   if (!ckpt_write(f, phase, sizeof(phase), hstate))
+      goto clean_and_return;
+   if (!ckpt_write(f, par, sizeof(par), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, Z->Q, m*m * sizeof(double), hstate))
+      goto clean_and_return;
+   if (!ckpt_write(f, Z->p, m*(r+1) * sizeof(double), hstate))
+      goto clean_and_return;
+   if (!ckpt_write(f, trace, iter * sizeof(double), hstate))
+      goto clean_and_return;
+
+   uint32_t digest = XXH32_digest(hstate);
+   hstate = NULL;
+   if (fwrite(&digest, sizeof(uint32_t), 1, f) != 1) goto clean_and_return;
+
+   status = commit_file(f, tmpname, ckpt);
+   f = NULL;
+
+clean_and_return:
+   if (hstate != NULL) free(hstate);
+   if (f != NULL) {
+      fclose(f);
+      unlink(tmpname);
+   }
+   if (status == FAILURE) {
+      fprintf(stderr, "cannot write file %s\n", ckpt);
+   }
+   free(tmpname);
+   return status;
+
+}
+
+
+int
+read_checkpoint
+(
+   const char     * ckpt,
+         zerone_t * Z,
+         double   * trace
+)
+// SYNOPSIS:
+//   Restore the state of the Baum-Welch algorithm saved by
+//   'write_checkpoint()'. 'Z' must be allocated with the same
+//   number of states and observations as the checkpointed run.
+//   'trace' must have space for 'BW_MAXITER' values.
+//   If the bins of the checkpoint exist, they must be of the same
+//   generation (see 'recover_checkpoint()').
+//
+//   If profiles were appended to the observations since the
+//   checkpoint (see 'append_ChIP()'), their parameters are
+//   initialized by 'extend_par()' and the iterations restart
+//   from 0, warm-started from the checkpointed parameters.
+//
+// RETURN:
+//   SUCCESS (1) or FAILURE (0).
+{
+
+   void *hstate = NULL;
+   char *bins = NULL;
+   int status = FAILURE;
+
+   FILE *f = fopen(ckpt, "r");
+   if (f == NULL) {
+      fprintf(stderr, "cannot open file %s\n", ckpt);
+      return FAILURE;
+   }
+
+   bins = ckpt_name(ckpt, ".bins");
+   if (bins == NULL) goto clean_and_return;
+
+   hstate = XXH32_init(0);
+   if (hstate == NULL) goto clean_and_return;
+
+   char magic[8];
+   uint32_t gen;
+   uint64_t n;
+   uint32_t r;
+   uint32_t m;
+   uint32_t obs;
+   int32_t iter;
+   int32_t phase[2];
+   double par[3];
+
+   if (fread(magic, 8, 1, f) != 1 || memcmp(magic, CKPT_MAGIC, 8) != 0)
+      goto format_error;
+   if (!ckpt_read(f, &gen, sizeof(uint32_t), hstate)) goto format_error;
+   if (!ckpt_read(f, &n, sizeof(uint64_t), hstate)) goto format_error;
+   if (!ckpt_read(f, &r, sizeof(uint32_t), hstate)) goto format_error;
+   if (!ckpt_read(f, &m, sizeof(uint32_t), hstate)) goto format_error;
+   if (!ckpt_read(f, &obs, sizeof(uint32_t), hstate)) goto format_error;
+
+   // The profiles appended since the checkpoint are not in the
+   // digest (see 'obs_digest()').
+   const int64_t bgen = file_gen(bins);
+   if (n != nobs(Z->ChIP) || r > Z->ChIP->r || m != Z->m ||
+         obs != obs_digest(Z->ChIP, r) || (bgen >= 0 && bgen != gen)) {
+      fprintf(stderr, "checkpoint %s does not match the data\n", ckpt);
+      goto clean_and_return;
+   }
+
+   if (!ckpt_read(f, &iter, sizeof(int32_t), hstate)) goto format_error;
+   if (iter < 0 || iter >= BW_MAXITER) goto format_error;
+   if (!ckpt_read(f, phase, sizeof(phase), hstate)) goto format_error;
+   if (phase[0] < 0 || phase[0] > iter || phase[1] < 0) goto format_error;
+   if (!ckpt_read(f, par, sizeof(par), hstate)) goto format_error;
+   if (!ckpt_read(f, Z->Q, m*m * sizeof(double), hstate))
+      goto format_error;
+   if (!ckpt_read(f, Z->p, m*(r+1) * sizeof(double), hstate))
+      goto format_error;
+   if (!ckpt_read(f, trace, iter * sizeof(double), hstate))
+      goto format_error;
+
+   uint32_t digest;
+   uint32_t expected = XXH32_digest(hstate);
+   hstate = NULL;
+   if (fread(&digest, sizeof(uint32_t), 1, f) != 1 || digest != expected)
+      goto format_error;
+
+   Z->gen = gen;
+   Z->iter = iter;
+   Z->vt = phase[0];
+   Z->polish = phase[1];
+   Z->a = par[0];
+   Z->pi = par[1];
+   Z->l = par[2];
+
+   if (r < Z->ChIP->r) {
+      extend_par(Z, r);
+      memset(trace, 0, BW_MAXITER * sizeof(double));
+      Z->iter = 0;
+      Z->vt = 0;
+      Z->polish = 0;
+   }
+
+   status = SUCCESS;
+
+clean_and_return:
+   if (hstate != NULL) free(hstate);
+   free(bins);
+   fclose(f);
+   return status;
+
+format_error:
+   fprintf(stderr, "corrupt or truncated file %s\n", ckpt);
+   goto clean_and_return;
+
+}
+
+
+uint32_t
+obs_digest
+(
+   const ChIP_t * ChIP,
+         size_t   r
+)
+// SYNOPSIS:
+//   Digest of the block sizes and of the observations of the first
+//   'r' profiles. The profiles appended after a checkpoint (see
+//   'append_ChIP()') are the last columns of 'y', so they do not
+//   change the digest of the first profiles.
+{
+
+   XXH32_stateSpace_t space;
+   void *hstate = &space;
+   XXH32_resetState(hstate, 0);
+
+   const size_t n = nobs(ChIP);
+   const size_t s = ChIP->r - ChIP->nomock;
+   // The implicit profile is not in 'y' (see 'ChIP_t').
+   const size_t c = r - ChIP->nomock;
+
+   XXH32_update(hstate, ChIP->sz, ChIP->nb * sizeof(uint));
+   if (c == s) {
+      const size_t size = n*s * sizeof(int);
+      for (size_t done = 0 ; done < size ; done += HCHUNK) {
+         size_t len = size - done < HCHUNK ? size - done : HCHUNK;
+         XXH32_update(hstate, (const char *) ChIP->y + done, len);
+      }
+   }
+   else {
+      for (size_t k = 0 ; k < n ; k++) {
+         XXH32_update(hstate, ChIP->y + k*s, c * sizeof(int));
+      }
+   }
+
+   // The state is on the stack ('XXH32_digest()' frees it).
+   return XXH32_intermediateDigest(hstate);
+
+}
+
+
+
+int
+recover_checkpoint
+(
+   const char * ckpt
+)
+// SYNOPSIS:
+//   Finish or undo an update of the checkpoint 'ckpt' that was
+//   interrupted (see 'online_zerone()'). The update writes the
+//   bins and the statistics of the online EM under staged names
+//   ("<ckpt>.next.bins" and "<ckpt>.next.online"), then the
+//   checkpoint, and finally moves the staged files in place.
+//   A staged file of the same generation as the checkpoint was
+//   committed and is moved in place, any other is removed.
+//
+// RETURN:
+//   SUCCESS (1) or FAILURE (0).
+{
+
+   const char *ext[2] = {".bins", ".online"};
+   const int64_t gen = file_gen(ckpt);
+   int status = SUCCESS;
+
+   for (int i = 0 ; i < 2 ; i++) {
+      char *dest = ckpt_name(ckpt, ext[i]);
+      char *next = malloc(strlen(ckpt) + strlen(ext[i]) + 6);
+      if (dest == NULL || next == NULL) {
+         debug_print("%s", "memory error\n");
+         free(dest);
+         free(next);
+         return FAILURE;
+      }
+      sprintf(next, "%s.next%s", ckpt, ext[i]);
+      if (access(next, F_OK) == 0) {
+         const int64_t g = file_gen(next);
+         if (gen >= 0 && g == gen) {
+            if (rename(next, dest) != 0) {
+               fprintf(stderr, "cannot rename %s\n", next);
+               status = FAILURE;
+            }
+         }
+         else if (unlink(next) != 0) {
+            fprintf(stderr, "cannot remove %s\n", next);
+            status = FAILURE;
+         }
+      }
+      free(dest);
+      free(next);
+   }
+
+   return status;
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+char *
+ckpt_name
+(
+   const char * ckpt,
+   const char * ext
+)
+{
+
+   char *fname = malloc(strlen(ckpt) + strlen(ext) + 1);
+   if (fname == NULL) {
+      debug_print("%s", "memory error\n");
+      return NULL;
+   }
+
+   sprintf(fname, "%s%s", ckpt, ext);
+   return fname;
+
+}
+
+
+int64_t
+file_gen
+(
+   const char * fname
+)
+// The generation follows the magic number in the bins, in the
+// checkpoint and in the statistics of the online EM. The files
+// are written atomically, so the digest need not be checked.
+// Returns -1 if the file cannot be read.
+{
+
+   FILE *f = fopen(fname, "r");
+   if (f == NULL) return -1;
+
+   char magic[8];
+   uint32_t gen;
+   int64_t status = -1;
+   if (fread(magic, 8, 1, f) == 1 && fread(&gen, sizeof(uint32_t), 1, f) == 1)
+      status = gen;
+
+   fclose(f);
+   return status;
+
+}
+
+
+FILE *
+open_tmp_file
+(
+   const char  * fname,
+         char ** tmpname
+)
+// Open a temporary file in the directory of 'fname'. It is
+// renamed to 'fname' by 'commit_file()' when complete.
+{
+
+   *tmpname = malloc(strlen(fname) + 32);
+   if (*tmpname == NULL) {
+      debug_print("%s", "memory error\n");
+      return NULL;
+   }
+
+   sprintf(*tmpname, "%s.tmp.%d", fname, (int) getpid());
+
+   FILE *f = fopen(*tmpname, "w");
+   if (f == NULL) {
+      fprintf(stderr, "cannot open file %s\n", *tmpname);
+   }
+
+   return f;
+
+}
+
+
+int
+commit_file
+(
+         FILE * f,
+   const char * tmpname,
+   const char * fname
+)
+// Flush the temporary file to disk and rename it. The rename is
+// atomic so readers see either the old or the new file.
+{
+
+   int failed = fflush(f) != 0 || fsync(fileno(f)) != 0;
+   failed |= fclose(f) != 0;
+
+   if (failed || rename(tmpname, fname) != 0) {
+      unlink(tmpname);
+      return FAILURE;
+   }
+
+   return SUCCESS;
+
+}
+
+
+int
+ckpt_write
+(
+         FILE   * f,
+   const void   * data,
+         size_t   size,
+         void   * hstate
+)
+// Write 'size' bytes and update the digest.
+{
+
+   if (size == 0) return SUCCESS;
+   if (fwrite(data, size, 1, f) != 1) return FAILURE;
+
+   for (size_t done = 0 ; done < size ; done += HCHUNK) {
+      size_t len = size - done < HCHUNK ? size - done : HCHUNK;
+      XXH32_update(hstate, (const char *) data + done, len);
+   }
+
+   return SUCCESS;
+
+}
+
+
+int
+ckpt_read
+(
+   FILE   * f,
+   void   * data,
+   size_t   size,
+   void   * hstate
+)
+// Read 'size' bytes and update the digest.
+{
+
+   if (size == 0) return SUCCESS;
+   if (fread(data, size, 1, f) != 1) return FAILURE;
+
+   for (size_t done = 0 ; done < size ; done += HCHUNK) {
+      size_t len = size - done < HCHUNK ? size - done : HCHUNK;
+      XXH32_update(hstate, (const char *) data + done, len);
+   }
+
+   return SUCCESS;
+
+}
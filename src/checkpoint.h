@@ -0,0 +1,58 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "zerone.h"
+
+// A checkpoint consists of two files: the binned observations,
+// written once after parsing the input ("<name>.bins"), and the
+// state of the Baum-Welch algorithm ("<name>"), rewritten after
+// every cycle. Both are replaced atomically. An update of the
+// observations (see 'online_zerone()') also rewrites the bins,
+// so the files carry a generation and the checkpoint is written
+// last to commit them (see 'recover_checkpoint()').
+
+struct bins_info_t;
+typedef struct bins_info_t bins_info_t;
+
+struct bins_info_t {
+   int window;      // window size
+   int minmapq;     // minimum mapping quality
+   int nomock;      // no mock file was provided
+   int gen;         // generation of the bins
+};
+
+// Helpers to write files atomically with a trailing digest
+// (also used by the cache of mock files).
+int      commit_file (FILE *, const char *, const char *);
+int      ckpt_read (FILE *, void *, size_t, void *);
+int      ckpt_write (FILE *, const void *, size_t, void *);
+FILE   * open_tmp_file (const char *, char **);
+uint32_t obs_digest (const ChIP_t *, size_t);
+
+ChIP_t * read_bins (const char *, bins_info_t *);
+int      read_checkpoint (const char *, zerone_t *, double *);
+int      recover_checkpoint (const char *);
+int      write_bins (const char *, const ChIP_t *, bins_info_t);
+int      write_checkpoint (const char *, const zerone_t *, const double *);
+
+#endif
@@ -0,0 +1,295 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "counters.h"
+
+struct tstate_t;
+typedef struct tstate_t tstate_t;
+
+struct tstate_t {
+   int       fd[NCOUNTERS];               // group (-1 if not available) //
+   int       ok[NSTAGES];                 // counters read at begin //
+   int64_t   t0[NSTAGES];                 // time at begin //
+   uint64_t  c0[NSTAGES][NCOUNTERS];      // counters at begin //
+};
+
+
+//  ----- Globals ----- //
+int counters_on = 0;
+
+stage_t        STAGES[NSTAGES];          // totals of all the threads //
+pthread_key_t  STATE_KEY;                // to close the counters //
+pthread_once_t STATE_ONCE = PTHREAD_ONCE_INIT;
+__thread tstate_t * MYSTATE = NULL;      // state of the thread //
+
+const char *STAGE_NAMES[NSTAGES] = {
+   "ingestion", "indexts", "emissions", "fwd/bwd",
+   "M-step", "Viterbi", "output",
+};
+
+// Type and config of the events (in the order of 'count').
+uint32_t EVENTS[NCOUNTERS][2] = {
+   {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+   {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+   {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+   {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+
+//  ---- Declaration of local functions  ---- //
+void       destroy_tstate (void *);
+void       make_state_key (void);
+tstate_t * new_tstate (void);
+int        read_group (const tstate_t *, uint64_t *);
+
+
+//  -- Definitions of exported functions  --- //
+
+void
+start_counters
+(void)
+// SYNOPSIS:
+//   Reset the totals and turn the counters on.
+{
+   memset(STAGES, 0, sizeof(STAGES));
+   counters_on = 1;
+}
+
+
+void
+stage_event
+(
+   int   s,
+   int   end
+)
+// SYNOPSIS:
+//   Record the beginning or the end of stage 's' in the calling
+//   thread. Use the macros 'stage_begin()' and 'stage_end()'
+//   instead. A thread cannot enter the same stage twice.
+//
+// SIDE EFFECTS:
+//   At the end of the stage, the deltas are added to the totals.
+{
+
+   if (MYSTATE == NULL && (MYSTATE = new_tstate()) == NULL) return;
+   tstate_t *st = MYSTATE;
+
+   uint64_t c[NCOUNTERS] = {0};
+   struct timespec now;
+   int ok;
+
+   // Time is inside the counted interval.
+   if (!end) {
+      ok = read_group(st, c);
+      clock_gettime(CLOCK_MONOTONIC, &now);
+   }
+   else {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      ok = read_group(st, c);
+   }
+   const int64_t ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+
+   if (!end) {
+      st->t0[s] = ns;
+      st->ok[s] = ok;
+      memcpy(st->c0[s], c, sizeof(c));
+      return;
+   }
+
+   stage_t *stage = STAGES + s;
+   __atomic_add_fetch(&stage->calls, 1, __ATOMIC_RELAXED);
+   __atomic_add_fetch(&stage->ns, ns - st->t0[s], __ATOMIC_RELAXED);
+   if (!ok || !st->ok[s]) {
+      __atomic_add_fetch(&stage->missed, 1, __ATOMIC_RELAXED);
+      return;
+   }
+   for (int i = 0 ; i < NCOUNTERS ; i++) {
+      __atomic_add_fetch(&stage->count[i], c[i] - st->c0[s][i],
+            __ATOMIC_RELAXED);
+   }
+
+}
+
+
+void
+read_stage
+(
+   int       s,
+   stage_t * stage
+)
+// SYNOPSIS:
+//   Copy the totals of stage 's' in 'stage'.
+{
+   stage->calls = __atomic_load_n(&STAGES[s].calls, __ATOMIC_RELAXED);
+   stage->ns = __atomic_load_n(&STAGES[s].ns, __ATOMIC_RELAXED);
+   stage->missed = __atomic_load_n(&STAGES[s].missed, __ATOMIC_RELAXED);
+   for (int i = 0 ; i < NCOUNTERS ; i++) {
+      stage->count[i] =
+         __atomic_load_n(&STAGES[s].count[i], __ATOMIC_RELAXED);
+   }
+}
+
+
+void
+print_counters
+(
+   FILE * f
+)
+// SYNOPSIS:
+//   Print the totals of the stages that were run. Times are summed
+//   over the threads. IPC is instructions per cycle, the misses are
+//   given per thousand instructions and the bandwidth is estimated
+//   from the cache misses (64 bytes each) and the time of the stage.
+//   The counters of a stage are not shown if some of the threads
+//   could not read them.
+{
+
+   fprintf(f, "# %-10s %8s %10s %10s %6s %8s %10s %8s\n", "stage",
+         "calls", "time (s)", "Mcycles", "IPC", "LLC/ki", "MB/s", "br/ki");
+
+   int missed = 0;
+   for (int s = 0 ; s < NSTAGES ; s++) {
+      stage_t stage;
+      read_stage(s, &stage);
+      if (stage.calls == 0) continue;
+
+      const double sec = stage.ns / 1e9;
+      fprintf(f, "# %-10s %8ld %10.3f", STAGE_NAMES[s],
+            (long) stage.calls, sec);
+
+      const double cyc = stage.count[0];
+      const double ins = stage.count[1];
+      if (stage.missed > 0 || cyc == 0 || ins == 0) {
+         fprintf(f, " %10s %6s %8s %10s %8s\n", "-", "-", "-", "-", "-");
+         missed = 1;
+         continue;
+      }
+      fprintf(f, " %10.1f %6.2f %8.2f %10.1f %8.2f\n", cyc / 1e6,
+            ins / cyc, 1000 * stage.count[2] / ins,
+            sec > 0 ? 64 * stage.count[2] / sec / 1e6 : 0.0,
+            1000 * stage.count[3] / ins);
+   }
+
+   if (missed) {
+      fprintf(f, "# (hardware counters not available)\n");
+   }
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+void
+make_state_key
+(void)
+{
+   pthread_key_create(&STATE_KEY, destroy_tstate);
+}
+
+
+tstate_t *
+new_tstate
+(void)
+// SYNOPSIS:
+//   Create the state of the calling thread and open its group of
+//   counters. The state is destroyed when the thread exits.
+//
+// RETURN:
+//   The state, or NULL in case of memory error. The counters are
+//   not available if 'fd[0]' is -1.
+{
+
+   tstate_t *st = calloc(1, sizeof(tstate_t));
+   if (st == NULL) return NULL;
+
+   for (int i = 0 ; i < NCOUNTERS ; i++) st->fd[i] = -1;
+
+   for (int i = 0 ; i < NCOUNTERS ; i++) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = EVENTS[i][0];
+      attr.config = EVENTS[i][1];
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      // Count the calling thread on any CPU.
+      st->fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1,
+            st->fd[0], 0);
+      if (st->fd[i] < 0) {
+         // Not available: no counter at all.
+         for (int j = 0 ; j < i ; j++) close(st->fd[j]);
+         for (int j = 0 ; j < NCOUNTERS ; j++) st->fd[j] = -1;
+         break;
+      }
+   }
+
+   pthread_once(&STATE_ONCE, make_state_key);
+   pthread_setspecific(STATE_KEY, st);
+
+   return st;
+
+}
+
+
+void
+destroy_tstate
+(
+   void * arg
+)
+{
+   tstate_t *st = (tstate_t *) arg;
+   for (int i = 0 ; i < NCOUNTERS ; i++) {
+      if (st->fd[i] >= 0) close(st->fd[i]);
+   }
+   free(st);
+   MYSTATE = NULL;
+}
+
+
+int
+read_group
+(
+   const tstate_t * st,
+         uint64_t * c
+)
+// SYNOPSIS:
+//   Read the counters of the thread in 'c'.
+//
+// RETURN:
+//   1 if the counters were read, 0 otherwise.
+{
+
+   if (st->fd[0] < 0) return 0;
+
+   // With 'PERF_FORMAT_GROUP' the number of counters comes first.
+   uint64_t buf[1+NCOUNTERS];
+   if (read(st->fd[0], buf, sizeof(buf)) != sizeof(buf)) return 0;
+   if (buf[0] != NCOUNTERS) return 0;
+
+   memcpy(c, buf+1, NCOUNTERS * sizeof(uint64_t));
+   return 1;
+
+}
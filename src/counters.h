@@ -0,0 +1,70 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _COUNTERS_H
+#define _COUNTERS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Stage timers and hardware counters. The stages are bracketed by
+// 'stage_begin()' and 'stage_end()' in the thread that runs them.
+// Every thread opens its own group of counters with 'perf_event_open'
+// (cycles, instructions, cache misses and branch misses in user
+// space) the first time it enters a stage, and adds the deltas of
+// the stage to global totals with atomic operations. The counters
+// may not be available (e.g. because of 'perf_event_paranoid'), in
+// which case only the timers are reported. When the counters are
+// off (the default), the macros below only test a global flag.
+
+enum {
+   STAGE_PARSE,      // ingestion of the input files //
+   STAGE_INDEX,      // 'indexts()' //
+   STAGE_EMISSION,   // 'zinm_prob()' //
+   STAGE_FWDB,       // 'block_fwdb()' //
+   STAGE_MSTEP,      // 'suff_stats()' and update of the parameters //
+   STAGE_VITERBI,    // 'block_viterbi()' //
+   STAGE_OUTPUT,     // 'print_sinks()' //
+   NSTAGES,
+};
+
+#define NCOUNTERS 4   // cycles, instructions, cache and branch misses //
+
+struct stage_t;
+typedef struct stage_t stage_t;
+
+struct stage_t {
+   int64_t  calls;               // times the stage was run //
+   int64_t  ns;                  // time (summed over threads) //
+   int64_t  missed;              // calls without counters //
+   int64_t  count[NCOUNTERS];    // hardware counters //
+};
+
+extern int counters_on;
+
+#define stage_begin(s) \
+   do { if (counters_on) stage_event(s, 0); } while (0)
+#define stage_end(s) \
+   do { if (counters_on) stage_event(s, 1); } while (0)
+
+void   print_counters (FILE *);
+void   stage_event (int, int);
+void   start_counters (void);
+void   read_stage (int, stage_t *);
+
+#endif
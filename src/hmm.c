@@ -18,6 +18,7 @@
 
 #include "debug.h"
 #include "hmm.h"
+#include "trace.h"
 
 double
 fwd
@@ -176,13 +177,10 @@ bwd
    int     j;       // State index.
    int     k;       // Position of the time series.
    double  x;       // Sum used for computation intermediates.
-   double *R;       // Reverse kernel.
+   double  R[m*m];  // Reverse kernel.
 
-   R = malloc(m*m * sizeof(double));
-   if (R == NULL) {
-      debug_print("%s", "memory error\n");
-      return;
-   }
+   // NB: 'R' lives on the stack (like the intermediates of 'fwd()')
+   // so that short time series do not pay for an allocation.
 
    // 'T[i+j*m]' is the sum of transition probabilities from state 'i'
    // to state 'j' (congruent with 'Q') conditional on the observations.
@@ -228,8 +226,6 @@ bwd
       }
    }
 
-   free(R);
-
    return;
 
 }
@@ -311,6 +307,57 @@ viterbi(
 //
 // SIDE EFFECTS:
 //   Updates 'path' in place.
+{
+
+   int *argmax = malloc(m*n * sizeof(int));
+   if (argmax == NULL) {
+      debug_print("%s", "memory error\n");
+      // Set path to -1 and return.
+      memset(path, -1, n*sizeof(int));
+      return;
+   }
+
+   viterbi_ws(m, n, log_Q, log_i, log_p, argmax, path);
+
+   free(argmax);
+
+   return;
+
+}
+
+
+void
+viterbi_ws(
+   // input //
+         unsigned int            m,
+         unsigned int            n,
+   const double       * restrict log_Q,
+   const double       * restrict log_i,
+   const double       * restrict log_p,
+   // workspace //
+                  int * restrict argmax,
+   // output //
+                  int * restrict path
+)
+// SYNOPSIS:
+//   Kernel of 'viterbi()' working in caller-provided scratch space.
+//   'block_viterbi()' uses it to process all the blocks with a
+//   single buffer for the back-pointers.
+//
+// ARGUMENTS:
+//   'm': the number of states
+//   'n': the length of the sequence of observations
+//   'log_Q': (m,m) log transition matrix.
+//   'log_i': (m) log initial probabilities
+//   'log_p': (m,n) log emission probabilities
+//   'argmax': (m,n) scratch space for the back-pointers
+//   'path': (n) Viterbi path.
+//
+// RETURN:
+//   'void'
+//
+// SIDE EFFECTS:
+//   Updates 'path' and 'argmax' in place.
 {
 
    int i;        // State index.
@@ -320,14 +367,7 @@ viterbi(
    double thismax;
    double tmp;
 
-   long double *array = malloc(2*m * sizeof(long double));
-   int *argmax = malloc(m*n * sizeof(int));
-   if (argmax == NULL || array == NULL) {
-      debug_print("%s", "memory error\n");
-      // Set path to -1 and return.
-      memset(path, -1, n*sizeof(int));
-      return;
-   }
+   long double array[2*m];
    long double *oldmax = array;
    long double *newmax = array + m;
 
@@ -358,9 +398,6 @@ viterbi(
    // Trace back the Viterbi path.
    for (k = n-2 ; k >= 0 ; k--) path[k] = argmax[path[k+1]+(k+1)*m];
 
-   free(array);
-   free(argmax);
-
    return;
 
 }
@@ -403,28 +440,37 @@ block_fwdb(
 
    // Initialization.
    double loglik = 0.0;
-   int offset = 0;
+   size_t offset = 0;
    memset(sumtrans, 0.0, m*m * sizeof(double));
 
    // Cycle over fragments of the time series.
-   offset = 0;
-   double *T = malloc(m*m * sizeof(double));
-   if (T == NULL) {
-      debug_print("%s", "memory error\n");
-      return -1.0/0.0;
-   }
+   double T[m*m];
    for (int i = 0 ; i < nblocks ; i++) {
+      if (size[i] == 1) {
+         // Fast path for runs of blocks of a single window (small
+         // contigs). There is no transition, so the posteriors are
+         // the alphas and the backward pass is skipped.
+         trace_begin("fwd/bwd", NULL, i);
+         for ( ; i < nblocks && size[i] == 1 ; i++) {
+            loglik += fwd(m, 1, Q, init, prob+offset);
+            memcpy(phi+offset, prob+offset, m * sizeof(double));
+            offset += m;
+         }
+         trace_end("fwd/bwd", NULL, i-1);
+         i--;
+         continue;
+      }
       // NOTE: the call to `fwdb` replaces the values of 'prob' by
       // the normalized alphas.
+      trace_begin("fwd/bwd", NULL, i);
       loglik += fwdb(m, size[i], Q, init, prob+offset, phi+offset, T);
+      trace_end("fwd/bwd", NULL, i);
       for (int j = 0 ; j < m*m ; j++) {
          sumtrans[j] += T[j];
       }
       offset += m * size[i];
    }
 
-   free(T);
-
    return loglik;
 
 }
@@ -487,8 +533,12 @@ block_viterbi
 //   Updates 'path' in place.
 {
 
-   int n = 0;
-   for (int i = 0 ; i < nblocks ; i++) n += size[i];
+   size_t n = 0;
+   unsigned int maxsz = 0;
+   for (int i = 0 ; i < nblocks ; i++) {
+      n += size[i];
+      if (size[i] > maxsz) maxsz = size[i];
+   }
 
    double *log_Q = malloc(m*m * sizeof(double));
    double *log_i = malloc(m * sizeof(double));
@@ -587,7 +637,7 @@ block_viterbi
    // If an emssion probability is not available at some step, all
    // the log values are set to 0. Observations do not contribute
    // to te path (only the transition probabilities).
-   int offset = 0;
+   size_t offset = 0;
    for (int i = 0 ; i < nblocks ; i++) {
       for (int k = 0 ; k < size[i] ; k++) {
          if (is_undefined(log_p + offset + k*m, m)) {
@@ -597,14 +647,29 @@ block_viterbi
       offset += m * size[i];
    }
 
+   // The back-pointers of all the blocks go to the same buffer,
+   // which is allocated once with the size of the largest block.
+   int *argmax = malloc(m*maxsz * sizeof(int));
+   if (argmax == NULL && maxsz > 0) {
+      debug_print("%s", "memory error\n");
+      free(log_Q);
+      free(log_i);
+      if (args_in_lin_space) free(log_p);
+      return 1;
+   }
+
    // NOTE: the offset is not the same in 'path' and 'log_p' because
    // of their dimensions (explains 'm*offset' in the case of 'log_p').
    offset = 0;
    for (int i = 0 ; i < nblocks ; i++) {
-      viterbi(m, size[i], log_Q, log_i, log_p+m*offset, path+offset);
+      trace_begin("viterbi", NULL, i);
+      viterbi_ws(m, size[i], log_Q, log_i, log_p+m*offset,
+            argmax, path+offset);
+      trace_end("viterbi", NULL, i);
       offset += size[i];
    }
 
+   free(argmax);
    free(log_Q);
    free(log_i);
 
@@ -39,6 +39,7 @@ V  bwd           (  U,  U, cD*,  D*,  D*,  D*         );
 D  fwd           (  U,  U, cD*, cD*,  D*              );
 D  fwdb          (  U,  U, cD*, cD*,  D*,  D*, D*     );
 V  viterbi       (  U,  U, cD*, cD*,  cD*, I*         );
+V  viterbi_ws    (  U,  U, cD*, cD*,  cD*, I*, I*     );
 
 #undef D
 #undef I
@@ -18,9 +18,19 @@
 
 #include <stdio.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "autowin.h"
+#include "checkpoint.h"
+#include "counters.h"
 #include "debug.h"
+#include "online.h"
+#include "output.h"
 #include "parse.h"
-#include "predict.h"
+#include "pipeline.h"
+#include "refine.h"
+#include "serve.h"
+#include "trace.h"
 #include "zerone.h"
 
 
@@ -28,26 +38,88 @@ const char *USAGE =
 "\n"
 "USAGE:"
 "  zerone [options] <input file 1> ... <input file n>\n"
+"  zerone serve [serve options] <socket>\n"
 "\n"
 "  Input options\n"
 "    -0 --mock: given file is a mock control\n"
 "    -1 --chip: given file is a ChIP-seq experiment\n"
 "    -w --window: window size in bp (default 300)\n"
+"       --auto-window: choose the window size among 1, 2, 3,\n"
+"                      4, 6 and 8 times --window by the QC\n"
+"                      score of fits on a subsample\n"
 "    -q --quality: minimum mapping quality (default 20)\n"
+"       --cache: directory where the binned mock files and\n"
+"                their fit are cached between runs\n"
+"       --cache-size: max size of the cache in MB (default none)\n"
 "\n"
 "  Output options\n"
 "    -l --list-output: output list of targets (default table)\n"
 "    -c --confidence: print targets only with higher confidence\n"
 "                     restricts intervals accordingly in list output\n"
+"    -o --output: FORMAT[:CONF][:FILE] where FORMAT is 'list' or\n"
+"                 'table', CONF the confidence (default -c) and\n"
+"                 FILE the output file (default stdout); can be\n"
+"                 repeated, all the outputs are written in one pass\n"
+"\n"
+"  Checkpoint options\n"
+"    -k --checkpoint: save state to given file during the run\n"
+"       --resume: resume the run saved in checkpoint file\n"
+"                 (input files are not needed, ChIP files\n"
+"                 are added to the run as new replicates)\n"
+"       --add-reads: with --resume, add the reads of the input\n"
+"                    files to the profiles of the checkpoint\n"
+"                    (same mock and ChIP files in the same order)\n"
+"                    and update the fit by a step of online EM\n"
+"                    on the chromosomes that received reads\n"
 "\n"
 "  Other options\n"
+"    -t --threads: number of threads used to process the input\n"
+"                  and to run the EM, pinned to the processors\n"
+"                  node by node (default: number of processors)\n"
+"    -s --starts: number of EM initializations run in\n"
+"                 parallel, the best fit is kept (default 1)\n"
+"       --workers: number of processes sharing the EM,\n"
+"                  each on a shard of chromosomes (default 1)\n"
+"       --early-qc: stop early if QC predicts rejection\n"
+"                   (no target is reported in that case)\n"
+"       --adaptive: run the EM on segments of consecutive\n"
+"                   windows where all counts are below given\n"
+"                   value (e.g. 1 merges empty windows)\n"
+"       --refine: run the EM on coarse windows of given number\n"
+"                 of windows, then run the candidate targets\n"
+"                 again at the window size\n"
+"       --hard-em: fit by Viterbi training (hard EM), then run\n"
+"                  EM cycles until convergence (a resumed run\n"
+"                  keeps the engine and the number of EM cycles\n"
+"                  of its checkpoint)\n"
+"       --polish: with --hard-em, run at most given number of\n"
+"                 EM cycles (e.g. 0); faster, but the fit and\n"
+"                 the calls are less accurate (see README)\n"
+"       --counters: report time and hardware counters\n"
+"                   (perf_event_open) of the stages on stderr\n"
+"       --trace: write a timeline of the stages of the run\n"
+"                to given file in Chrome trace format (the\n"
+"                processes of --workers are not traced)\n"
 "    -h --help: display this message and exit\n"
 "    -v --version: display version and exit\n"
 "\n"
+"  Serve options (jobs are JSON requests, see serve.h)\n"
+"    -j --jobs: max number of running jobs (default 4)\n"
+"    -m --memory: max memory per job in MB (default none)\n"
+"    -p --job-workers: max worker processes per job (default 1)\n"
+"\n"
 "EXAMPLES:\n"
 " zerone --mock file1.bam,file2.bam --chip file3.bam,file4.bam\n"
 " zerone -l -0 file1.map -1 file2.map -1 file4.map\n"
-" zerone -l -c.99 -w200 -0 file1.sam -1 file2.sam,file4.sam\n";
+" zerone -l -c.99 -w200 -0 file1.sam -1 file2.sam,file4.sam\n"
+" zerone -o table:all.txt -o list:.99:targets.txt -0 file1.sam file2.sam\n"
+" zerone --auto-window -w100 -0 file1.bam -1 file2.bam\n"
+" zerone -k run.ckpt -0 file1.bam -1 file2.bam\n"
+" zerone -k run.ckpt --resume\n"
+" zerone -k run.ckpt --resume -1 file5.bam\n"
+" zerone -k run.ckpt --resume --add-reads -0 file6.bam -1 file7.bam\n"
+" zerone --cache ~/.zerone -0 file1.bam -1 file2.bam\n"
+" zerone serve -j 8 -m 4096 /tmp/zerone.sock\n";
 
 
 #define VERSION "zerone-v1.0"
@@ -97,6 +169,167 @@ parse_fname
 }
 
 
+int
+parse_sink
+(
+   char   * spec,
+   double   minconf,
+   sink_t * sinks,
+   int      i
+)
+// Output specifications have the form FORMAT[:CONF][:FILE]. The
+// confidence is optional, the file is stdout if none is given.
+// The specification is parsed in 'sinks[i]', and its file must
+// not be the file of a previous sink (or a redirected stdout).
+{
+
+   sink_t *sink = sinks + i;
+
+   char *format = strsep(&spec, ":");
+   if (strcmp(format, "list") == 0) {
+      sink->list = 1;
+   }
+   else if (strcmp(format, "table") == 0) {
+      sink->list = 0;
+   }
+   else {
+      fprintf(stderr, "zerone error: unknown output format '%s'\n",
+            format);
+      return 0;
+   }
+
+   sink->minconf = minconf;
+   if (spec != NULL) {
+      char *endptr = NULL;
+      errno = 0;
+      double conf = strtod(spec, &endptr);
+      if (endptr != spec && (*endptr == ':' || *endptr == '\0')) {
+         if (errno || conf < 0 || conf > 1) {
+            fprintf(stderr, "zerone error: confidence must be "
+                  "a float between 0 and 1\n");
+            return 0;
+         }
+         sink->minconf = conf;
+         spec = *endptr == ':' ? endptr + 1 : NULL;
+      }
+   }
+
+   if (spec == NULL || *spec == '\0' || strcmp(spec, "-") == 0) {
+      sink->f = stdout;
+      return 1;
+   }
+
+   // Compare the files before opening, which truncates them.
+   struct stat st;
+   struct stat prev;
+   if (stat(spec, &st) == 0 && S_ISREG(st.st_mode)) {
+      int dup = fstat(fileno(stdout), &prev) == 0 && S_ISREG(prev.st_mode)
+         && prev.st_dev == st.st_dev && prev.st_ino == st.st_ino;
+      for (int j = 0 ; j < i ; j++) {
+         if (sinks[j].f == stdout || fstat(fileno(sinks[j].f), &prev)) {
+            continue;
+         }
+         dup |= prev.st_dev == st.st_dev && prev.st_ino == st.st_ino;
+      }
+      if (dup) {
+         fprintf(stderr, "zerone error: %s is given twice as output\n",
+               spec);
+         return 0;
+      }
+   }
+
+   sink->f = fopen(spec, "w");
+   if (sink->f == NULL) {
+      fprintf(stderr, "zerone error: cannot open %s\n", spec);
+      return 0;
+   }
+
+   return 1;
+
+}
+
+
+int
+serve_main
+(
+   int     argc,
+   char ** argv
+)
+// Options and arguments of 'zerone serve'.
+{
+
+   serve_args_t args = {0};
+   args.maxjobs = 4;
+   args.maxworkers = 1;
+
+   while (1) {
+      int option_index = 0;
+      static struct option long_options[] = {
+         {"help",        no_argument,                0, 'h'},
+         {"job-workers", required_argument,          0, 'p'},
+         {"jobs",        required_argument,          0, 'j'},
+         {"memory",      required_argument,          0, 'm'},
+         {0, 0, 0, 0}
+      };
+
+      int c = getopt_long(argc, argv, "hj:m:p:",
+            long_options, &option_index);
+
+      if (c == -1) break;
+
+      switch (c) {
+      case 'h':
+         say_usage();
+         return EXIT_SUCCESS;
+
+      case 'j':
+         args.maxjobs = atoi(optarg);
+         if (args.maxjobs <= 0) {
+            fprintf(stderr, "zerone error: jobs must be a "
+                  "positive integer\n");
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         break;
+
+      case 'm':
+         if (atol(optarg) <= 0) {
+            fprintf(stderr, "zerone error: memory must be a "
+                  "positive integer\n");
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         args.maxmem = atol(optarg);
+         break;
+
+      case 'p':
+         args.maxworkers = atoi(optarg);
+         if (args.maxworkers <= 0) {
+            fprintf(stderr, "zerone error: job workers must be a "
+                  "positive integer\n");
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         break;
+
+      default:
+         say_usage();
+         return EXIT_FAILURE;
+
+      }
+   }
+
+   if (optind != argc-1) {
+      fprintf(stderr, "zerone error: specify a socket to serve on\n");
+      say_usage();
+      return EXIT_FAILURE;
+   }
+
+   return serve(argv[optind], args) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+}
+
+
 int main(int argc, char **argv) {
 
    debug_print("%s (DEBUG)\n", VERSION);
@@ -106,6 +339,11 @@ int main(int argc, char **argv) {
       exit(EXIT_SUCCESS);
    }
 
+   // Daemon mode.
+   if (strcmp(argv[1], "serve") == 0) {
+      return serve_main(argc-1, argv+1);
+   }
+
    // Input file names (mock and ChIP).
    char *mock_fnames[MAXNARGS+1] = {0};
    char *ChIP_fnames[MAXNARGS+1] = {0};
@@ -116,11 +354,31 @@ int main(int argc, char **argv) {
    int no_ChIP_specified = 1;
 
    static int list_flag = 0;
+   static int autowin_flag = 0;
    static int minmapq = 20;
    static int window = 300;
    static int mock_flag = 1;
+   static int earlyqc_flag = 0;
+   static int counters_flag = 0;
+   static int resume_flag = 0;
+   static int addreads_flag = 0;
+   static int starts = 1;
+   static int adaptive = 0;
+   static int refine = 0;
+   static int hardem = 0;
+   static int polish = -1;
+   static int workers = 1;
+   static int threads = 0;
+   static char *cache = NULL;
+   static size_t cachesize = 0;
+   static char *checkpoint = NULL;
+   static char *trace = NULL;
    static double minconf = 0.0;
 
+   // Output specifications (see 'parse_sink()').
+   char *outputs[OUTPUT_MAXSINKS] = {0};
+   int n_outputs = 0;
+
    // Needed to check 'strtoul()'.
    char *endptr;
 
@@ -129,19 +387,36 @@ int main(int argc, char **argv) {
    while(1) {
       int option_index = 0;
       static struct option long_options[] = {
+         {"adaptive",    required_argument,          0, 'A'},
+         {"add-reads",   no_argument,   &addreads_flag,  1 },
+         {"auto-window", no_argument,    &autowin_flag,  1 },
+         {"cache",       required_argument,          0, 'C'},
+         {"cache-size",  required_argument,          0, 'S'},
          {"chip",        required_argument,          0, '1'},
          {"confidence",  required_argument,          0, 'c'},
+         {"counters",    no_argument,   &counters_flag,  1 },
+         {"early-qc",    no_argument,    &earlyqc_flag,  1 },
+         {"checkpoint",  required_argument,          0, 'k'},
+         {"hard-em",     no_argument,          &hardem,  1 },
          {"help",        no_argument,                0, 'h'},
          {"list-output", no_argument,       &list_flag,  1 },
          {"mock",        required_argument,          0, '0'},
          {"no-mock",     no_argument,       &mock_flag,  0 },
+         {"output",      required_argument,          0, 'o'},
+         {"polish",      required_argument,          0, 'P'},
          {"quality",     required_argument,          0, 'q'},
+         {"refine",      required_argument,          0, 'R'},
+         {"resume",      no_argument,     &resume_flag,  1 },
+         {"starts",      required_argument,          0, 's'},
+         {"threads",     required_argument,          0, 't'},
+         {"trace",       required_argument,          0, 'T'},
          {"version",     no_argument,                0, 'v'},
          {"window",      required_argument,          0, 'w'},
+         {"workers",     required_argument,          0, 'W'},
          {0, 0, 0, 0}
       };
 
-      int c = getopt_long(argc, argv, "0:1:c:hlq:vw:",
+      int c = getopt_long(argc, argv, "0:1:c:hk:lo:q:s:t:vw:",
             long_options, &option_index);
 
       // Done parsing named options. //
@@ -163,10 +438,70 @@ int main(int argc, char **argv) {
          no_ChIP_specified = 0;
          break;
 
+      case 'A':
+         errno = 0;
+         endptr = NULL;
+         adaptive = strtoul(optarg, &endptr, 10);
+         if (!check_strtoX(optarg, endptr) || adaptive <= 0) {
+            fprintf(stderr, "zerone error: adaptive must be a "
+                  "positive integer\n");
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         debug_print("| adaptive: %d\n", adaptive);
+         break;
+
+      case 'R':
+         errno = 0;
+         endptr = NULL;
+         refine = strtoul(optarg, &endptr, 10);
+         if (!check_strtoX(optarg, endptr) || refine <= 1) {
+            fprintf(stderr, "zerone error: refine must be an "
+                  "integer greater than 1\n");
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         debug_print("| refine: %d\n", refine);
+         break;
+
+      case 'P':
+         errno = 0;
+         endptr = NULL;
+         polish = strtoul(optarg, &endptr, 10);
+         if (!check_strtoX(optarg, endptr) || polish < 0) {
+            fprintf(stderr, "zerone error: polish must be a "
+                  "non-negative integer\n");
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         debug_print("| polish: %d\n", polish);
+         break;
+
+      case 'C':
+         debug_print("| cache: %s\n", optarg);
+         cache = optarg;
+         break;
+
+      case 'S':
+         if (atol(optarg) <= 0) {
+            fprintf(stderr, "zerone error: cache size must be a "
+                  "positive integer\n");
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         cachesize = (size_t) atol(optarg) << 20;
+         debug_print("| cache size: %ld\n", cachesize);
+         break;
+
       case 'h':
          say_usage();
          return EXIT_SUCCESS;
 
+      case 'k':
+         debug_print("| checkpoint: %s\n", optarg);
+         checkpoint = optarg;
+         break;
+
       case 'l':
          list_flag = 1;
          break;
@@ -186,6 +521,17 @@ int main(int argc, char **argv) {
          debug_print("| minconf: %f\n", minconf);
          break;
 
+      case 'o':
+         if (n_outputs >= OUTPUT_MAXSINKS) {
+            fprintf(stderr, "zerone error: at most %d outputs\n",
+                  OUTPUT_MAXSINKS);
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         debug_print("| output: %s\n", optarg);
+         outputs[n_outputs++] = optarg;
+         break;
+
       case 'q':
          // Decode argument with 'strtoul()'
          errno = 0;
@@ -202,10 +548,48 @@ int main(int argc, char **argv) {
          debug_print("| minmapq: %d\n", minmapq);
          break;
 
+      case 's':
+         starts = atoi(optarg);
+         if (starts <= 0) {
+            fprintf(stderr, "zerone error: starts must be a "
+                  "positive integer\n");
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         debug_print("| starts: %d\n", starts);
+         break;
+
+      case 't':
+         threads = atoi(optarg);
+         if (threads <= 0) {
+            fprintf(stderr, "zerone error: threads must be a "
+                  "positive integer\n");
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         debug_print("| threads: %d\n", threads);
+         break;
+
+      case 'T':
+         debug_print("| trace: %s\n", optarg);
+         trace = optarg;
+         break;
+
       case 'v':
          say_version();
          return EXIT_SUCCESS;
 
+      case 'W':
+         workers = atoi(optarg);
+         if (workers <= 0) {
+            fprintf(stderr, "zerone error: workers must be a "
+                  "positive integer\n");
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         debug_print("| workers: %d\n", workers);
+         break;
+
       case 'w':
          window = atoi(optarg);
          if (window <= 0) {
@@ -234,31 +618,209 @@ int main(int argc, char **argv) {
    debug_print("%s", "done parsing arguments\n");
 
    // Check options.
-   if (no_mock_specified && mock_flag) {
+   if (resume_flag && checkpoint == NULL) {
+      fprintf(stderr,
+         "zerone error: specify a checkpoint file to resume\n");
+      say_usage();
+      return EXIT_FAILURE;
+   }
+   if (workers > 1 && (starts > 1 || earlyqc_flag)) {
+      fprintf(stderr, "zerone warning: --starts and --early-qc "
+            "are ignored with --workers\n");
+   }
+   if (adaptive && refine) {
+      fprintf(stderr,
+         "zerone error: --adaptive and --refine are exclusive\n");
+      say_usage();
+      return EXIT_FAILURE;
+   }
+   if (autowin_flag && checkpoint != NULL) {
+      fprintf(stderr,
+         "zerone error: --auto-window and --checkpoint are exclusive\n");
+      say_usage();
+      return EXIT_FAILURE;
+   }
+   if (hardem && (adaptive || starts > 1 || workers > 1)) {
+      fprintf(stderr, "zerone warning: --hard-em is ignored with "
+            "--adaptive, --starts and --workers\n");
+   }
+   if (polish >= 0 && !hardem) {
+      fprintf(stderr, "zerone warning: --polish is ignored "
+            "without --hard-em\n");
+   }
+   // Polish until convergence by default.
+   if (polish < 0) polish = BW_MAXITER;
+   if (adaptive && workers > 1) {
+      fprintf(stderr, "zerone warning: --workers is ignored "
+            "with --adaptive\n");
+   }
+   if (addreads_flag && (!resume_flag || no_ChIP_specified)) {
+      fprintf(stderr, "zerone error: --add-reads needs --resume "
+            "and the files of the new reads\n");
+      say_usage();
+      return EXIT_FAILURE;
+   }
+   if (resume_flag && !addreads_flag && !no_mock_specified) {
+      fprintf(stderr,
+         "zerone error: cannot add mock files to a checkpoint\n");
+      say_usage();
+      return EXIT_FAILURE;
+   }
+   if (no_mock_specified && mock_flag && !resume_flag) {
       fprintf(stderr,
          "zerone error: specify a file for mock control experiment\n");
       say_usage();
       return EXIT_FAILURE;
    }
-   if (no_ChIP_specified) {
+   if (no_ChIP_specified && !resume_flag) {
       fprintf(stderr,
          "zerone error: specify a file for ChIP-seq experiment\n");
       say_usage();
       return EXIT_FAILURE;
    }
 
-   // Process input files.
-   zerone_parser_args_t args;
-   args.window = window;
-   args.minmapq = minmapq;
+   // Open the outputs before the run, so that errors
+   // are reported before spending time on the input.
+   sink_t sinks[OUTPUT_MAXSINKS] = {{0}};
+   int nsinks = n_outputs;
+   for (int i = 0 ; i < n_outputs ; i++) {
+      if (!parse_sink(outputs[i], minconf, sinks, i)) {
+         say_usage();
+         return EXIT_FAILURE;
+      }
+   }
+   if (n_outputs == 0) {
+      // Without '-o' use '-l' and '-c' on stdout.
+      sinks[0].f = stdout;
+      sinks[0].list = list_flag;
+      sinks[0].minconf = minconf;
+      nsinks = 1;
+   }
+
+   if (threads == 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+   if (trace != NULL) start_trace();
+   if (counters_flag) start_counters();
+
+   ChIP_t *ChIP = NULL;
+   ChIP_t *delta = NULL;
+   bins_info_t info = {0};
+   input_t input = {0};
+
+   if (resume_flag) {
+      // Use the binned observations of the checkpoint. The
+      // options they were produced with take precedence. An
+      // interrupted update of the bins is finished or undone.
+      if (!recover_checkpoint(checkpoint)) {
+         fprintf(stderr, "zerone error: cannot recover %s\n", checkpoint);
+         exit(EXIT_FAILURE);
+      }
+      ChIP = read_bins(checkpoint, &info);
+      window = info.window;
+      minmapq = info.minmapq;
+      mock_flag = !info.nomock;
+      if (ChIP != NULL && addreads_flag) {
+         // New reads of the profiles (see 'online_zerone()').
+         zerone_parser_args_t args;
+         args.window = window;
+         args.minmapq = minmapq;
+         delta = parse_input_files(mock_fnames, ChIP_fnames, args);
+         if (delta == NULL) {
+            fprintf(stderr, "zerone error: cannot add reads\n");
+            exit(EXIT_FAILURE);
+         }
+      }
+      // Add new replicates to the observations. The parameters
+      // of the checkpoint are then used as a warm start.
+      else if (ChIP != NULL && !no_ChIP_specified) {
+         zerone_parser_args_t args;
+         args.window = window;
+         args.minmapq = minmapq;
+         ChIP_t *new = parse_input_files(mock_fnames, ChIP_fnames, args);
+         if (new == NULL || append_ChIP(ChIP, new) < 0 ||
+               !write_bins(checkpoint, ChIP, info)) {
+            fprintf(stderr, "zerone error: cannot add replicates\n");
+            exit(EXIT_FAILURE);
+         }
+         free(new->y);
+         free(new);
+      }
+      // Resume Baum-Welch only if at least one cycle was saved.
+      resume_flag = access(checkpoint, F_OK) == 0;
+      if (addreads_flag && !resume_flag) {
+         fprintf(stderr, "zerone error: no fit in %s to add reads to\n",
+               checkpoint);
+         exit(EXIT_FAILURE);
+      }
+   }
+   else {
+      // Process input files.
+      zerone_parser_args_t args;
+      args.window = window;
+      args.minmapq = minmapq;
+
+      load_args_t largs = {0};
+      largs.threads = threads;
+      largs.cache = cache;
+      largs.cachesize = cachesize;
+
+      if (load_input(mock_fnames, ChIP_fnames, args, largs, &input) == 0) {
+         ChIP = input.ChIP;
+      }
+
+      info.window = window;
+      info.minmapq = minmapq;
+      info.nomock = !mock_flag;
 
-   ChIP_t *ChIP = parse_input_files(mock_fnames, ChIP_fnames, args);
+      // Remove the checkpoint of a previous run, so that it is
+      // never resumed with the bins of this one (the staged files
+      // of an interrupted update then go too).
+      if (checkpoint != NULL && ((access(checkpoint, F_OK) == 0 &&
+            unlink(checkpoint) != 0) || !recover_checkpoint(checkpoint))) {
+         fprintf(stderr, "zerone error: cannot remove %s\n", checkpoint);
+         exit(EXIT_FAILURE);
+      }
+      if (ChIP != NULL && checkpoint != NULL &&
+            !write_bins(checkpoint, ChIP, info)) {
+         fprintf(stderr, "zerone error: cannot write checkpoint\n");
+         exit(EXIT_FAILURE);
+      }
+   }
 
    if (ChIP == NULL) {
       fprintf(stderr, "error while reading input\n");
       exit(EXIT_FAILURE);
    }
 
+   // Fit of the chosen window size on a subsample (warm start).
+   zerone_t *warm = NULL;
+
+   if (autowin_flag) {
+      // The input was binned at the finest size of the ladder.
+      const int K = auto_window(ChIP, window, threads, &warm);
+      if (K < 0) {
+         fprintf(stderr, "zerone error: cannot choose window size\n");
+         exit(EXIT_FAILURE);
+      }
+      if (K > 1) {
+         ChIP_t *coarse = coarsen_ChIP(ChIP, K);
+         if (coarse == NULL) {
+            fprintf(stderr, "zerone error: cannot choose window size\n");
+            exit(EXIT_FAILURE);
+         }
+         free(ChIP->y);
+         free(ChIP);
+         ChIP = coarse;
+         window *= K;
+         // The fit of the mock and the index are those of the
+         // windows of the input, do not pass them on.
+         free(input.par);
+         free(input.index);
+         input.par = NULL;
+         input.index = NULL;
+      }
+   }
+
    // debug info //
    {
       debug_print("%s", "done reading input files\n");
@@ -275,21 +837,50 @@ int main(int argc, char **argv) {
          fprintf(stderr, "memory error\n");
          exit(EXIT_FAILURE);
       }
+      // The implicit profile has no read (see 'ChIP_t').
+      const int o = ChIP->nomock;
       for (int i = 0 ; i < nobs(ChIP) ; i++) {
-         for (int j = 0 ; j < ChIP->r ; j++) {
-            nreads[j] += ChIP->y[j + i*ChIP->r];
+         for (int j = o ; j < ChIP->r ; j++) {
+            nreads[j] += ChIP->y[j-o + i*(ChIP->r-o)];
          }
       }
       debug_print("| aggregated mock: %ld reads\n", nreads[0]);
+      // Profiles from a checkpoint come first.
+      int nckpt = addreads_flag ? ChIP->r-1 : ChIP->r-1 - n_ChIP_files;
       for (int j = 0 ; j < ChIP->r-1 ; j++) {
-         debug_print("| %s: %ld reads\n", ChIP_fnames[j], nreads[j+1]);
+         debug_print("| %s: %ld reads\n", j < nckpt ?
+               "(checkpoint)" : ChIP_fnames[j-nckpt], nreads[j+1]);
       }
       free(nreads);
    }
 
    // Do zerone.
    debug_print("%s", "starting zerone\n");
-   zerone_t *Z = do_zerone(ChIP);
+   zerone_args_t zargs = {0};
+   zargs.earlyqc = earlyqc_flag;
+   zargs.checkpoint = checkpoint;
+   zargs.resume = resume_flag;
+   zargs.starts = starts;
+   zargs.adaptive = adaptive;
+   zargs.refine = refine;
+   zargs.hardem = hardem;
+   zargs.polish = polish;
+   zargs.workers = workers;
+   zargs.threads = threads;
+   zargs.mockpar = input.par;
+   zargs.index = input.index;
+   zargs.i0 = input.i0;
+   zargs.warm = warm;
+
+   // With '--add-reads' the fit of the checkpoint is updated.
+   zerone_t *Z = addreads_flag ?
+      online_zerone(ChIP, delta, checkpoint, info) :
+      do_zerone(ChIP, &zargs);
+
+   if (delta != NULL) {
+      free(delta->y);
+      free(delta);
+   }
 
    if (Z == NULL) {
       fprintf(stderr, "run time error (sorry)\n");
@@ -315,87 +906,35 @@ int main(int argc, char **argv) {
       }
    }
 
-   // Quality control.
-   double feat[5];
-   double QC = zerone_qc(Z, feat);
-   fprintf(stdout, "# QC score: %.3f\n", QC);
-   fprintf(stdout, "# features: %.3f, %.3f, %.3f, %.3f, %.3f\n",
-                           feat[0], feat[1], feat[2], feat[3], feat[4]);
-   fprintf(stdout, "# advice: %s discretization.\n",
-         QC >= 0 ? "accept" : "reject");
-
-   // List output.
-   if (list_flag) {
-      int wid = 0;
-      int target = 0;
-      double best = 0.0;
-      for (int i = 0 ; i < ChIP->nb ; i++) {
-         char *name = ChIP->nm + 32*i;
-
-         // Do not print the last bin because it may extend
-         // beyond the limit of the chromosome.
-         for (int j = 0 ; j < ChIP->sz[i]-1 ; j++) {
-            // Toggle on target state.
-            double conf = Z->phi[2+wid*3];
-            if (!target && Z->path[wid] == 2 && conf > minconf) {
-               fprintf(stdout, "%s\t%d\t", name, window*j + 1);
-               best = conf;
-               target = 1;
-            }
-            // Toggle off target state.
-            else if (target) {
-               // Update best score.
-               if (conf > best) best = conf;
-               if (Z->path[wid] != 2 || conf < minconf) {
-                  fprintf(stdout, "%d\t%.5f\n", window*(j+1), best);
-                  best = 0.0;
-                  target = 0;
-               }
-            }
-            wid++;
-         }
-         // In case the end of the block is a target.
-         if (target) {
-            fprintf(stdout, "%d\t%.5f\n", window * ChIP->sz[i], best);
-            best = 0.0;
-            target = 0;
-         }
-      }
+   output_args_t oargs = {0};
+   oargs.window = window;
+   oargs.nomock = !mock_flag;
+
+   stage_begin(STAGE_OUTPUT);
+   print_sinks(sinks, nsinks, Z, oargs);
+   stage_end(STAGE_OUTPUT);
+
+   // Write errors (e.g. a full disk) show up when closing.
+   int wrerr = fflush(stdout) != 0 || ferror(stdout);
+   for (int i = 0 ; i < nsinks ; i++) {
+      if (sinks[i].f == stdout) continue;
+      wrerr |= ferror(sinks[i].f);
+      wrerr |= fclose(sinks[i].f) != 0;
+   }
+   if (wrerr) {
+      fprintf(stderr, "zerone error: cannot write output\n");
+      exit(EXIT_FAILURE);
    }
 
-   // Table output.
-   else {
-      // Use 'offset' to navigate in the ChIP blocks.
-      uint64_t offset = 0;
-      // In case no mock was provided, skip the column.
-      const int skipmock = mock_flag ? 0 : 1;
-
-      for (int i = 0 ; i < ChIP->nb ; i++) {
-         char *name = ChIP->nm + 32*i;
-
-         // Do not print the last bin because it may extend
-         // beyond the limit of the chromosome.
-         for (int j = 0 ; j < ChIP->sz[i]-1 ; j++) {
-            // Skip if 'confidence' too low.
-            if (Z->phi[2+(offset+j)*3] < minconf) continue;
-            fprintf(stdout, "%s\t%d\t%d\t%d", name, window*j + 1,
-                    // Block name, window start, end, state.
-                    window*(j+1), Z->path[offset+j] == 2 ? 1 : 0);
-            for (int k = skipmock ; k < Z->ChIP->r ; k++) {
-               fprintf(stdout, "\t%d",
-                    // Read numbers of each file.
-                    Z->ChIP->y[(offset+j)*Z->ChIP->r+k]);
-            }
-            fprintf(stdout, "\t%.5f\n",
-                    // Confidence score.
-                    Z->phi[2+(offset+j)*3]);
-         }
-         // End of the block. Update 'offset' before
-         // local window number is reset to 0.
-         offset += Z->ChIP->sz[i];
-      }
+   // All the threads are done (the results are out).
+   if (counters_flag) print_counters(stderr);
+   if (trace != NULL && write_trace(trace) < 0) {
+      fprintf(stderr, "zerone warning: cannot write trace\n");
    }
 
+   free(input.par);
+   free(input.index);
+   if (warm != NULL) destroy_zerone_all(warm);
 
    destroy_zerone_all(Z); // Also frees ChIP.
 
@@ -0,0 +1,543 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "counters.h"
+#include "debug.h"
+#include "hmm.h"
+#include "numa.h"
+#include "trace.h"
+
+// Where Linux describes the NUMA nodes.
+#define NODE_DIR "/sys/devices/system/node"
+
+// Commands sent to the threads.
+#define CMD_PLACE  1
+#define CMD_ROWS   2
+#define CMD_COPY   3
+#define CMD_ESTEP  4
+#define CMD_QUIT   5
+
+
+//  ---- Declaration of local functions  ---- //
+int    parse_cpulist (const char *, cpu_set_t *);
+void   part_rows (pool_t *, part_t *, int);
+void   place_part (pool_t *, part_t *);
+void   run_command (pool_t *, int);
+int    run_prob (pool_t *, int);
+void * run_part (void *);
+int    read_cpulist (const char *, cpu_set_t *);
+
+
+
+//  -- Definitions of exported functions  --- //
+
+int
+numa_cpus
+(
+   int * cpu,
+   int * node,
+   int   max
+)
+// SYNOPSIS:
+//   List the CPUs where the process is allowed to run, node by
+//   node, with their NUMA node. Without NUMA information (e.g.
+//   no sysfs), all the CPUs are on node 0.
+//
+// RETURN:
+//   The number of CPUs (at most 'max').
+{
+
+   cpu_set_t allowed;
+   CPU_ZERO(&allowed);
+   if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) return 0;
+
+   int ncpu = 0;
+   cpu_set_t nodes;
+   if (read_cpulist(NODE_DIR "/online", &nodes)) {
+      for (int d = 0 ; d < CPU_SETSIZE && ncpu < max ; d++) {
+         if (!CPU_ISSET(d, &nodes)) continue;
+         char fname[64];
+         cpu_set_t cpus;
+         snprintf(fname, 64, NODE_DIR "/node%d/cpulist", d);
+         if (!read_cpulist(fname, &cpus)) continue;
+         for (int c = 0 ; c < CPU_SETSIZE && ncpu < max ; c++) {
+            if (!CPU_ISSET(c, &cpus) || !CPU_ISSET(c, &allowed)) continue;
+            // A CPU is listed only once.
+            CPU_CLR(c, &allowed);
+            cpu[ncpu] = c;
+            node[ncpu] = d;
+            ncpu++;
+         }
+      }
+   }
+
+   // The CPUs left have no known node.
+   for (int c = 0 ; c < CPU_SETSIZE && ncpu < max ; c++) {
+      if (!CPU_ISSET(c, &allowed)) continue;
+      cpu[ncpu] = c;
+      node[ncpu] = 0;
+      ncpu++;
+   }
+
+   return ncpu;
+
+}
+
+
+pool_t *
+new_pool
+(
+   zerone_t * Z,
+   bw_t     * bw,
+   int        nthreads
+)
+// SYNOPSIS:
+//   Start the threads of the E-step of 'Z', with the workspace
+//   'bw' (which must be indexed). Every thread first touches its
+//   slices of 'bw->pem' and 'bw->phi'. The observations and the
+//   index are not copied, the threads read their slices.
+//
+// RETURN:
+//   A pointer to the pool, or NULL if there would be fewer than
+//   two threads or in case of failure (the run is then
+//   sequential, so the caller need not give up).
+{
+
+   ChIP_t *ChIP = Z->ChIP;
+   const size_t m = Z->m;
+   const size_t r = ChIP->r;
+   const size_t s = r - ChIP->nomock;
+   const size_t ssz = 1 + m*m + m*(r+2);
+
+   if (nthreads < 2) return NULL;
+   if (nthreads > POOL_MAXTHREADS) nthreads = POOL_MAXTHREADS;
+
+   shard_t shards[POOL_MAXTHREADS];
+   const int nparts = split_shards(ChIP, nthreads, shards);
+   if (nparts < 2) return NULL;
+
+   int cpu[POOL_MAXTHREADS];
+   int node[POOL_MAXTHREADS];
+   int ncpu = numa_cpus(cpu, node, POOL_MAXTHREADS);
+
+   pool_t *pool = calloc(1, sizeof(pool_t));
+   part_t *parts = calloc(nparts, sizeof(part_t));
+   if (pool == NULL || parts == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      free(pool);
+      free(parts);
+      return NULL;
+   }
+
+   pool->nparts = nparts;
+   pool->parts = parts;
+   pool->Z = Z;
+   pool->bw = bw;
+
+   for (int i = 0 ; i < nparts ; i++) {
+      part_t *part = parts + i;
+      part->pool = pool;
+      part->sh = shards[i];
+      // Spread the threads evenly over the listed CPUs.
+      part->cpu = ncpu > 0 ? cpu[i*ncpu / nparts] : -1;
+      part->node = ncpu > 0 ? node[i*ncpu / nparts] : 0;
+      part->view = malloc(sizeof(ChIP_t) + part->sh.nb * sizeof(uint));
+      part->stat = malloc(ssz * sizeof(double));
+      if (part->view == NULL || part->stat == NULL) {
+         fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+         goto fail;
+      }
+      part->view->r = r;
+      part->view->nb = part->sh.nb;
+      part->view->nomock = ChIP->nomock;
+      part->view->seg = NULL;
+      part->view->y = ChIP->y + part->sh.off*s;
+      part->view->nm = ChIP->nm + 32*part->sh.b0;
+      memcpy(part->view->sz, ChIP->sz + part->sh.b0,
+            part->sh.nb * sizeof(uint));
+      debug_print("part %d: %d blocks, %ld windows, cpu %d (node %d)\n",
+            i, part->sh.nb, part->sh.n, part->cpu, part->node);
+   }
+
+   // The threads wait at the gate until the barriers are
+   // set for the number of threads that could be started.
+   pthread_mutex_init(&pool->gate, NULL);
+   pthread_mutex_lock(&pool->gate);
+
+   int started = 0;
+   for ( ; started < nparts ; started++) {
+      part_t *part = parts + started;
+      pthread_attr_t attr;
+      pthread_attr_init(&attr);
+      // The thread starts on its CPU, so that its own stack
+      // is on the right node as well.
+      if (part->cpu >= 0) {
+         cpu_set_t set;
+         CPU_ZERO(&set);
+         CPU_SET(part->cpu, &set);
+         pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set);
+      }
+      int err = pthread_create(&part->tid, &attr, run_part, part);
+      pthread_attr_destroy(&attr);
+      if (err) break;
+   }
+
+   pthread_barrier_init(&pool->start, NULL, started+1);
+   pthread_barrier_init(&pool->done, NULL, started+1);
+   pthread_mutex_unlock(&pool->gate);
+
+   if (started < nparts) {
+      fprintf(stderr, "cannot start threads %s:%d\n", __FILE__, __LINE__);
+      pool->cmd = CMD_QUIT;
+      pthread_barrier_wait(&pool->start);
+      for (int i = 0 ; i < started ; i++) pthread_join(parts[i].tid, NULL);
+      pthread_barrier_destroy(&pool->start);
+      pthread_barrier_destroy(&pool->done);
+      pthread_mutex_destroy(&pool->gate);
+      goto fail;
+   }
+
+   // Place the probabilities.
+   run_command(pool, CMD_PLACE);
+
+   return pool;
+
+fail:
+   for (int i = 0 ; i < nparts ; i++) {
+      free(parts[i].view);
+      free(parts[i].stat);
+   }
+   free(parts);
+   free(pool);
+   return NULL;
+
+}
+
+
+void
+destroy_pool
+(
+   pool_t * pool
+)
+// SYNOPSIS:
+//   Stop the threads and free the pool. The observations
+//   of the fit are not affected.
+{
+
+   pool->cmd = CMD_QUIT;
+   pthread_barrier_wait(&pool->start);
+   for (int i = 0 ; i < pool->nparts ; i++) {
+      pthread_join(pool->parts[i].tid, NULL);
+      free(pool->parts[i].view);
+      free(pool->parts[i].stat);
+   }
+
+   pthread_barrier_destroy(&pool->start);
+   pthread_barrier_destroy(&pool->done);
+   pthread_mutex_destroy(&pool->gate);
+
+   free(pool->parts);
+   free(pool);
+
+   return;
+
+}
+
+
+int
+pool_estep
+(
+   pool_t * pool
+)
+// SYNOPSIS:
+//   Same E-step as 'bw_iter()' on every part in parallel. The
+//   log-likelihood is returned in 'pool->Z->l', the expected
+//   transitions and the sufficient statistics of the emission
+//   parameters in 'pool->bw->trans' and 'pool->bw->suff'.
+//
+// RETURN:
+//   0 upon success, -1 in case of failure.
+{
+
+   const size_t m = pool->Z->m;
+   const size_t r = pool->Z->ChIP->r;
+
+   unsigned int lin_space_no_warn = 4;
+   if (run_prob(pool, lin_space_no_warn) < 0) return -1;
+   run_command(pool, CMD_ESTEP);
+
+   // Sum the statistics in the order of the parts.
+   double l = 0.0;
+   memset(pool->bw->trans, 0, m*m * sizeof(double));
+   memset(pool->bw->suff, 0, m*(r+2) * sizeof(double));
+   for (int i = 0 ; i < pool->nparts ; i++) {
+      const double *stat = pool->parts[i].stat;
+      l += stat[0];
+      for (size_t j = 0 ; j < m*m ; j++) {
+         pool->bw->trans[j] += stat[1+j];
+      }
+      for (size_t j = 0 ; j < m*(r+2) ; j++) {
+         pool->bw->suff[j] += stat[1+m*m+j];
+      }
+   }
+
+   pool->Z->l = l;
+   return 0;
+
+}
+
+
+int
+pool_prob
+(
+   pool_t * pool,
+   int      otype
+)
+// SYNOPSIS:
+//   Compute the emission probabilities in 'pool->bw->pem' with
+//   'zinm_prob()' on every part in parallel.
+//
+// RETURN:
+//   0 upon success, -1 in case of failure.
+{
+
+   return run_prob(pool, otype);
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+int
+parse_cpulist
+(
+   const char      * list,
+         cpu_set_t * set
+)
+// SYNOPSIS:
+//   Parse a list in the format of sysfs (e.g. "0-3,8,10-11").
+//
+// RETURN:
+//   1 upon success, 0 if the list is not valid.
+{
+
+   CPU_ZERO(set);
+   const char *s = list;
+   while (*s != '\0' && *s != '\n') {
+      char *end;
+      long lo = strtol(s, &end, 10);
+      if (end == s) return 0;
+      long hi = lo;
+      if (*end == '-') {
+         s = end+1;
+         hi = strtol(s, &end, 10);
+         if (end == s) return 0;
+      }
+      if (lo < 0 || hi < lo || hi >= CPU_SETSIZE) return 0;
+      for (long i = lo ; i <= hi ; i++) CPU_SET(i, set);
+      s = end;
+      if (*s == ',') s++;
+      else if (*s != '\0' && *s != '\n') return 0;
+   }
+
+   return 1;
+
+}
+
+
+int
+read_cpulist
+(
+   const char      * fname,
+         cpu_set_t * set
+)
+// SYNOPSIS:
+//   Read a list of CPUs or nodes from sysfs.
+//
+// RETURN:
+//   1 upon success, 0 if the file cannot be read or parsed.
+{
+
+   FILE *f = fopen(fname, "r");
+   if (f == NULL) return 0;
+
+   char buf[1024];
+   int ok = fgets(buf, 1024, f) != NULL && parse_cpulist(buf, set);
+
+   fclose(f);
+   return ok;
+
+}
+
+
+void
+run_command
+(
+   pool_t * pool,
+   int      cmd
+)
+// SYNOPSIS:
+//   Run the command on all the parts and wait until they are done.
+{
+
+   pool->cmd = cmd;
+   pthread_barrier_wait(&pool->start);
+   pthread_barrier_wait(&pool->done);
+
+}
+
+
+int
+run_prob
+(
+   pool_t * pool,
+   int      otype
+)
+// SYNOPSIS:
+//   Compute the first occurrences of the emissions on all the
+//   parts, then copy them to the other rows (see 'zinm_prob_mt()').
+//   The copies may come from another part, so they must wait for
+//   all the first occurrences.
+//
+// RETURN:
+//   0 upon success, -1 in case of failure.
+{
+
+   pool->otype = otype;
+   if (zinm_logp(pool->Z, otype, pool->logp) < 0) return -1;
+   run_command(pool, CMD_ROWS);
+   run_command(pool, CMD_COPY);
+
+   return 0;
+
+}
+
+
+void
+part_rows
+(
+   pool_t * pool,
+   part_t * part,
+   int      pass
+)
+// SYNOPSIS:
+//   Run a pass of 'zinm_rows()' on the rows of the part, with
+//   the index of the whole time series.
+{
+
+   const zinm_part_t rows = {
+      .Z = pool->Z, .index = pool->bw->index, .logp = pool->logp,
+      .otype = pool->otype, .k0 = part->sh.off,
+      .k1 = part->sh.off + part->sh.n, .pass = pass,
+      .pem = pool->bw->pem,
+   };
+
+   stage_begin(STAGE_EMISSION);
+   zinm_rows(&rows);
+   stage_end(STAGE_EMISSION);
+
+}
+
+
+void
+place_part
+(
+   pool_t * pool,
+   part_t * part
+)
+// SYNOPSIS:
+//   First touch the probabilities of the part from its thread.
+{
+
+   const size_t m = pool->Z->m;
+   const size_t off = part->sh.off;
+   const size_t n = part->sh.n;
+
+   memset(pool->bw->pem + off*m, 0, n*m * sizeof(double));
+   memset(pool->bw->phi + off*m, 0, n*m * sizeof(double));
+
+}
+
+
+void *
+run_part
+(
+   void * arg
+)
+// SYNOPSIS:
+//   Main loop of the threads. The commands are run on the part
+//   of the thread until the pool is destroyed.
+{
+
+   part_t *part = (part_t *) arg;
+   pool_t *pool = part->pool;
+
+   // Wait until all the threads are started.
+   pthread_mutex_lock(&pool->gate);
+   pthread_mutex_unlock(&pool->gate);
+
+   while (1) {
+      pthread_barrier_wait(&pool->start);
+      if (pool->cmd == CMD_QUIT) break;
+
+      const size_t m = pool->Z->m;
+      const size_t off = part->sh.off;
+      double *pem = pool->bw->pem + off*m;
+      double *phi = pool->bw->phi + off*m;
+      // The global index of the windows of the part.
+      const int *index = pool->bw->index + off;
+
+      const int id = part - pool->parts;
+
+      if (pool->cmd == CMD_PLACE) {
+         trace_begin("place", NULL, id);
+         place_part(pool, part);
+         trace_end("place", NULL, id);
+      }
+      else if (pool->cmd == CMD_ROWS || pool->cmd == CMD_COPY) {
+         trace_begin("emission", NULL, id);
+         part_rows(pool, part, pool->cmd == CMD_ROWS ? 1 : 2);
+         trace_end("emission", NULL, id);
+      }
+      else if (pool->cmd == CMD_ESTEP) {
+         // Same as the E-step of 'bw_iter()', after the emissions.
+         trace_begin("E-step", NULL, id);
+         double prob[m];
+         for (size_t i = 0 ; i < m ; i++) prob[i] = 1.0 / m;
+         stage_begin(STAGE_FWDB);
+         part->stat[0] = block_fwdb(m, part->view->nb, part->view->sz,
+               pool->Z->Q, prob, pem, phi, part->stat+1);
+         stage_end(STAGE_FWDB);
+         stage_begin(STAGE_MSTEP);
+         suff_stats(m, part->view, index, pool->bw->i0, phi,
+               part->stat+1+m*m);
+         stage_end(STAGE_MSTEP);
+         trace_end("E-step", NULL, id);
+      }
+
+      pthread_barrier_wait(&pool->done);
+   }
+
+   return NULL;
+
+}
@@ -0,0 +1,77 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _NUMA_H
+#define _NUMA_H
+
+#include <pthread.h>
+#include "shard.h"
+#include "zerone.h"
+
+// Threaded E-step with NUMA-aware placement. The blocks are split
+// in contiguous parts (see 'split_shards()'), each owned by a
+// thread that stays on the same CPU for the whole run. The CPUs
+// are taken node by node, so neighbouring parts share a node.
+// Every thread first-touches its slices of the emission and of
+// the posterior probabilities, which places the pages on the
+// node of the thread (Linux allocates a page on the node of the
+// CPU that touches it first). The observations and the index of
+// the fit are read in place, through views of the parts. The
+// emissions are computed in two passes like 'zinm_prob_mt()':
+// the first occurrences of the observations, then the copies,
+// which may come from another part. The statistics of the parts
+// are summed in a fixed order, so the result does not depend on
+// the scheduling of the threads.
+
+#define POOL_MAXTHREADS 256
+
+struct part_t;
+struct pool_t;
+typedef struct part_t part_t;
+typedef struct pool_t pool_t;
+
+struct part_t {
+   pool_t    * pool;    // the pool of the thread //
+   shard_t     sh;      // blocks and windows of the part //
+   int         cpu;     // CPU of the thread (-1 if not pinned) //
+   int         node;    // NUMA node of the CPU //
+   pthread_t   tid;     // thread //
+   ChIP_t    * view;    // observations of the part //
+   double    * stat;    // log-likelihood, transitions, 'suff' //
+};
+
+struct pool_t {
+   int                 nparts;  // number of threads //
+   part_t            * parts;   // parts of the time series //
+   pthread_mutex_t     gate;    // held while threads start //
+   pthread_barrier_t   start;   // start of a command //
+   pthread_barrier_t   done;    // end of a command //
+   int                 cmd;     // current command //
+   int                 otype;   // output type of 'zinm_prob()' //
+   double              logp[3*64]; // see 'zinm_logp()' //
+   zerone_t          * Z;       // the fit //
+   bw_t              * bw;      // Baum-Welch workspace //
+};
+
+void     destroy_pool (pool_t *);
+pool_t * new_pool (zerone_t *, bw_t *, int);
+int      numa_cpus (int *, int *, int);
+int      pool_estep (pool_t *);
+int      pool_prob (pool_t *, int);
+
+#endif
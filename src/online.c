@@ -0,0 +1,689 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <unistd.h>
+#include "checkpoint.h"
+#include "debug.h"
+#include "online.h"
+#include "xxhash.h"
+
+#define ONLINE_MAGIC "ZRNONLN2"
+
+
+int
+block_estep
+(
+   const zerone_t * Z,
+         int        b,
+         size_t     off,
+   // output //
+         int      * index,
+         double   * pem,
+         double   * phi,
+         double   * stat
+)
+// SYNOPSIS:
+//   Run the forward-backward algorithm on block 'b' (starting at
+//   window 'off') with the current parameters and compute the
+//   sufficient statistics of the block. 'index', 'pem' and 'phi'
+//   must hold as many windows as the block.
+//
+// RETURN:
+//   0 upon success, -1 in case of failure.
+//
+// SIDE EFFECTS:
+//   'stat' holds the log-likelihood of the block, the expected
+//   transitions (m,m) and the statistics of the emission
+//   parameters (see 'suff_stats()'). 'phi' holds the posterior
+//   probabilities.
+{
+
+   const size_t m = Z->m;
+   const size_t r = Z->ChIP->r;
+   const size_t n = Z->ChIP->sz[b];
+
+   memset(stat, 0, (1 + m*m + m*(r+2)) * sizeof(double));
+   if (n == 0) return 0;
+
+   // The block is seen as a time series of its own.
+   ChIP_t *view = malloc(sizeof(ChIP_t) + sizeof(uint));
+   if (view == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return -1;
+   }
+
+   view->r = r;
+   view->nb = 1;
+   view->nomock = Z->ChIP->nomock;
+   view->seg = NULL;
+   view->y = Z->ChIP->y + off*(r - view->nomock);
+   view->nm = Z->ChIP->nm + 32*b;
+   view->sz[0] = n;
+
+   zerone_t block = *Z;
+   block.ChIP = view;
+
+   double prob[m];
+   for (size_t i = 0 ; i < m ; i++) prob[i] = 1.0 / m;
+
+   unsigned int lin_space_no_warn = 4;
+   int i0 = index_ChIP(view, index);
+   zinm_prob(&block, index, lin_space_no_warn, pem);
+   stat[0] = fwdb(m, n, Z->Q, prob, pem, phi, stat+1);
+   suff_stats(m, view, index, i0, phi, stat+1+m*m);
+
+   free(view);
+   return 0;
+
+}
+
+
+online_t *
+new_online
+(
+   zerone_t *Z
+)
+// SYNOPSIS:
+//   Prepare stepwise EM updates of the fit 'Z'. The parameters
+//   of 'Z' are used as a starting point (typically the output of
+//   'do_zerone()'). All the blocks are marked for computation, so
+//   the first call to 'online_update()' is a full Baum-Welch cycle.
+{
+
+   const size_t m  = Z->m;
+   const size_t r  = Z->ChIP->r;
+   const int    nb = Z->ChIP->nb;
+
+   online_t *O = calloc(1, sizeof(online_t));
+   if (O == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return NULL;
+   }
+
+   O->Z = Z;
+   O->R = Z->p[1] / Z->p[0];
+   O->ssz = 1 + m*m + m*(r+2);
+   O->off = malloc(nb * sizeof(size_t));
+   O->stat = calloc(nb * O->ssz, sizeof(double));
+   O->sum = calloc(O->ssz, sizeof(double));
+   O->run = calloc(O->ssz, sizeof(double));
+   O->dirty = malloc(nb * sizeof(int));
+   if (O->off == NULL || O->stat == NULL || O->sum == NULL ||
+         O->run == NULL || O->dirty == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      destroy_online(O);
+      return NULL;
+   }
+
+   size_t offset = 0;
+   for (int b = 0 ; b < nb ; b++) {
+      O->off[b] = offset;
+      O->dirty[b] = 1;
+      offset += Z->ChIP->sz[b];
+   }
+
+   return O;
+
+}
+
+
+void
+destroy_online
+(
+   online_t *O
+)
+// SYNOPSIS:
+//   Free the memory allocated by 'new_online()'. The fit 'Z'
+//   is not destroyed.
+{
+
+   free(O->off);
+   free(O->stat);
+   free(O->sum);
+   free(O->run);
+   free(O->dirty);
+   free(O);
+
+   return;
+
+}
+
+
+int
+online_add
+(
+         online_t * O,
+   const ChIP_t   * delta
+)
+// SYNOPSIS:
+//   Add the reads of 'delta' to the observations and mark the
+//   blocks that received reads for computation. The blocks of
+//   'delta' are matched by name (the blocks are expected in the
+//   same order, but they need not be all present). The blocks
+//   that are longer in 'delta' (reads further along the block)
+//   are extended with empty windows. Windows that are invalid in
+//   either series are left untouched.
+//
+// RETURN:
+//   The number of blocks marked for computation, or -1 in case
+//   of failure (in which case the observations are not modified).
+{
+
+   ChIP_t *ChIP = O->Z->ChIP;
+   // Number of columns of 'y' (see 'ChIP_t').
+   const size_t r = ChIP->r - ChIP->nomock;
+
+   if (delta->r != ChIP->r) {
+      fprintf(stderr, "new reads do not match the data "
+            "(%ld profiles instead of %ld)\n", delta->r, ChIP->r);
+      return -1;
+   }
+   if (delta->nomock != ChIP->nomock) {
+      fprintf(stderr, "new reads do not match the data "
+            "(mock control %s)\n", ChIP->nomock ? "absent" : "present");
+      return -1;
+   }
+
+   // Match the blocks before modifying anything.
+   int *map = malloc(delta->nb * sizeof(int));
+   if (map == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return -1;
+   }
+
+   size_t grow = 0;
+   for (int b = 0 ; b < delta->nb ; b++) {
+      const char *name = delta->nm + 32*b;
+      map[b] = find_block(ChIP, name, b);
+      if (map[b] < 0) {
+         fprintf(stderr, "unknown block %s in new reads\n", name);
+         free(map);
+         return -1;
+      }
+      if (delta->sz[b] > ChIP->sz[map[b]]) {
+         grow += delta->sz[b] - ChIP->sz[map[b]];
+      }
+   }
+
+   int nmarked = 0;
+
+   if (grow > 0) {
+      // Move the blocks to their new offsets (from the end) and
+      // clear the new windows.
+      const size_t n = nobs(ChIP);
+      int *y = realloc(ChIP->y, (n+grow)*r * sizeof(int));
+      if (y == NULL) {
+         fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+         free(map);
+         return -1;
+      }
+      ChIP->y = y;
+      size_t newsz[ChIP->nb];
+      for (int c = 0 ; c < ChIP->nb ; c++) newsz[c] = ChIP->sz[c];
+      for (int b = 0 ; b < delta->nb ; b++) {
+         if (delta->sz[b] > newsz[map[b]]) newsz[map[b]] = delta->sz[b];
+      }
+      size_t end = n+grow;
+      for (int c = ChIP->nb-1 ; c >= 0 ; c--) {
+         end -= newsz[c];
+         memmove(y + end*r, y + O->off[c]*r, ChIP->sz[c]*r * sizeof(int));
+         memset(y + (end + ChIP->sz[c])*r, 0,
+               (newsz[c] - ChIP->sz[c])*r * sizeof(int));
+         if (newsz[c] > ChIP->sz[c]) {
+            nmarked += !O->dirty[c];
+            O->dirty[c] = 1;
+         }
+         ChIP->sz[c] = newsz[c];
+         O->off[c] = end;
+      }
+   }
+
+   size_t doff = 0;
+   for (int b = 0 ; b < delta->nb ; b++) {
+      int c = map[b];
+      int *y = ChIP->y + O->off[c]*r;
+      const int *dy = delta->y + doff*r;
+      for (size_t k = 0 ; k < delta->sz[b] ; k++) {
+         if (is_invalid(y, k, r) || is_invalid(dy, k, r)) continue;
+         for (size_t j = 0 ; j < r ; j++) y[j+k*r] += dy[j+k*r];
+      }
+      nmarked += !O->dirty[c];
+      O->dirty[c] = 1;
+      doff += delta->sz[b];
+   }
+
+   free(map);
+   return nmarked;
+
+}
+
+
+int
+online_update
+(
+   online_t *O
+)
+// SYNOPSIS:
+//   Run one step of the stepwise EM algorithm: recompute the
+//   statistics of the blocks marked for computation, blend the
+//   refreshed totals with the running statistics and update the
+//   parameters of the fit. The cost is proportional to the size
+//   of the recomputed blocks.
+//
+// RETURN:
+//   The number of recomputed blocks, or -1 in case of failure.
+//
+// SIDE EFFECTS:
+//   Update 'Q', 'p' and 'l' of the fit in place. 'l' is the
+//   sum of the log-likelihoods of the blocks, each computed with
+//   the parameters in use when it was last recomputed.
+{
+
+   zerone_t *Z = O->Z;
+   const ChIP_t *ChIP = Z->ChIP;
+   const size_t m = Z->m;
+   const size_t r = ChIP->r;
+   const size_t ssz = O->ssz;
+
+   int      * index = NULL;
+   double   * pem   = NULL;
+   double   * phi   = NULL;
+   double   * newp  = NULL;
+   int        nupd  = -1;
+
+   double stat[ssz];
+
+   // Allocate the workspace for the largest dirty block.
+   size_t maxsz = 0;
+   for (int b = 0 ; b < ChIP->nb ; b++) {
+      if (O->dirty[b] && ChIP->sz[b] > maxsz) maxsz = ChIP->sz[b];
+   }
+
+   index = malloc(maxsz * sizeof(int));
+   pem = malloc(maxsz*m * sizeof(double));
+   phi = malloc(maxsz*m * sizeof(double));
+   newp = malloc(m*(r+1) * sizeof(double));
+   if ((maxsz > 0 && (index == NULL || pem == NULL || phi == NULL)) ||
+         newp == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   nupd = 0;
+   for (int b = 0 ; b < ChIP->nb ; b++) {
+      if (!O->dirty[b]) continue;
+      if (block_estep(Z, b, O->off[b], index, pem, phi, stat) < 0) {
+         nupd = -1;
+         goto clean_and_return;
+      }
+      // Replace the contribution of the block to the sum.
+      double *old = O->stat + b*ssz;
+      for (size_t j = 0 ; j < ssz ; j++) {
+         O->sum[j] += stat[j] - old[j];
+      }
+      memcpy(old, stat, ssz * sizeof(double));
+      O->dirty[b] = 0;
+      nupd++;
+   }
+
+   if (nupd == 0) goto clean_and_return;
+
+   // Blend with decaying step size (the first step is 1).
+   double rho = pow(1 + O->step, -ONLINE_ALPHA);
+   for (size_t j = 0 ; j < ssz ; j++) {
+      O->run[j] = (1-rho) * O->run[j] + rho * O->sum[j];
+   }
+   O->step++;
+
+   debug_print("online step %d: %d blocks (rho = %.3f)\n",
+         O->step, nupd, rho);
+
+   // M-step on the running statistics.
+   if (update_p(Z, O->R, O->run+1+m*m, newp) < 0) {
+      nupd = -1;
+      goto clean_and_return;
+   }
+   update_trans(m, Z->Q, O->run+1);
+   memcpy(Z->p, newp, m*(r+1) * sizeof(double));
+   Z->l = O->sum[0];
+
+clean_and_return:
+   free(index);
+   free(pem);
+   free(phi);
+   free(newp);
+   return nupd;
+
+}
+
+
+zerone_t *
+online_decode
+(
+   const online_t *O
+)
+// SYNOPSIS:
+//   Compute the posterior probabilities, the emission probabilities
+//   and the Viterbi path of the current fit. This is a full pass
+//   over the observations, to call when the targets are needed.
+//
+// RETURN:
+//   A new 'zerone_t' with sorted states that shares the observations
+//   of the fit (set its 'ChIP' to 'NULL' before destroying it), or
+//   'NULL' in case of failure.
+{
+
+   const zerone_t *Z = O->Z;
+   const ChIP_t *ChIP = Z->ChIP;
+   const size_t m = Z->m;
+   const size_t n = nobs(ChIP);
+
+   int *index = NULL;
+   double stat[O->ssz];
+   zerone_t *D = new_zerone(m, Z->ChIP);
+   if (D == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return NULL;
+   }
+
+   set_zerone_par(D, Z->Q, Z->a, Z->pi, Z->p);
+   D->l = Z->l;
+   D->iter = O->step;
+
+   index = malloc(n * sizeof(int));
+   D->phi = malloc(n*m * sizeof(double));
+   D->pem = malloc(n*m * sizeof(double));
+   if (index == NULL || D->phi == NULL || D->pem == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto fail;
+   }
+
+   for (int b = 0 ; b < ChIP->nb ; b++) {
+      size_t off = O->off[b];
+      if (block_estep(D, b, off, index, D->pem + off*m,
+               D->phi + off*m, stat) < 0) goto fail;
+   }
+
+   // Emission probabilities in log space for the Viterbi path.
+   unsigned int log_space_no_warn = 5;
+   index_ChIP(ChIP, index);
+   zinm_prob(D, index, log_space_no_warn, D->pem);
+   free(index);
+   index = NULL;
+
+   zerone_viterbi(D);
+   if (D->path == NULL) goto fail;
+
+   return D;
+
+fail:
+   free(index);
+   D->ChIP = NULL;
+   destroy_zerone_all(D);
+   return NULL;
+
+}
+
+
+int
+online_save
+(
+   const online_t * O,
+   const char     * fname
+)
+// SYNOPSIS:
+//   Save the statistics of the blocks and the running statistics
+//   of 'O' to 'fname', along with a digest of the observations
+//   and the generation of the checkpoint 'O->Z->gen', so that the
+//   next updates start from there (see 'online_load()').
+//   The file is replaced atomically.
+//
+// RETURN:
+//   0 upon success, -1 in case of failure.
+{
+
+   char *tmpname = NULL;
+   void *hstate = NULL;
+   int status = -1;
+
+   FILE *f = open_tmp_file(fname, &tmpname);
+   if (f == NULL) goto clean_and_return;
+
+   hstate = XXH32_init(0);
+   if (hstate == NULL) goto clean_and_return;
+
+   const ChIP_t *ChIP = O->Z->ChIP;
+   const uint32_t gen = O->Z->gen;
+   const uint32_t nb = ChIP->nb;
+   const uint64_t ssz = O->ssz;
+   const uint32_t obs = obs_digest(ChIP, ChIP->r);
+   const int32_t step = O->step;
+
+   if (fwrite(ONLINE_MAGIC, 8, 1, f) != 1) goto clean_and_return;
+   if (!ckpt_write(f, &gen, sizeof(uint32_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, &nb, sizeof(uint32_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, &ssz, sizeof(uint64_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, &obs, sizeof(uint32_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, &step, sizeof(int32_t), hstate)) goto clean_and_return;
+   if (!ckpt_write(f, O->stat, nb*ssz * sizeof(double), hstate))
+      goto clean_and_return;
+   if (!ckpt_write(f, O->sum, ssz * sizeof(double), hstate))
+      goto clean_and_return;
+   if (!ckpt_write(f, O->run, ssz * sizeof(double), hstate))
+      goto clean_and_return;
+
+   uint32_t digest = XXH32_digest(hstate);
+   hstate = NULL;
+   if (fwrite(&digest, sizeof(uint32_t), 1, f) != 1) goto clean_and_return;
+
+   status = commit_file(f, tmpname, fname) ? 0 : -1;
+   f = NULL;
+
+clean_and_return:
+   if (hstate != NULL) free(hstate);
+   if (f != NULL) {
+      fclose(f);
+      unlink(tmpname);
+   }
+   if (status < 0) fprintf(stderr, "cannot write file %s\n", fname);
+   free(tmpname);
+   return status;
+
+}
+
+
+int
+online_load
+(
+         online_t * O,
+   const char     * fname
+)
+// SYNOPSIS:
+//   Restore the statistics saved by 'online_save()'. The blocks
+//   are then not recomputed until they receive new reads.
+//
+// RETURN:
+//   1 upon success, 0 if the file does not exist or was saved for
+//   other observations or for another generation of the checkpoint
+//   (in which case 'O' is not modified), -1 if the file is corrupt.
+{
+
+   FILE *f = fopen(fname, "r");
+   if (f == NULL) return 0;
+
+   const ChIP_t *ChIP = O->Z->ChIP;
+   const size_t nb = ChIP->nb;
+   const size_t ssz = O->ssz;
+
+   void *hstate = NULL;
+   double *stat = NULL;
+   double *sums = NULL;
+   int status = -1;
+
+   hstate = XXH32_init(0);
+   stat = malloc(nb*ssz * sizeof(double));
+   sums = malloc(2*ssz * sizeof(double));
+   if (hstate == NULL || stat == NULL || sums == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   char magic[8];
+   uint32_t gen;
+   uint32_t nb_;
+   uint64_t ssz_;
+   uint32_t obs;
+   int32_t step;
+
+   if (fread(magic, 8, 1, f) != 1 || memcmp(magic, ONLINE_MAGIC, 8) != 0)
+      goto format_error;
+   if (!ckpt_read(f, &gen, sizeof(uint32_t), hstate)) goto format_error;
+   if (!ckpt_read(f, &nb_, sizeof(uint32_t), hstate)) goto format_error;
+   if (!ckpt_read(f, &ssz_, sizeof(uint64_t), hstate)) goto format_error;
+   if (!ckpt_read(f, &obs, sizeof(uint32_t), hstate)) goto format_error;
+
+   if (gen != (uint32_t) O->Z->gen || nb_ != nb || ssz_ != ssz ||
+         obs != obs_digest(ChIP, ChIP->r)) {
+      status = 0;
+      goto clean_and_return;
+   }
+
+   if (!ckpt_read(f, &step, sizeof(int32_t), hstate)) goto format_error;
+   if (!ckpt_read(f, stat, nb*ssz * sizeof(double), hstate))
+      goto format_error;
+   if (!ckpt_read(f, sums, 2*ssz * sizeof(double), hstate))
+      goto format_error;
+
+   uint32_t digest;
+   uint32_t expected = XXH32_digest(hstate);
+   hstate = NULL;
+   if (fread(&digest, sizeof(uint32_t), 1, f) != 1 || digest != expected)
+      goto format_error;
+
+   memcpy(O->stat, stat, nb*ssz * sizeof(double));
+   memcpy(O->sum, sums, ssz * sizeof(double));
+   memcpy(O->run, sums + ssz, ssz * sizeof(double));
+   memset(O->dirty, 0, nb * sizeof(int));
+   O->step = step;
+   status = 1;
+
+clean_and_return:
+   if (hstate != NULL) free(hstate);
+   free(stat);
+   free(sums);
+   fclose(f);
+   return status;
+
+format_error:
+   fprintf(stderr, "corrupt or truncated file %s\n", fname);
+   goto clean_and_return;
+
+}
+
+
+zerone_t *
+online_zerone
+(
+         ChIP_t      * ChIP,
+   const ChIP_t      * delta,
+   const char        * ckpt,
+         bins_info_t   info
+)
+// SYNOPSIS:
+//   Add the reads of 'delta' to the observations 'ChIP' of the
+//   checkpoint 'ckpt' and update the fit of the checkpoint by one
+//   step of the stepwise EM algorithm. The statistics of the blocks
+//   are kept in "<ckpt>.online" between calls, so only the blocks
+//   that received reads are recomputed (without the file, all the
+//   blocks are). The observations, the checkpoint and the file of
+//   statistics are then saved for the next call, as one update:
+//   the bins and the statistics are staged with the next generation
+//   of the checkpoint, which is written last and commits them
+//   (see 'recover_checkpoint()').
+//
+// RETURN:
+//   The decoded fit (see 'online_decode()') that owns 'ChIP', or
+//   'NULL' in case of failure.
+{
+
+   const unsigned int m = 3;
+
+   zerone_t *Z = NULL;
+   zerone_t *D = NULL;
+   online_t *O = NULL;
+   char *fname = NULL;
+   char *next = NULL;
+
+   double trace[BW_MAXITER] = {0};
+
+   Z = new_zerone(m, ChIP);
+   if (Z == NULL) {
+      fprintf(stderr, "error in function '%s()' %s:%d\n",
+            __func__, __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+   // The checkpoint is checked against the observations
+   // before the new reads are added.
+   if (!read_checkpoint(ckpt, Z, trace)) goto clean_and_return;
+
+   O = new_online(Z);
+   if (O == NULL) goto clean_and_return;
+
+   fname = malloc(strlen(ckpt) + 13);
+   next = malloc(strlen(ckpt) + 6);
+   if (fname == NULL || next == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+   sprintf(fname, "%s.online", ckpt);
+   sprintf(next, "%s.next", ckpt);
+
+   int loaded = online_load(O, fname);
+   if (loaded < 0) goto clean_and_return;
+   if (loaded == 0) fprintf(stderr, "no block statistics, "
+         "computing all the blocks\n");
+
+   if (online_add(O, delta) < 0) goto clean_and_return;
+   int nblocks = online_update(O);
+   if (nblocks < 0) goto clean_and_return;
+   fprintf(stderr, "online EM step on %d blocks\n", nblocks);
+
+   // The digests of the statistics and of the checkpoint
+   // are those of the updated observations. A crash before
+   // the checkpoint is written leaves the previous generation.
+   Z->gen++;
+   info.gen = Z->gen;
+   sprintf(fname, "%s.next.online", ckpt);
+   if (online_save(O, fname) < 0) goto clean_and_return;
+   if (!write_bins(next, ChIP, info)) goto clean_and_return;
+   if (!write_checkpoint(ckpt, Z, trace)) goto clean_and_return;
+   if (!recover_checkpoint(ckpt)) goto clean_and_return;
+
+   D = online_decode(O);
+
+clean_and_return:
+   if (O != NULL) destroy_online(O);
+   if (Z != NULL) {
+      Z->ChIP = NULL;
+      destroy_zerone_all(Z);
+   }
+   free(fname);
+   free(next);
+   return D;
+
+}
@@ -0,0 +1,61 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _ONLINE_H
+#define _ONLINE_H
+
+#include "checkpoint.h"
+#include "zerone.h"
+
+#define ONLINE_ALPHA 0.6   // decay of the step size //
+
+// Stepwise (online) EM. The expected sufficient statistics of
+// the Baum-Welch algorithm are cached for every block. When new
+// reads arrive, only the blocks that received them are run
+// through the forward-backward algorithm, and the global
+// statistics are blended with the refreshed totals using a step
+// size that decays as (1+step)^-ONLINE_ALPHA. The statistics
+// can be saved next to a checkpoint, so that every wave of reads
+// is added by a new process ('zerone --resume --add-reads').
+
+struct online_t;
+typedef struct online_t online_t;
+
+struct online_t {
+   zerone_t * Z;      // the fit (parameters updated in place) //
+   double     R;      // mock emission ratio //
+   size_t     ssz;    // size of the statistics of a block //
+   size_t   * off;    // offset of every block //
+   double   * stat;   // sufficient statistics of every block //
+   double   * sum;    // sum of the statistics of all blocks //
+   double   * run;    // running (blended) statistics //
+   int      * dirty;  // blocks to recompute (1) //
+   int        step;   // number of updates //
+};
+
+void       destroy_online(online_t *);
+online_t * new_online(zerone_t *);
+int        online_add(online_t *, const ChIP_t *);
+zerone_t * online_decode(const online_t *);
+int        online_load(online_t *, const char *);
+int        online_save(const online_t *, const char *);
+int        online_update(online_t *);
+zerone_t * online_zerone(ChIP_t *, const ChIP_t *, const char *,
+               bins_info_t);
+
+#endif
@@ -0,0 +1,223 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "output.h"
+#include "predict.h"
+#include "trace.h"
+
+// Room for a line of table output (64 profiles at most).
+#define LINESZ 2048
+
+
+//  ---- Declaration of local functions  ---- //
+void list_step (sink_t *, const char *, int, int, double, int);
+int  table_line (char *, const zerone_t *, const char *, int, size_t,
+                 output_args_t);
+
+
+//  -- Definitions of exported functions  --- //
+
+void
+print_output
+(
+         FILE          * f,
+   const zerone_t      * Z,
+         output_args_t   args
+)
+// SYNOPSIS:
+//   Print the QC report followed by the targets (list output)
+//   or by the windows (table output) to stream 'f'.
+{
+
+   sink_t sink = { .f = f, .list = args.list, .minconf = args.minconf };
+   print_sinks(&sink, 1, Z, args);
+
+}
+
+
+void
+print_sinks
+(
+         sink_t        * sinks,
+         int             nsinks,
+   const zerone_t      * Z,
+         output_args_t   args
+)
+// SYNOPSIS:
+//   Print the QC report to every sink, followed by the targets or
+//   the windows, according to the format and the threshold of the
+//   sink. Only 'window' and 'nomock' are used from 'args'.
+{
+
+   // Quality control.
+   double feat[5];
+   double QC = zerone_qc((zerone_t *) Z, feat);
+
+   for (int s = 0 ; s < nsinks ; s++) {
+      FILE *f = sinks[s].f;
+      fprintf(f, "# QC score: %.3f\n", QC);
+      fprintf(f, "# features: %.3f, %.3f, %.3f, %.3f, %.3f\n",
+                              feat[0], feat[1], feat[2], feat[3], feat[4]);
+      fprintf(f, "# advice: %s discretization.\n",
+            QC >= 0 ? "accept" : "reject");
+
+      // Early rejection: the fit is provisional, so do not
+      // report any target. Just say how much work was saved.
+      if (Z->early) {
+         fprintf(f, "# early rejection after %d EM iterations "
+               "(skipped up to %d EM iterations and Viterbi).\n",
+               Z->iter, BW_MAXITER - 1 - Z->iter);
+      }
+      sinks[s].target = 0;
+      sinks[s].best = 0.0;
+   }
+
+   if (Z->early) return;
+
+   const ChIP_t *ChIP = Z->ChIP;
+   const int window = args.window;
+
+   char line[LINESZ];
+
+   // Use 'offset' to navigate in the ChIP blocks.
+   size_t offset = 0;
+   // List output has always used a window counter that
+   // skips the last bin of the blocks. Keep it that way.
+   size_t lwid = 0;
+
+   for (int i = 0 ; i < ChIP->nb ; i++) {
+      char *name = ChIP->nm + 32*i;
+      trace_begin("output", NULL, i);
+
+      // Do not print the last bin because it may extend
+      // beyond the limit of the chromosome.
+      for (int j = 0 ; j < ChIP->sz[i]-1 ; j++) {
+         const size_t wid = offset + j;
+         // The line of table output is formatted once.
+         int len = -1;
+         for (int s = 0 ; s < nsinks ; s++) {
+            if (sinks[s].list) {
+               list_step(sinks + s, name, j, Z->path[lwid],
+                     Z->phi[2+lwid*3], window);
+               continue;
+            }
+            // Skip if 'confidence' too low.
+            if (Z->phi[2+wid*3] < sinks[s].minconf) continue;
+            if (len < 0) len = table_line(line, Z, name, j, wid, args);
+            fwrite(line, 1, len, sinks[s].f);
+         }
+         lwid++;
+      }
+
+      // In case the end of the block is a target.
+      for (int s = 0 ; s < nsinks ; s++) {
+         if (sinks[s].list && sinks[s].target) {
+            fprintf(sinks[s].f, "%d\t%.5f\n",
+                  window * ChIP->sz[i], sinks[s].best);
+            sinks[s].best = 0.0;
+            sinks[s].target = 0;
+         }
+      }
+
+      // End of the block. Update 'offset' before
+      // local window number is reset to 0.
+      offset += ChIP->sz[i];
+      trace_end("output", NULL, i);
+   }
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+void
+list_step
+(
+         sink_t * sink,
+   const char   * name,
+         int      j,
+         int      state,
+         double   conf,
+         int      window
+)
+// SYNOPSIS:
+//   Update list output with window 'j' of block 'name'.
+{
+
+   // Toggle on target state.
+   if (!sink->target && state == 2 && conf > sink->minconf) {
+      fprintf(sink->f, "%s\t%d\t", name, window*j + 1);
+      sink->best = conf;
+      sink->target = 1;
+   }
+   // Toggle off target state.
+   else if (sink->target) {
+      // Update best score.
+      if (conf > sink->best) sink->best = conf;
+      if (state != 2 || conf < sink->minconf) {
+         fprintf(sink->f, "%d\t%.5f\n", window*(j+1), sink->best);
+         sink->best = 0.0;
+         sink->target = 0;
+      }
+   }
+
+}
+
+
+int
+table_line
+(
+         char          * line,
+   const zerone_t      * Z,
+   const char          * name,
+         int             j,
+         size_t          wid,
+         output_args_t   args
+)
+// SYNOPSIS:
+//   Format window 'j' of block 'name' (window 'wid' of the
+//   series) as a line of table output.
+//
+// RETURN:
+//   The length of the line.
+{
+
+   const ChIP_t *ChIP = Z->ChIP;
+   const int window = args.window;
+   // In case no mock was provided, skip the column.
+   const int skipmock = args.nomock || ChIP->nomock ? 1 : 0;
+   // Number of columns of 'y' (see 'ChIP_t').
+   const int o = ChIP->nomock;
+   const size_t s = ChIP->r - o;
+
+   int len = sprintf(line, "%s\t%d\t%d\t%d", name, window*j + 1,
+           // Block name, window start, end, state.
+           window*(j+1), Z->path[wid] == 2 ? 1 : 0);
+   for (int k = skipmock ; k < ChIP->r ; k++) {
+      len += sprintf(line + len, "\t%d",
+           // Read numbers of each file.
+           ChIP->y[wid*s+k-o]);
+   }
+   len += sprintf(line + len, "\t%.5f\n",
+           // Confidence score.
+           Z->phi[2+wid*3]);
+
+   return len;
+
+}
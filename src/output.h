@@ -0,0 +1,56 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _OUTPUT_H
+#define _OUTPUT_H
+
+#include <stdio.h>
+#include "zerone.h"
+
+// Results can be written to several sinks, each with its own
+// format (list or table), confidence threshold and stream. All
+// the sinks are fed in a single pass over the windows.
+
+#define OUTPUT_MAXSINKS 16
+
+struct output_args_t;
+struct sink_t;
+typedef struct output_args_t output_args_t;
+typedef struct sink_t sink_t;
+
+struct output_args_t {
+   int    window;     // window size
+   int    list;       // list of targets instead of table
+   int    nomock;     // no mock file (skip the column)
+   double minconf;    // minimum confidence of targets
+};
+
+struct sink_t {
+   FILE   * f;         // output stream
+   int      list;      // list of targets instead of table
+   double   minconf;   // minimum confidence of targets
+   // State of list output.
+   int      target;    // in a target
+   double   best;      // best confidence of the target
+};
+
+void print_output (FILE *, const zerone_t *, output_args_t);
+void print_sinks (sink_t *, int, const zerone_t *, output_args_t);
+
+#endif
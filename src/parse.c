@@ -17,23 +17,27 @@
 */
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <zlib.h>
 #include "bgzf.h"
+#include "counters.h"
 #include "ctype.h"
 #include "debug.h"
 #include "parse.h"
 #include "sam.h"
+#include "trace.h"
 #include "zerone.h"
 
 // Snippets.
 int check_strtoX (char *, char *);
 
 //  ----- Globals ----- //
-void * STATE;
-int    ERR;
+// Thread-local, so that files can be parsed concurrently.
+__thread void * STATE;
+__thread int    ERR;
 
 #define SUCCESS 1
 #define FAILURE 0
@@ -53,16 +57,19 @@ int    ERR;
 // Size of the buffer for gzip decompression.
 #define CHUNK 16384
 
+// Bytes of 'y' per tile in 'merge_blocks()'.
+#define MERGE_TILE 32768
+
 // Macro to check all applicable zlib errors.
 #define is_zerr(a) ((a) == Z_NEED_DICT || (a) == Z_DATA_ERROR \
       || (a) == Z_MEM_ERROR)
 
 // Type declarations.
-struct hash_t;
 struct link_t;
 struct rod_t;
 struct bitf_t;
 struct loc_t;
+struct merge_t;
 
 struct bgzf_state_t;
 struct generic_state_t;
@@ -72,11 +79,11 @@ typedef struct link_t link_t;
 typedef struct loc_t loc_t;
 typedef struct rod_t rod_t;
 typedef struct bitf_t bitf_t;
+typedef struct merge_t merge_t;
 typedef struct bgzf_state_t bgzf_state_t;
 typedef struct generic_state_t generic_state_t;
 
 // Shortcuts.
-typedef link_t * hash_t;
 typedef char * bloom_t;
 
 // Special functions.
@@ -111,6 +118,16 @@ struct loc_t {
    int    mapq;
 };
 
+struct merge_t {
+   const rod_t       ** rods;    // Rods of the files per block.
+   const size_t       * offset;  // First window of the blocks.
+   const unsigned int * size;    // Number of windows of the blocks.
+   int                  s;       // Number of columns of 'y'.
+   int                  b0;      // First block of the part.
+   int                  b1;      // End of the part (excluded).
+   int                * y;       // Observations.
+};
+
 // Iterator states.
 struct bgzf_state_t {
    BGZF      * file;
@@ -150,11 +167,12 @@ int      parse_wig (loc_t *, char *);
 int      add_to_rod (rod_t **, uint32_t, int);
 int      bloom_query_and_set(const char *, int, bloom_t);
 int      bitf_query_and_set (int, link_t *);
-void     destroy_hash(hash_t *);
 void     destroy_bitfields(hash_t *);
 void     reset_bitfields(hash_t *);
+link_t ** find_slot (link_t **, size_t, const char *);
 link_t * lookup_or_insert (const char *, hash_t *);
-ChIP_t * merge_hashes (hash_t **, int, int);
+void     merge_blocks (const merge_t *);
+void   * run_merge_blocks (void *);
 
 // Convenience functions.
 uint32_t djb2 (const char *);
@@ -184,20 +202,42 @@ parse_input_files
       }
    }
 
-   ChIP_t * ChIP = NULL;         // Return value.
-   hash_t * hashtab[512] = {0};  // Array of hash tables.
-   int      nhashes = 0;         // Number of hashes.
+   hash_t *mock = parse_mock_files(mock_fnames, args);
+   if (mock == NULL) return NULL;
+
+   // The last argument says whether any mock file was provided.
+   ChIP_t *ChIP = parse_ChIP_files(mock, ChIP_fnames, args,
+         mock_fnames[0] == NULL);
+
+   destroy_hash(mock);
+   return ChIP;
+
+}
+
+
+hash_t *
+parse_mock_files
+(
+   char                 * mock_fnames[],
+   zerone_parser_args_t   args
+)
+// SYNOPSIS:
+//   Parse the mock files in a single hash table. The table
+//   is empty if 'mock_fnames' is empty. It can be passed to
+//   'parse_ChIP_files()' repeatedly.
+//
+// RETURN:
+//   A pointer to the hash table, or NULL in case of failure.
+{
 
    // Create a unique hash table for all mock files.
-   hashtab[0] = calloc(HSIZE, sizeof(link_t *));
+   hash_t *mock = calloc(HSIZE, sizeof(link_t *));
 
-   if (hashtab[0] == NULL) {
+   if (mock == NULL) {
       debug_print("%s", "memory error\n");
-      goto clean_and_return;
+      return NULL;
    }
 
-   nhashes = 1;
-
    // Fill in the hash with mock files.
    // Because the same hash table is used every time,
    // the reads in the same window are summed even if
@@ -206,17 +246,52 @@ parse_input_files
 
       debug_print("%s %s\n", "autoparsing mock file", mock_fnames[i]);
 
-      if(!autoparse(mock_fnames[i], hashtab[0], args)) {
+      trace_begin("parse", mock_fnames[i], -1);
+      stage_begin(STAGE_PARSE);
+      int ok = autoparse(mock_fnames[i], mock, args);
+      stage_end(STAGE_PARSE);
+      trace_end("parse", mock_fnames[i], -1);
+
+      if(!ok) {
          debug_print("%s", "autoparse failed\n");
-         goto clean_and_return;
+         destroy_hash(mock);
+         return NULL;
       }
 
-      reset_bitfields(hashtab[0]);
+      reset_bitfields(mock);
    }
 
-   destroy_bitfields(hashtab[0]);
+   destroy_bitfields(mock);
+
+   return mock;
+
+}
 
 
+ChIP_t *
+parse_ChIP_files
+(
+   hash_t               * mock,
+   char                 * ChIP_fnames[],
+   zerone_parser_args_t   args,
+   int                    no_mock
+)
+// SYNOPSIS:
+//   Parse the ChIP files and merge them with the mock hash
+//   table (see 'parse_mock_files()') in a 'ChIP_t'. If
+//   'no_mock' is set, the first profile is implicit.
+//
+// SIDE EFFECTS:
+//   The blocks found only in ChIP files are inserted in
+//   'mock' and the sizes of its blocks are updated.
+{
+
+   ChIP_t * ChIP = NULL;         // Return value.
+   hash_t * hashtab[512] = {0};  // Array of hash tables.
+   int      nhashes = 1;         // Number of hashes.
+
+   hashtab[0] = mock;
+
    // Create distinct hash for each ChIP file.
    for (int i = 0; ChIP_fnames[i] != NULL; i++) {
 
@@ -227,37 +302,139 @@ parse_input_files
          goto clean_and_return;
       }
 
-      hashtab[nhashes] = calloc(HSIZE, sizeof(link_t *));
-      if (hashtab[nhashes] == NULL) {
-         debug_print("%s", "memory error\n");
-         goto clean_and_return;
-      }
+      hashtab[nhashes] = parse_file(ChIP_fnames[i], args);
+      if (hashtab[nhashes] == NULL) goto clean_and_return;
 
       nhashes++;
-      if (!autoparse(ChIP_fnames[i], hashtab[nhashes-1], args)) {
-         debug_print("%s", "autoparse failed\n");
-         goto clean_and_return;
-      }
-
-      destroy_bitfields(hashtab[nhashes-1]);
 
    }
 
-   // Merge hash tables in to a 'ChIP_t'. The last argument
-   // says whether any mock file was provided.
-   ChIP = merge_hashes(hashtab, nhashes, mock_fnames[0] == NULL);
+   // Merge hash tables in to a 'ChIP_t'.
+   ChIP = merge_hashes(hashtab, nhashes, no_mock);
    if (ChIP == NULL) {
       debug_print("%s", "memory error\n");
       goto clean_and_return;
    }
 
 clean_and_return:
-   for (int i = 0 ; i < nhashes ; i++) destroy_hash(hashtab[i]);
+   // The mock hash table belongs to the caller.
+   for (int i = 1 ; i < nhashes ; i++) destroy_hash(hashtab[i]);
    return ChIP;
 
 }
 
 
+hash_t *
+parse_file
+(
+   const char           * fname,
+   zerone_parser_args_t   args
+)
+// SYNOPSIS:
+//   Parse a single file in a new hash table. Different files
+//   can be parsed concurrently (in different threads).
+//
+// RETURN:
+//   A pointer to the hash table, or NULL in case of failure.
+{
+
+   hash_t *hashtab = calloc(HSIZE, sizeof(link_t *));
+   if (hashtab == NULL) {
+      debug_print("%s", "memory error\n");
+      return NULL;
+   }
+
+   trace_begin("parse", fname, -1);
+   stage_begin(STAGE_PARSE);
+   int ok = autoparse(fname, hashtab, args);
+   stage_end(STAGE_PARSE);
+   trace_end("parse", fname, -1);
+
+   if (!ok) {
+      debug_print("%s", "autoparse failed\n");
+      destroy_hash(hashtab);
+      return NULL;
+   }
+
+   destroy_bitfields(hashtab);
+
+   return hashtab;
+
+}
+
+
+hash_t *
+hash_from_ChIP
+(
+   const ChIP_t * ChIP
+)
+// SYNOPSIS:
+//   Rebuild the hash table of a single profile (the first column
+//   of 'ChIP'), e.g. the output of 'merge_hashes()' on the mock
+//   hash table alone. Merging the new table gives the same blocks
+//   in the same order as merging the original.
+//
+// RETURN:
+//   A pointer to the hash table, or NULL in case of failure.
+{
+
+   hash_t *hashtab = calloc(HSIZE, sizeof(link_t *));
+   if (hashtab == NULL) {
+      debug_print("%s", "memory error\n");
+      return NULL;
+   }
+
+   size_t offset = nobs(ChIP);
+
+   // Links are inserted at the head of the lists, so the blocks
+   // are inserted in reverse order to restore the original order.
+   for (int i = ChIP->nb-1 ; i >= 0 ; i--) {
+      const size_t blksz = ChIP->sz[i];
+      offset -= blksz;
+      link_t *lnk = lookup_or_insert(ChIP->nm + 32*i, hashtab);
+      if (lnk == NULL || blksz == 0) goto fail;
+      rod_t *rod = realloc(lnk->counts,
+            sizeof(rod_t) + blksz * sizeof(uint32_t));
+      if (rod == NULL) goto fail;
+      lnk->counts = rod;
+      rod->sz = blksz;
+      rod->mx = blksz-1;
+      for (size_t k = 0 ; k < blksz ; k++) {
+         rod->array[k] = ChIP->y[(offset+k)*ChIP->r];
+      }
+   }
+
+   destroy_bitfields(hashtab);
+
+   return hashtab;
+
+fail:
+   debug_print("%s", "memory error\n");
+   destroy_hash(hashtab);
+   return NULL;
+
+}
+
+
+void
+destroy_hash
+(
+   hash_t * hashtab
+)
+{
+   for (int i = 0 ; i < HSIZE ; i++) {
+      for (link_t *lnk = hashtab[i] ; lnk != NULL ; ) {
+         link_t *tmp = lnk->next;
+         free(lnk->counts);
+         if (lnk->repeats != NULL) free(lnk->repeats);
+         free(lnk);
+         lnk = tmp;
+      }
+   }
+   free(hashtab);
+}
+
+
 
 //  ---- Definitions of local functions  ---- //
 
@@ -408,6 +585,12 @@ autoparse
 
    loc_t loc = {0};
 
+   // Alignments are usually sorted by sequence name, so the link
+   // of the previous read is a good guess for the next one. This
+   // skips most hash lookups when there are many small contigs
+   // (and long collision lists in the hash table).
+   link_t *lnk = NULL;
+
    // Find an iterator for the given file type.
    iter_t iterate = choose_iterator(fname);
 
@@ -425,7 +608,9 @@ autoparse
       // reads with low quality.
       if (loc.name == NULL || loc.mapq < minmapq) continue;
 
-      link_t *lnk = lookup_or_insert(loc.name, hashtab);
+      if (lnk == NULL || strcmp(loc.name, lnk->seqname) != 0) {
+         lnk = lookup_or_insert(loc.name, hashtab);
+      }
 
       if (lnk == NULL) {
          debug_print("%s", "hash query failed\n");
@@ -464,7 +649,7 @@ generic_iterator
 )
 {
 
-   static unsigned int lineno;
+   static __thread unsigned int lineno;
 
    // Cast as state for generic iterator.
    generic_state_t *state = (generic_state_t *) STATE;
@@ -507,6 +692,11 @@ generic_iterator
    return nbytes;
 
 clean_and_return:
+   // The reader and the parser may keep the state of the file
+   // (see 'getgzline()' and 'parse_wig()'). Reset it for the
+   // next file parsed by this thread.
+   if (doread == getgzline) getgzline(NULL, NULL, NULL);
+   if (parse == parse_wig) parse_wig(NULL, NULL);
    free(state->buff);
    fclose(state->file);
    free(state);
@@ -525,7 +715,7 @@ bgzf_iterator
 )
 {
 
-   static int n_parsed_header_targets;
+   static __thread int n_parsed_header_targets;
 
    // Cast as state for bgzf iterator.
    bgzf_state_t *state = (bgzf_state_t *) STATE;
@@ -850,15 +1040,24 @@ parse_wig
 )
 {
 
-   // XXX CAUTION: this function is non-reentrant. XXX //
-   // XXX Use multithreading at your own risk.     XXX //
-
-   static char chrom[32] = {0};
-   static int  fixedstep =  0;
-   static int  fstart    =  1;
-   static int  step      =  1;
-   static int  span      =  1;
-   static int  iter      =  0;
+   // The state of the file is per thread, so that different
+   // files can be parsed concurrently. Call with 'line' set to
+   // NULL to reset it at the end of a file.
+
+   static __thread char chrom[32] = {0};
+   static __thread int  fixedstep =  0;
+   static __thread int  fstart    =  1;
+   static __thread int  step      =  1;
+   static __thread int  span      =  1;
+   static __thread int  iter      =  0;
+
+   if (line == NULL) {
+      chrom[0] = '\0';
+      fixedstep = 0;
+      fstart = step = span = 1;
+      iter = 0;
+      return SUCCESS;
+   }
 
    // Ignore track definition lines.
    if (strncmp(line, "track", 5) == 0) return SUCCESS;
@@ -958,24 +1157,6 @@ djb2
 }
 
 
-void
-destroy_hash
-(
-   hash_t * hashtab
-)
-{
-   for (int i = 0 ; i < HSIZE ; i++) {
-      for (link_t *lnk = hashtab[i] ; lnk != NULL ; ) {
-         link_t *tmp = lnk->next;
-         free(lnk->counts);
-         if (lnk->repeats != NULL) free(lnk->repeats);
-         free(lnk);
-         lnk = tmp;
-      }
-   }
-   free(hashtab);
-}
-
 void
 destroy_bitfields
 (
@@ -1032,25 +1213,26 @@ getgzline
    size_t * bsz,
    FILE   * gzfile
 )
-// The function is absolutely not re-entrant.
+// The stream is per thread, so that different files can be read
+// concurrently, but a thread must read one file at a time.
 {
 
-   static z_stream strm;
-   static unsigned char *start;
+   static __thread z_stream strm;
+   static __thread unsigned char *start;
 
    // 'sentinel' is always 'out + CHUNK - strm.avail_out'.
-   static unsigned char *sentinel;
-   static unsigned char out[CHUNK];
-   static unsigned char in[CHUNK];
+   static __thread unsigned char *sentinel;
+   static __thread unsigned char out[CHUNK];
+   static __thread unsigned char in[CHUNK];
 
    int zstat;
 
    // Set to 0 upon first call.
-   static int is_initialized;
+   static __thread int is_initialized;
 
    // Set 'buff' to NULL to interrupt inflation.
-   if (is_initialized && buff == NULL) {
-      (void) inflateEnd(&strm);
+   if (buff == NULL) {
+      if (is_initialized) (void) inflateEnd(&strm);
       is_initialized = 0;
       return -1;
    }
@@ -1200,10 +1382,74 @@ merge_hashes
    const int       no_mock
 )
 {
+   return merge_hashes_mt(hashes, nhashes, no_mock, 1);
+}
+
+
+ChIP_t *
+merge_hashes_mt
+(
+         hash_t ** hashes,
+         int       nhashes,
+   const int       no_mock,
+         int       nthreads
+)
+// SYNOPSIS:
+//   Same as 'merge_hashes()' on 'nthreads' threads. The blocks are
+//   split in parts of about the same number of windows and every
+//   thread transposes the counts of its blocks in tiles of
+//   'MERGE_TILE' bytes of 'y', so that the tile stays in cache
+//   while the rods of the files are read sequentially.
+//
+// RETURN:
+//   A pointer to the 'ChIP_t', or 'NULL' in case of failure.
+//
+// SIDE EFFECTS:
+//   The blocks found only in ChIP hash tables are inserted in the
+//   first (mock) hash table. The other hash tables are unchanged.
+{
+   ChIP_t *ChIP = NULL;
+
+   unsigned int *size = NULL;
+   char *name = NULL;
+   char **nptr = NULL;
+   int *y = NULL;
+   size_t *offset = NULL;
+   const rod_t **rods = NULL;
+   link_t **slots = NULL;
+   int *blk = NULL;
+
    // Add keys and update a reference hash table (the
    // first, i.e. the hash table of mock controls).
    hash_t *refhash = hashes[0];
 
+   // The hash tables have a fixed number of cells, so with many
+   // small contigs the lists are long and a query costs a walk
+   // through the list. The keys are indexed once in an open
+   // addressing table (at most half full) that is used instead.
+   size_t nlinks = 0;
+   for (int i = 0 ; i < nhashes ; i++) {
+      for (int j = 0 ; j < HSIZE ; j++) {
+         for (link_t *lnk = hashes[i][j] ; lnk != NULL ; lnk = lnk->next) {
+            nlinks++;
+         }
+      }
+   }
+   size_t nslots = 1;
+   while (nslots < 2*nlinks) nslots *= 2;
+   slots = calloc(nslots, sizeof(link_t *));
+   blk = malloc(nslots * sizeof(int));
+   if (slots == NULL || blk == NULL) {
+      debug_print("%s", "memory error\n");
+      goto clean_and_return;
+   }
+
+   for (int j = 0 ; j < HSIZE ; j++) {
+      for (link_t *lnk = refhash[j] ; lnk != NULL ; lnk = lnk->next) {
+         *find_slot(slots, nslots-1, lnk->seqname) = lnk;
+      }
+   }
+
    for (int i = 1 ; i < nhashes ; i++) {
       // Run over all other hash tables.
       hash_t *hashtab = hashes[i];
@@ -1212,11 +1458,15 @@ merge_hashes
          // through every link of the list.
          for (link_t *lnk = hashtab[j] ; lnk != NULL ; lnk = lnk->next) {
             // Get chromosome from reference hash (or create it).
-            link_t *reflnk = lookup_or_insert(lnk->seqname, refhash);
-            if (reflnk == NULL) {
-               debug_print("%s", "hash query failed\n");
-               return NULL;
+            link_t **slot = find_slot(slots, nslots-1, lnk->seqname);
+            if (*slot == NULL) {
+               *slot = lookup_or_insert(lnk->seqname, refhash);
+               if (*slot == NULL) {
+                  debug_print("%s", "hash query failed\n");
+                  goto clean_and_return;
+               }
             }
+            link_t *reflnk = *slot;
             // Update the max in reference hash. Note that
             // the size of this 'link_t' may be smaller.
             if (lnk->counts->mx > reflnk->counts->mx) {
@@ -1230,7 +1480,7 @@ merge_hashes
    // max value was updated as the upper bound of all the tables.
    // Now use the data in reference hash to create 'ChIP_t'.
    int nkeys = 0;
-   int nbins = 0;
+   size_t nbins = 0;
    for (int j = 0 ; j < HSIZE ; j++) {
       for (link_t *lnk = refhash[j] ; lnk != NULL ; lnk = lnk->next) {
          nkeys++;
@@ -1238,22 +1488,29 @@ merge_hashes
       }
    }
 
-   // Allocate all.
-   unsigned int *size = malloc(nkeys * sizeof(unsigned int));
-   char *name = malloc(nkeys * 32);
-   char **nptr = malloc(nkeys * sizeof(char *));
-   int *y = calloc(nhashes * nbins, sizeof(int));
+   // In case no mock file was provided, the first profile
+   // is implicit (see 'ChIP_t') and 'y' has 's' columns.
+   const int o = no_mock ? 1 : 0;
+   const int s = nhashes - o;
 
-   if (size == NULL || name == NULL || y == NULL || nptr == NULL) {
+   // Allocate all.
+   size = malloc(nkeys * sizeof(unsigned int));
+   name = malloc(nkeys * 32);
+   nptr = malloc(nkeys * sizeof(char *));
+   offset = malloc((nkeys+1) * sizeof(size_t));
+   rods = calloc((size_t) nkeys * s, sizeof(rod_t *));
+   y = calloc(s * nbins, sizeof(int));
+
+   if (size == NULL || name == NULL || y == NULL || nptr == NULL ||
+         offset == NULL || rods == NULL) {
       debug_print("%s", "memory error\n");
-      return NULL;
+      goto clean_and_return;
    }
 
-   // Fill in the observations.
+   // Collect the blocks (chromosomes) and the rods of the
+   // files. Files without the block keep a 'NULL' rod.
    int m = 0;
-   size_t offset = 0;
-
-   // Iterate over the blocks (chromosomes).
+   offset[0] = 0;
    for (int j = 0 ; j < HSIZE ; j++) {
    for (link_t *rlnk = refhash[j] ; rlnk != NULL ; rlnk = rlnk->next) {
 
@@ -1261,48 +1518,140 @@ merge_hashes
       char *key = rlnk->seqname;
       nptr[m] = name + 32*m;
       strncpy(nptr[m], key, 32);
-      size_t blksz = size[m++] = rlnk->counts->mx + 1;
-
-      // Go through all the hashes to get the data.
-      for (int i = 0 ; i < nhashes ; i++) {
-         // In case no mock file was provided, the first
-         // column of the data is replaced by 1s all along.
-         if (no_mock && i == 0) {
-            for (int k = 0 ; k < blksz ; k++) {
-               y[offset + (nhashes * k)] = 1;
-            }
-            continue;
-         }
-         hash_t *hashtab = hashes[i];
-         link_t *lnk = lookup_or_insert(key, hashtab);
-         if (lnk == NULL) {
-            debug_print("%s", "hash query failed\n");
-            return NULL;
-         }
-         rod_t *counts = lnk->counts;
-         size_t kmax = counts->sz < blksz ? counts->sz : blksz;
-         for (int k = 0 ; k < kmax ; k++) {
-            y[offset + (nhashes * k) + i] = counts->array[k];
+      size[m] = rlnk->counts->mx + 1;
+      offset[m+1] = offset[m] + size[m];
+      blk[find_slot(slots, nslots-1, key) - slots] = m;
+      if (o == 0) rods[(size_t) m*s] = rlnk->counts;
+
+      m++;
+
+   }
+   }
+
+   for (int i = 1 ; i < nhashes ; i++) {
+      for (int j = 0 ; j < HSIZE ; j++) {
+         for (link_t *lnk = hashes[i][j] ; lnk != NULL ; lnk = lnk->next) {
+            int b = blk[find_slot(slots, nslots-1, lnk->seqname) - slots];
+            rods[i-o + (size_t) b*s] = lnk->counts;
          }
       }
+   }
 
-      // Update offset.
-      offset += nhashes * blksz;
+   {
+      // Split the blocks in parts of about 'nbins/nparts' windows.
+      int nparts = nthreads < nkeys ? nthreads : nkeys;
+      if (nparts < 1) nparts = 1;
+      merge_t part[nparts];
+      pthread_t tid[nparts];
+      int started[nparts];
+
+      int b = 0;
+      for (int t = 0 ; t < nparts ; t++) {
+         size_t goal = nbins * (t+1) / nparts;
+         part[t] = (merge_t) { .rods = rods, .offset = offset, .size = size,
+            .s = s, .b0 = b, .y = y };
+         while (b < nkeys && (t == nparts-1 || offset[b+1] <= goal)) b++;
+         part[t].b1 = b;
+      }
 
-   }
+      for (int t = 1 ; t < nparts ; t++) {
+         started[t] = pthread_create(tid+t, NULL,
+               run_merge_blocks, part+t) == 0;
+         // Merge in the current thread if the thread failed.
+         if (!started[t]) merge_blocks(part+t);
+      }
+      merge_blocks(part);
+      for (int t = 1 ; t < nparts ; t++) {
+         if (started[t]) pthread_join(tid[t], NULL);
+      }
    }
 
-   ChIP_t *ChIP = new_ChIP(nhashes, nkeys, y, (const char **) nptr, size);
+   ChIP = new_ChIP(nhashes, nkeys, y, (const char **) nptr, size);
+   if (ChIP != NULL) ChIP->nomock = o;
 
+clean_and_return:
+   if (ChIP == NULL) free(y);
    free(size);
    free(name);
    free(nptr);
+   free(offset);
+   free(rods);
+   free(slots);
+   free(blk);
 
    return ChIP;
 
 }
 
 
+void
+merge_blocks
+(
+   const merge_t * part
+)
+// SYNOPSIS:
+//   Fill in the observations of blocks 'b0' to 'b1' (excluded).
+//   The blocks are processed in tiles of windows that fit in
+//   'MERGE_TILE' bytes of 'y'; within a tile the columns are
+//   filled one file at a time.
+{
+   const int s = part->s;
+   size_t tile = MERGE_TILE / (s * sizeof(int));
+   if (tile < 1) tile = 1;
+
+   for (int b = part->b0 ; b < part->b1 ; b++) {
+      int *yb = part->y + s * part->offset[b];
+      const rod_t **rods = part->rods + (size_t) b*s;
+      const size_t blksz = part->size[b];
+      for (size_t k0 = 0 ; k0 < blksz ; k0 += tile) {
+         size_t k1 = min(k0 + tile, blksz);
+         for (int i = 0 ; i < s ; i++) {
+            if (rods[i] == NULL) continue;
+            const uint32_t *array = rods[i]->array;
+            size_t kmax = min(rods[i]->sz, k1);
+            for (size_t k = k0 ; k < kmax ; k++) {
+               yb[i + s*k] = array[k];
+            }
+         }
+      }
+   }
+}
+
+
+void *
+run_merge_blocks
+(
+   void * arg
+)
+// Thread wrapper of 'merge_blocks()'.
+{
+   merge_blocks((const merge_t *) arg);
+   return NULL;
+}
+
+
+link_t **
+find_slot
+(
+         link_t ** slots,
+         size_t    mask,
+   const char    * s
+)
+// Linear probing in the table of 'mask+1' (a power of 2) links
+// of 'merge_hashes_mt()'. Returns the slot of the link with
+// sequence name 's', or the empty slot where it belongs.
+{
+
+   size_t h = djb2(s) & mask;
+   while (slots[h] != NULL && strcmp(s, slots[h]->seqname) != 0) {
+      h = (h+1) & mask;
+   }
+
+   return slots + h;
+
+}
+
+
 link_t *
 lookup_or_insert
 (
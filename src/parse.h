@@ -21,6 +21,17 @@
 
 #include "zerone.h"
 
+// Hash table of binned read counts per chromosome.
+struct link_t;
+typedef struct link_t * hash_t;
+
+void     destroy_hash(hash_t *);
+hash_t * hash_from_ChIP(const ChIP_t *);
+ChIP_t * merge_hashes (hash_t **, int, int);
+ChIP_t * merge_hashes_mt (hash_t **, int, int, int);
+ChIP_t * parse_ChIP_files(hash_t *, char **, zerone_parser_args_t, int);
+hash_t * parse_file(const char *, zerone_parser_args_t);
 ChIP_t * parse_input_files(char **, char **, zerone_parser_args_t);
+hash_t * parse_mock_files(char **, zerone_parser_args_t);
 
 #endif
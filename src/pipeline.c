@@ -0,0 +1,359 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "cache.h"
+#include "debug.h"
+#include "parse.h"
+#include "pipeline.h"
+#include "tasks.h"
+#include "trace.h"
+
+struct load_t;
+struct load_file_t;
+typedef struct load_t load_t;
+typedef struct load_file_t load_file_t;
+
+struct load_t {
+   char                 ** mock_fnames;
+   char                 ** ChIP_fnames;
+   zerone_parser_args_t    args;
+   hash_t               ** hashes;   // mock, then ChIP files //
+   int                     nhashes;
+   size_t                  n0;       // windows of the mock profile //
+   zinb_par_t            * par0;     // fit of the mock profile alone //
+   input_t               * input;
+   load_args_t             largs;
+   char                  * key;      // cache key of the mock files //
+   int                     hit;      // mock files found in cache //
+};
+
+struct load_file_t {
+   load_t * ld;
+   int      i;        // file number (1 for the first ChIP file) //
+};
+
+
+//  ---- Declaration of local functions  ---- //
+int task_fit (void *);
+int task_index (void *);
+int task_merge (void *);
+int task_parse_ChIP (void *);
+int task_parse_mock (void *);
+int task_refit (void *);
+
+
+//  -- Definitions of exported functions  --- //
+
+int
+load_input
+(
+   char                 * mock_fnames[],
+   char                 * ChIP_fnames[],
+   zerone_parser_args_t   args,
+   load_args_t            largs,
+   input_t              * input
+)
+// SYNOPSIS:
+//   Parse and merge the input files, fit the mock profile and
+//   index the time series using 'largs.threads' threads. Without
+//   mock file, the first profile is implicit (see 'ChIP_t').
+//
+// RETURN:
+//   0 on success, -1 on failure.
+//
+// SIDE EFFECTS:
+//   Fills 'input', whose members belong to the caller.
+{
+
+   int status = -1;
+   *input = (input_t) {0};
+
+   int nChIP = 0;
+   while (ChIP_fnames[nChIP] != NULL) nChIP++;
+
+   if (nChIP >= 512) {
+      fprintf(stderr, "too many files\n");
+      return -1;
+   }
+
+   const int ntasks = nChIP + 5;
+   task_t **tasks = calloc(ntasks, sizeof(task_t *));
+   hash_t **hashes = calloc(nChIP+1, sizeof(hash_t *));
+   load_file_t *files = malloc(nChIP * sizeof(load_file_t));
+   load_t ld = {
+      .mock_fnames = mock_fnames,
+      .ChIP_fnames = ChIP_fnames,
+      .args = args,
+      .hashes = hashes,
+      .nhashes = nChIP+1,
+      .input = input,
+      .largs = largs,
+   };
+
+   if (tasks == NULL || hashes == NULL || (nChIP > 0 && files == NULL)) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   // Task graph:
+   //   parse mock -> fit --------+
+   //   parse ChIP (each) ----> merge -> index, refit
+   //   parse mock ---------------+
+   task_t *mock = tasks[0] = new_task(task_parse_mock, &ld);
+   task_t *fit = tasks[1] = new_task(task_fit, &ld);
+   task_t *merge = tasks[2] = new_task(task_merge, &ld);
+   task_t *index = tasks[3] = new_task(task_index, &ld);
+   task_t *refit = tasks[4] = new_task(task_refit, &ld);
+   for (int i = 0 ; i < nChIP ; i++) {
+      files[i] = (load_file_t) { .ld = &ld, .i = i+1 };
+      tasks[5+i] = new_task(task_parse_ChIP, files+i);
+   }
+
+   for (int i = 0 ; i < ntasks ; i++) {
+      if (tasks[i] == NULL) goto clean_and_return;
+   }
+
+   // The merge modifies the mock hash table, so it
+   // must wait for the fit of the mock profile.
+   int err = task_after(fit, mock) | task_after(merge, mock) |
+      task_after(merge, fit) | task_after(index, merge) |
+      task_after(refit, merge);
+   for (int i = 0 ; i < nChIP ; i++) {
+      err |= task_after(merge, tasks[5+i]);
+   }
+   if (err) goto clean_and_return;
+
+   status = run_tasks(tasks, ntasks, largs.threads);
+
+clean_and_return:
+   if (status < 0) {
+      if (input->ChIP != NULL) {
+         free(input->ChIP->y);
+         free(input->ChIP);
+      }
+      free(input->par);
+      free(input->index);
+      *input = (input_t) {0};
+   }
+   if (hashes != NULL) {
+      for (int i = 0 ; i < nChIP+1 ; i++) {
+         if (hashes[i] != NULL) destroy_hash(hashes[i]);
+      }
+   }
+   if (tasks != NULL) {
+      for (int i = 0 ; i < ntasks ; i++) free(tasks[i]);
+   }
+   free(ld.par0);
+   free(ld.key);
+   free(tasks);
+   free(hashes);
+   free(files);
+
+   return status;
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+int
+task_fit
+(
+   void * arg
+)
+// SYNOPSIS:
+//   Fit the mock profile before the ChIP files are merged.
+{
+
+   load_t *ld = (load_t *) arg;
+   if (ld->mock_fnames[0] == NULL || ld->hit) return 0;
+
+   // There is no side effect on the hash table without ChIP.
+   ChIP_t *mock = merge_hashes(ld->hashes, 1, 0);
+   if (mock == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return -1;
+   }
+
+   ld->n0 = nobs(mock);
+   trace_begin("fit mock", NULL, -1);
+   if (ld->n0 > 0) ld->par0 = mle_zinb(mock->y, ld->n0);
+   trace_end("fit mock", NULL, -1);
+
+   // Failure to write the cache is not fatal (the function warns).
+   if (ld->key != NULL) {
+      cache_put(ld->largs.cache, ld->key, mock, ld->par0,
+            ld->largs.cachesize);
+   }
+
+   free(mock->y);
+   free(mock);
+
+   return 0;
+
+}
+
+
+int
+task_index
+(
+   void * arg
+)
+{
+
+   load_t *ld = (load_t *) arg;
+   const ChIP_t *ChIP = ld->input->ChIP;
+   const size_t n = nobs(ChIP);
+
+   ld->input->index = malloc(n * sizeof(int));
+   if (ld->input->index == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return -1;
+   }
+
+   trace_begin("index", NULL, -1);
+   ld->input->i0 = index_ChIP(ChIP, ld->input->index);
+   trace_end("index", NULL, -1);
+
+   return 0;
+
+}
+
+
+int
+task_merge
+(
+   void * arg
+)
+{
+
+   load_t *ld = (load_t *) arg;
+
+   // The third argument says whether any mock file was provided.
+   // All the other tasks are done or wait for the merge, so it
+   // can use all the threads.
+   trace_begin("merge", NULL, -1);
+   ld->input->ChIP = merge_hashes_mt(ld->hashes, ld->nhashes,
+         ld->mock_fnames[0] == NULL, ld->largs.threads);
+   trace_end("merge", NULL, -1);
+   if (ld->input->ChIP == NULL) {
+      debug_print("%s", "memory error\n");
+      return -1;
+   }
+
+   return 0;
+
+}
+
+
+int
+task_parse_ChIP
+(
+   void * arg
+)
+{
+
+   load_file_t *file = (load_file_t *) arg;
+   load_t *ld = file->ld;
+   const char *fname = ld->ChIP_fnames[file->i-1];
+
+   debug_print("%s %s\n", "autoparsing ChIP file", fname);
+
+   ld->hashes[file->i] = parse_file(fname, ld->args);
+   return ld->hashes[file->i] == NULL ? -1 : 0;
+
+}
+
+
+int
+task_parse_mock
+(
+   void * arg
+)
+{
+
+   load_t *ld = (load_t *) arg;
+
+   if (ld->largs.cache != NULL && ld->mock_fnames[0] != NULL) {
+      ld->key = cache_key(ld->mock_fnames, ld->args);
+      if (ld->key == NULL) return -1;
+      ChIP_t *mock = cache_get(ld->largs.cache, ld->key, &ld->par0);
+      if (mock != NULL) {
+         debug_print("%s", "mock files found in cache\n");
+         ld->n0 = nobs(mock);
+         ld->hashes[0] = hash_from_ChIP(mock);
+         ld->hit = 1;
+         free(mock->y);
+         free(mock);
+         return ld->hashes[0] == NULL ? -1 : 0;
+      }
+   }
+
+   ld->hashes[0] = parse_mock_files(ld->mock_fnames, ld->args);
+   return ld->hashes[0] == NULL ? -1 : 0;
+
+}
+
+
+int
+task_refit
+(
+   void * arg
+)
+// SYNOPSIS:
+//   Keep the fit of the mock profile (parsed or cached). The windows
+//   added by the merge have no mock read, so the fit is padded with
+//   as many 0s (see 'pad_zinb()'). The first column of the merged
+//   observations is fitted again only if there is no fit to pad.
+//   A failed fit is not an error here ('par' is left NULL).
+{
+
+   load_t *ld = (load_t *) arg;
+   const ChIP_t *ChIP = ld->input->ChIP;
+   const size_t n = nobs(ChIP);
+
+   if (ld->par0 != NULL && (n == ld->n0 ||
+            (n > ld->n0 && pad_zinb(ld->par0, ld->n0, n - ld->n0)))) {
+      ld->input->par = ld->par0;
+      ld->par0 = NULL;
+      return 0;
+   }
+
+   free(ld->par0);
+   ld->par0 = NULL;
+
+   int *mock = malloc(n * sizeof(int));
+   if (mock == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return -1;
+   }
+
+   for (size_t i = 0 ; i < n ; i++) {
+      mock[i] = ChIP->nomock ? 1 : ChIP->y[0+i*ChIP->r];
+   }
+   trace_begin("mock fit", NULL, -1);
+   ld->input->par = mle_zinb(mock, n);
+   trace_end("mock fit", NULL, -1);
+
+   free(mock);
+   return 0;
+
+}
@@ -0,0 +1,58 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include "zerone.h"
+
+// Input stage of a run: parse the files, merge them, fit the
+// mock profile and index the time series. The stages overlap
+// on a pool of threads (see tasks.h). The ChIP files are parsed
+// concurrently with the mock files, and the mock profile is
+// fitted as soon as the mock files are parsed. The fit is
+// checked after the merge and redone if the ChIP files added
+// windows (the mock profile then has more zeros), so that the
+// results are the same as with sequential processing.
+//
+// The mock profile and its fit can be stored in a cache
+// directory (see cache.h) and are then not computed again.
+
+struct input_t;
+struct load_args_t;
+typedef struct input_t input_t;
+typedef struct load_args_t load_args_t;
+
+struct input_t {
+   ChIP_t     * ChIP;    // binned observations //
+   zinb_par_t * par;     // fit of the mock profile (or NULL) //
+   int        * index;   // index of the time series //
+   int          i0;      // first all-0 emission //
+};
+
+struct load_args_t {
+   int          threads;     // number of threads //
+   const char * cache;       // cache directory (or NULL) //
+   size_t       cachesize;   // max size of the cache in bytes (0: none) //
+};
+
+int load_input (char **, char **, zerone_parser_args_t, load_args_t,
+      input_t *);
+
+#endif
@@ -41,6 +41,9 @@ extract_features
    const unsigned int m = Z->m;
    const unsigned int n = nobs(ChIP);
    const unsigned int r = ChIP->r;
+   // The implicit profile (see 'ChIP_t') is not used below.
+   const unsigned int o = ChIP->nomock;
+   const unsigned int s = r - o;
 
    // Feature 0: tansition from "top" to "mid".
    features[0] = Z->Q[2 + 1*m];
@@ -74,20 +77,20 @@ extract_features
       if (Z->path[i] == 2) {
          n_yes++;
          for (int j = 1 ; j < r ; j++) {
-            mean_yes[j] += ChIP->y[j+i*r];
+            mean_yes[j] += ChIP->y[j-o+i*s];
             for (int k = j ; k < r ; k++) {
                prod_yes[j+k*r] +=
-                  ChIP->y[j+i*r] * ChIP->y[k+i*r];
+                  ChIP->y[j-o+i*s] * ChIP->y[k-o+i*s];
             }
          }
       }
       else {
          for (int j = 1 ; j < r ; j++) {
-            mean_no[j] += ChIP->y[j+i*r];
+            mean_no[j] += ChIP->y[j-o+i*s];
          }
       }
       for (int j = 1 ; j < r ; j++) {
-         var[j] += (ChIP->y[j+i*r]) * (ChIP->y[j+i*r]);
+         var[j] += (ChIP->y[j-o+i*s]) * (ChIP->y[j-o+i*s]);
       }
    }
 
@@ -0,0 +1,471 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <float.h>
+#include <math.h>
+#include "debug.h"
+#include "refine.h"
+
+
+//  ---- Declaration of local functions  ---- //
+size_t   find_regions (size_t, const ChIP_t *, const double *,
+            const int *, int, const ChIP_t *, const double *, size_t *,
+            uint *);
+
+
+
+//  -- Definitions of exported functions  --- //
+
+ChIP_t *
+coarsen_ChIP
+(
+   const ChIP_t * ChIP,
+         int      K
+)
+// SYNOPSIS:
+//   Sum the windows of every block by groups of 'K' (the last
+//   coarse window of a block may hold fewer windows). A coarse
+//   window is invalid if one of its windows is.
+//
+// RETURN:
+//   The coarse windows, or NULL in case of failure.
+{
+
+   const size_t s = ChIP->r - ChIP->nomock;
+   const int *y = ChIP->y;
+
+   int *sum = NULL;
+   uint *size = malloc(ChIP->nb * sizeof(uint));
+   if (size == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return NULL;
+   }
+
+   size_t nc = 0;
+   for (int b = 0 ; b < ChIP->nb ; b++) {
+      size[b] = (ChIP->sz[b] + K-1) / K;
+      nc += size[b];
+   }
+
+   sum = calloc(nc*s, sizeof(int));
+   if (sum == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      free(size);
+      return NULL;
+   }
+
+   ChIP_t *new = new_ChIP(ChIP->r, ChIP->nb, sum, NULL, size);
+   free(size);
+   if (new == NULL) {
+      free(sum);
+      return NULL;
+   }
+   memcpy(new->nm, ChIP->nm, 32 * ChIP->nb);
+   new->nomock = ChIP->nomock;
+
+   size_t k = 0;   // current window //
+   size_t c0 = 0;  // first coarse window of the block //
+   for (int b = 0 ; b < ChIP->nb ; b++) {
+      for (size_t i = 0 ; i < ChIP->sz[b] ; i++, k++) {
+         const size_t c = c0 + i/K;
+         if (is_invalid(sum, c, s)) continue;
+         if (is_invalid(y, k, s)) {
+            for (size_t j = 0 ; j < s ; j++) sum[j+c*s] = -1;
+            continue;
+         }
+         for (size_t j = 0 ; j < s ; j++) sum[j+c*s] += y[j+k*s];
+      }
+      c0 += new->sz[b];
+   }
+
+   return new;
+
+}
+
+
+int
+refine_zerone
+(
+         zerone_t   * Z,
+         ChIP_t     * ChIP,
+         int          K,
+   const zinb_par_t * par,
+         int          threads
+)
+// SYNOPSIS:
+//   Transfer the fit 'Z' of the coarse windows of 'ChIP' (see
+//   'coarsen_ChIP()') to the windows of 'ChIP', run the candidate
+//   regions again at the resolution of the windows and re-estimate
+//   the parameters on the windows (see 'refine.h').
+//   'par' is the fit of the mock of the windows (it is computed
+//   if 'par' is NULL). The emission probabilities are computed
+//   for every window (in log space, with up to 'threads' threads).
+//
+// RETURN:
+//   0, or -1 in case of failure (in which case 'Z' is unchanged).
+//
+// SIDE EFFECTS:
+//   'Z->ChIP' is set to 'ChIP' and the parameters of 'Z' are
+//   replaced by those of the windows. The caller keeps the
+//   ownership of the coarse windows.
+{
+
+   const ChIP_t *coarse = Z->ChIP;
+   const size_t m = Z->m;
+   const size_t r = ChIP->r;
+   const size_t s = r - ChIP->nomock;
+   const size_t n = nobs(ChIP);
+   const size_t nc = nobs(coarse);
+
+   int status = -1;
+
+   // The number of states is 3 (see 'do_zerone()').
+   double Q[9] = {0};
+   double p[3*64] = {0};
+
+   zinb_par_t * ownpar = NULL;
+   zerone_t   * D      = NULL;
+   int        * mock   = NULL;
+   int        * index  = NULL;
+   double     * pem    = NULL;
+   double     * phi    = NULL;
+   int        * path   = NULL;
+   size_t     * start  = NULL;
+   uint       * size   = NULL;
+   double     * rpem   = NULL;
+   double     * rphi   = NULL;
+   int        * rpath  = NULL;
+   double     * suff   = NULL;
+
+   if (par == NULL) {
+      // Fit the mock of the windows (see 'do_zerone()').
+      mock = malloc(n * sizeof(int));
+      if (mock == NULL) {
+         fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+         goto clean_and_return;
+      }
+      for (size_t i = 0 ; i < n ; i++) {
+         mock[i] = ChIP->nomock ? 1 : ChIP->y[0+i*s];
+      }
+      par = ownpar = mle_zinb(mock, n);
+      if (par == NULL) {
+         fprintf(stderr, "zerone failure %s:%d\n", __FILE__, __LINE__);
+         goto clean_and_return;
+      }
+   }
+
+   fine_par(Z, K, par, Q, p);
+
+   D = new_zerone(m, ChIP);
+   index = malloc(n * sizeof(int));
+   pem = malloc(n*m * sizeof(double));
+   phi = Z->phi == NULL ? NULL : malloc(n*m * sizeof(double));
+   path = Z->path == NULL ? NULL : malloc(n * sizeof(int));
+   if (D == NULL || index == NULL || pem == NULL ||
+         (Z->phi != NULL && phi == NULL) ||
+         (Z->path != NULL && path == NULL)) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   // Emission probabilities of the windows.
+   set_zerone_par(D, Q, par->a, par->pi, p);
+   unsigned int log_space_no_warn = 5;
+   const int i0 = index_ChIP(ChIP, index);
+   zinm_prob_mt(D, index, log_space_no_warn, pem, threads);
+
+   start = malloc(nc * sizeof(size_t));
+   size = malloc(nc * sizeof(uint));
+   suff = malloc(m*(r+2) * sizeof(double));
+   if (start == NULL || size == NULL || suff == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   const double R = p[1] / p[0];
+   double initp[3] = {0};
+   double init[3] = {0};
+   for (size_t i = 0 ; i < m ; i++) initp[i] = log(1.0/m);
+   for (size_t i = 0 ; i < m ; i++) init[i] = 1.0/m;
+
+   size_t cap = 0;  // windows allocated for the regions //
+
+   for (int iter = 0 ; ; iter++) {
+
+      // Every window gets the fit of its coarse window.
+      size_t k = 0;
+      size_t c0 = 0;
+      for (int b = 0 ; b < ChIP->nb ; b++) {
+         for (size_t i = 0 ; i < ChIP->sz[b] ; i++, k++) {
+            const size_t c = c0 + i/K;
+            if (phi != NULL) memcpy(phi+k*m, Z->phi+c*m, m*sizeof(double));
+            if (path != NULL) path[k] = Z->path[c];
+         }
+         c0 += coarse->sz[b];
+      }
+
+      // No path (early QC): nothing to refine.
+      if (phi == NULL || path == NULL) break;
+
+      // The regions depend on the emissions of the windows, so
+      // they are found again after every M-step.
+      const size_t nreg = find_regions(m, coarse, Z->phi, Z->path, K,
+            ChIP, pem, start, size);
+      size_t nr = 0;
+      for (size_t i = 0 ; i < nreg ; i++) nr += size[i];
+
+      debug_print("refine: %zu regions, %zu of %zu windows\n",
+            nreg, nr, n);
+      if (nr == 0) break;
+
+      if (nr > cap) {
+         free(rpem);
+         free(rphi);
+         free(rpath);
+         rpem = malloc(nr*m * sizeof(double));
+         rphi = malloc(nr*m * sizeof(double));
+         rpath = malloc(nr * sizeof(int));
+         if (rpem == NULL || rphi == NULL || rpath == NULL) {
+            fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+            goto clean_and_return;
+         }
+         cap = nr;
+      }
+
+      // The regions are the blocks of a time series of their own.
+      for (size_t i = 0, off = 0 ; i < nreg ; off += size[i++]) {
+         memcpy(rpem+off*m, pem+start[i]*m, size[i]*m * sizeof(double));
+      }
+
+      double log_Q[9] = {0};
+      for (size_t i = 0 ; i < m*m ; i++) log_Q[i] = log(Q[i]);
+      // See 'zerone_viterbi()'.
+      for (size_t i = 0 ; i < m*m ; i++) {
+         if (log_Q[i] == 0) log_Q[i] = -DBL_MIN;
+      }
+
+      if (block_viterbi(m, nreg, size, log_Q, initp, rpem, rpath)) {
+         goto clean_and_return;
+      }
+
+      // The Viterbi algorithm and 'fwdb()' overwrite the emissions.
+      for (size_t i = 0, off = 0 ; i < nreg ; off += size[i++]) {
+         memcpy(rpem+off*m, pem+start[i]*m, size[i]*m * sizeof(double));
+      }
+
+      double trans[9] = {0};
+      block_fwdb(m, nreg, size, Q, init, rpem, rphi, trans);
+
+      for (size_t i = 0, off = 0 ; i < nreg ; off += size[i++]) {
+         memcpy(phi+start[i]*m, rphi+off*m, size[i]*m * sizeof(double));
+         memcpy(path+start[i], rpath+off, size[i] * sizeof(int));
+      }
+
+      if (iter == REFINE_MAXITER) break;
+
+      // Re-estimate the parameters at the resolution of the windows.
+      // Outside the regions, the posteriors are those of the coarse
+      // windows and the windows stay in their state.
+      double newp[3*64] = {0};
+      suff_stats(m, ChIP, index, i0, phi, suff);
+      if (update_p(D, R, suff, newp) < 0) break;
+      double maxd = 0.0;
+      for (size_t i = 0 ; i < m*(r+1) ; i++) {
+         if (fabs(newp[i]-p[i]) > maxd) maxd = fabs(newp[i]-p[i]);
+      }
+      if (maxd < TOLERANCE) break;
+      memcpy(p, newp, m*(r+1) * sizeof(double));
+      for (size_t i = 0, k = 0 ; i <= nreg ; i++) {
+         const size_t end = i < nreg ? start[i] : n;
+         for ( ; k < end ; k++) {
+            for (size_t j = 0 ; j < m ; j++) trans[j+j*m] += phi[j+k*m];
+         }
+         if (i < nreg) k += size[i];
+      }
+      update_trans(m, Q, trans);
+      set_zerone_par(D, Q, par->a, par->pi, p);
+      zinm_prob_mt(D, index, log_space_no_warn, pem, threads);
+
+   }
+
+   free(Z->phi);
+   free(Z->pem);
+   free(Z->path);
+   Z->phi = phi;
+   Z->pem = pem;
+   Z->path = path;
+   Z->ChIP = ChIP;
+   set_zerone_par(Z, Q, par->a, par->pi, p);
+   phi = pem = NULL;
+   path = NULL;
+   status = 0;
+
+clean_and_return:
+   if (D != NULL) {
+      D->ChIP = NULL;
+      destroy_zerone_all(D);
+   }
+   free(ownpar);
+   free(mock);
+   free(index);
+   free(pem);
+   free(phi);
+   free(path);
+   free(start);
+   free(size);
+   free(rpem);
+   free(rphi);
+   free(rpath);
+   free(suff);
+   return status;
+
+}
+
+
+
+void
+fine_par
+(
+   const zerone_t   * Z,
+         double       K,
+   const zinb_par_t * par,
+   // output //
+         double     * Q,
+         double     * p
+)
+// SYNOPSIS:
+//   Parameters of the windows from the fit 'Z' of the coarse
+//   windows and from the fit 'par' of the mock of the windows.
+//   The transitions between states are divided by 'K'. The mean
+//   of profile 'j' in state 'i' is 'a * p(i,j) / p(i,0)'; it is
+//   divided by 'K' except for the implicit profile (see 'ChIP_t').
+//   'K' may be lower than 1 when the windows are coarser than
+//   those of 'Z' (see 'autowin.h'), in which case the transitions
+//   out of a state are capped to 'REFINE_MAXLEAVE' in total.
+{
+
+   const size_t m = Z->m;
+   const size_t r = Z->ChIP->r;
+   const size_t o = Z->ChIP->nomock;
+   const double c = Z->a / (K * par->a);
+
+   for (size_t i = 0 ; i < m ; i++) {
+      double leave = 0.0;
+      for (size_t j = 0 ; j < m ; j++) {
+         if (i != j) leave += Z->Q[i+j*m] / K;
+      }
+      const double cap = leave > REFINE_MAXLEAVE ?
+         REFINE_MAXLEAVE / leave : 1.0;
+      double stay = 1.0;
+      for (size_t j = 0 ; j < m ; j++) {
+         if (i == j) continue;
+         Q[i+j*m] = Z->Q[i+j*m] / K * cap;
+         stay -= Q[i+j*m];
+      }
+      Q[i+i*m] = stay;
+   }
+
+   for (size_t i = 0 ; i < m ; i++) {
+      const double *pc = Z->p + i*(r+1);
+      double *pf = p + i*(r+1);
+      double sum = pf[0] = pc[0];
+      for (size_t j = 1 ; j < r+1 ; j++) {
+         sum += pf[j] = pc[j] * (o && j == 1 ? K*c : c);
+      }
+      for (size_t j = 0 ; j < r+1 ; j++) pf[j] /= sum;
+   }
+
+   return;
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+size_t
+find_regions
+(
+         size_t   m,
+   const ChIP_t * coarse,
+   const double * phi,
+   const int    * path,
+         int      K,
+   const ChIP_t * ChIP,
+   const double * pem,
+   // output //
+         size_t * start,
+         uint   * size
+)
+// SYNOPSIS:
+//   Find the runs of coarse windows to refine: those where the
+//   target state has posterior probability at least 'REFINE_MINPOST'
+//   or is on the Viterbi path, those with a window where the target
+//   state has the highest emission probability in 'pem' (in log
+//   space, may be NULL), and their 'REFINE_PAD' neighbours.
+//   Runs do not span blocks.
+//
+// RETURN:
+//   The number of regions.
+//
+// SIDE EFFECTS:
+//   'start' and 'size' hold the first window of the regions in
+//   'ChIP' and their number of windows.
+{
+
+   size_t nreg = 0;
+   size_t c0 = 0;  // first coarse window of the block //
+   size_t k0 = 0;  // first window of the block //
+
+   for (int b = 0 ; b < coarse->nb ; b++) {
+      const size_t nc = coarse->sz[b];
+      const size_t nf = ChIP->sz[b];
+      int open = 0;   // the last region can be extended //
+      for (size_t c = 0 ; c < nc ; c++) {
+         const size_t lo = c < REFINE_PAD ? 0 : c - REFINE_PAD;
+         const size_t hi = c + REFINE_PAD < nc ? c + REFINE_PAD : nc-1;
+         int candidate = 0;
+         for (size_t d = lo ; d <= hi && !candidate ; d++) {
+            candidate = phi[2+(c0+d)*m] >= REFINE_MINPOST ||
+               path[c0+d] == 2;
+            const size_t e1 = (d+1)*K < nf ? (d+1)*K : nf;
+            for (size_t e = d*K ; pem && e < e1 && !candidate ; e++) {
+               const double *pe = pem + (k0+e)*m;
+               candidate = pe[2] > pe[0] && pe[2] > pe[1];
+            }
+         }
+         if (!candidate) {
+            open = 0;
+            continue;
+         }
+         const size_t f0 = c*K;
+         const size_t f1 = (c+1)*K < nf ? (c+1)*K : nf;
+         if (!open) {
+            start[nreg] = k0 + f0;
+            size[nreg] = 0;
+            nreg++;
+            open = 1;
+         }
+         size[nreg-1] += f1 - f0;
+      }
+      c0 += nc;
+      k0 += nf;
+   }
+
+   return nreg;
+
+}
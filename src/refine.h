@@ -0,0 +1,55 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _REFINE_H
+#define _REFINE_H
+
+#include "zerone.h"
+
+// Coarse-to-fine calling. The windows are summed by groups of
+// 'K' in every block and the model is fitted on these coarse
+// windows. The targets occupy a small part of the genome, so
+// the coarse windows where the posterior probability of the
+// target state is not negligible (padded with their neighbours)
+// are the only ones run again at the resolution of the windows,
+// with forward-backward and Viterbi. The other windows keep the
+// posterior probabilities and the state of their coarse window.
+//
+// The parameters are carried over to the windows: the mock is
+// fitted on the windows, the means of the ChIP profiles are
+// divided by 'K' and so are the transitions between states
+// (the expected length of a run is 'K' times larger). This is
+// only a starting point: the targets are narrower than the coarse
+// windows, so their means are underestimated. The parameters are
+// then re-estimated on the windows by EM, with the posteriors of
+// the coarse windows outside the regions, and the regions are
+// found again after every M-step (windows where the target state
+// has the highest emission probability become candidates).
+
+#define REFINE_MINPOST  0.01  // min target posterior to refine //
+#define REFINE_PAD      1     // coarse windows around candidates //
+#define REFINE_MAXLEAVE 0.5   // max transitions out of a state //
+#define REFINE_MAXITER  10    // max M-steps on the windows //
+
+ChIP_t * coarsen_ChIP (const ChIP_t *, int);
+void     fine_par (const zerone_t *, double, const zinb_par_t *,
+            double *, double *);
+int      refine_zerone (zerone_t *, ChIP_t *, int, const zinb_par_t *,
+            int);
+
+#endif
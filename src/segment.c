@@ -0,0 +1,353 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <float.h>
+#include <math.h>
+#include "debug.h"
+#include "segment.h"
+
+
+void
+destroy_segments
+(
+   ChIP_t * ChIP
+)
+{
+
+   if (ChIP == NULL) return;
+   if (ChIP->seg != NULL) {
+      free(ChIP->seg->len);
+      free(ChIP->seg->nzero);
+      free(ChIP->seg);
+   }
+   free(ChIP->y);
+   free(ChIP);
+
+}
+
+
+ChIP_t *
+segment_ChIP
+(
+   const ChIP_t * ChIP,
+         int      below
+)
+// SYNOPSIS:
+//   Merge the runs of consecutive windows of the same block where
+//   every count is lower than 'below' (at most 'SEG_MAXLEN' windows
+//   per segment). The other windows are segments of length 1.
+//
+// RETURN:
+//   The segments (to be destroyed with 'destroy_segments()'), or
+//   NULL in case of failure.
+{
+
+   const size_t n = nobs(ChIP);
+   const size_t o = ChIP->nomock;
+   const size_t s = ChIP->r - o;
+   const int *y = ChIP->y;
+
+   ChIP_t *new = NULL;
+   int *sum = malloc(n*s * sizeof(int));
+   uint *len = malloc(n * sizeof(uint));
+   uint *nzero = malloc(n * sizeof(uint));
+   seg_t *seg = malloc(sizeof(seg_t));
+   if (sum == NULL || len == NULL || nzero == NULL || seg == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto fail;
+   }
+
+   new = new_ChIP(ChIP->r, ChIP->nb, sum, NULL, ChIP->sz);
+   if (new == NULL) goto fail;
+   memcpy(new->nm, ChIP->nm, 32 * ChIP->nb);
+   new->nomock = o;
+
+   size_t k = 0;   // current window //
+   size_t ns = 0;  // number of segments //
+   for (int b = 0 ; b < ChIP->nb ; b++) {
+      const size_t end = k + ChIP->sz[b];
+      const size_t first = ns;
+      int open = 0;   // the last segment can be extended //
+      for ( ; k < end ; k++) {
+         int low = !is_invalid(y, k, s);
+         int zero = !o && low;
+         for (size_t j = 0 ; j < s && low ; j++) {
+            low = y[j+k*s] < below;
+            zero &= y[j+k*s] == 0;
+         }
+         if (!low || !open || len[ns-1] >= SEG_MAXLEN) {
+            // Start a new segment.
+            memset(sum + ns*s, 0, s * sizeof(int));
+            len[ns] = nzero[ns] = 0;
+            ns++;
+         }
+         for (size_t j = 0 ; j < s ; j++) sum[j+(ns-1)*s] += y[j+k*s];
+         len[ns-1]++;
+         nzero[ns-1] += zero;
+         open = low;
+      }
+      new->sz[b] = ns - first;
+   }
+
+   debug_print("segments: %zu windows, %zu segments\n", n, ns);
+
+   // Give back the memory of the unused segments.
+   int *y_ = realloc(sum, ns*s * sizeof(int));
+   uint *len_ = realloc(len, ns * sizeof(uint));
+   uint *nzero_ = realloc(nzero, ns * sizeof(uint));
+   if (y_ != NULL) sum = y_;
+   if (len_ != NULL) len = len_;
+   if (nzero_ != NULL) nzero = nzero_;
+
+   seg->len = len;
+   seg->nzero = nzero;
+   new->y = sum;
+   new->seg = seg;
+
+   return new;
+
+fail:
+   free(new);
+   free(sum);
+   free(len);
+   free(nzero);
+   free(seg);
+   return NULL;
+
+}
+
+
+int
+expand_segments
+(
+   zerone_t * Z,
+   ChIP_t   * ChIP,
+   int        threads
+)
+// SYNOPSIS:
+//   Transfer the fit 'Z' of the segments of 'ChIP' to the windows
+//   of 'ChIP'. The windows of a segment get the posterior
+//   probabilities and the state of the segment, the emission
+//   probabilities are computed for every window (in log space,
+//   with up to 'threads' threads).
+//
+// RETURN:
+//   0, or -1 in case of failure (in which case 'Z' is unchanged).
+//
+// SIDE EFFECTS:
+//   'Z->ChIP' is set to 'ChIP', the caller keeps the ownership of
+//   the segments.
+{
+
+   const size_t m = Z->m;
+   const size_t n = nobs(ChIP);
+   const size_t ns = nobs(Z->ChIP);
+   const uint *len = Z->ChIP->seg->len;
+
+   double *phi = Z->phi == NULL ? NULL : malloc(n*m * sizeof(double));
+   double *pem = Z->pem == NULL ? NULL : malloc(n*m * sizeof(double));
+   int *path = Z->path == NULL ? NULL : malloc(n * sizeof(int));
+   int *index = malloc(n * sizeof(int));
+   if ((Z->phi != NULL && phi == NULL) || (Z->pem != NULL && pem == NULL)
+         || (Z->path != NULL && path == NULL) || index == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      free(phi);
+      free(pem);
+      free(path);
+      free(index);
+      return -1;
+   }
+
+   for (size_t k = 0, w = 0 ; k < ns ; k++) {
+      for (size_t l = 0 ; l < len[k] ; l++, w++) {
+         if (phi != NULL) memcpy(phi+w*m, Z->phi+k*m, m * sizeof(double));
+         if (path != NULL) path[w] = Z->path[k];
+      }
+   }
+
+   free(Z->phi);
+   free(Z->pem);
+   free(Z->path);
+   Z->phi = phi;
+   Z->path = path;
+   Z->pem = pem;
+   Z->ChIP = ChIP;
+
+   if (pem != NULL) {
+      unsigned int log_space_no_warn = 5;
+      index_ChIP(ChIP, index);
+      zinm_prob_mt(Z, index, log_space_no_warn, pem, threads);
+   }
+
+   free(index);
+   return 0;
+
+}
+
+
+void
+seg_prob
+(
+   zerone_t * zerone,
+   int        otype,
+   double   * pem
+)
+// SYNOPSIS:
+//   Emission probabilities of the segments (see 'zinm_prob()' for
+//   the arguments and the output). A segment of 'L' windows, 'z' of
+//   which are all 0, and with sums of counts 'Y' has the emission
+//
+//     (pi * p_0(i)^a + 1-pi)^z * p_0(i)^a(L-z) * p_1(i)^Y_1 * ...
+//
+//   times 'Q(i,i)^(L-1)' for the transitions inside the segment.
+{
+
+   const ChIP_t       * ChIP  = zerone->ChIP;
+   const unsigned int   r     = ChIP->r;
+   const unsigned int   m     = zerone->m;
+   const unsigned int   o     = ChIP->nomock;
+   const unsigned int   s     = r - o;
+   const unsigned int   n     = nobs(ChIP);
+   const int          * y     = ChIP->y;
+   const uint         * len   = ChIP->seg->len;
+   const uint         * nzero = ChIP->seg->nzero;
+   const double         a     = zerone->a;
+   const double         pi    = zerone->pi;
+   const double       * p     = zerone->p;
+   const double       * Q     = zerone->Q;
+
+   double logp[(r+1)*m];
+   double logz[m];
+   double logQ[m];
+   for (size_t i = 0 ; i < m ; i++) {
+      double sump = 0.0;
+      for (size_t j = 0 ; j < r+1 ; j++) sump += p[j+i*(r+1)];
+      for (size_t j = 0 ; j < r+1 ; j++) {
+         logp[j+i*(r+1)] = log(p[j+i*(r+1)] / sump);
+      }
+      logz[i] = log(pi*exp(a*logp[0+i*(r+1)]) + (1.0-pi));
+      logQ[i] = log(Q[i+i*m]);
+   }
+
+   for (size_t k = 0 ; k < n ; k++) {
+      if (is_invalid(y, k, s)) {
+         // Only segments of length 1 can have missing values.
+         for (size_t i = 0 ; i < m ; i++) pem[i+k*m] = NAN;
+         continue;
+      }
+
+      const double L = len[k];
+      const double z = nzero[k];
+      for (size_t i = 0 ; i < m ; i++) {
+         double e = z * logz[i] + (L-z) * a * logp[0+i*(r+1)];
+         if (o) e += (L-z) * logp[1+i*(r+1)];
+         for (size_t j = 0 ; j < s ; j++) {
+            e += y[j+k*s] * logp[(j+o+1)+i*(r+1)];
+         }
+         if (L > 1) e += (L-1) * logQ[i];
+         pem[i+k*m] = e;
+      }
+
+      // Same output types as 'zinm_prob()'.
+      if ((otype & 3) == 1) continue;
+
+      double sum = 0.0;
+      double lin[m];
+      for (size_t i = 0 ; i < m ; i++) sum += lin[i] = exp(pem[i+k*m]);
+      if (sum > 0 || (otype & 3) == 2) {
+         memcpy(pem+k*m, lin, m * sizeof(double));
+      }
+   }
+
+   return;
+
+}
+
+
+void
+seg_stats
+(
+         size_t   m,
+   const ChIP_t * ChIP,
+   const double * phi,
+   // output //
+         double * suff
+)
+// SYNOPSIS:
+//   Expected sufficient statistics of the emission parameters from
+//   the posterior probabilities of the segments (see 'suff_stats()').
+//   All the windows of a segment have the posterior probabilities
+//   of the segment, so the statistics are those of the windows.
+{
+
+   const size_t r = ChIP->r;
+   const size_t o = ChIP->nomock;
+   const size_t s = r - o;
+   const size_t n = nobs(ChIP);
+   const int *y = ChIP->y;
+   const uint *len = ChIP->seg->len;
+   const uint *nzero = ChIP->seg->nzero;
+
+   for (size_t i = 0 ; i < m ; i++) {
+      double *st = suff + i*(r+2);
+      memset(st, 0, (r+2) * sizeof(double));
+      for (size_t k = 0 ; k < n ; k++) {
+         if (is_invalid(y, k, s)) continue;
+         const double w = phi[i+k*m];
+         st[0] += w * (len[k] - nzero[k]);
+         st[1] += w * nzero[k];
+         // The implicit profile counts 1 read per window.
+         for (size_t j = 0 ; j < s ; j++) {
+            st[j+o+2] += w * y[j+k*s];
+         }
+      }
+      if (o) st[2] = st[0];
+   }
+
+   return;
+
+}
+
+
+void
+seg_trans
+(
+         size_t   m,
+   const ChIP_t * ChIP,
+   const double * phi,
+   // output //
+         double * trans
+)
+// SYNOPSIS:
+//   Add the expected transitions inside the segments (a segment of
+//   'L' windows stays 'L-1' times in its state) to 'trans'.
+{
+
+   const size_t n = nobs(ChIP);
+   const uint *len = ChIP->seg->len;
+
+   for (size_t k = 0 ; k < n ; k++) {
+      if (len[k] < 2) continue;
+      for (size_t i = 0 ; i < m ; i++) {
+         trans[i+i*m] += (len[k]-1) * phi[i+k*m];
+      }
+   }
+
+   return;
+
+}
@@ -0,0 +1,55 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SEGMENT_H
+#define _SEGMENT_H
+
+#include "zerone.h"
+
+// Adaptive windows. Consecutive windows of a block where every
+// count is below a threshold carry little information, so they
+// are merged in segments and the HMM runs on the segments. The
+// state is constant within a segment: the emission of a segment
+// is the product of the emissions of its windows, and a segment
+// of 'L' windows in state 'i' contributes 'Q(i,i)^(L-1)' for the
+// transitions inside it. The emission parameters of the ZINM only
+// depend on sums of counts, so a segment is stored as a window of
+// 'y' holding the sums of its counts, with its number of windows
+// and of all-0 windows. Windows with missing values are never
+// merged. Segments are kept short: a long segment carries enough
+// weight to pull a whole run of empty windows into the state of
+// a neighbouring peak.
+
+#define SEG_MAXLEN 16
+
+struct seg_t;
+typedef struct seg_t seg_t;
+
+struct seg_t {
+   uint   * len;     // number of windows of every segment //
+   uint   * nzero;   // number of all-0 windows of every segment //
+};
+
+void     destroy_segments (ChIP_t *);
+int      expand_segments (zerone_t *, ChIP_t *, int);
+ChIP_t * segment_ChIP (const ChIP_t *, int);
+void     seg_prob (zerone_t *, int, double *);
+void     seg_stats (size_t, const ChIP_t *, const double *, double *);
+void     seg_trans (size_t, const ChIP_t *, const double *, double *);
+
+#endif
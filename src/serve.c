@@ -0,0 +1,1134 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "output.h"
+#include "parse.h"
+#include "serve.h"
+
+// Exit status of job processes.
+#define JOB_OK       0
+#define JOB_EINPUT   1
+#define JOB_ERUN     2
+#define JOB_EOUTPUT  3
+
+const char *JOB_ERRORS[] = {
+   NULL,
+   "cannot read input",
+   "run time error",
+   "cannot write output",
+};
+
+struct mock_t;
+struct slot_t;
+struct wait_t;
+typedef struct mock_t mock_t;
+typedef struct slot_t slot_t;
+typedef struct wait_t wait_t;
+
+struct mock_t {
+   char                 * key;     // file names, sizes, dates and options //
+   char                 * files[SERVE_MAXFILES+1]; // mock files //
+   zerone_parser_args_t   pargs;   // parser options //
+   hash_t               * hash;    // binned mock reads (NULL if failed) //
+   zinb_par_t           * par;     // fit of the mock profile (or NULL) //
+   size_t                 n;       // number of windows of the mock profile //
+   time_t                 used;    // time of last use //
+   pthread_t              loader;  // thread loading the mock files //
+   int                    loading; // set until 'loader' is joined //
+   int                    done;    // set by 'loader' when it is done //
+   int                    nwait;   // jobs of the queue that use it //
+};
+
+struct slot_t {
+   pid_t            pid;   // job process (0 if the slot is free) //
+   int              id;    // job number //
+   int              fd;    // connection to the client //
+   struct timeval   t0;    // start time //
+};
+
+struct wait_t {
+   job_t    job;     // request //
+   mock_t * mock;    // mock files of the job (NULL if free) //
+   int      id;      // job number //
+   int      fd;      // connection to the client //
+};
+
+
+//  ---- Declaration of local functions  ---- //
+int      collect_mocks (mock_t *, int);
+void     destroy_mock (mock_t *);
+mock_t * get_mock (mock_t *, const job_t *);
+void     job_done (int);
+int      json_bool (const char **, int *);
+int      json_number (const char **, double *);
+int      json_string (const char **, char **);
+int      json_strings (const char **, char **, int);
+void     json_ws (const char **);
+void   * load_mock (void *);
+int      read_request (int, char *);
+int      reap_jobs (slot_t *, int, int);
+char   * resident_key (const job_t *);
+void     respond (int, int, const char *, double, long);
+void     run_job (int, const job_t *, const mock_t *, serve_args_t);
+int      start_job (wait_t *, wait_t *, slot_t *, int *, int, serve_args_t);
+void     stop_serving (int);
+
+// Set by SIGINT and SIGTERM.
+volatile sig_atomic_t SERVE_STOP = 0;
+// Written to by SIGCHLD and by the loaders to wake up 'poll()'.
+int SERVE_PIPE[2] = {-1, -1};
+
+
+//  -- Definitions of exported functions  --- //
+
+void
+destroy_job
+(
+   job_t * job
+)
+{
+   for (int i = 0 ; i < SERVE_MAXFILES ; i++) {
+      free(job->mock[i]);
+      free(job->chip[i]);
+   }
+   free(job->output);
+   memset(job, 0, sizeof(job_t));
+}
+
+
+int
+parse_job
+(
+   const char   *  json,
+         job_t  *  job,
+   const char   ** err
+)
+// SYNOPSIS:
+//   Parse a job request (a flat JSON object). Missing keys
+//   take the default values of the command line.
+//
+// RETURN:
+//   1 on success, 0 on failure ('err' is set to a message).
+//
+// SIDE EFFECTS:
+//   Allocates the strings of 'job' (see 'destroy_job()'),
+//   also in case of failure.
+{
+
+   memset(job, 0, sizeof(job_t));
+   job->window = 300;
+   job->minmapq = 20;
+   job->workers = 1;
+
+   const char *s = json;
+   double x = 0;
+
+   json_ws(&s);
+   if (*s++ != '{') {
+      *err = "request is not a JSON object";
+      return 0;
+   }
+
+   json_ws(&s);
+   if (*s == '}') s++;
+   else while (1) {
+      char *key = NULL;
+      if (!json_string(&s, &key)) {
+         *err = "invalid key";
+         return 0;
+      }
+      json_ws(&s);
+      if (*s++ != ':') {
+         free(key);
+         *err = "invalid request";
+         return 0;
+      }
+      json_ws(&s);
+      int ok = 0;
+      if (strcmp(key, "mock") == 0) {
+         ok = json_strings(&s, job->mock, SERVE_MAXFILES);
+      }
+      else if (strcmp(key, "chip") == 0) {
+         ok = json_strings(&s, job->chip, SERVE_MAXFILES);
+      }
+      else if (strcmp(key, "output") == 0) {
+         free(job->output);
+         job->output = NULL;
+         ok = json_string(&s, &job->output);
+      }
+      else if (strcmp(key, "window") == 0) {
+         ok = json_number(&s, &x) && x == (int) x && x > 0;
+         job->window = x;
+      }
+      else if (strcmp(key, "quality") == 0) {
+         ok = json_number(&s, &x) && x == (int) x && x >= 0 && x <= 254;
+         job->minmapq = x;
+      }
+      else if (strcmp(key, "confidence") == 0) {
+         ok = json_number(&s, &x) && x >= 0 && x <= 1;
+         job->minconf = x;
+      }
+      else if (strcmp(key, "workers") == 0) {
+         ok = json_number(&s, &x) && x == (int) x && x > 0;
+         job->workers = x;
+      }
+      else if (strcmp(key, "memory") == 0) {
+         ok = json_number(&s, &x) && x == (long) x && x >= 0;
+         job->memory = x;
+      }
+      else if (strcmp(key, "list") == 0) {
+         ok = json_bool(&s, &job->list);
+      }
+      else if (strcmp(key, "no-mock") == 0) {
+         ok = json_bool(&s, &job->nomock);
+      }
+      else if (strcmp(key, "early-qc") == 0) {
+         ok = json_bool(&s, &job->earlyqc);
+      }
+      else {
+         free(key);
+         *err = "unknown key";
+         return 0;
+      }
+      free(key);
+      if (!ok) {
+         *err = "invalid value";
+         return 0;
+      }
+      json_ws(&s);
+      if (*s == ',') {
+         s++;
+         json_ws(&s);
+         continue;
+      }
+      if (*s++ == '}') break;
+      *err = "invalid request";
+      return 0;
+   }
+
+   json_ws(&s);
+   if (*s != '\0') {
+      *err = "invalid request";
+      return 0;
+   }
+
+   // Same checks as on the command line.
+   if (job->chip[0] == NULL) {
+      *err = "specify a file for ChIP-seq experiment";
+      return 0;
+   }
+   if (job->mock[0] == NULL && !job->nomock) {
+      *err = "specify a file for mock control experiment";
+      return 0;
+   }
+   if (job->mock[0] != NULL && job->nomock) {
+      *err = "mock files given with no-mock";
+      return 0;
+   }
+
+   // The daemon does not run in the directory of the client.
+   int relative = job->output != NULL && job->output[0] != '/';
+   for (int i = 0 ; job->mock[i] != NULL ; i++) {
+      relative |= job->mock[i][0] != '/';
+   }
+   for (int i = 0 ; job->chip[i] != NULL ; i++) {
+      relative |= job->chip[i][0] != '/';
+   }
+   if (relative) {
+      *err = "file names must be absolute";
+      return 0;
+   }
+
+   return 1;
+
+}
+
+
+int
+serve
+(
+   const char         * path,
+         serve_args_t   args
+)
+// SYNOPSIS:
+//   Listen on Unix domain socket 'path' and run the jobs until
+//   SIGINT or SIGTERM is received. The request is read by the
+//   daemon and the mock files are parsed by a loader thread (or
+//   found in the cache), everything else is done by a job process,
+//   so that the cache is shared by copy-on-write and is never
+//   modified by the jobs. The accept loop never parses files.
+//
+// RETURN:
+//   0 on normal termination, -1 if the socket cannot be set up.
+{
+
+   mock_t cache[SERVE_MAXMOCKS] = {{0}};
+   wait_t queue[SERVE_MAXQUEUE] = {{{{0}}}};
+   int njobs = 0;
+   int nrun = 0;
+
+   slot_t *slots = calloc(args.maxjobs, sizeof(slot_t));
+   if (slots == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return -1;
+   }
+
+   struct sockaddr_un addr = {0};
+   addr.sun_family = AF_UNIX;
+   if (strlen(path) >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "socket path too long: %s\n", path);
+      free(slots);
+      return -1;
+   }
+   strcpy(addr.sun_path, path);
+
+   // The jobs can read and write whatever the daemon can, so
+   // the socket is created with mode 0600 (there is no window
+   // during which other users could connect).
+   mode_t mask = umask(0177);
+   int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+   int bound = sock >= 0 &&
+      bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+   umask(mask);
+   if (!bound || listen(sock, 16) < 0) {
+      fprintf(stderr, "cannot listen on %s: %s\n", path, strerror(errno));
+      if (sock >= 0) close(sock);
+      free(slots);
+      return -1;
+   }
+
+   if (pipe(SERVE_PIPE) < 0 ||
+         fcntl(SERVE_PIPE[0], F_SETFL, O_NONBLOCK) < 0 ||
+         fcntl(SERVE_PIPE[1], F_SETFL, O_NONBLOCK) < 0) {
+      fprintf(stderr, "cannot create pipe: %s\n", strerror(errno));
+      close(sock);
+      free(slots);
+      return -1;
+   }
+
+   // Clients may leave before the end of their job. Signals
+   // interrupt 'poll()' so that the loop can terminate, and
+   // finished jobs are reported as soon as they are done.
+   struct sigaction sa = {{0}};
+   sa.sa_handler = stop_serving;
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   sa.sa_handler = job_done;
+   sigaction(SIGCHLD, &sa, NULL);
+   signal(SIGPIPE, SIG_IGN);
+
+   fprintf(stderr, "serving on %s\n", path);
+
+   char req[SERVE_MAXREQ];
+
+   while (!SERVE_STOP) {
+
+      nrun -= reap_jobs(slots, args.maxjobs, 0);
+
+      // Start the jobs whose mock files are loaded (or failed) in
+      // order of arrival, as long as there are free slots, and
+      // forget the mock files that could not be loaded. The others
+      // stay in the queue until a job is done ('SIGCHLD' wakes up
+      // 'poll()').
+      collect_mocks(cache, 0);
+      for (int last = 0 ; ; ) {
+         wait_t *next = NULL;
+         for (int i = 0 ; i < SERVE_MAXQUEUE ; i++) {
+            wait_t *w = queue + i;
+            if (w->mock == NULL || w->mock->loading || w->id <= last)
+               continue;
+            if (next == NULL || w->id < next->id) next = w;
+         }
+         if (next == NULL) break;
+         last = next->id;
+         start_job(next, queue, slots, &nrun, sock, args);
+      }
+      for (int i = 0 ; i < SERVE_MAXMOCKS ; i++) {
+         if (cache[i].key != NULL && !cache[i].loading &&
+               cache[i].nwait == 0 && cache[i].hash == NULL)
+            destroy_mock(cache + i);
+      }
+
+      struct pollfd pfd[2] = {
+         { .fd = sock, .events = POLLIN },
+         { .fd = SERVE_PIPE[0], .events = POLLIN },
+      };
+      if (poll(pfd, 2, 1000) <= 0) continue;
+      if (pfd[1].revents & POLLIN) {
+         char buf[64];
+         if (read(SERVE_PIPE[0], buf, sizeof(buf)) < 0) continue;
+      }
+      if (!(pfd[0].revents & POLLIN)) continue;
+
+      int fd = accept(sock, NULL, NULL);
+      if (fd < 0) continue;
+
+      // Do not let a silent client block the daemon.
+      struct timeval tv = { .tv_sec = 5 };
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+      const int id = ++njobs;
+      const char *err = NULL;
+      job_t job;
+
+      // Jobs run with the permissions of the daemon.
+      struct ucred cred;
+      socklen_t len = sizeof(cred);
+      if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+            cred.uid != geteuid()) {
+         fprintf(stderr, "job %d: permission denied\n", id);
+         respond(fd, id, "permission denied", 0, 0);
+         close(fd);
+         continue;
+      }
+
+      if (!read_request(fd, req)) {
+         respond(fd, id, "cannot read request", 0, 0);
+         close(fd);
+         continue;
+      }
+
+      if (!parse_job(req, &job, &err)) {
+         fprintf(stderr, "job %d: %s\n", id, err);
+         respond(fd, id, err, 0, 0);
+         destroy_job(&job);
+         close(fd);
+         continue;
+      }
+
+      wait_t *w = queue;
+      while (w < queue + SERVE_MAXQUEUE && w->mock != NULL) w++;
+      if (w == queue + SERVE_MAXQUEUE) {
+         fprintf(stderr, "job %d: too many waiting jobs\n", id);
+         respond(fd, id, "too many waiting jobs", 0, 0);
+         destroy_job(&job);
+         close(fd);
+         continue;
+      }
+
+      mock_t *mock = get_mock(cache, &job);
+      if (mock == NULL) {
+         fprintf(stderr, "job %d: cannot read mock files\n", id);
+         respond(fd, id, "cannot read mock files", 0, 0);
+         destroy_job(&job);
+         close(fd);
+         continue;
+      }
+
+      w->job = job;
+      w->mock = mock;
+      w->id = id;
+      w->fd = fd;
+      mock->nwait++;
+
+      if (mock->loading) {
+         fprintf(stderr, "job %d: waiting for mock files\n", id);
+      }
+      else if (!start_job(w, queue, slots, &nrun, sock, args)) {
+         fprintf(stderr, "job %d: waiting for a free slot\n", id);
+      }
+
+   }
+
+   fprintf(stderr, "stopping (%d running jobs)\n", nrun);
+   while (nrun > 0) nrun -= reap_jobs(slots, args.maxjobs, 1);
+
+   collect_mocks(cache, 1);
+   for (int i = 0 ; i < SERVE_MAXQUEUE ; i++) {
+      if (queue[i].mock == NULL) continue;
+      respond(queue[i].fd, queue[i].id, "daemon stopped", 0, 0);
+      close(queue[i].fd);
+      destroy_job(&queue[i].job);
+   }
+
+   close(sock);
+   close(SERVE_PIPE[0]);
+   close(SERVE_PIPE[1]);
+   unlink(path);
+
+   for (int i = 0 ; i < SERVE_MAXMOCKS ; i++) destroy_mock(cache + i);
+   free(slots);
+
+   return 0;
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+int
+collect_mocks
+(
+   mock_t * cache,
+   int      hang
+)
+// SYNOPSIS:
+//   Join the loader threads that are done. If 'hang' is set,
+//   wait for all of them.
+//
+// RETURN:
+//   The number of loaders joined.
+{
+
+   int njoined = 0;
+
+   for (int i = 0 ; i < SERVE_MAXMOCKS ; i++) {
+      if (!cache[i].loading) continue;
+      if (!hang && !__atomic_load_n(&cache[i].done, __ATOMIC_ACQUIRE)) {
+         continue;
+      }
+      pthread_join(cache[i].loader, NULL);
+      cache[i].loading = 0;
+      njoined++;
+   }
+
+   return njoined;
+
+}
+
+
+void
+destroy_mock
+(
+   mock_t * mock
+)
+{
+   if (mock->hash != NULL) destroy_hash(mock->hash);
+   free(mock->key);
+   free(mock->par);
+   for (int i = 0 ; i < SERVE_MAXFILES ; i++) free(mock->files[i]);
+   memset(mock, 0, sizeof(mock_t));
+}
+
+
+mock_t *
+get_mock
+(
+         mock_t * cache,
+   const job_t  * job
+)
+// SYNOPSIS:
+//   Find the mock files of the job in the cache, or start a
+//   thread to load them (see 'load_mock()'). The least recently
+//   used entry that is neither loading nor used by a job of the
+//   queue is replaced when the cache is full.
+//
+// RETURN:
+//   The cache entry (which may be loading), or NULL if the files
+//   cannot be found or all the entries are in use.
+{
+
+   char *key = resident_key(job);
+   if (key == NULL) return NULL;
+
+   mock_t *mock = NULL;
+   for (int i = 0 ; i < SERVE_MAXMOCKS ; i++) {
+      if (cache[i].key != NULL && strcmp(cache[i].key, key) == 0) {
+         free(key);
+         cache[i].used = time(NULL);
+         return cache + i;
+      }
+      if (cache[i].loading || cache[i].nwait > 0) continue;
+      if (mock == NULL || cache[i].used < mock->used) mock = cache + i;
+   }
+
+   if (mock == NULL) {
+      fprintf(stderr, "too many mock files in use\n");
+      free(key);
+      return NULL;
+   }
+
+   destroy_mock(mock);
+
+   mock->key = key;
+   mock->used = time(NULL);
+   mock->pargs.window = job->window;
+   mock->pargs.minmapq = job->minmapq;
+
+   for (int i = 0 ; job->mock[i] != NULL ; i++) {
+      mock->files[i] = strdup(job->mock[i]);
+      if (mock->files[i] == NULL) {
+         fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+         destroy_mock(mock);
+         return NULL;
+      }
+   }
+
+   mock->loading = 1;
+   if (pthread_create(&mock->loader, NULL, load_mock, mock) != 0) {
+      // Load in the current thread instead.
+      load_mock(mock);
+      mock->loading = 0;
+   }
+
+   return mock;
+
+}
+
+
+void
+job_done
+(
+   int sig
+)
+{
+   int errsv = errno;
+   // The pipe is non-blocking, it does not matter if it is full.
+   ssize_t w = write(SERVE_PIPE[1], "", 1);
+   (void) w;
+   errno = errsv;
+}
+
+
+int
+json_bool
+(
+   const char ** s,
+         int  *  value
+)
+{
+   if (strncmp(*s, "true", 4) == 0) {
+      *s += 4;
+      *value = 1;
+      return 1;
+   }
+   if (strncmp(*s, "false", 5) == 0) {
+      *s += 5;
+      *value = 0;
+      return 1;
+   }
+   return 0;
+}
+
+
+int
+json_number
+(
+   const char   ** s,
+         double  * value
+)
+{
+   // Reject what 'strtod()' accepts but JSON does not.
+   if (**s != '-' && (**s < '0' || **s > '9')) return 0;
+   char *endptr = NULL;
+   *value = strtod(*s, &endptr);
+   if (endptr == *s) return 0;
+   *s = endptr;
+   return 1;
+}
+
+
+int
+json_string
+(
+   const char ** s,
+         char ** value
+)
+// SYNOPSIS:
+//   Parse a JSON string. Unicode escapes are not supported.
+{
+
+   const char *c = *s;
+   if (*c++ != '"') return 0;
+
+   char *buf = malloc(strlen(c) + 1);
+   if (buf == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return 0;
+   }
+
+   size_t i = 0;
+   for ( ; *c != '"' ; c++) {
+      if ((unsigned char) *c < 0x20) goto fail;
+      if (*c != '\\') {
+         buf[i++] = *c;
+         continue;
+      }
+      switch (*++c) {
+         case '"':  buf[i++] = '"';  break;
+         case '\\': buf[i++] = '\\'; break;
+         case '/':  buf[i++] = '/';  break;
+         case 'b':  buf[i++] = '\b'; break;
+         case 'f':  buf[i++] = '\f'; break;
+         case 'n':  buf[i++] = '\n'; break;
+         case 'r':  buf[i++] = '\r'; break;
+         case 't':  buf[i++] = '\t'; break;
+         default:   goto fail;
+      }
+   }
+
+   buf[i] = '\0';
+   *value = buf;
+   *s = c+1;
+   return 1;
+
+fail:
+   free(buf);
+   return 0;
+
+}
+
+
+int
+json_strings
+(
+   const char ** s,
+         char ** values,
+         int     max
+)
+// SYNOPSIS:
+//   Parse a JSON array of at most 'max' strings in the
+//   NULL-terminated array 'values' (replacing its content).
+{
+
+   for (int i = 0 ; values[i] != NULL ; i++) {
+      free(values[i]);
+      values[i] = NULL;
+   }
+
+   if (*(*s)++ != '[') return 0;
+   json_ws(s);
+   if (**s == ']') {
+      (*s)++;
+      return 1;
+   }
+
+   for (int i = 0 ; i < max ; i++) {
+      if (!json_string(s, values + i)) return 0;
+      json_ws(s);
+      if (**s == ']') {
+         (*s)++;
+         return 1;
+      }
+      if (*(*s)++ != ',') return 0;
+      json_ws(s);
+   }
+
+   // Too many strings.
+   return 0;
+
+}
+
+
+void
+json_ws
+(
+   const char ** s
+)
+{
+   while (**s == ' ' || **s == '\t' || **s == '\n' || **s == '\r') (*s)++;
+}
+
+
+void *
+load_mock
+(
+   void * arg
+)
+// SYNOPSIS:
+//   Body of the loader threads: parse the mock files of the
+//   cache entry 'arg' and fit the mock profile. The hash table
+//   is NULL if the files cannot be parsed.
+//
+// SIDE EFFECTS:
+//   Sets 'done' when the entry is ready and wakes up the daemon.
+{
+
+   mock_t *mock = arg;
+
+   mock->hash = parse_mock_files(mock->files, mock->pargs);
+
+   // Fit the mock profile alone. Merging does not modify
+   // the hash table when there is no ChIP file.
+   if (mock->hash != NULL && mock->files[0] != NULL) {
+      char *none[1] = {NULL};
+      ChIP_t *ChIP = parse_ChIP_files(mock->hash, none, mock->pargs, 0);
+      if (ChIP == NULL) {
+         destroy_hash(mock->hash);
+         mock->hash = NULL;
+      }
+      else {
+         mock->n = nobs(ChIP);
+         if (mock->n > 0) mock->par = mle_zinb(ChIP->y, mock->n);
+         free(ChIP->y);
+         free(ChIP);
+      }
+   }
+
+   __atomic_store_n(&mock->done, 1, __ATOMIC_RELEASE);
+   job_done(0);
+
+   return NULL;
+
+}
+
+
+int
+read_request
+(
+   int    fd,
+   char * buf
+)
+// SYNOPSIS:
+//   Read a request up to the first newline (or EOF).
+{
+
+   size_t n = 0;
+   while (n < SERVE_MAXREQ-1) {
+      ssize_t got = read(fd, buf + n, SERVE_MAXREQ-1 - n);
+      if (got < 0 && errno == EINTR) continue;
+      if (got < 0) return 0;
+      if (got == 0) break;
+      char *nl = memchr(buf + n, '\n', got);
+      n += got;
+      if (nl != NULL) {
+         *nl = '\0';
+         return 1;
+      }
+   }
+
+   // Truncated requests are rejected.
+   if (n == SERVE_MAXREQ-1) return 0;
+   buf[n] = '\0';
+   return n > 0;
+
+}
+
+
+int
+reap_jobs
+(
+   slot_t * slots,
+   int      nslots,
+   int      hang
+)
+// SYNOPSIS:
+//   Collect the jobs that are done, and report the status, the
+//   duration and the peak memory of each to its client. If 'hang'
+//   is set, wait until at least one job is done.
+//
+// RETURN:
+//   The number of jobs collected.
+{
+
+   int nreaped = 0;
+   int status;
+   struct rusage ru;
+   pid_t pid;
+
+   while ((pid = wait4(-1, &status, hang ? 0 : WNOHANG, &ru)) != 0) {
+
+      if (pid < 0) {
+         // Interrupted by a signal, or no child left.
+         if (errno == EINTR && !SERVE_STOP) continue;
+         break;
+      }
+
+      slot_t *slot = NULL;
+      for (int i = 0 ; i < nslots ; i++) {
+         if (slots[i].pid == pid) slot = slots + i;
+      }
+      if (slot == NULL) continue;
+
+      struct timeval t1;
+      gettimeofday(&t1, NULL);
+      double secs = (t1.tv_sec - slot->t0.tv_sec) +
+            (t1.tv_usec - slot->t0.tv_usec) / 1e6;
+
+      const char *err = NULL;
+      if (!WIFEXITED(status)) {
+         err = "job killed (memory limit exceeded?)";
+      }
+      else if (WEXITSTATUS(status) != JOB_OK) {
+         int code = WEXITSTATUS(status);
+         err = code <= JOB_EOUTPUT ? JOB_ERRORS[code] : "job failed";
+      }
+
+      fprintf(stderr, "job %d: %s, %.1f s, %ld kB max RSS\n", slot->id,
+            err == NULL ? "done" : err, secs, ru.ru_maxrss);
+
+      respond(slot->fd, slot->id, err, secs, ru.ru_maxrss);
+      close(slot->fd);
+      slot->pid = 0;
+
+      nreaped++;
+      hang = 0;
+
+   }
+
+   return nreaped;
+
+}
+
+
+char *
+resident_key
+(
+   const job_t * job
+)
+// SYNOPSIS:
+//   Identify the binned mock files by their names, sizes and
+//   modification times, together with the parser options.
+//
+// RETURN:
+//   A newly allocated string, or NULL if a file cannot be found.
+{
+
+   char *key = NULL;
+   size_t sz = 0;
+   FILE *f = open_memstream(&key, &sz);
+   if (f == NULL) return NULL;
+
+   for (int i = 0 ; job->mock[i] != NULL ; i++) {
+      struct stat st;
+      if (stat(job->mock[i], &st) != 0) {
+         fprintf(stderr, "cannot open file %s\n", job->mock[i]);
+         fclose(f);
+         free(key);
+         return NULL;
+      }
+      fprintf(f, "%s\t%lld\t%lld\n", job->mock[i],
+            (long long) st.st_size, (long long) st.st_mtime);
+   }
+   fprintf(f, "%d\t%d", job->window, job->minmapq);
+
+   if (fclose(f) != 0) {
+      free(key);
+      return NULL;
+   }
+
+   return key;
+
+}
+
+
+void
+respond
+(
+         int    fd,
+         int    id,
+   const char * err,
+         double secs,
+         long   maxrss
+)
+// SYNOPSIS:
+//   Write the status line that terminates every response.
+//   Errors are ignored because the client may be gone.
+{
+   if (err == NULL) {
+      dprintf(fd, "{\"job\": %d, \"status\": \"ok\", \"seconds\": %.3f, "
+            "\"maxrss_kb\": %ld}\n", id, secs, maxrss);
+   }
+   else {
+      dprintf(fd, "{\"job\": %d, \"status\": \"error\", "
+            "\"message\": \"%s\"}\n", id, err);
+   }
+}
+
+
+void
+run_job
+(
+         int            fd,
+   const job_t        * job,
+   const mock_t       * mock,
+         serve_args_t   args
+)
+// SYNOPSIS:
+//   Body of a job process: parse the ChIP files, run Zerone and
+//   write the output. The resident mock data (shared with the
+//   daemon) counts towards the memory limit.
+//
+// SIDE EFFECTS:
+//   Terminates the process with one of the 'JOB_*' codes.
+{
+
+   size_t mb = job->memory;
+   if (args.maxmem > 0 && (mb == 0 || mb > args.maxmem)) mb = args.maxmem;
+   if (mb > 0) {
+      struct rlimit rl = { .rlim_cur = mb << 20, .rlim_max = mb << 20 };
+      setrlimit(RLIMIT_AS, &rl);
+   }
+
+   // The output must be a regular file (not a link, a device
+   // or a named pipe, which would block the job).
+   FILE *out = NULL;
+   if (job->output == NULL) {
+      out = fdopen(fd, "w");
+   }
+   else {
+      struct stat st;
+      int ofd = open(job->output,
+            O_WRONLY | O_CREAT | O_NOFOLLOW | O_NONBLOCK, 0644);
+      if (ofd >= 0 && fstat(ofd, &st) == 0 && S_ISREG(st.st_mode) &&
+            ftruncate(ofd, 0) == 0) out = fdopen(ofd, "w");
+      else if (ofd >= 0) close(ofd);
+   }
+   if (out == NULL) {
+      fprintf(stderr, "cannot open output %s\n",
+            job->output != NULL ? job->output : "stream");
+      _exit(JOB_EOUTPUT);
+   }
+
+   zerone_parser_args_t pargs;
+   pargs.window = job->window;
+   pargs.minmapq = job->minmapq;
+
+   // The merge modifies the mock hash table of this process only.
+   ChIP_t *ChIP = parse_ChIP_files(mock->hash, (char **) job->chip,
+         pargs, job->nomock);
+   if (ChIP == NULL) _exit(JOB_EINPUT);
+
+   zerone_args_t zargs = {0};
+   zargs.earlyqc = job->earlyqc;
+   zargs.workers = job->workers < args.maxworkers ?
+      job->workers : args.maxworkers;
+
+   // The windows added by the ChIP files have no mock read, so
+   // the cached fit is padded with as many 0s (see 'pad_zinb()').
+   zinb_par_t par;
+   const size_t n = nobs(ChIP);
+   if (mock->par != NULL) {
+      par = *mock->par;
+      if (n == mock->n || (n > mock->n && pad_zinb(&par, mock->n,
+                  n - mock->n))) zargs.mockpar = &par;
+   }
+
+   zerone_t *Z = do_zerone(ChIP, &zargs);
+   if (Z == NULL) _exit(JOB_ERUN);
+
+   output_args_t oargs = {0};
+   oargs.window = job->window;
+   oargs.list = job->list;
+   oargs.nomock = job->nomock;
+   oargs.minconf = job->minconf;
+
+   print_output(out, Z, oargs);
+   if (fclose(out) != 0) _exit(JOB_EOUTPUT);
+
+   _exit(JOB_OK);
+
+}
+
+
+int
+start_job
+(
+   wait_t       * w,
+   wait_t       * queue,
+   slot_t       * slots,
+   int          * nrun,
+   int            sock,
+   serve_args_t   args
+)
+// SYNOPSIS:
+//   Start the job 'w' of the queue in a job process if a slot
+//   is free. The job fails if its mock files could not be loaded.
+//   Nothing is started once the daemon is stopping.
+//
+// RETURN:
+//   1 if the job left the queue, 0 if it is still waiting.
+//
+// SIDE EFFECTS:
+//   Frees 'w' for the next job of the queue if the job left it.
+{
+
+   const int id = w->id;
+
+   if (w->mock->hash == NULL) {
+      fprintf(stderr, "job %d: cannot read mock files\n", id);
+      respond(w->fd, id, "cannot read mock files", 0, 0);
+      close(w->fd);
+      goto clean_and_return;
+   }
+
+   // The job is started later by 'serve()' (or answered
+   // when the daemon stops).
+   if (SERVE_STOP || *nrun >= args.maxjobs) return 0;
+
+   slot_t *slot = slots;
+   while (slot->pid != 0) slot++;
+
+   gettimeofday(&slot->t0, NULL);
+   pid_t pid = fork();
+
+   if (pid == 0) {
+      // The connections of the other jobs must be
+      // closed for their clients to receive EOF.
+      for (int i = 0 ; i < args.maxjobs ; i++) {
+         if (slots[i].pid != 0) close(slots[i].fd);
+      }
+      for (int i = 0 ; i < SERVE_MAXQUEUE ; i++) {
+         if (queue[i].mock != NULL && queue + i != w) close(queue[i].fd);
+      }
+      close(sock);
+      close(SERVE_PIPE[0]);
+      close(SERVE_PIPE[1]);
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      signal(SIGCHLD, SIG_DFL);
+      run_job(w->fd, &w->job, w->mock, args);
+   }
+
+   if (pid < 0) {
+      fprintf(stderr, "job %d: cannot fork\n", id);
+      respond(w->fd, id, "cannot start job", 0, 0);
+      close(w->fd);
+   }
+   else {
+      fprintf(stderr, "job %d: started (pid %d)\n", id, (int) pid);
+      slot->pid = pid;
+      slot->id = id;
+      slot->fd = w->fd;
+      (*nrun)++;
+   }
+
+clean_and_return:
+   destroy_job(&w->job);
+   w->mock->nwait--;
+   w->mock = NULL;
+   return 1;
+
+}
+
+
+void
+stop_serving
+(
+   int sig
+)
+{
+   SERVE_STOP = 1;
+}
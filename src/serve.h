@@ -0,0 +1,85 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _SERVE_H
+#define _SERVE_H
+
+#include <sys/types.h>
+#include "zerone.h"
+
+// Resident daemon ('zerone serve'). Jobs are submitted as a
+// single-line JSON object over a Unix domain socket, e.g.
+//
+//   {"mock": ["m.bam"], "chip": ["c1.bam", "c2.bam"], "list": true}
+//
+// Recognized keys are "mock", "chip", "window", "quality",
+// "list", "confidence", "no-mock", "early-qc", "workers",
+// "memory" (MB) and "output" (file name). The results are
+// streamed back on the connection unless "output" is given.
+// The response always ends with a JSON status line such as
+//
+//   {"job": 1, "status": "ok", "seconds": 2.1, "maxrss_kb": 5012}
+//
+// The socket is only accessible to the user running the
+// daemon, and requests from other users are rejected. File
+// names must be absolute because the daemon does not run in
+// the directory of the client.
+//
+// The daemon keeps the binned mock files and the fit of the
+// mock profile in memory. Mock files that are not in memory
+// are loaded by a thread, and the jobs that need them wait
+// in a queue meanwhile. Each job runs in its own process
+// with its own memory limit, and the number of running jobs
+// is capped (the other jobs wait in the queue).
+
+#define SERVE_MAXFILES  255      // max files per job //
+#define SERVE_MAXMOCKS  8        // cached mock sets //
+#define SERVE_MAXREQ    65536    // max request size //
+#define SERVE_MAXQUEUE  64       // max jobs waiting to start //
+
+struct job_t;
+struct serve_args_t;
+typedef struct job_t job_t;
+typedef struct serve_args_t serve_args_t;
+
+struct job_t {
+   char   * mock[SERVE_MAXFILES+1];  // mock files (NULL-terminated) //
+   char   * chip[SERVE_MAXFILES+1];  // ChIP files (NULL-terminated) //
+   char   * output;    // output file (or NULL to stream) //
+   int      window;    // window size //
+   int      minmapq;   // minimum mapping quality //
+   int      list;      // list output //
+   int      nomock;    // no mock file //
+   int      earlyqc;   // early QC //
+   int      workers;   // worker processes //
+   size_t   memory;    // memory limit in MB (0: none) //
+   double   minconf;   // minimum confidence //
+};
+
+struct serve_args_t {
+   int      maxjobs;     // max running jobs //
+   int      maxworkers;  // max worker processes per job //
+   size_t   maxmem;      // max memory per job in MB (0: none) //
+};
+
+void destroy_job (job_t *);
+int  parse_job (const char *, job_t *, const char **);
+int  serve (const char *, serve_args_t);
+
+#endif
@@ -0,0 +1,440 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "checkpoint.h"
+#include "debug.h"
+#include "shard.h"
+
+#define SUCCESS 1
+#define FAILURE 0
+
+// Commands sent to the workers.
+#define CMD_ESTEP  1
+#define CMD_DECODE 2
+#define CMD_QUIT   3
+
+
+//  ---- Declaration of local functions  ---- //
+int    broadcast (const shard_t *, int, const int *, const zerone_t *);
+int    recv_all (int, void *, size_t);
+void   run_worker (const zerone_t *, const shard_t *, int);
+int    send_all (int, const void *, size_t);
+void   stop_workers (shard_t *, int);
+
+
+int
+send_all
+(
+         int     fd,
+   const void  * buf,
+         size_t  len
+)
+// Write 'len' bytes to the socket. Do not raise SIGPIPE if
+// the other end is closed, the error is reported instead.
+{
+
+   const char *ptr = buf;
+   while (len > 0) {
+      ssize_t nb = send(fd, ptr, len, MSG_NOSIGNAL);
+      if (nb < 0 && errno == EINTR) continue;
+      if (nb <= 0) return FAILURE;
+      ptr += nb;
+      len -= nb;
+   }
+
+   return SUCCESS;
+
+}
+
+
+int
+recv_all
+(
+   int     fd,
+   void  * buf,
+   size_t  len
+)
+// Read exactly 'len' bytes from the socket.
+{
+
+   char *ptr = buf;
+   while (len > 0) {
+      ssize_t nb = recv(fd, ptr, len, 0);
+      if (nb < 0 && errno == EINTR) continue;
+      if (nb <= 0) return FAILURE;
+      ptr += nb;
+      len -= nb;
+   }
+
+   return SUCCESS;
+
+}
+
+
+int
+split_shards
+(
+   const ChIP_t  * ChIP,
+         int       nworkers,
+         shard_t * shards
+)
+// SYNOPSIS:
+//   Split the blocks in contiguous shards with approximately
+//   the same number of windows. Every shard has at least one
+//   block, so there may be fewer shards than workers.
+//
+// RETURN:
+//   The number of shards.
+{
+
+   const size_t n = nobs(ChIP);
+   const int ns = nworkers < ChIP->nb ? nworkers : ChIP->nb;
+
+   int b = 0;
+   size_t off = 0;
+   for (int s = 0 ; s < ns ; s++) {
+      shards[s].b0 = b;
+      shards[s].off = off;
+      shards[s].nb = 0;
+      shards[s].n = 0;
+      // Leave at least one block to every remaining shard.
+      const size_t target = (s+1) * n / ns;
+      while (b < ChIP->nb - (ns-1-s) && (shards[s].nb == 0 ||
+               off < target || s == ns-1)) {
+         shards[s].nb++;
+         shards[s].n += ChIP->sz[b];
+         off += ChIP->sz[b];
+         b++;
+      }
+   }
+
+   return ns;
+
+}
+
+
+void
+run_worker
+(
+   const zerone_t * Z,
+   const shard_t  * shard,
+         int        fd
+)
+// SYNOPSIS:
+//   Main loop of a worker process. The worker answers the
+//   commands of the coordinator until it is told to quit or
+//   the socket is closed. The function does not return.
+{
+
+   const size_t m = Z->m;
+   const size_t r = Z->ChIP->r;
+   const size_t n = shard->n;
+   const size_t ssz = 1 + m*m + m*(r+2);
+
+   // The shard is seen as a time series of its own.
+   ChIP_t *view = malloc(sizeof(ChIP_t) + shard->nb * sizeof(uint));
+   if (view == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      _exit(EXIT_FAILURE);
+   }
+
+   view->r = r;
+   view->nb = shard->nb;
+   view->nomock = Z->ChIP->nomock;
+   view->seg = NULL;
+   view->y = Z->ChIP->y + shard->off*(r - view->nomock);
+   view->nm = Z->ChIP->nm + 32*shard->b0;
+   memcpy(view->sz, Z->ChIP->sz + shard->b0, shard->nb * sizeof(uint));
+
+   double Q[9];
+   double p[3*64];
+   zerone_t W = *Z;
+   W.ChIP = view;
+   W.Q = memcpy(Q, Z->Q, m*m * sizeof(double));
+   W.p = memcpy(p, Z->p, m*(r+1) * sizeof(double));
+   W.phi = NULL;
+   W.pem = NULL;
+   W.path = NULL;
+
+   bw_t *bw = new_bw(&W);
+   if (bw == NULL) _exit(EXIT_FAILURE);
+
+   double prob[m];
+   for (size_t i = 0 ; i < m ; i++) prob[i] = 1.0 / m;
+
+   double stat[ssz];
+   int status = EXIT_FAILURE;
+
+   int hdr[4];
+   while (recv_all(fd, hdr, sizeof(hdr))) {
+
+      if (hdr[0] == CMD_QUIT) {
+         status = EXIT_SUCCESS;
+         break;
+      }
+
+      if (!recv_all(fd, Q, m*m * sizeof(double))) break;
+      if (!recv_all(fd, p, m*(r+1) * sizeof(double))) break;
+
+      if (hdr[0] == CMD_ESTEP) {
+         // Same as the E-step of 'bw_iter()' on the shard.
+         unsigned int lin_space_no_warn = 4;
+         zinm_prob(&W, bw->index, lin_space_no_warn, bw->pem);
+         stat[0] = block_fwdb(m, view->nb, view->sz, Q, prob,
+               bw->pem, bw->phi, stat+1);
+         suff_stats(m, view, bw->index, bw->i0, bw->phi, stat+1+m*m);
+         if (!send_all(fd, stat, ssz * sizeof(double))) break;
+      }
+
+      else if (hdr[0] == CMD_DECODE) {
+         // Same as 'bw_finish()' and 'zerone_viterbi()' on the
+         // shard, with the state map of the whole fit.
+         unsigned int log_space_no_warn = 5;
+         zinm_prob(&W, bw->index, log_space_no_warn, bw->pem);
+         W.phi = bw->phi;
+         W.pem = bw->pem;
+         reorder(&W, hdr+1);
+
+         double log_Q[9];
+         double initp[3];
+         for (size_t i = 0 ; i < 3 ; i++) initp[i] = log(1.0/3);
+         for (size_t i = 0 ; i < 9 ; i++) log_Q[i] = log(Q[i]);
+
+         int *path = malloc(n * sizeof(int));
+         if (path == NULL) {
+            fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+            break;
+         }
+         block_viterbi(m, view->nb, view->sz, log_Q, initp, W.pem, path);
+
+         int sent = send_all(fd, W.phi, n*m * sizeof(double)) &&
+                    send_all(fd, path, n * sizeof(int));
+         free(path);
+         if (!sent) break;
+      }
+
+   }
+
+   // Do not flush the stdio buffers inherited from the parent.
+   _exit(status);
+
+}
+
+
+int
+broadcast
+(
+   const shard_t  * shards,
+         int        ns,
+   const int      * hdr,
+   const zerone_t * Z
+)
+// Send a command and the current parameters to all the workers.
+{
+
+   const size_t m = Z->m;
+   const size_t r = Z->ChIP->r;
+
+   for (int s = 0 ; s < ns ; s++) {
+      if (!send_all(shards[s].fd, hdr, 4 * sizeof(int)) ||
+          !send_all(shards[s].fd, Z->Q, m*m * sizeof(double)) ||
+          !send_all(shards[s].fd, Z->p, m*(r+1) * sizeof(double))) {
+         fprintf(stderr, "lost connection to worker %d\n", s);
+         return FAILURE;
+      }
+   }
+
+   return SUCCESS;
+
+}
+
+
+void
+stop_workers
+(
+   shard_t * shards,
+   int       ns
+)
+// Tell the workers to quit and wait for them to exit.
+{
+
+   const int hdr[4] = {CMD_QUIT};
+   for (int s = 0 ; s < ns ; s++) {
+      if (shards[s].pid <= 0) continue;
+      send_all(shards[s].fd, hdr, sizeof(hdr));
+      close(shards[s].fd);
+      waitpid(shards[s].pid, NULL, 0);
+   }
+
+   return;
+
+}
+
+
+int
+shard_zerone
+(
+         zerone_t      * Z,
+   const zerone_args_t * args,
+         double        * trace
+)
+// SYNOPSIS:
+//   Run the Baum-Welch algorithm with 'args->workers' processes
+//   from the parameters of 'Z' (after 'Z->iter' cycles), then
+//   reorder the states and compute the Viterbi path. Checkpoints
+//   are written by the coordinator after every cycle. Only the
+//   posterior probabilities and the Viterbi path are gathered,
+//   so 'Z->pem' is 'NULL' on exit.
+//
+// RETURN:
+//   0 upon success, -1 in case of failure.
+//
+// SIDE EFFECTS:
+//   Update 'Z' in place.
+{
+
+   const size_t m = Z->m;
+   const size_t r = Z->ChIP->r;
+   const size_t n = nobs(Z->ChIP);
+   const size_t ssz = 1 + m*m + m*(r+2);
+   const double R = Z->p[1] / Z->p[0];
+
+   int ns = 0;
+   int status = -1;
+
+   double sum[ssz];
+   double stat[ssz];
+   double newp[3*64];
+
+   shard_t *shards = calloc(args->workers, sizeof(shard_t));
+   if (shards == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return -1;
+   }
+
+   ns = split_shards(Z->ChIP, args->workers, shards);
+
+   // Start the workers. They inherit the observations
+   // and the current parameters.
+   for (int s = 0 ; s < ns ; s++) {
+      int sv[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+         fprintf(stderr, "cannot create socket (%s)\n", strerror(errno));
+         ns = s;
+         goto clean_and_return;
+      }
+      pid_t pid = fork();
+      if (pid < 0) {
+         fprintf(stderr, "cannot start worker (%s)\n", strerror(errno));
+         close(sv[0]);
+         close(sv[1]);
+         ns = s;
+         goto clean_and_return;
+      }
+      if (pid == 0) {
+         close(sv[0]);
+         for (int i = 0 ; i < s ; i++) close(shards[i].fd);
+         run_worker(Z, shards+s, sv[1]);
+      }
+      close(sv[1]);
+      shards[s].fd = sv[0];
+      shards[s].pid = pid;
+      debug_print("worker %d: %d blocks, %ld windows\n",
+            s, shards[s].nb, shards[s].n);
+   }
+
+   const int estep[4] = {CMD_ESTEP};
+   for (Z->iter++ ; Z->iter < BW_MAXITER ; Z->iter++) {
+
+#ifdef DEBUG
+fprintf(stderr, "iter: %d\r", Z->iter);
+#endif
+
+      if (!broadcast(shards, ns, estep, Z)) goto clean_and_return;
+
+      // Reduce the sufficient statistics.
+      memset(sum, 0, ssz * sizeof(double));
+      for (int s = 0 ; s < ns ; s++) {
+         if (!recv_all(shards[s].fd, stat, ssz * sizeof(double))) {
+            fprintf(stderr, "lost connection to worker %d\n", s);
+            goto clean_and_return;
+         }
+         for (size_t j = 0 ; j < ssz ; j++) sum[j] += stat[j];
+      }
+
+      // M-step (see 'bw_iter()').
+      Z->l = sum[0];
+      update_trans(m, Z->Q, sum+1);
+      if (update_p(Z, R, sum+1+m*m, newp) < 0) goto clean_and_return;
+      trace[Z->iter-1] = Z->l;
+
+      double maxd = 0.0;
+      for (size_t i = 0 ; i < m*(r+1) ; i++) {
+         double thisd = fabs(newp[i]-Z->p[i]);
+         maxd = thisd > maxd ? thisd : maxd;
+      }
+
+      if (maxd < TOLERANCE) break;
+      memcpy(Z->p, newp, m*(r+1) * sizeof(double));
+
+      // Failure to write is not fatal (the function warns).
+      if (args->checkpoint != NULL) {
+         write_checkpoint(args->checkpoint, Z, trace);
+      }
+
+   }
+
+#ifdef DEBUG
+fprintf(stderr, "\n");
+#endif
+
+   // Decode the shards with sorted states.
+   int decode[4] = {CMD_DECODE};
+   get_state_map(Z, decode+1);
+   if (!broadcast(shards, ns, decode, Z)) goto clean_and_return;
+   reorder(Z, decode+1);
+
+   Z->phi = malloc(n*m * sizeof(double));
+   Z->path = malloc(n * sizeof(int));
+   if (Z->phi == NULL || Z->path == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   for (int s = 0 ; s < ns ; s++) {
+      size_t off = shards[s].off;
+      size_t sn = shards[s].n;
+      if (!recv_all(shards[s].fd, Z->phi + off*m, sn*m * sizeof(double))
+            || !recv_all(shards[s].fd, Z->path + off, sn * sizeof(int))) {
+         fprintf(stderr, "lost connection to worker %d\n", s);
+         goto clean_and_return;
+      }
+   }
+
+   status = 0;
+
+clean_and_return:
+   stop_workers(shards, ns);
+   free(shards);
+   return status;
+
+}
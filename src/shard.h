@@ -0,0 +1,49 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#include <sys/types.h>
+#include "zerone.h"
+
+// Distributed Baum-Welch algorithm. The blocks are split in
+// contiguous shards of similar size, each owned by a worker
+// process. At every cycle, the coordinator broadcasts the
+// parameters and the workers return the sufficient statistics
+// of their shard (log-likelihood, expected transitions and
+// statistics of the emission parameters). The coordinator sums
+// them and runs the M-step. The Viterbi path is computed by the
+// workers on their own shard.
+
+struct shard_t;
+typedef struct shard_t shard_t;
+
+struct shard_t {
+   int      fd;     // socket to the worker //
+   pid_t    pid;    // worker process //
+   int      b0;     // first block //
+   int      nb;     // number of blocks //
+   size_t   off;    // first window //
+   size_t   n;      // number of windows //
+};
+
+int shard_zerone (zerone_t *, const zerone_args_t *, double *);
+int split_shards (const ChIP_t *, int, shard_t *);
+
+#endif
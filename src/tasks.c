@@ -0,0 +1,194 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "tasks.h"
+
+struct pool_t;
+typedef struct pool_t pool_t;
+
+struct pool_t {
+   task_t         ** ready;    // tasks ready to run (stack) //
+   int               nready;   // number of ready tasks //
+   int               nleft;    // tasks not done yet //
+   int               nrun;     // tasks running //
+   int               failed;   // a task has failed //
+   pthread_mutex_t   lock;
+   pthread_cond_t    cond;
+};
+
+
+//  ---- Declaration of local functions  ---- //
+void * pool_worker (void *);
+
+
+//  -- Definitions of exported functions  --- //
+
+task_t *
+new_task
+(
+   task_fn_t   fn,
+   void      * arg
+)
+{
+   task_t *new = calloc(1, sizeof(task_t));
+   if (new == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return NULL;
+   }
+   new->fn = fn;
+   new->arg = arg;
+   return new;
+}
+
+
+int
+task_after
+(
+   task_t * task,
+   task_t * dep
+)
+// SYNOPSIS:
+//   Declare that 'task' cannot start before 'dep' is done.
+//
+// RETURN:
+//   0 on success, -1 if 'dep' has too many dependent tasks.
+{
+   if (dep->nnext >= SCHED_MAXNEXT) {
+      fprintf(stderr, "too many dependent tasks %s:%d\n",
+            __FILE__, __LINE__);
+      return -1;
+   }
+   dep->next[dep->nnext++] = task;
+   task->ndeps++;
+   return 0;
+}
+
+
+int
+run_tasks
+(
+   task_t ** tasks,
+   int       ntasks,
+   int       nthreads
+)
+// SYNOPSIS:
+//   Run the tasks on 'nthreads' threads (including the calling
+//   thread) in an order compatible with the dependencies. After
+//   a failure, the tasks that have not started are skipped.
+//   With one thread, the tasks run in the calling thread.
+//
+// RETURN:
+//   0 if all the tasks succeeded, -1 otherwise.
+//
+// SIDE EFFECTS:
+//   The dependency counts of the tasks are consumed.
+{
+
+   pool_t pool = {0};
+   pool.nleft = ntasks;
+   pool.ready = malloc(ntasks * sizeof(task_t *));
+   if (pool.ready == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return -1;
+   }
+
+   for (int i = 0 ; i < ntasks ; i++) {
+      if (tasks[i]->ndeps == 0) pool.ready[pool.nready++] = tasks[i];
+   }
+
+   pthread_mutex_init(&pool.lock, NULL);
+   pthread_cond_init(&pool.cond, NULL);
+
+   // More threads than tasks would idle.
+   if (nthreads > ntasks) nthreads = ntasks;
+   if (nthreads < 1) nthreads = 1;
+
+   pthread_t *tid = malloc(nthreads * sizeof(pthread_t));
+   int nstarted = 0;
+   if (tid != NULL) {
+      for (int i = 1 ; i < nthreads ; i++) {
+         if (pthread_create(tid+i, NULL, pool_worker, &pool) != 0) break;
+         nstarted++;
+      }
+   }
+
+   // The calling thread is part of the pool.
+   pool_worker(&pool);
+   for (int i = 1 ; i <= nstarted ; i++) pthread_join(tid[i], NULL);
+
+   pthread_mutex_destroy(&pool.lock);
+   pthread_cond_destroy(&pool.cond);
+   free(tid);
+   free(pool.ready);
+
+   return pool.failed || pool.nleft > 0 ? -1 : 0;
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+void *
+pool_worker
+(
+   void * arg
+)
+// SYNOPSIS:
+//   Run ready tasks until there is nothing left to do.
+{
+
+   pool_t *pool = (pool_t *) arg;
+
+   pthread_mutex_lock(&pool->lock);
+   while (1) {
+      // Nothing can be started after a failure.
+      if (pool->failed) pool->nready = 0;
+      if (pool->nready == 0) {
+         // Done, or a cycle in the graph.
+         if (pool->nrun == 0) break;
+         pthread_cond_wait(&pool->cond, &pool->lock);
+         continue;
+      }
+
+      task_t *task = pool->ready[--pool->nready];
+      pool->nrun++;
+      pthread_mutex_unlock(&pool->lock);
+
+      int status = task->fn(task->arg);
+
+      pthread_mutex_lock(&pool->lock);
+      pool->nrun--;
+      pool->nleft--;
+      if (status < 0) pool->failed = 1;
+      for (int i = 0 ; i < task->nnext ; i++) {
+         if (--task->next[i]->ndeps == 0) {
+            pool->ready[pool->nready++] = task->next[i];
+         }
+      }
+      pthread_cond_broadcast(&pool->cond);
+   }
+   pthread_cond_broadcast(&pool->cond);
+   pthread_mutex_unlock(&pool->lock);
+
+   return NULL;
+
+}
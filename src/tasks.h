@@ -0,0 +1,48 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _TASKS_H
+#define _TASKS_H
+
+// Minimal task-graph scheduler. Tasks are created with
+// 'new_task()', ordered with 'task_after()' and run on a
+// pool of threads by 'run_tasks()'. A task is started as
+// soon as all the tasks it depends on are done.
+
+#define SCHED_MAXNEXT 64   // max dependent tasks per task //
+
+struct task_t;
+typedef struct task_t task_t;
+
+// Tasks return 0 on success and -1 on failure.
+typedef int (*task_fn_t) (void *);
+
+struct task_t {
+   task_fn_t   fn;                     // task body //
+   void      * arg;                    // argument of 'fn' //
+   int         ndeps;                  // unfinished dependencies //
+   int         nnext;                  // number of dependent tasks //
+   task_t    * next[SCHED_MAXNEXT];    // dependent tasks //
+};
+
+task_t * new_task (task_fn_t, void *);
+int      run_tasks (task_t **, int, int);
+int      task_after (task_t *, task_t *);
+
+#endif
@@ -0,0 +1,255 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "trace.h"
+
+struct event_t;
+struct chunk_t;
+struct tbuf_t;
+typedef struct event_t event_t;
+typedef struct chunk_t chunk_t;
+typedef struct tbuf_t tbuf_t;
+
+struct event_t {
+   int64_t      ts;       // nanoseconds since 'start_trace()' //
+   const char * name;     // name of the stage //
+   const char * label;    // file name or NULL //
+   int          id;       // block or part number //
+   char         ph;       // 'B' (begin) or 'E' (end) //
+};
+
+struct chunk_t {
+   chunk_t    * next;
+   int          n;
+   event_t      ev[TRACE_CHUNK];
+};
+
+struct tbuf_t {
+   tbuf_t     * next;     // next buffer of the global list //
+   int          tid;      // thread number in the trace //
+   long         lost;     // events lost to memory errors //
+   chunk_t    * head;
+   chunk_t    * tail;
+};
+
+
+//  ----- Globals ----- //
+int trace_on = 0;
+
+tbuf_t        * ALLBUFS = NULL;   // buffers of all the threads //
+int             NTIDS = 0;        // threads with a buffer //
+struct timespec T0;               // time of 'start_trace()' //
+__thread tbuf_t * MYBUF = NULL;   // buffer of the thread //
+
+
+//  ---- Declaration of local functions  ---- //
+tbuf_t * new_tbuf (void);
+void     json_escape (FILE *, const char *);
+
+
+//  -- Definitions of exported functions  --- //
+
+void
+start_trace
+(void)
+// SYNOPSIS:
+//   Set the time origin and turn tracing on. Call before
+//   starting the threads to be traced.
+{
+   clock_gettime(CLOCK_MONOTONIC, &T0);
+   trace_on = 1;
+}
+
+
+void
+trace_event
+(
+         char   ph,
+   const char * name,
+   const char * label,
+         int    id
+)
+// SYNOPSIS:
+//   Append an event to the buffer of the calling thread. Use
+//   the macros 'trace_begin()' and 'trace_end()' instead.
+//
+// SIDE EFFECTS:
+//   The buffer of the thread is created on the first call.
+//   Events are dropped (and counted) in case of memory error.
+{
+
+   if (MYBUF == NULL && (MYBUF = new_tbuf()) == NULL) return;
+
+   tbuf_t *buf = MYBUF;
+   if (buf->tail == NULL || buf->tail->n == TRACE_CHUNK) {
+      chunk_t *new = calloc(1, sizeof(chunk_t));
+      if (new == NULL) {
+         buf->lost++;
+         return;
+      }
+      if (buf->tail == NULL) buf->head = new;
+      else buf->tail->next = new;
+      buf->tail = new;
+   }
+
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   event_t *ev = buf->tail->ev + buf->tail->n++;
+   ev->ts = (now.tv_sec - T0.tv_sec) * 1000000000LL +
+      (now.tv_nsec - T0.tv_nsec);
+   ev->name = name;
+   ev->label = label;
+   ev->id = id;
+   ev->ph = ph;
+
+}
+
+
+int
+write_trace
+(
+   const char * fname
+)
+// SYNOPSIS:
+//   Turn tracing off, write the events of all the threads in
+//   'fname' and release the buffers. The other threads must be
+//   done (joined) when this function is called.
+//
+// RETURN:
+//   0 on success, -1 in case of failure.
+{
+
+   trace_on = 0;
+
+   int status = -1;
+   FILE *f = fopen(fname, "w");
+   if (f == NULL) {
+      fprintf(stderr, "cannot open trace file %s\n", fname);
+      goto clean_and_return;
+   }
+
+   fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+   fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+         "\"args\":{\"name\":\"zerone\"}}");
+
+   for (tbuf_t *buf = ALLBUFS ; buf != NULL ; buf = buf->next) {
+      fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+            "\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+            buf->tid, buf->tid);
+      if (buf->lost > 0) {
+         fprintf(stderr, "trace: %ld events lost (thread %d)\n",
+               buf->lost, buf->tid);
+      }
+      for (chunk_t *c = buf->head ; c != NULL ; c = c->next) {
+         for (int i = 0 ; i < c->n ; i++) {
+            event_t *ev = c->ev + i;
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"zerone\","
+                  "\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+                  ev->name, ev->ph, ev->ts / 1000.0, buf->tid);
+            // Arguments are shown on the begin events.
+            if (ev->ph == 'B' && (ev->label != NULL || ev->id >= 0)) {
+               fprintf(f, ",\"args\":{");
+               if (ev->label != NULL) {
+                  fprintf(f, "\"file\":");
+                  json_escape(f, ev->label);
+               }
+               if (ev->id >= 0) {
+                  fprintf(f, "%s\"id\":%d",
+                        ev->label != NULL ? "," : "", ev->id);
+               }
+               fprintf(f, "}");
+            }
+            fprintf(f, "}");
+         }
+      }
+   }
+
+   fprintf(f, "\n]}\n");
+   if (fclose(f) != 0) {
+      fprintf(stderr, "cannot write trace file %s\n", fname);
+      goto clean_and_return;
+   }
+
+   status = 0;
+
+clean_and_return:
+   while (ALLBUFS != NULL) {
+      tbuf_t *buf = ALLBUFS;
+      ALLBUFS = buf->next;
+      while (buf->head != NULL) {
+         chunk_t *c = buf->head;
+         buf->head = c->next;
+         free(c);
+      }
+      free(buf);
+   }
+   NTIDS = 0;
+   MYBUF = NULL;
+
+   return status;
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+tbuf_t *
+new_tbuf
+(void)
+// SYNOPSIS:
+//   Create the buffer of the calling thread and push it on the
+//   global list. This is the only operation shared by the threads,
+//   and it is lock-free.
+{
+
+   tbuf_t *new = calloc(1, sizeof(tbuf_t));
+   if (new == NULL) return NULL;
+
+   new->tid = __atomic_add_fetch(&NTIDS, 1, __ATOMIC_RELAXED);
+   new->next = __atomic_load_n(&ALLBUFS, __ATOMIC_RELAXED);
+   while (!__atomic_compare_exchange_n(&ALLBUFS, &new->next, new,
+            0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+   return new;
+
+}
+
+
+void
+json_escape
+(
+         FILE * f,
+   const char * s
+)
+// SYNOPSIS:
+//   Write 's' as a JSON string.
+{
+   fputc('"', f);
+   for ( ; *s != '\0' ; s++) {
+      unsigned char c = *s;
+      if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+      else if (c < 0x20) fprintf(f, "\\u%04x", c);
+      else fputc(c, f);
+   }
+   fputc('"', f);
+}
@@ -0,0 +1,46 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+// Timeline of the stages of a run in Chrome trace format (open the
+// file with chrome://tracing or https://ui.perfetto.dev). Each
+// thread appends its events to a buffer of its own, without locks.
+// The buffers are pushed on a global list (with an atomic exchange)
+// when a thread records its first event, and they are written by
+// 'write_trace()' when all the other threads are done. When tracing
+// is off (the default), the macros below only test a global flag.
+
+#define TRACE_CHUNK 4096   // events per chunk of a buffer //
+
+extern int trace_on;
+
+// The names must be string literals, the labels (file names, may
+// be NULL) must outlive the trace and 'id' is a block or a part
+// number (-1 if none).
+#define trace_begin(name, label, id) \
+   do { if (trace_on) trace_event('B', name, label, id); } while (0)
+#define trace_end(name, label, id) \
+   do { if (trace_on) trace_event('E', name, label, id); } while (0)
+
+void   start_trace (void);
+void   trace_event (char, const char *, const char *, int);
+int    write_trace (const char *);
+
+#endif
@@ -0,0 +1,645 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Microbenchmarks of the kernels. The modules are compiled with
+// optimizations (see 'make bench'). The parser is included so that
+// its local functions can be called directly.
+//
+// USAGE:
+//   runbench [-n windows] [-r profiles] [-s sparsity] [-b blocks]
+//            [-R reads] [-t threads] [-k repetitions] [-w warm-up]
+//            [kernel ...]
+//
+// The observations are random: a window is all 0 with probability
+// 'sparsity', otherwise the counts are geometric with mean 2. Every
+// repetition is timed separately. The buffers that the kernels
+// modify in place are reset outside of the timed region.
+
+#include <getopt.h>
+#include <time.h>
+#include <x86intrin.h>
+#include "parse.c"
+
+#define BENCH_MAXREPS 1000
+
+struct data_t;
+struct kernel_t;
+typedef struct data_t data_t;
+typedef struct kernel_t kernel_t;
+
+struct data_t {
+   // Sizes.
+   unsigned int   m;         // number of states //
+   unsigned int   n;         // number of windows //
+   unsigned int   r;         // number of profiles //
+   unsigned int   nb;        // number of blocks //
+   unsigned int * sz;        // sizes of the blocks //
+   size_t         nreads;    // number of reads //
+   int            threads;   // threads of the threaded kernels //
+   // HMM.
+   double         Q[9];      // transitions //
+   double         init[3];   // initial probabilities //
+   double         logQ[9];
+   double         logi[3];
+   double       * prob;      // emission probabilities //
+   double       * logp;      // same in log space //
+   double       * alpha;     // output of 'fwd()' //
+   double       * work;      // copy of the above //
+   double       * phi;
+   double         T[9];
+   int          * path;
+   // Emissions.
+   int          * y;         // observations //
+   int          * mock;      // first profile //
+   int          * index;
+   zerone_t     * Z;
+   // Parser.
+   uint32_t     * pos;       // positions of the reads //
+   hash_t       * hash;
+   link_t       * lnk;
+   char         * sam;       // SAM lines (separated by '\0') //
+   char         * bed;       // BED lines (separated by '\0') //
+   char         * text;      // copy of one of the above //
+   size_t         samsz;
+   size_t         bedsz;
+   const char   * fname;     // SAM file //
+};
+
+struct kernel_t {
+   const char * name;
+   const char * unit;                 // "window" or "read" //
+   void      (* reset) (data_t *);    // before each run (or NULL) //
+   void      (* run) (data_t *);      // timed //
+};
+
+
+//  ---- Declaration of local functions  ---- //
+int     cmp_double (const void *, const void *);
+void    destroy_data (data_t *);
+double  lcg (uint64_t *);
+int     make_data (data_t *, double);
+
+// Kernels.
+void    reset_alpha (data_t *);
+void    reset_bed (data_t *);
+void    reset_hash (data_t *);
+void    reset_logp (data_t *);
+void    reset_prob (data_t *);
+void    reset_sam (data_t *);
+void    run_add_to_rod (data_t *);
+void    run_autoparse (data_t *);
+void    run_bitf (data_t *);
+void    run_block_fwdb (data_t *);
+void    run_block_viterbi (data_t *);
+void    run_bwd (data_t *);
+void    run_fwd (data_t *);
+void    run_fwdb (data_t *);
+void    run_indexts (data_t *);
+void    run_mle_zinb (data_t *);
+void    run_parse_bed (data_t *);
+void    run_parse_sam (data_t *);
+void    run_viterbi (data_t *);
+void    run_zinm_prob (data_t *);
+void    run_zinm_prob_mt (data_t *);
+
+const kernel_t KERNELS[] = {
+   {"fwd",                "window", reset_prob,  run_fwd},
+   {"bwd",                "window", reset_alpha, run_bwd},
+   {"fwdb",               "window", reset_prob,  run_fwdb},
+   {"block_fwdb",         "window", reset_prob,  run_block_fwdb},
+   {"viterbi",            "window", NULL,        run_viterbi},
+   {"block_viterbi",      "window", reset_logp,  run_block_viterbi},
+   {"zinm_prob",          "window", NULL,        run_zinm_prob},
+   {"zinm_prob_mt",       "window", NULL,        run_zinm_prob_mt},
+   {"indexts",            "window", NULL,        run_indexts},
+   {"mle_zinb",           "window", NULL,        run_mle_zinb},
+   {"add_to_rod",         "read",   reset_hash,  run_add_to_rod},
+   {"bitf_query_and_set", "read",   reset_hash,  run_bitf},
+   {"parse_sam",          "read",   reset_sam,   run_parse_sam},
+   {"parse_bed",          "read",   reset_bed,   run_parse_bed},
+   {"autoparse",          "read",   reset_hash,  run_autoparse},
+   {NULL, NULL, NULL, NULL},
+};
+
+
+int
+main
+(
+   int    argc,
+   char * argv[]
+)
+{
+
+   data_t D = {0};
+   D.m = 3;
+   D.n = 100000;
+   D.r = 3;
+   D.nb = 24;
+   D.threads = sysconf(_SC_NPROCESSORS_ONLN);
+   double sparsity = 0.5;
+   long nreads = -1;
+   int reps = 10;
+   int warmup = 2;
+
+   int c;
+   while ((c = getopt(argc, argv, "b:k:n:r:R:s:t:w:")) != -1) {
+      switch (c) {
+      case 'b': D.nb = atoi(optarg); break;
+      case 'k': reps = atoi(optarg); break;
+      case 'n': D.n = atoi(optarg); break;
+      case 'r': D.r = atoi(optarg); break;
+      case 'R': nreads = atol(optarg); break;
+      case 's': sparsity = atof(optarg); break;
+      case 't': D.threads = atoi(optarg); break;
+      case 'w': warmup = atoi(optarg); break;
+      default:
+         fprintf(stderr, "usage: %s [-n windows] [-r profiles] "
+               "[-s sparsity] [-b blocks] [-R reads] [-t threads] "
+               "[-k repetitions] [-w warm-up] [kernel ...]\n", argv[0]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (D.n < 2 || D.r < 2 || D.nb < 1 || D.nb > D.n || reps < 1 ||
+         reps > BENCH_MAXREPS || warmup < 0 || sparsity < 0 ||
+         sparsity > 1 || D.threads < 1) {
+      fprintf(stderr, "invalid arguments\n");
+      return EXIT_FAILURE;
+   }
+   D.nreads = nreads < 0 ? D.n : nreads;
+
+   if (!make_data(&D, sparsity)) {
+      fprintf(stderr, "cannot create the data\n");
+      destroy_data(&D);
+      return EXIT_FAILURE;
+   }
+
+   printf("# n = %u, r = %u, sparsity = %.2f, blocks = %u, "
+         "reads = %zu, threads = %d, repetitions = %d, warm-up = %d\n",
+         D.n, D.r, sparsity, D.nb, D.nreads, D.threads, reps, warmup);
+   printf("%-20s %-7s %12s %12s %10s %10s\n", "kernel", "unit",
+         "min (us)", "median (us)", "ns/unit", "cyc/unit");
+
+   for (const kernel_t *k = KERNELS ; k->name != NULL ; k++) {
+      // Run only the kernels given as arguments (if any).
+      int selected = optind == argc;
+      for (int i = optind ; i < argc ; i++) {
+         if (strcmp(argv[i], k->name) == 0) selected = 1;
+      }
+      if (!selected) continue;
+
+      for (int i = 0 ; i < warmup ; i++) {
+         if (k->reset != NULL) k->reset(&D);
+         k->run(&D);
+      }
+
+      double ns[BENCH_MAXREPS];
+      double cyc[BENCH_MAXREPS];
+      for (int i = 0 ; i < reps ; i++) {
+         if (k->reset != NULL) k->reset(&D);
+         struct timespec t0;
+         struct timespec t1;
+         clock_gettime(CLOCK_MONOTONIC, &t0);
+         uint64_t c0 = __rdtsc();
+         k->run(&D);
+         uint64_t c1 = __rdtsc();
+         clock_gettime(CLOCK_MONOTONIC, &t1);
+         ns[i] = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+         cyc[i] = c1 - c0;
+      }
+
+      qsort(ns, reps, sizeof(double), cmp_double);
+      qsort(cyc, reps, sizeof(double), cmp_double);
+      const double units = strcmp(k->unit, "read") == 0 ? D.nreads : D.n;
+      printf("%-20s %-7s %12.1f %12.1f %10.2f %10.2f\n", k->name,
+            k->unit, ns[0] / 1e3, ns[reps/2] / 1e3,
+            ns[reps/2] / units, cyc[reps/2] / units);
+      fflush(stdout);
+   }
+
+   destroy_data(&D);
+   return EXIT_SUCCESS;
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+double
+lcg
+(
+   uint64_t * state
+)
+// SYNOPSIS:
+//   Uniform random number in (0,1). The benchmarks do not depend
+//   on the C library to be reproducible.
+{
+   *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+   return ((*state >> 11) + 0.5) / 9007199254740992.0;
+}
+
+
+int
+cmp_double
+(
+   const void * a,
+   const void * b
+)
+{
+   const double x = *(const double *) a;
+   const double y = *(const double *) b;
+   return (x > y) - (x < y);
+}
+
+
+int
+make_data
+(
+   data_t * D,
+   double   sparsity
+)
+// SYNOPSIS:
+//   Allocate and fill the buffers of the benchmarks.
+//
+// RETURN:
+//   1 on success, 0 in case of failure.
+{
+
+   const size_t m = D->m;
+   const size_t n = D->n;
+   const size_t r = D->r;
+   uint64_t seed = 123;
+
+   D->sz = malloc(D->nb * sizeof(unsigned int));
+   D->y = malloc(n*r * sizeof(int));
+   D->mock = malloc(n * sizeof(int));
+   D->index = malloc(n * sizeof(int));
+   D->prob = malloc(n*m * sizeof(double));
+   D->logp = malloc(n*m * sizeof(double));
+   D->alpha = malloc(n*m * sizeof(double));
+   D->work = malloc(n*m * sizeof(double));
+   D->phi = malloc(n*m * sizeof(double));
+   D->path = malloc(n * sizeof(int));
+   D->pos = malloc(D->nreads * sizeof(uint32_t));
+   if (D->sz == NULL || D->y == NULL || D->mock == NULL ||
+         D->index == NULL || D->prob == NULL || D->logp == NULL ||
+         D->alpha == NULL || D->work == NULL || D->phi == NULL ||
+         D->path == NULL || D->pos == NULL) return 0;
+
+   // Blocks of the same size.
+   for (int i = 0 ; i < D->nb ; i++) D->sz[i] = n / D->nb;
+   D->sz[D->nb-1] += n % D->nb;
+
+   // Observations.
+   for (size_t i = 0 ; i < n ; i++) {
+      const int zero = lcg(&seed) < sparsity;
+      for (size_t j = 0 ; j < r ; j++) {
+         D->y[j+i*r] = zero ? 0 : (int) (-log(lcg(&seed)) * 2);
+      }
+      D->mock[i] = D->y[0+i*r];
+   }
+
+   const double Q[9] = {
+      .97, .01, .02,
+      .01, .97, .01,
+      .02, .02, .97,
+   };
+   memcpy(D->Q, Q, sizeof(Q));
+   for (int i = 0 ; i < 9 ; i++) D->logQ[i] = log(Q[i]);
+   for (int i = 0 ; i < 3 ; i++) D->init[i] = 1.0 / 3;
+   for (int i = 0 ; i < 3 ; i++) D->logi[i] = log(1.0 / 3);
+
+   // Emissions from the ZINM model.
+   D->Z = new_zerone(m, new_ChIP(r, D->nb, D->y, NULL, D->sz));
+   if (D->Z == NULL || D->Z->ChIP == NULL) return 0;
+   double *p = malloc(m*(r+1) * sizeof(double));
+   if (p == NULL) return 0;
+   const double p0[3] = {.5, .4, .2};
+   for (size_t i = 0 ; i < m ; i++) {
+      p[0+i*(r+1)] = p0[i];
+      for (size_t j = 1 ; j <= r ; j++) {
+         p[j+i*(r+1)] = (1-p0[i]) / r;
+      }
+   }
+   set_zerone_par(D->Z, Q, 1.2, .8, p);
+   free(p);
+
+   index_ChIP(D->Z->ChIP, D->index);
+   zinm_prob(D->Z, D->index, 4, D->prob);
+   for (size_t i = 0 ; i < n*m ; i++) D->logp[i] = log(D->prob[i]);
+
+   memcpy(D->alpha, D->prob, n*m * sizeof(double));
+   fwd(m, n, Q, D->init, D->alpha);
+
+   // Reads on one sequence, at most one per base.
+   for (size_t i = 0 ; i < D->nreads ; i++) {
+      D->pos[i] = 1 + (uint32_t) (lcg(&seed) * n * 300);
+   }
+
+   // SAM and BED lines.
+   const size_t lsz = 128;
+   D->sam = malloc(D->nreads * lsz);
+   D->bed = malloc(D->nreads * lsz);
+   D->text = malloc(D->nreads * lsz);
+   if (D->sam == NULL || D->bed == NULL || D->text == NULL) return 0;
+   for (size_t i = 0 ; i < D->nreads ; i++) {
+      D->samsz += 1 + sprintf(D->sam + D->samsz,
+            "r%zu\t0\tchr1\t%u\t40\t36M\t*\t0\t0\t*\t*", i, D->pos[i]);
+      D->bedsz += 1 + sprintf(D->bed + D->bedsz,
+            "chr1\t%u\t%u\t1", D->pos[i]-1, D->pos[i]+35);
+   }
+
+   // The same SAM lines in a file.
+   D->fname = "bench.tmp.sam";
+   FILE *f = fopen(D->fname, "w");
+   if (f == NULL) return 0;
+   for (size_t off = 0 ; off < D->samsz ; ) {
+      fprintf(f, "%s\n", D->sam + off);
+      off += strlen(D->sam + off) + 1;
+   }
+   fclose(f);
+
+   return 1;
+
+}
+
+
+void
+destroy_data
+(
+   data_t * D
+)
+{
+   if (D->fname != NULL) unlink(D->fname);
+   if (D->hash != NULL) destroy_hash(D->hash);
+   if (D->Z != NULL) {
+      free(D->Z->ChIP);
+      D->Z->ChIP = NULL;
+      destroy_zerone_all(D->Z);
+   }
+   free(D->sz);
+   free(D->y);
+   free(D->mock);
+   free(D->index);
+   free(D->prob);
+   free(D->logp);
+   free(D->alpha);
+   free(D->work);
+   free(D->phi);
+   free(D->path);
+   free(D->pos);
+   free(D->sam);
+   free(D->bed);
+   free(D->text);
+}
+
+
+//  ---- Kernels ---- //
+
+void
+reset_prob
+(
+   data_t * D
+)
+{
+   memcpy(D->work, D->prob, D->n*D->m * sizeof(double));
+}
+
+
+void
+reset_alpha
+(
+   data_t * D
+)
+{
+   memcpy(D->work, D->alpha, D->n*D->m * sizeof(double));
+}
+
+
+void
+reset_logp
+(
+   data_t * D
+)
+{
+   memcpy(D->work, D->logp, D->n*D->m * sizeof(double));
+}
+
+
+void
+reset_hash
+(
+   data_t * D
+)
+{
+   if (D->hash != NULL) destroy_hash(D->hash);
+   D->hash = calloc(HSIZE, sizeof(link_t *));
+   if (D->hash == NULL) {
+      fprintf(stderr, "memory error\n");
+      exit(EXIT_FAILURE);
+   }
+   D->lnk = lookup_or_insert("chr1", D->hash);
+}
+
+
+void
+reset_sam
+(
+   data_t * D
+)
+{
+   memcpy(D->text, D->sam, D->samsz);
+}
+
+
+void
+reset_bed
+(
+   data_t * D
+)
+{
+   memcpy(D->text, D->bed, D->bedsz);
+}
+
+
+void
+run_fwd
+(
+   data_t * D
+)
+{
+   fwd(D->m, D->n, D->Q, D->init, D->work);
+}
+
+
+void
+run_bwd
+(
+   data_t * D
+)
+{
+   bwd(D->m, D->n, D->Q, D->work, D->phi, D->T);
+}
+
+
+void
+run_fwdb
+(
+   data_t * D
+)
+{
+   fwdb(D->m, D->n, D->Q, D->init, D->work, D->phi, D->T);
+}
+
+
+void
+run_block_fwdb
+(
+   data_t * D
+)
+{
+   block_fwdb(D->m, D->nb, D->sz, D->Q, D->init, D->work, D->phi, D->T);
+}
+
+
+void
+run_viterbi
+(
+   data_t * D
+)
+{
+   viterbi(D->m, D->n, D->logQ, D->logi, D->logp, D->path);
+}
+
+
+void
+run_block_viterbi
+(
+   data_t * D
+)
+{
+   block_viterbi(D->m, D->nb, D->sz, D->logQ, D->logi, D->work, D->path);
+}
+
+
+void
+run_zinm_prob
+(
+   data_t * D
+)
+{
+   zinm_prob(D->Z, D->index, 4, D->work);
+}
+
+
+void
+run_zinm_prob_mt
+(
+   data_t * D
+)
+{
+   zinm_prob_mt(D->Z, D->index, 4, D->work, D->threads);
+}
+
+
+void
+run_indexts
+(
+   data_t * D
+)
+{
+   indexts(D->n, D->r, D->y, D->index);
+}
+
+
+void
+run_mle_zinb
+(
+   data_t * D
+)
+{
+   free(mle_zinb(D->mock, D->n));
+}
+
+
+void
+run_add_to_rod
+(
+   data_t * D
+)
+{
+   for (size_t i = 0 ; i < D->nreads ; i++) {
+      add_to_rod(&D->lnk->counts, D->pos[i] / 300, 1);
+   }
+}
+
+
+void
+run_bitf
+(
+   data_t * D
+)
+{
+   for (size_t i = 0 ; i < D->nreads ; i++) {
+      bitf_query_and_set(D->pos[i], D->lnk);
+   }
+}
+
+
+void
+run_parse_sam
+(
+   data_t * D
+)
+{
+   loc_t loc;
+   for (size_t off = 0 ; off < D->samsz ; ) {
+      char *line = D->text + off;
+      off += strlen(line) + 1;
+      parse_sam(&loc, line);
+   }
+}
+
+
+void
+run_parse_bed
+(
+   data_t * D
+)
+{
+   loc_t loc;
+   for (size_t off = 0 ; off < D->bedsz ; ) {
+      char *line = D->text + off;
+      off += strlen(line) + 1;
+      parse_bed(&loc, line);
+   }
+}
+
+
+void
+run_autoparse
+(
+   data_t * D
+)
+{
+   zerone_parser_args_t args = { .window = 300, .minmapq = 20 };
+   if (!autoparse(D->fname, D->hash, args)) {
+      fprintf(stderr, "cannot parse %s\n", D->fname);
+      exit(EXIT_FAILURE);
+   }
+}
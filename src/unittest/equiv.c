@@ -0,0 +1,607 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Differential harness: run the kernels of the program side by side
+// with the frozen reference kernels (see 'reference.c') and report
+// the deviations. The program is built with the same optimizations
+// as zerone (see 'make equiv').
+//
+// USAGE:
+//   runequiv [-n windows] [-r profiles] [-s sparsity] [-b blocks]
+//            [-N max windows] [-j threads] [-a abs tol] [-e rel tol]
+//            [-d path tol] [dataset ...]
+//
+// The datasets are 'random' (simulated with the options -n, -r, -s
+// and -b), 'ctcf' (data/*.sam), 'H3K9ac' and 'RXRA' (*.txt.gz in
+// this directory). The last three are truncated to the first -N
+// windows. All are used
+// by default. For every dataset, the kernels are run on the same
+// input ('zinm_prob', 'block_fwdb', 'block_viterbi'), then the whole
+// Baum-Welch algorithm is run from the same start, followed by the
+// Viterbi algorithm and 'extract_features()'. With -j, the threaded
+// E-step of the program is checked as well.
+//
+// A value deviates if both the absolute and the relative deviations
+// exceed the tolerances. The exit status is 1 if any check fails.
+
+#include <getopt.h>
+#include <zlib.h>
+#include "numa.h"
+#include "parse.h"
+#include "predict.h"
+#include "reference.h"
+
+#define EQUIV_MAXCOLS 63
+
+struct tol_t;
+typedef struct tol_t tol_t;
+
+struct tol_t {
+   double   abs;    // absolute tolerance //
+   double   rel;    // relative tolerance //
+   double   path;   // rate of disagreement of the paths //
+};
+
+
+//  ----- Globals ----- //
+tol_t TOL = { .abs = 1e-9, .rel = 1e-9, .path = 0.0 };
+int NFAIL = 0;
+
+
+//  ---- Declaration of local functions  ---- //
+void     check_dataset (const char *, ChIP_t *, int);
+void     check_path (const char *, const int *, const int *, size_t);
+void     check_values (const char *, const char *, const double *,
+            const double *, size_t);
+double   lcg (uint64_t *);
+void     truncate_ChIP (ChIP_t *, size_t);
+zerone_t * new_start (ChIP_t *);
+ChIP_t * random_ChIP (unsigned int, unsigned int, double, unsigned int);
+ChIP_t * read_table (const char *, size_t);
+int    * run_viterbi (zerone_t *, int);
+
+
+int
+main
+(
+   int    argc,
+   char * argv[]
+)
+{
+
+   unsigned int n = 50000;
+   unsigned int r = 3;
+   unsigned int nb = 8;
+   double sparsity = 0.5;
+   size_t maxn = 200000;
+   int threads = 1;
+
+   int c;
+   while ((c = getopt(argc, argv, "a:b:d:e:j:n:N:r:s:")) != -1) {
+      switch (c) {
+      case 'a': TOL.abs = atof(optarg); break;
+      case 'b': nb = atoi(optarg); break;
+      case 'd': TOL.path = atof(optarg); break;
+      case 'e': TOL.rel = atof(optarg); break;
+      case 'j': threads = atoi(optarg); break;
+      case 'n': n = atoi(optarg); break;
+      case 'N': maxn = atol(optarg); break;
+      case 'r': r = atoi(optarg); break;
+      case 's': sparsity = atof(optarg); break;
+      default:
+         fprintf(stderr, "usage: %s [-n windows] [-r profiles] "
+               "[-s sparsity] [-b blocks] [-N max windows] [-j threads] "
+               "[-a abs tol] [-e rel tol] [-d path tol] [dataset ...]\n",
+               argv[0]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (n < 2 || r < 2 || r > EQUIV_MAXCOLS || nb < 1 || nb > n ||
+         maxn < 2 || threads < 1 || sparsity < 0 || sparsity > 1) {
+      fprintf(stderr, "invalid arguments\n");
+      return EXIT_FAILURE;
+   }
+
+   printf("# tolerances: abs %.1e, rel %.1e, path %.1e\n",
+         TOL.abs, TOL.rel, TOL.path);
+
+   const char *datasets[] = {"random", "ctcf", "H3K9ac", "RXRA", NULL};
+   for (int d = 0 ; datasets[d] != NULL ; d++) {
+      // Run only the datasets given as arguments (if any).
+      int selected = optind == argc;
+      for (int i = optind ; i < argc ; i++) {
+         if (strcmp(argv[i], datasets[d]) == 0) selected = 1;
+      }
+      if (!selected) continue;
+
+      ChIP_t *ChIP = NULL;
+      if (strcmp(datasets[d], "random") == 0) {
+         ChIP = random_ChIP(n, r, sparsity, nb);
+      }
+      else if (strcmp(datasets[d], "ctcf") == 0) {
+         char *mock[] = {"../../data/mock.sam", NULL};
+         char *chip[] = {"../../data/ctcf1.sam", "../../data/ctcf2.sam",
+            NULL};
+         zerone_parser_args_t args = { .window = 300, .minmapq = 20 };
+         ChIP = parse_input_files(mock, chip, args);
+      }
+      else {
+         char fname[64];
+         sprintf(fname, "%s.txt.gz", datasets[d]);
+         ChIP = read_table(fname, maxn);
+      }
+
+      if (ChIP == NULL) {
+         fprintf(stderr, "cannot load dataset %s\n", datasets[d]);
+         NFAIL++;
+         continue;
+      }
+
+      if (strcmp(datasets[d], "random") != 0) truncate_ChIP(ChIP, maxn);
+
+      check_dataset(datasets[d], ChIP, threads);
+   }
+
+   printf("# %d check(s) failed\n", NFAIL);
+   return NFAIL > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+}
+
+
+//  ---- Definitions of local functions  ---- //
+
+void
+check_dataset
+(
+   const char   * name,
+         ChIP_t * ChIP,
+         int      threads
+)
+// SYNOPSIS:
+//   Run all the checks on 'ChIP'.
+//
+// SIDE EFFECTS:
+//   'ChIP' is destroyed.
+{
+
+   const size_t n = nobs(ChIP);
+   const size_t m = 3;
+   const size_t r = ChIP->r;
+
+   printf("# dataset %s: n = %zu, r = %zu, blocks = %d\n",
+         name, n, r, ChIP->nb);
+   printf("%-16s %-10s %12s %12s  %s\n", "kernel", "value",
+         "max abs", "max rel", "status");
+
+   zerone_t *Z = new_start(ChIP);
+   zerone_t *R = new_start(ChIP);
+   int *index = malloc(n * sizeof(int));
+   int *rindex = malloc(n * sizeof(int));
+   double *pem = malloc(n*m * sizeof(double));
+   double *rpem = malloc(n*m * sizeof(double));
+   double *phi = malloc(n*m * sizeof(double));
+   double *rphi = malloc(n*m * sizeof(double));
+   if (Z == NULL || R == NULL || index == NULL || rindex == NULL ||
+         pem == NULL || rpem == NULL || phi == NULL || rphi == NULL) {
+      fprintf(stderr, "cannot check dataset %s\n", name);
+      NFAIL++;
+      goto clean_and_return;
+   }
+
+   // Emissions from the same start.
+   index_ChIP(ChIP, index);
+   ref_indexts(n, r - ChIP->nomock, ChIP->y, rindex);
+   zinm_prob(Z, index, 4, pem);
+   ref_zinm_prob(R, rindex, 4, rpem);
+   check_values("zinm_prob", "pem", pem, rpem, n*m);
+
+   // Forward-backward on the same emissions.
+   double init[3] = {1.0/3, 1.0/3, 1.0/3};
+   double T[9];
+   double rT[9];
+   memcpy(rpem, pem, n*m * sizeof(double));
+   double l = block_fwdb(m, ChIP->nb, ChIP->sz, Z->Q, init, pem, phi, T);
+   double rl = ref_block_fwdb(m, ChIP->nb, ChIP->sz, R->Q, init, rpem,
+         rphi, rT);
+   check_values("block_fwdb", "loglik", &l, &rl, 1);
+   check_values("block_fwdb", "phi", phi, rphi, n*m);
+   check_values("block_fwdb", "trans", T, rT, m*m);
+
+   // Viterbi on the same emissions (log space).
+   double logQ[9];
+   double logi[3];
+   for (int i = 0 ; i < 9 ; i++) logQ[i] = log(Z->Q[i]);
+   for (int i = 0 ; i < 3 ; i++) logi[i] = log(1.0/3);
+   zinm_prob(Z, index, 5, pem);
+   memcpy(rpem, pem, n*m * sizeof(double));
+   int *path = malloc(n * sizeof(int));
+   int *rpath = malloc(n * sizeof(int));
+   if (path != NULL && rpath != NULL) {
+      block_viterbi(m, ChIP->nb, ChIP->sz, logQ, logi, pem, path);
+      ref_block_viterbi(m, ChIP->nb, ChIP->sz, logQ, logi, rpem, rpath);
+      check_path("block_viterbi", path, rpath, n);
+   }
+   free(path);
+   free(rpath);
+
+   // Whole Baum-Welch algorithm from the same start.
+   bw_zinm(Z);
+   ref_bw_zinm(R);
+   if (Z->pem == NULL || R->pem == NULL) {
+      printf("%-16s %-10s %12s %12s  %s\n", "bw_zinm", "-", "-", "-",
+            "FAIL (no fit)");
+      NFAIL++;
+      goto clean_and_return;
+   }
+   double iter = Z->iter;
+   double riter = R->iter;
+   check_values("bw_zinm", "iter", &iter, &riter, 1);
+   check_values("bw_zinm", "loglik", &Z->l, &R->l, 1);
+   check_values("bw_zinm", "Q", Z->Q, R->Q, m*m);
+   check_values("bw_zinm", "p", Z->p, R->p, m*(r+1));
+   check_values("bw_zinm", "phi", Z->phi, R->phi, n*m);
+
+   // Viterbi path and features of each fit.
+   Z->path = run_viterbi(Z, 0);
+   R->path = run_viterbi(R, 1);
+   if (Z->path != NULL && R->path != NULL) {
+      check_path("viterbi", Z->path, R->path, n);
+      double feat[5];
+      double rfeat[5];
+      extract_features(Z, feat);
+      ref_extract_features(R, rfeat);
+      check_values("extract_features", "features", feat, rfeat, 5);
+   }
+
+   // Threaded E-step of the program.
+   if (threads > 1) {
+      zerone_t *W = new_start(ChIP);
+      bw_t *bw = W == NULL ? NULL : new_bw(W);
+      if (bw == NULL) {
+         NFAIL++;
+      }
+      else {
+         bw->pool = new_pool(W, bw, threads);
+         char kname[32];
+         sprintf(kname, "bw_zinm -j %d", threads);
+         for (W->iter = 1 ; W->iter < BW_MAXITER ; W->iter++) {
+            int status = bw_iter(W, bw);
+            if (status != 0) break;
+         }
+         bw_finish(W, bw);
+         check_values(kname, "loglik", &W->l, &R->l, 1);
+         check_values(kname, "Q", W->Q, R->Q, m*m);
+         check_values(kname, "p", W->p, R->p, m*(r+1));
+         check_values(kname, "phi", W->phi, R->phi, n*m);
+      }
+      if (W != NULL) {
+         W->ChIP = NULL;
+         destroy_zerone_all(W);
+      }
+   }
+
+clean_and_return:
+   free(index);
+   free(rindex);
+   free(pem);
+   free(rpem);
+   free(phi);
+   free(rphi);
+   // 'Z' owns 'ChIP', 'R' shares it.
+   if (R != NULL) {
+      R->ChIP = NULL;
+      destroy_zerone_all(R);
+   }
+   if (Z != NULL) destroy_zerone_all(Z);
+   else {
+      free(ChIP->y);
+      free(ChIP);
+   }
+
+}
+
+
+void
+check_values
+(
+   const char   * kernel,
+   const char   * value,
+   const double * x,
+   const double * ref,
+         size_t   n
+)
+// SYNOPSIS:
+//   Report the maximum absolute and relative deviations of 'x'
+//   from 'ref'. NAs must be at the same positions.
+{
+
+   double maxabs = 0.0;
+   double maxrel = 0.0;
+   int fail = 0;
+
+   for (size_t i = 0 ; i < n ; i++) {
+      if (x[i] != x[i] || ref[i] != ref[i]) {
+         // Both must be NA.
+         if ((x[i] == x[i]) != (ref[i] == ref[i])) {
+            maxabs = maxrel = INFINITY;
+            fail = 1;
+         }
+         continue;
+      }
+      if (x[i] == ref[i]) continue;
+      double dabs = fabs(x[i] - ref[i]);
+      double dmax = fmax(fabs(x[i]), fabs(ref[i]));
+      double drel = dabs / dmax;
+      if (dabs > maxabs) maxabs = dabs;
+      if (drel > maxrel) maxrel = drel;
+      if (dabs > TOL.abs && drel > TOL.rel) fail = 1;
+   }
+
+   printf("%-16s %-10s %12.3e %12.3e  %s\n", kernel, value,
+         maxabs, maxrel, fail ? "FAIL" : "ok");
+   NFAIL += fail;
+
+}
+
+
+void
+check_path
+(
+   const char * kernel,
+   const int  * path,
+   const int  * ref,
+         size_t n
+)
+// SYNOPSIS:
+//   Report the rate of disagreement of 'path' and 'ref'.
+{
+
+   size_t diff = 0;
+   for (size_t i = 0 ; i < n ; i++) diff += path[i] != ref[i];
+
+   const double rate = (double) diff / n;
+   const int fail = rate > TOL.path;
+   printf("%-16s %-10s %12zu %12.3e  %s\n", kernel, "path",
+         diff, rate, fail ? "FAIL" : "ok");
+   NFAIL += fail;
+
+}
+
+
+zerone_t *
+new_start
+(
+   ChIP_t * ChIP
+)
+// SYNOPSIS:
+//   Create a fit of 'ChIP' with the default start of 'do_zerone()'.
+//
+// RETURN:
+//   The fit, or NULL in case of failure.
+{
+
+   const size_t n = nobs(ChIP);
+   const size_t r = ChIP->r;
+   const size_t s = r - ChIP->nomock;
+
+   int *mock = malloc(n * sizeof(int));
+   if (mock == NULL) return NULL;
+   for (size_t i = 0 ; i < n ; i++) {
+      mock[i] = ChIP->nomock ? 1 : ChIP->y[0+i*s];
+   }
+   zinb_par_t *par = mle_zinb(mock, n);
+   free(mock);
+   if (par == NULL) return NULL;
+
+   double Q[9] = {0};
+   double p[3*(EQUIV_MAXCOLS+1)] = {0};
+   init_par(par, r, 0, Q, p);
+
+   zerone_t *Z = new_zerone(3, ChIP);
+   if (Z != NULL) set_zerone_par(Z, Q, par->a, par->pi, p);
+   free(par);
+
+   return Z;
+
+}
+
+
+int *
+run_viterbi
+(
+   zerone_t * Z,
+   int        ref
+)
+// SYNOPSIS:
+//   Viterbi path of the fit 'Z' (without reordering the states),
+//   computed by the program or by the reference.
+{
+
+   const size_t n = nobs(Z->ChIP);
+   int *path = malloc(n * sizeof(int));
+   if (path == NULL) return NULL;
+
+   double logQ[9];
+   double logi[3];
+   for (int i = 0 ; i < 9 ; i++) logQ[i] = log(Z->Q[i]);
+   for (int i = 0 ; i < 3 ; i++) logi[i] = log(1.0/3);
+
+   if (ref) {
+      ref_block_viterbi(3, Z->ChIP->nb, Z->ChIP->sz, logQ, logi,
+            Z->pem, path);
+   }
+   else {
+      block_viterbi(3, Z->ChIP->nb, Z->ChIP->sz, logQ, logi,
+            Z->pem, path);
+   }
+
+   return path;
+
+}
+
+
+double
+lcg
+(
+   uint64_t * state
+)
+// SYNOPSIS:
+//   Uniform random number in (0,1) (see 'bench.c').
+{
+   *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+   return ((*state >> 11) + 0.5) / 9007199254740992.0;
+}
+
+
+ChIP_t *
+random_ChIP
+(
+   unsigned int   n,
+   unsigned int   r,
+   double         sparsity,
+   unsigned int   nb
+)
+// SYNOPSIS:
+//   Simulate 'n' windows of a 3-state HMM in 'nb' blocks. The counts
+//   of the mock are geometric with mean 1, the counts of the ChIP
+//   profiles have mean 0.5, 2 or 6 depending on the state. Windows
+//   are set to 0 with probability 'sparsity'.
+{
+
+   uint64_t seed = 12345;
+   const double mean[3] = {0.5, 2.0, 6.0};
+
+   int *y = malloc(n*r * sizeof(int));
+   unsigned int *sz = malloc(nb * sizeof(unsigned int));
+   if (y == NULL || sz == NULL) {
+      free(y);
+      free(sz);
+      return NULL;
+   }
+
+   for (int i = 0 ; i < nb ; i++) sz[i] = n / nb;
+   sz[nb-1] += n % nb;
+
+   int state = 0;
+   for (size_t i = 0 ; i < n ; i++) {
+      // Stay in the same state with probability 0.95.
+      if (lcg(&seed) > 0.95) state = (int) (lcg(&seed) * 3);
+      const int zero = lcg(&seed) < sparsity;
+      for (size_t j = 0 ; j < r ; j++) {
+         const double mu = j == 0 ? 1.0 : mean[state];
+         const double q = mu / (1 + mu);
+         y[j+i*r] = zero ? 0 : (int) floor(log(lcg(&seed)) / log(q));
+      }
+   }
+
+   ChIP_t *ChIP = new_ChIP(r, nb, y, NULL, sz);
+   free(sz);
+   if (ChIP == NULL) free(y);
+   return ChIP;
+
+}
+
+
+void
+truncate_ChIP
+(
+   ChIP_t * ChIP,
+   size_t   maxn
+)
+// SYNOPSIS:
+//   Keep only the first 'maxn' windows of 'ChIP' (the remaining
+//   observations stay allocated).
+{
+
+   size_t n = 0;
+   for (int i = 0 ; i < ChIP->nb ; i++) {
+      if (n + ChIP->sz[i] >= maxn) {
+         ChIP->sz[i] = maxn - n;
+         ChIP->nb = i+1;
+         return;
+      }
+      n += ChIP->sz[i];
+   }
+
+}
+
+
+ChIP_t *
+read_table
+(
+   const char * fname,
+         size_t maxn
+)
+// SYNOPSIS:
+//   Read at most 'maxn' windows of a table of counts (a header,
+//   then a block name and the counts on every line; NA is -1).
+{
+
+   ChIP_t *ChIP = NULL;
+   int *y = NULL;
+   unsigned int *sz = NULL;
+   char *names = NULL;
+   const char **nm = NULL;
+   size_t r = 0;
+   size_t n = 0;
+   int nb = 0;
+
+   gzFile f = gzopen(fname, "r");
+   if (f == NULL) return NULL;
+
+   char line[1024];
+   if (gzgets(f, line, sizeof(line)) == NULL) goto clean_and_return;
+   for (char *s = line ; (s = strchr(s, '\t')) != NULL ; s++) r++;
+   if (r < 2 || r > EQUIV_MAXCOLS) goto clean_and_return;
+
+   y = malloc(maxn*r * sizeof(int));
+   sz = calloc(maxn, sizeof(unsigned int));
+   names = calloc(maxn, 32);
+   if (y == NULL || sz == NULL || names == NULL) goto clean_and_return;
+
+   while (n < maxn && gzgets(f, line, sizeof(line)) != NULL) {
+      char *s = line;
+      char *name = strsep(&s, "\t");
+      if (nb == 0 || strcmp(name, names + 32*(nb-1)) != 0) {
+         strncpy(names + 32*nb, name, 31);
+         nb++;
+      }
+      sz[nb-1]++;
+      for (size_t j = 0 ; j < r ; j++) {
+         char *tok = strsep(&s, "\t\n");
+         if (tok == NULL) goto clean_and_return;
+         y[j+n*r] = strcmp(tok, "NA") == 0 ? -1 : atoi(tok);
+      }
+      n++;
+   }
+
+   nm = malloc(nb * sizeof(char *));
+   if (nm == NULL) goto clean_and_return;
+   for (int i = 0 ; i < nb ; i++) nm[i] = names + 32*i;
+   ChIP = new_ChIP(r, nb, y, nm, sz);
+
+clean_and_return:
+   gzclose(f);
+   if (ChIP == NULL) free(y);
+   free(sz);
+   free(names);
+   free(nm);
+   return ChIP;
+
+}
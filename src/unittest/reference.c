@@ -0,0 +1,1407 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Frozen copies of the kernels of the program, taken verbatim from
+// hmm.c, utils.c, zerone.c and predict.c with a 'ref_' prefix, and
+// a sequential copy of 'bw_zinm()'. The differential harness
+// ('equiv.c') checks the kernels of the program against them, so
+// they must not change when the kernels are optimized.
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debug.h"
+#include "reference.h"
+#include "xxhash.h"
+
+// Constants of the reference, independent of zerone.h.
+#undef  BW_MAXITER
+#undef  BT_MAXITER
+#undef  TOLERANCE
+#define BW_MAXITER 100
+#define BT_MAXITER 20
+#define TOLERANCE 1e-6
+
+#define U32 uint32_t
+#define DIM 5
+#define sq(x) ((x)*(x))
+#define SQ(a) (a)*(a)
+
+// Globals variable.
+U32 *ref_xxhash;
+
+
+//  ---- Declaration of local functions  ---- //
+void    ref_bwd (unsigned int, unsigned int, const double *, double *,
+           double *, double *);
+double  ref_eval_bw_dfdp0 (double, double, double, double, double,
+           double, double, double);
+double  ref_eval_bw_f (double, double, double, double, double,
+           double, double, double);
+double  ref_fwd (unsigned int, unsigned int, const double *,
+           const double *, double *);
+double  ref_fwdb (unsigned int, unsigned int, const double *,
+           const double *, double *, double *, double *);
+int     ref_is_all_zero (const int *, int, int);
+int     ref_is_invalid (const int *, int, int);
+int     ref_is_undefined (const double *, int);
+int     ref_stblcmp (const void *, const void *);
+void    ref_suff_stats (size_t, const ChIP_t *, const int *, int,
+           const double *, double *);
+int     ref_update_p (const zerone_t *, double, const double *, double *);
+void    ref_update_trans (size_t, double *, const double *);
+void    ref_viterbi_ws (unsigned int, unsigned int, const double *,
+           const double *, const double *, int *, int *);
+
+
+//  -- Definitions of exported functions  --- //
+
+void
+ref_bw_zinm
+(
+   zerone_t * zerone
+)
+// SYNOPSIS:
+//   Same as 'bw_zinm()' in a single thread: index the time series,
+//   run the Baum-Welch cycles and transfer the posterior and the
+//   emission probabilities (in log space) to 'zerone'.
+{
+
+   ChIP_t *ChIP = zerone->ChIP;
+   const size_t n = nobs(ChIP);
+   const size_t m = zerone->m;
+   const size_t r = ChIP->r;
+   const double R = (zerone->p[1]) / zerone->p[0];
+
+   double prob[m];
+   for (size_t i = 0 ; i < m ; i++) prob[i] = 1.0 / m;
+
+   int *index = malloc(n * sizeof(int));
+   double *pem = malloc(n*m * sizeof(double));
+   double *phi = malloc(n*m * sizeof(double));
+   double *trans = malloc(m*m * sizeof(double));
+   double *suff = malloc(m*(r+2) * sizeof(double));
+   double *newp = malloc(m*(r+1) * sizeof(double));
+   if (index == NULL || pem == NULL || phi == NULL || trans == NULL ||
+         suff == NULL || newp == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   // The implicit profile is not indexed (see 'index_ChIP()').
+   int i0 = ref_indexts(n, r - ChIP->nomock, ChIP->y, index);
+   if (ChIP->nomock) i0 = -1;
+
+   for (zerone->iter = 1 ; zerone->iter < BW_MAXITER ; zerone->iter++) {
+      unsigned int lin_space_no_warn = 4;
+      ref_zinm_prob(zerone, index, lin_space_no_warn, pem);
+      zerone->l = ref_block_fwdb(m, ChIP->nb, ChIP->sz, zerone->Q,
+            prob, pem, phi, trans);
+      ref_suff_stats(m, ChIP, index, i0, phi, suff);
+      ref_update_trans(m, zerone->Q, trans);
+      if (ref_update_p(zerone, R, suff, newp) < 0) goto clean_and_return;
+      double maxd = 0.0;
+      for (size_t i = 0 ; i < m*(r+1) ; i++) {
+         double thisd = fabs(newp[i]-zerone->p[i]);
+         maxd = thisd > maxd ? thisd : maxd;
+      }
+      if (maxd < TOLERANCE) break;
+      memcpy(zerone->p, newp, m*(r+1) * sizeof(double));
+   }
+
+   unsigned int log_space_no_warn = 5;
+   ref_zinm_prob(zerone, index, log_space_no_warn, pem);
+
+   zerone->pem = pem;
+   zerone->phi = phi;
+   pem = NULL;
+   phi = NULL;
+
+clean_and_return:
+   free(index);
+   free(pem);
+   free(phi);
+   free(trans);
+   free(suff);
+   free(newp);
+   return;
+
+}
+
+
+//  ---- Frozen kernels ---- //
+
+double
+ref_fwd
+(
+   // input //
+         unsigned int            m,
+         unsigned int            n,
+   const double       * restrict Q,
+   const double       * restrict init,
+   // output //
+         double       * restrict prob
+)
+// SYNOPSIS:
+//   Forward algorithm.
+//
+// NUMERIC ROBUSTNESS:
+//   This implementation is robust to NAs and to underflow. In case of
+//   NA or underflow it will ignore the emission and treat the
+//   observation as missing (i.e. only the transitions at that position
+//   will contribute to the output). If the emission probabilities are
+//   passed as negative numbers, the algorithm will assume that they are
+//   given in log space.
+//
+// ARGUMENTS:
+//   'm': the number of states
+//   'n': the length of the sequence of observations
+//   'Q': (m,m) transition matrix ('Q[i+j*m]' is a ij transtition).
+//   'init': (m) initial probabilities
+//   'prob': (m,n) emission probabilities
+//
+// RETURN:
+//   The total log-likelihood.
+//
+// SIDE EFFECTS:
+//   Replaces 'prob' by forward alphas.
+{
+
+   int i;           // State index.
+   int j;           // State index.
+   int k;           // Position of the time series.
+   double tmp[m];   // Intermediates.
+   double a[m];     // Current normalized alpha.
+
+   // Normalization constant, also used to return log-likelihood.
+   double c;
+   double loglik = 0.0;
+
+   for (k = 0 ; k < n ; k++) {
+      // This is an easy pattern for the branch predictor.
+      if (k == 0) {
+         memcpy(tmp, init, m * sizeof(double));
+      }
+      else {
+         memset(tmp, 0, m * sizeof(double));
+         for (j = 0 ; j < m ; j++) {
+         for (i = 0 ; i < m ; i++) {
+            tmp[j] += a[i] * Q[i+j*m];
+         }
+         }
+      }
+
+      // Test for missing emission probabilities.
+      int na_found = 0;
+      for (j = 0 ; j < m ; j++) {
+         if (prob[j+k*m] != prob[j+k*m]) {
+            // NA found. Ignore emissions, and update 'prob'
+            // with the value of 'a'.
+            memcpy(a, tmp, m * sizeof(double));
+            memcpy(prob + k*m, tmp, m * sizeof(double));
+            na_found = 1;
+            break;
+         }
+      }
+      // Move on if NAs were found.
+      if (na_found) continue;
+
+      c = 0.0;
+      // Test if emission probabilities have underflowed.
+      // NB: we use the convention that in case all 'm' emission
+      // probabilies underflow, their log is returned instead. If the
+      // first one is negative, they are all computed in log space.
+      if (prob[0+k*m] < 0) {
+         // Use an alternative computation to obviate underflow.
+         // The is is slower because of the call to the function `exp`.
+         // First I find the max emission probability, then I divide 'c'
+         // by the exp of that value and compensate by adding the value
+         // to 'loglik' directly.
+         int w = 0;
+         for (j = 1 ; j < m ; j++) if (prob[j+k*m] > prob[w+k*m]) w = j;
+         for (j = 0 ; j < m ; j++) {
+            c += a[j] = tmp[j] * exp(prob[j+k*m] - prob[w+k*m]);
+         }
+         // To the exception of the correction below, the rest
+         // of the computation is identical.
+         loglik += prob[w+k*m];
+      }
+      else {
+         // No underflow. Continue the forward algorithm the usual way.
+         for (j = 0 ; j < m ; j++) {
+            c += a[j] = tmp[j] * prob[j+k*m];
+         }
+      }
+      if (!(c > 0)) {
+         // Underflow can theoretically still happen, for instance if
+         // the transition to the state with highest emission probability
+         // is impossible. In this (hopeless) treat the emissions as
+         // missing.
+         memcpy(a, tmp, m * sizeof(double));
+         memcpy(prob + k*m, tmp, m * sizeof(double));
+      }
+      else {
+         for (j = 0 ; j < m ; j++) a[j] /= c;
+         memcpy(prob +k*m, a, m * sizeof(double));
+         loglik += log(c);
+      }
+
+   }
+
+   return loglik;
+
+}
+
+
+void
+ref_bwd
+(
+   // input //
+         unsigned int            m,
+         unsigned int            n,
+   const double       * restrict Q,
+   // output //
+         double       * restrict alpha,
+         double       * restrict phi,
+         double       * restrict T
+)
+// SYNOPSIS:
+//   Backward algorithm with Markovian backward smoothing.
+//
+// ARGUMENTS:
+//   'm': the number of states
+//   'n': the length of the sequence of observations
+//   'Q': (m,m) transition matrix ('Q[i+j*m]' is a ij transtition).
+//   'alpha': (m,n) the forward alpha probabilities
+//   'phi': (m,n) probabilities of states given observations
+//   'T': (m,m) sum of conditional transitions probabilties
+//
+// RETURN:
+//   'void'
+//
+// SIDE EFFECTS:
+//   Updates 'phi' and 'T' in place.
+
+{
+
+   int     i;       // State index.
+   int     j;       // State index.
+   int     k;       // Position of the time series.
+   double  x;       // Sum used for computation intermediates.
+   double  R[m*m];  // Reverse kernel.
+
+   // NB: 'R' lives on the stack (like the intermediates of 'fwd()')
+   // so that short time series do not pay for an allocation.
+
+   // 'T[i+j*m]' is the sum of transition probabilities from state 'i'
+   // to state 'j' (congruent with 'Q') conditional on the observations.
+   memset(T, 0.0, m*m * sizeof(double));
+
+   // First iteration of the backward pass.
+   // memset(phi, 0.0, m*n * sizeof(double));
+   bzero(phi, m*n * sizeof(double));
+   memcpy(phi+(n-1)*m, alpha+(n-1)*m, m * sizeof(double));
+
+//-----------------------------------------------------------------------
+// Here we work out the local reverse kernel.
+// ak(i) is the probability of being in state i at step k given Y1,...,k
+// bk(i) is the beta function defined by the forward-backward decom-
+// position, such that ak(i)bk(i) is the probability of being in state i
+// at step k given Y1,...,n.
+//
+// 'R[j+i*m]' = P(Xk=i|Xk+1=j,Y1,...,n) =
+//       P(Xk=i,Xk+1=j,Y1,...,n) / P(Xk+1=j,Y1,...,n) =
+//       ak(i)Q(i,j)gk+1(j)bk+1(j) / ak+1(j)bk+1(j) =
+//       ak(i)Q(i,j)gk+1(j) / sum_i ak(i)Q(i,j)gk+1(j)
+//       ak(i)Q(i,j) / sum_i ak(i)Q(i,j)
+//
+// P(Xk=i|Y1,...,n) = sum_j P(Xk=i|Xk+1=j,Y1,...,n) * P(Xk+1=j|Y1,...,n)
+// which gives the line 'phi[j+k*m] += phi[i+(k+1)*m] * R[i+j*m]'.
+//-----------------------------------------------------------------------
+
+   // Next iterations of the backward pass.
+   for (k = n-2 ; k >= 0 ; k--) {
+      for (j = 0 ; j < m ; j++) {
+         x = 0.0;
+         // Note the double assignment in the following line.
+         for (i = 0 ; i < m ; i++) x += R[j+i*m] = alpha[i+k*m]*Q[i+j*m];
+         for (i = 0 ; i < m ; i++) R[j+i*m] /= x;
+      }
+      for (j = 0 ; j < m ; j++) {
+      for (i = 0 ; i < m ; i++) {
+         // Use the reverse kernel to update 'phi' and 'T'.
+         x = phi[i+(k+1)*m] * R[i+j*m];
+         phi[j+k*m] += x;
+         T[j+i*m] += x;
+      }
+      }
+   }
+
+   return;
+
+}
+
+
+double
+ref_fwdb
+(
+   // input //
+         unsigned int            m,
+         unsigned int            n,
+   const double       * restrict Q,
+   const double       * restrict init,
+   // output //
+         double       * restrict prob,
+         double       * restrict phi,
+         double       * restrict T
+)
+// SYNOPSIS:
+//   Forward-backward algorithm with Markovian backward smoothing.
+//
+// NUMERIC ROBUSTNESS:
+//   This implementation is robust to NAs and to underflow. In case of
+//   NA or underflow it will ignore the emission and treat the
+//   observation as missing (i.e. only the transitions at that position
+//   will contribute to the output).
+//
+// ARGUMENTS:
+//   'm': the number of states
+//   'n': the length of the sequence of observations
+//   'Q': (m,m) transition matrix ('Q[i+j*m]' is a ij transtition).
+//   'init': (m) initial probabilities
+//   'prob': (m,n) emission probabilities
+//   'phi': (m,n) probabilities given observations
+//   'T': (m,m) sum of conditional transitions probabilties
+//
+// RETURN:
+//   The total log-likelihood.
+//
+// SIDE EFFECTS:
+//   Replaces 'prob' by alphas, updates 'phi' and 'T' in place.
+{
+
+   double loglik = ref_fwd(m, n, Q, init, prob);
+   ref_bwd(m, n, Q, prob, phi, T);
+
+   return loglik;
+}
+
+
+void
+ref_viterbi_ws(
+   // input //
+         unsigned int            m,
+         unsigned int            n,
+   const double       * restrict log_Q,
+   const double       * restrict log_i,
+   const double       * restrict log_p,
+   // workspace //
+                  int * restrict argmax,
+   // output //
+                  int * restrict path
+)
+// SYNOPSIS:
+//   Kernel of 'viterbi()' working in caller-provided scratch space.
+//   'block_viterbi()' uses it to process all the blocks with a
+//   single buffer for the back-pointers.
+//
+// ARGUMENTS:
+//   'm': the number of states
+//   'n': the length of the sequence of observations
+//   'log_Q': (m,m) log transition matrix.
+//   'log_i': (m) log initial probabilities
+//   'log_p': (m,n) log emission probabilities
+//   'argmax': (m,n) scratch space for the back-pointers
+//   'path': (n) Viterbi path.
+//
+// RETURN:
+//   'void'
+//
+// SIDE EFFECTS:
+//   Updates 'path' and 'argmax' in place.
+{
+
+   int i;        // State index.
+   int j;        // State index.
+   int k;        // Position of the time series.
+
+   double thismax;
+   double tmp;
+
+   long double array[2*m];
+   long double *oldmax = array;
+   long double *newmax = array + m;
+
+   // Initial step of the algorithm.
+   for (j = 0 ; j < m ; j++) newmax[j] = log_i[j+0*m] + log_p[j+0*m];
+   for (k = 1 ; k < n ; k++) {
+      // Set newmax to oldmax (by swapping).
+      long double *swp = oldmax; oldmax = newmax; newmax = swp;
+      // Viterbi recursion.
+      for (j = 0 ; j < m ; j++) {
+         thismax = oldmax[0] + log_Q[0+j*m];
+         argmax[j+k*m] = 0;
+         for (i = 1 ; i < m ; i++) {
+            tmp = oldmax[i] + log_Q[i+j*m];
+            if (tmp > thismax) {
+               thismax = tmp;
+               argmax[j+k*m] = i;
+            }
+         }
+         newmax[j] = thismax + log_p[j+k*m];
+      }
+   }
+
+   // Get final state.
+   int final_state = 0;
+   for (j = 1 ; j < m ; j++) if (newmax[j] > newmax[0]) final_state = j;
+   path[n-1] = final_state;
+   // Trace back the Viterbi path.
+   for (k = n-2 ; k >= 0 ; k--) path[k] = argmax[path[k+1]+(k+1)*m];
+
+   return;
+
+}
+
+
+double
+ref_block_fwdb(
+   // input //
+         unsigned int            m,
+         unsigned int            nblocks,
+   const unsigned int *          size,
+   // params //
+         double       * restrict Q,
+         double       * restrict init,
+   // output //
+         double       * restrict prob,
+         double       * restrict phi,
+         double       * restrict sumtrans
+)
+// SYNOPSIS:
+//   Wrapper for 'fwdb' which separates independent fragments of a
+//   time series.
+//
+// ARGUMENTS:
+//   'm': the number of states
+//   'nblocks': the number of fragments in the time series
+//   'size': (nblocks) the lengths of the fragments of the time series
+//   'Q': (m,m) transition matrix ('Q[i+j*m]' is a ij transtition)
+//   'init': (m) initial probabilities
+//   'prob': (n) the emssion probabilities
+//   'phi': (m,n) probabilities given observations
+//   'sumtrans': (m,m) sum of conditional transitions probabilties
+//
+// RETURN:
+//   'void'
+//
+// SIDE EFFECTS:
+//   Updates 'prob', 'phi', 'sumtrans' and 'loglik' in place.
+{
+
+   // Initialization.
+   double loglik = 0.0;
+   size_t offset = 0;
+   memset(sumtrans, 0.0, m*m * sizeof(double));
+
+   // Cycle over fragments of the time series. The scratch
+   // space 'T' is shared by all the blocks, so assemblies
+   // with many small contigs do not pay a per-block cost.
+   double T[m*m];
+   for (int i = 0 ; i < nblocks ; i++) {
+      // NOTE: the call to `fwdb` replaces the values of 'prob' by
+      // the normalized alphas.
+      loglik += ref_fwdb(m, size[i], Q, init, prob+offset, phi+offset, T);
+      for (int j = 0 ; j < m*m ; j++) {
+         sumtrans[j] += T[j];
+      }
+      offset += m * size[i];
+   }
+
+   return loglik;
+
+}
+
+
+int
+ref_is_undefined(
+   const double * slice,
+         int      m
+)
+// SYNOPSIS:
+//   Helper function for `block_viterbi`. A set of 'm' emission
+//   probabilities is considered undefined if one of them is NA,
+//   or if they are all equal to -inf in log space.
+{
+   int n_inf = 0;
+   for (int i = 0 ; i < m ; i++) {
+      if (slice[i] != slice[i]) return 1;
+      if (slice[i] == -INFINITY) n_inf++;
+   }
+   return (n_inf == m);
+}
+
+
+int
+ref_block_viterbi
+(
+   // input //
+         unsigned int            m,
+         unsigned int            nblocks,
+   const unsigned int *          size,
+   const double       * restrict Q,
+   const double       * restrict init,
+         double       * restrict prob,
+   // output //
+                  int * restrict path
+)
+// SYNOPSIS:
+//   Viterbi algorithm for fragmented time series. The arguments can be
+//   passed in linear or in log space.
+//
+// NUMERIC STABLITY:
+//   This implementation is NA-robust by omission. If NAs are present
+//   at a given step, all the emission probabilities of that step are
+//   set to 0, so they do not contribute to the Viterbi path.
+//
+// ARGUMENTS:
+//   'm': the number of states
+//   'nblocks': the number of fragments in the time series
+//   'size': (nblocks) the lengths of the fragments of the time series
+//   'Q': (m,m) transition matrix
+//   'init': (m) initial probabilities
+//   'prob': (n) emssion probabilities
+//   'path': (n) Viterbi path
+//
+// RETURN:
+//   'void'
+//
+// SIDE EFFECTS:
+//   Updates 'path' in place.
+{
+
+   size_t n = 0;
+   unsigned int maxsz = 0;
+   for (int i = 0 ; i < nblocks ; i++) {
+      n += size[i];
+      if (size[i] > maxsz) maxsz = size[i];
+   }
+
+   double *log_Q = malloc(m*m * sizeof(double));
+   double *log_i = malloc(m * sizeof(double));
+   if (log_Q == NULL || log_i == NULL) {
+      debug_print("%s", "memory error\n");
+      return 1;
+   }
+
+   // Check whether arguments are passed in linear or in log space.
+   // Scan 'Q' until the first non 0 value.
+   size_t idx;
+   for (idx = 0 ; idx < m*m && Q[idx] == 0; idx++);
+   int args_in_lin_space = Q[idx] > 0;
+
+   // Check arguments.
+   double sum_i = 0.0;
+   for (size_t i = 0 ; i < m ; i++) {
+
+      // Presence of NAs in 'init'.
+      if (init[i] != init[i]) {
+         fprintf(stderr, "invalid 'init' argument in '%s()'\n", __func__);
+         free(log_Q);
+         free(log_i);
+         return -1;
+      }
+      // Log/lin consistency of 'init'.
+      if ((init[i] >= 0) ^ args_in_lin_space) {
+         fprintf(stderr, "mixed log/lin arguments in '%s()'\n", __func__);
+         free(log_Q);
+         free(log_i);
+         return -1;
+      }
+
+      sum_i += args_in_lin_space ? init[i] : exp(init[i]);
+      double sum_Q = 0.0;
+
+      for (size_t j = 0 ; j < m ; j++) {
+
+         // Presence of NAs in 'Q'.
+         if (Q[i+j*m] != Q[i+j*m]) {
+            fprintf(stderr, "invalid 'Q' argument in '%s()'\n", __func__);
+            free(log_Q);
+            free(log_i);
+            return -1;
+         }
+         // Log/lin consistency of 'Q'.
+         if ((Q[i+j*m] >= 0) ^ args_in_lin_space) {
+            fprintf(stderr, "mixed log/lin arguments in '%s()'\n",
+                  __func__);
+            free(log_Q);
+            free(log_i);
+            return -1;
+         }
+         sum_Q += args_in_lin_space ? Q[i+j*m] : exp(Q[i+j*m]);
+      }
+
+      // Check that rows of 'Q' sum to 1.0.
+      if (fabs(sum_Q - 1.0) > 1e-6) {
+         fprintf(stderr, "'Q' is not stochastic in '%s()'\n", __func__);
+         free(log_Q);
+         free(log_i);
+         return -1;
+      }
+
+   }
+
+   // Check that 'init' sums to 1.0.
+   if (fabs(sum_i - 1.0) > 1e-6) {
+      fprintf(stderr, "'init' is not a probability in '%s()'\n", __func__);
+      free(log_Q);
+      free(log_i);
+      return -1;
+   }
+
+   double *log_p = NULL;
+   if (args_in_lin_space) {
+      log_p = malloc(n*m *sizeof(double));
+      if (log_p == NULL) {
+         debug_print("%s", "memory error\n");
+         free(log_Q);
+         free(log_i);
+         return 1;
+      }
+      for (int i = 0 ; i < n*m ; i++) log_p[i] = log(prob[i]);
+      for (int i = 0 ; i < m*m ; i++) log_Q[i] = log(Q[i]);
+      for (int i = 0 ; i < m ; i++)   log_i[i] = log(init[i]);
+   }
+   else {
+      // IMPORTANT: we will replace undefined emissions by 0.0.
+      // Copying 'init' and 'Q' is simpler for consistency.
+      log_p = prob;
+      for (int i = 0 ; i < m*m ; i++) log_Q[i] = Q[i];
+      for (int i = 0 ; i < m ; i++)   log_i[i] = init[i];
+   }
+
+   // If an emssion probability is not available at some step, all
+   // the log values are set to 0. Observations do not contribute
+   // to te path (only the transition probabilities).
+   size_t offset = 0;
+   for (int i = 0 ; i < nblocks ; i++) {
+      for (int k = 0 ; k < size[i] ; k++) {
+         if (ref_is_undefined(log_p + offset + k*m, m)) {
+            memset(log_p + offset + k*m, 0, m * sizeof(double));
+         }
+      }
+      offset += m * size[i];
+   }
+
+   // The back-pointers of all the blocks go to the same buffer,
+   // which is allocated once with the size of the largest block.
+   int *argmax = malloc(m*maxsz * sizeof(int));
+   if (argmax == NULL && maxsz > 0) {
+      debug_print("%s", "memory error\n");
+      free(log_Q);
+      free(log_i);
+      if (args_in_lin_space) free(log_p);
+      return 1;
+   }
+
+   // NOTE: the offset is not the same in 'path' and 'log_p' because
+   // of their dimensions (explains 'm*offset' in the case of 'log_p').
+   offset = 0;
+   for (int i = 0 ; i < nblocks ; i++) {
+      ref_viterbi_ws(m, size[i], log_Q, log_i, log_p+m*offset,
+            argmax, path+offset);
+      offset += size[i];
+   }
+
+   free(argmax);
+   free(log_Q);
+   free(log_i);
+
+   if (args_in_lin_space) {
+      free(log_p);
+   }
+
+   return 0;
+
+}
+
+
+int
+ref_stblcmp
+(
+   const void *a,
+   const void *b
+)
+// SYNOPSIS:
+//   Comparison function for stable sort on hashes. Used to sort
+//   addresses of global pointer 'xxhash'.
+{
+   U32 A = ref_xxhash[*(int *)a];
+   U32 B = ref_xxhash[*(int *)b];
+   if (A > B) return 1;
+   if (A < B) return -1;
+   // Hashes are identical, compare addresses for stable sort.
+   if (*(int *)a > *(int *)b)   return  1;
+   return -1;
+}
+
+
+int
+ref_indexts
+(
+         int n,
+         int r,
+   const int *ts,
+         int *index
+)
+// SYNOPSIS:
+// Index the time series using xxhash and return the index of the
+// first all-0 observation.
+{
+   int i;
+   ref_xxhash = malloc(n*sizeof(U32));
+   int *addr = malloc(n * sizeof(int));
+   if (ref_xxhash == NULL || addr == NULL) {
+      debug_print("%s", "memory error\n");
+      return -1;
+   }
+
+   for (i = 0 ; i < n ; i++) addr[i] = i;
+
+   // Compute xxhash digests.
+   for (i = 0 ; i < n ; i++) {
+      ref_xxhash[i] = XXH32(ts+i*r, r*sizeof(int), 0);
+   }
+
+   // Compute the xxhash digest of all 0s. We will need it
+   // to return the index of the small such observation.
+   int *all0 = calloc(r, sizeof(int));
+   if (all0 == NULL) {
+      debug_print("%s", "memory error\n");
+      return -1;
+   }
+   U32 xxhash0 = XXH32(all0, r*sizeof(int), 0);
+   free(all0);
+
+   // Stable sort array indices on digests order. Stability is
+   // important because we want the first occurrence of an
+   // observation to point to its own index, and all subsequent
+   // occurrences to point to it as well. If the reference index
+   // was not the first occurence in array order, it would cause
+   // difficulties for the purpose of computing emission
+   // probabilities.
+   qsort(addr, n, sizeof(int), ref_stblcmp);
+
+   int current = 0;
+   int index0 = -1;
+   index[addr[0]] = addr[0];
+   if (ref_xxhash[addr[0]] == xxhash0) index0 = addr[0];
+   for (i = 1 ; i < n ; i++) {
+      if (ref_xxhash[addr[i]] == ref_xxhash[current]) {
+         index[addr[i]] = current;
+      }
+      else {
+         current = index[addr[i]] = addr[i];
+         if (ref_xxhash[addr[i]] == xxhash0) index0 = addr[i];
+      }
+   }
+
+   free(ref_xxhash);
+   free(addr);
+
+   return index0;
+
+}
+
+
+int
+ref_is_invalid
+(
+    const int * y,
+          int   k,
+          int   r
+)
+// SYNOPSIS:
+//   Helper function. NAs of type 'int' is the largest negative
+//   value. More generally, any negative value in 'y' is invalid.
+{
+   for (int i = 0 ; i < r ; i++) if (y[i + k*r] < 0) return 1;
+   return 0;
+}
+
+
+int
+ref_is_all_zero
+(
+   const int * y,
+         int   k,
+         int   r
+)
+// SYNOPSIS:
+//   Helper function for `zinm_prob`. Returns 1 if and only if all
+//   the observations are 0.
+{
+   for (int i = 0 ; i < r ; i++) if (y[i + k*r] != 0) return 0;
+   return 1;
+}
+
+
+void
+ref_zinm_prob
+(
+         zerone_t * restrict zerone,
+   const int      * restrict index,
+   // call control //
+         int                otype,
+   // output //
+         double   * restrict pem
+)
+// SYNOPSIS:
+//   Compute emission probabilities with a mixture negative multinomial
+//   model. Since those are up to a multiplicative constant in the
+//   forward-backward algorithm, we can drop the multiplicative terms
+//   that do not depend on the state of the HMM.
+//   Since the negative nultinomial takes discrete values, we can cache
+//   the results for reuse in order to save computation. This is done
+//   by indexing the series.
+//
+//   My parametrization is of the form:
+//
+//        p_0(i)^a * p_1(i)^y_1 * p_2(i)^y_2 * ... * p_r+1(i)^y_r
+//
+//   And in the case that all emissions are 0
+//
+//                      pi * p_0(i)^a + (1-pi)
+//
+// NUMERICAL STABILITY:
+//   Each term of the sum above is computed in log space, the result is
+//   the computed as the sum of two exponentials. NA emissions are
+//   allowed and yield NA for the whole line of emissions.
+//
+// ARGUMENTS:
+//   'ChIP': struct of observations
+//   'par': struct of parameters for the ZINM distribution
+//   'index': a precomputed index of the ChIP data
+//   'otype': the type of output to produce (see below)
+//   'pem': (n_obs,n_states) emission probability
+//
+// RETURN:
+//   'void'
+//
+// SIDE EFFECTS:
+//   Update 'pem' in place.
+//
+// OUTPUT:
+//   The output type for 'pem' can be the emission probability in
+//   log space (1), the same emission probability in linear space (2),
+//   or in linear by default and in log space in case of underflow (0).
+//   'otype' also controls the verbosity. If the third bit is set,
+//   i.e. the value is set to 4, 5 or 6, the function will suppress
+//   warnings. Setting the fourth bit of 'otype' forces to compute
+//   the constant terms in emission probabilities.
+{
+
+   ChIP_t *ChIP = zerone->ChIP;
+   unsigned int temp = 0;
+   for (size_t i = 0 ; i < ChIP->nb ; i++) {
+      temp += ChIP->sz[i];
+   }
+
+   const unsigned int   r  = ChIP->r;
+   const int          * y  = ChIP->y;
+   const unsigned int   m  = zerone->m;
+   const double         a  = zerone->a;
+   const double         pi = zerone->pi;
+   const double       * p  = zerone->p;
+   const unsigned int   n  = temp;
+   // The implicit profile 'o' is 1 everywhere, so there are only
+   // 's' columns in 'y' and no emission is ever all 0.
+   const unsigned int   o  = ChIP->nomock;
+   const unsigned int   s  = r - o;
+
+   char *depends   = "compute in lin space, log space if underflow";
+   char *log_space = "always compute in log space";
+   char *lin_space = "always compute in linear space";
+   char *cases[3] = {depends, log_space, lin_space};
+   char *output_type = cases[otype & 3];
+
+   int compute_constant_terms = (otype >> 3) & 1;
+
+   double *logp = malloc((r+1)*m * sizeof(double));
+   if (logp == NULL) {
+      fprintf(stderr, "memory error (%s:%d)\n", __FILE__, __LINE__);
+      return;
+   }
+
+   // If the third bit of 'otype' is set, suppress warnings
+   // by setting 'warned' to 1.
+   int warned = (otype >> 2) & 1;
+
+   // Make sure that 'p' defines a probability.
+   for (size_t i = 0 ; i < m ; i++) {
+      double sump = 0.0;
+      for (size_t j = 0 ; j < r+1 ; j++) {
+         // Cannot normalize negative values. Sorry folks.
+         if (p[j+i*(r+1)] < 0) {
+            fprintf(stderr, "error: 'p' negative\n");
+            return;
+         }
+         sump += p[j+i*(r+1)];
+      }
+      int p_normalized_no = fabs(sump - 1.0) > DBL_EPSILON;
+      if (!warned && p_normalized_no) {
+         fprintf(stderr, "warning: renormalizing 'p'\n");
+         warned = 1;
+      }
+      for (int j = 0 ; j < r+1 ; j++) {
+         logp[j+i*(r+1)] = log(p[j+i*(r+1)] / sump);
+      }
+   }
+
+   // The following variable 'row_of_na' comes in handy to write
+   // full lines of NAs in the emissions.
+   double *row_of_na = malloc(m * sizeof(double));
+   if (row_of_na == NULL) {
+      fprintf(stderr, "memory error (%s:%d)\n", __FILE__, __LINE__);
+      return;
+   }
+   for (int i = 0 ; i < m ; i++) row_of_na[i] = NAN;
+
+   for (int k = 0 ; k < n ; k++) {
+      // Indexing allows to compute the terms only once. If the term
+      // has been computed before, copy the value and move on.
+      if (index[k] < k) {
+         // TODO: bypass the cache for writing. This would save
+         // some time when tere are a lot of observations.
+         // This would require reformattnig 'pem' and using
+         // _mm_stream_pd(double *p, __m128d a)
+         memcpy(pem + k*m, pem + index[k]*m, m * sizeof(double));
+         continue;
+      }
+
+      // This is the firt occurrence of the emission in the times
+      // series. We need to compute the emission probability.
+      // Test the presence of invalid/NA emissions in the row.
+      // If so, fill the row with NAs and move on.
+      if (ref_is_invalid(y, k, s)) {
+         memcpy(pem + k*m, row_of_na, m * sizeof(double));
+         continue;
+      }
+
+      if (!o && ref_is_all_zero(y, k, r)) {
+         // Emissions are all zeros, use the zero-inflated
+         // term from the zinm model.
+         for (int i = 0 ; i < m ; i++) {
+            pem[i+k*m] = log(pi*exp(a*logp[0+i*(r+1)]) + (1.0-pi));
+         }
+      }
+      else {
+         // Otherwise use the standard probability.
+         for (int i = 0 ; i < m ; i++) {
+            pem[i+k*m] = a * logp[0+i*(r+1)];
+            if (o) pem[i+k*m] += logp[1+i*(r+1)];
+            for (int j = 0 ; j < s ; j++) {
+               pem[i+k*m] += y[j+k*s] * logp[(j+o+1)+i*(r+1)];
+            }
+         }
+      }
+
+      if (compute_constant_terms) {
+         double c_term = -lgamma(a);
+         // The implicit profile adds 1 to the sum
+         // and 'lgamma(2) = 0' to the constant.
+         double sum = a + o;
+         for (int j = 0 ; j < s ; j++) {
+            int term = y[j+k*s];
+            sum += term;
+            c_term -= lgamma(term+1);
+         }
+         c_term += lgamma(sum);
+         for (int i = 0 ; i < m ; i++) {
+            pem[i+k*m] += c_term;
+         }
+      }
+
+      if (output_type == log_space) continue;
+
+      double sum = 0.0;
+      double lin[m];
+      for (int i = 0 ; i < m ; i++) sum += lin[i] = exp(pem[i+k*m]);
+      if (sum > 0 || output_type == lin_space) {
+         memcpy(pem+k*m, lin, m * sizeof(double));
+      }
+
+   }
+
+   free(logp);
+   free(row_of_na);
+   return;
+
+}
+
+
+void
+ref_update_trans
+(
+         size_t   m,
+         double * Q,
+   const double * trans
+)
+{
+
+   for (size_t i = 0 ; i < m ; i++) {
+      double sum = 0.0;
+      for (size_t j = 0 ; j < m ; j++) {
+         sum += trans[i+j*m];
+      }
+      for (size_t j = 0 ; j < m ; j++) {
+         Q[i+j*m] = trans[i+j*m] / sum;
+      }
+   }
+
+   return;
+
+}
+
+
+double
+ref_eval_bw_f
+(
+   double a,
+   double pi,
+   double p0,
+   double A,
+   double B,
+   double C,
+   double D,
+   double E
+)
+{
+   double term1 = (D + a*A) / p0;
+   double term2 = B * pi*a*pow(p0,a-1) / (pi*pow(p0,a)+1-pi);
+   return p0 + E/(term1 + term2) - 1.0 / C;
+}
+
+
+double
+ref_eval_bw_dfdp0
+(
+   double a,
+   double pi,
+   double p0,
+   double A,
+   double B,
+   double C,
+   double D,
+   double E
+)
+{
+
+   double term1 = (D + a*A) / p0;
+   double term2 = B * pi*a*pow(p0,a-1) / (pi*pow(p0,a)+1-pi);
+   double subterm3a = (1-pi)*pi*a*(a-1)*pow(p0,a-2);
+   double subterm3b = sq(pi)*a*pow(p0,2*a-2);
+   double term3 = B * (subterm3a - subterm3b) / sq(pi*pow(p0,a)+1-pi);
+   double term4 = (D + a*A) / sq(p0);
+
+   return 1 - E/sq(term1 + term2) * (term3-term4);
+
+}
+
+
+void
+ref_suff_stats
+(
+         size_t   m,
+   const ChIP_t * ChIP,
+   const int    * index,
+         int      i0,
+   const double * phi,
+   // output //
+         double * suff
+)
+// SYNOPSIS:
+//   Compute the expected sufficient statistics of the emission
+//   parameters from the posterior probabilities 'phi'. For every
+//   state, 'suff' holds the expected number of windows with
+//   at least one read (A), of windows with no read (B), of mock
+//   reads (D) and of reads in every ChIP profile (r-1 terms).
+//   These statistics are additive, so the statistics of several
+//   blocks can be summed.
+{
+
+   const size_t r = ChIP->r;
+   const size_t n = nobs(ChIP);
+   const int *y = ChIP->y;
+
+   if (ChIP->nomock) {
+      // The implicit profile is 1 in every window, so there is
+      // no all-0 window and the mock reads are counted in 'A'.
+      const size_t c = r-1;
+      for (size_t i = 0 ; i < m ; i++) {
+         double *s = suff + i*(r+2);
+         memset(s, 0, (r+2) * sizeof(double));
+         for (size_t k = 0 ; k < n; k++) {
+            if (ref_is_invalid(y, k, c)) continue;
+            s[0] += phi[i+k*m];
+            for (size_t j = 0 ; j < c ; j++) {
+               s[j+3] += phi[i+k*m] * y[j+k*c];
+            }
+         }
+         s[2] = s[0];
+      }
+      return;
+   }
+
+   for (size_t i = 0 ; i < m ; i++) {
+      double *s = suff + i*(r+2);
+      memset(s, 0, (r+2) * sizeof(double));
+      for (size_t k = 0 ; k < n; k++) {
+         if (index[k] == i0) {
+            s[1] += phi[i+k*m];
+         }
+         else {
+            // Skip invalid entries.
+            if (ref_is_invalid(y, k, r)) continue;
+            s[0] += phi[i+k*m];
+            s[2] += phi[i+k*m] * y[0+k*r];
+            for (size_t j = 1 ; j < r ; j++) {
+               s[j+2] += phi[i+k*m] * y[j+k*r];
+            }
+         }
+      }
+   }
+
+   return;
+
+}
+
+
+int
+ref_update_p
+(
+   const zerone_t * zerone,
+         double     R,
+   const double   * suff,
+   // output //
+         double   * newp
+)
+// SYNOPSIS:
+//   Find the emission parameters that maximize the expected
+//   log-likelihood given the sufficient statistics 'suff' (see
+//   'suff_stats()'). The statistics need only be known up to a
+//   multiplicative constant.
+//
+// RETURN:
+//   0 upon success, -1 in case of failure.
+{
+
+   const size_t m  = zerone->m;
+   const size_t r  = zerone->ChIP->r;
+   const double a  = zerone->a;
+   const double pi = zerone->pi;
+
+   for (size_t i = 0 ; i < m ; i++) {
+      // Compute the constants.
+      const double * s = suff + i*(r+2);
+      const double * ystar = s+2;
+      double A = s[0];
+      double B = s[1];
+      double C = 1+R;
+      double D = s[2];
+      double E = 0.0;
+      for (size_t j = 1 ; j < r ; j++) {
+         E += ystar[j];
+      }
+
+      // Find upper and lower bound for 'p0'.
+      double p0 = .5;
+      double p0_lo;
+      double p0_hi;
+      if (ref_eval_bw_f(a, pi, p0, A, B, C, D, E) < 0) {
+         p0 *= 2;
+         while (ref_eval_bw_f(a, pi, p0, A, B, C, D, E) < 0) p0 *= 2;
+         p0_lo = p0/2;
+         p0_hi = p0;
+      }
+      else {
+         p0 /= 2;
+         while (ref_eval_bw_f(a, pi, p0, A, B, C, D, E) > 0) p0 /= 2;
+         p0_lo = p0;
+         p0_hi = p0*2;
+      }
+
+      if (p0_lo > 1.0 || p0_hi < 0.0) {
+         fprintf(stderr, "cannot complete Baum-Welch algorithm\n");
+         return -1;
+      }
+
+      double new_p0 = (p0_lo + p0_hi) / 2;
+      for (int j = 0 ; j < BT_MAXITER ; j++) {
+         p0 = (new_p0 < p0_lo || new_p0 > p0_hi) ?
+            (p0_lo + p0_hi) / 2 :
+            new_p0;
+         double f = ref_eval_bw_f(a, pi, p0, A, B, C, D, E);
+         if (f > 0) p0_hi = p0; else p0_lo = p0;
+         if ((p0_hi - p0_lo) < TOLERANCE) break;
+         double dfdp0 = ref_eval_bw_dfdp0(a, pi, p0, A, B, C, D, E);
+         new_p0 = p0 - f / dfdp0;
+      }
+
+      // Update the state-independent parameters.
+      newp[0+i*(r+1)] = p0;
+      newp[1+i*(r+1)] = p0 * R;
+      // Now update the state-dependent parameters.
+      double term1 = (D + a*A) / p0;
+      double term2 = B * pi*a*pow(p0,a-1) / (pi*pow(p0,a)+1-pi);
+      double normconst = (term1 + term2) / C;
+      for (size_t j = 1 ; j < r ; j++) {
+         newp[(j+1)+i*(r+1)] = ystar[j] / normconst;
+      }
+
+   }
+
+   return 0;
+
+}
+
+
+double *
+ref_extract_features
+(
+   zerone_t * Z,
+   double   * features
+)
+{
+   ChIP_t *ChIP = Z->ChIP;
+   double * p = Z->p;
+   const unsigned int m = Z->m;
+   const unsigned int n = nobs(ChIP);
+   const unsigned int r = ChIP->r;
+   // The implicit profile (see 'ChIP_t') is not used below.
+   const unsigned int o = ChIP->nomock;
+   const unsigned int s = r - o;
+
+   // Feature 0: tansition from "top" to "mid".
+   features[0] = Z->Q[2 + 1*m];
+
+   // Feature 1: smallest "top" to "mid" signal ratio.
+   features[1] = 10;
+   for (int i = 2; i < r+1; i++) {
+      double ratio = (p[i+2*(r+1)] / p[0+2*(r+1)]) /
+         (p[i+1*(r+1)] / p[0+1*(r+1)]);
+      if (ratio < features[1]) features[1] = ratio;
+   }
+
+   double *mean_yes = calloc(r, sizeof(double));
+   double *mean_no = calloc(r, sizeof(double));
+   double *prod_yes = calloc(r*r, sizeof(double));
+   double *var = calloc(r, sizeof(double));
+
+   if (mean_yes == NULL || mean_no == NULL ||
+               var == NULL || prod_yes == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      // Fill feature vector with NAs.
+      for (int i = 0 ; i < DIM ; i++) features[i] = 0.0/0.0;
+      goto clean_and_return;
+   }
+
+   double n_yes = 0.0;
+
+   // Scan data and collect intermediate values to
+   // compute means, variances and covariances.
+   for (int i = 0; i < n; i++) {
+      if (Z->path[i] == 2) {
+         n_yes++;
+         for (int j = 1 ; j < r ; j++) {
+            mean_yes[j] += ChIP->y[j-o+i*s];
+            for (int k = j ; k < r ; k++) {
+               prod_yes[j+k*r] +=
+                  ChIP->y[j-o+i*s] * ChIP->y[k-o+i*s];
+            }
+         }
+      }
+      else {
+         for (int j = 1 ; j < r ; j++) {
+            mean_no[j] += ChIP->y[j-o+i*s];
+         }
+      }
+      for (int j = 1 ; j < r ; j++) {
+         var[j] += (ChIP->y[j-o+i*s]) * (ChIP->y[j-o+i*s]);
+      }
+   }
+
+   double n_no = n - n_yes;
+
+   if (n_yes < 1 || n_no < 1) {
+      // Limit case: avoid division by 0
+      // and set following features to 0.
+      features[2] = features[3] = features[4] = 0.0;
+      goto clean_and_return;
+   }
+
+   for (int j = 1 ; j < r ; j++) {
+      var[j] = var[j] / n - SQ((mean_no[j] + mean_yes[j]) / n);
+      mean_no[j] /= n_no;
+      mean_yes[j] /= n_yes;
+      for (int k = j ; k < r ; k++) {
+         prod_yes[j+k*r] /= n_yes;
+      }
+   }
+
+   // Feature 2: average number of targets.
+   features[2] = n_yes / n;
+
+   // Feature 3: minimum explained variance.
+   features[3] = 1.0;
+   
+   for (int j = 1 ; j < r ; j++) {
+      double v = n_yes*n_no * SQ(mean_yes[j]-mean_no[j]) / (var[j]*SQ(n));
+      if (v < features[3]) features[3] = v;
+   }
+
+   // Feature 4: minimum correlation on targets.
+   // This cannot be computed if only one profile is available.
+   if (r < 3) {
+      features[4] = 0.0/0.0;
+      goto clean_and_return;
+   }
+
+   features[4] = 1.0;
+
+   for (int j = 1 ; j < r ; j++) {
+   for (int k = j+1 ; k < r ; k++) {
+      double c = (prod_yes[j+k*r] - mean_yes[j]*mean_yes[k]) /
+         sqrt((prod_yes[j+j*r] - SQ(mean_yes[j])) *
+               (prod_yes[k+k*r] - SQ(mean_yes[k])));
+      if (c < features[4]) features[4] = c;
+   }
+   }
+
+clean_and_return:
+   free(mean_yes);
+   free(mean_no);
+   free(prod_yes);
+   free(var);
+
+   return features;
+
+}
@@ -0,0 +1,38 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _REFERENCE_H
+#define _REFERENCE_H
+
+#include "zerone.h"
+
+// Frozen copies of the reference kernels (see 'reference.c').
+// They are the baseline of the differential harness ('equiv.c'):
+// do not edit them when the kernels of the program are optimized.
+
+double   ref_block_fwdb (unsigned int, unsigned int, const unsigned int *,
+            double *, double *, double *, double *, double *);
+int      ref_block_viterbi (unsigned int, unsigned int,
+            const unsigned int *, const double *, const double *,
+            double *, int *);
+void     ref_bw_zinm (zerone_t *);
+double * ref_extract_features (zerone_t *, double *);
+int      ref_indexts (int, int, const int *, int *);
+void     ref_zinm_prob (zerone_t *, const int *, int, double *);
+
+#endif
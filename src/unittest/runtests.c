@@ -40,6 +40,20 @@ main(
    extern test_case_t test_cases_parse[];
    extern test_case_t test_cases_predict[];
    extern test_case_t test_cases_zerone[];
+   extern test_case_t test_cases_checkpoint[];
+   extern test_case_t test_cases_online[];
+   extern test_case_t test_cases_shard[];
+   extern test_case_t test_cases_output[];
+   extern test_case_t test_cases_serve[];
+   extern test_case_t test_cases_tasks[];
+   extern test_case_t test_cases_pipeline[];
+   extern test_case_t test_cases_cache[];
+   extern test_case_t test_cases_numa[];
+   extern test_case_t test_cases_trace[];
+   extern test_case_t test_cases_counters[];
+   extern test_case_t test_cases_segment[];
+   extern test_case_t test_cases_refine[];
+   extern test_case_t test_cases_autowin[];
 
    // Register test cases.
    const test_case_t *list_of_test_cases[] = {
@@ -49,6 +63,20 @@ main(
       test_cases_parse,
       test_cases_predict,
       test_cases_zerone,
+      test_cases_checkpoint,
+      test_cases_online,
+      test_cases_shard,
+      test_cases_output,
+      test_cases_serve,
+      test_cases_tasks,
+      test_cases_pipeline,
+      test_cases_cache,
+      test_cases_numa,
+      test_cases_trace,
+      test_cases_counters,
+      test_cases_segment,
+      test_cases_refine,
+      test_cases_autowin,
       NULL,
    };
 
@@ -0,0 +1,158 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "unittest.h"
+#include "autowin.c"
+
+void
+test_sample_ChIP
+(void)
+{
+
+   // Mock and one ChIP profile, two blocks, reads
+   // in windows 7 (first block) and 12 (second).
+   int y[28] = {0};
+   y[1+7*2] = 3;
+   y[0+12*2] = 1;
+   const char *names[2] = {"chr1", "chr2"};
+   uint size[2] = {10,4};
+   ChIP_t *ChIP = new_ChIP(2, 2, y, names, size);
+   test_assert_critical(ChIP != NULL);
+
+   // Two chunks of two windows: those with reads.
+   ChIP_t *S = sample_ChIP(ChIP, 4, 2);
+   test_assert_critical(S != NULL);
+   test_assert(S->r == 2);
+   test_assert(S->nb == 2);
+   test_assert(S->sz[0] == 2);
+   test_assert(S->sz[1] == 2);
+   test_assert(strcmp(S->nm, "chr1") == 0);
+   test_assert(strcmp(S->nm + 32, "chr2") == 0);
+   test_assert(S->y[1+1*2] == 3);
+   test_assert(S->y[0+2*2] == 1);
+   free(S->y);
+   free(S);
+
+   // All the windows.
+   S = sample_ChIP(ChIP, 100, 2);
+   test_assert_critical(S != NULL);
+   test_assert(S->nb == 2);
+   test_assert(S->sz[0] == 10 && S->sz[1] == 4);
+   for (int i = 0 ; i < 28 ; i++) test_assert(S->y[i] == y[i]);
+   free(S->y);
+   free(S);
+
+   // No read (invalid windows do not count): the chunks are drawn
+   // uniformly, windows 2-3 of the first block and 0-1 of the second.
+   y[1+7*2] = y[0+12*2] = 0;
+   y[0+2*2] = y[0+10*2] = -1;
+   S = sample_ChIP(ChIP, 4, 2);
+   test_assert_critical(S != NULL);
+   test_assert(S->nb == 2);
+   test_assert(S->y[0+0*2] == -1);
+   test_assert(S->y[0+2*2] == -1);
+   test_assert(strcmp(S->nm + 32, "chr2") == 0);
+   free(S->y);
+   free(S);
+
+   free(ChIP);
+
+}
+
+
+void
+test_auto_window
+(void)
+{
+
+   // Three blocks with enriched regions.
+   int *y = malloc(3*2400 * sizeof(int));
+   test_assert_critical(y != NULL);
+   unsigned int seed = 123;
+   for (int k = 0 ; k < 2400 ; k++) {
+      int enriched = (k % 160) > 60 && (k % 160) < 100;
+      y[0+k*3] = rand_r(&seed) % 3;
+      y[1+k*3] = rand_r(&seed) % 3 + (enriched ? 4 : 0);
+      y[2+k*3] = rand_r(&seed) % 3 + (enriched ? 3 : 0);
+   }
+
+   unsigned size[3] = {800,1000,600};
+   ChIP_t *ChIP = new_ChIP(3, 3, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   zerone_t *fit = NULL;
+   redirect_stderr();
+   int K = auto_window(ChIP, 100, 1, &fit);
+   unredirect_stderr();
+
+   int ladder[AUTOWIN_NSIZES] = AUTOWIN_LADDER;
+   int found = 0;
+   for (int i = 0 ; i < AUTOWIN_NSIZES ; i++) found |= K == ladder[i];
+   test_assert(found);
+   test_assert_critical(fit != NULL);
+   test_assert(fit->ChIP->r == 3);
+   test_assert(fit->ChIP->sz[0] == (800+K-1) / K);
+   test_assert(fit->phi == NULL && fit->pem == NULL);
+
+   // The fit is the warm start of the final run.
+   ChIP_t *C = K > 1 ? coarsen_ChIP(ChIP, K) : ChIP;
+   test_assert_critical(C != NULL);
+   zerone_args_t args = { .warm = fit };
+   redirect_stderr();
+   zerone_t *Z = do_zerone(C, &args);
+   unredirect_stderr();
+   test_assert_critical(Z != NULL);
+   test_assert_critical(Z->path != NULL);
+
+   double feat[5];
+   double QC = zerone_qc(Z, feat);
+   test_assert(fabs(QC - zerone_qc(fit, feat)) < 1e-6);
+
+   destroy_zerone_all(fit);
+   if (C != ChIP) free(C->y);
+   Z->ChIP = NULL;
+   destroy_zerone_all(Z);
+
+   // One ChIP profile: no QC score, the window is kept.
+   for (int k = 0 ; k < 2400 ; k++) {
+      y[0+k*2] = y[0+k*3];
+      y[1+k*2] = y[1+k*3];
+   }
+   free(ChIP);
+   ChIP = new_ChIP(2, 3, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   redirect_stderr();
+   K = auto_window(ChIP, 100, 1, NULL);
+   unredirect_stderr();
+   test_assert(K == 1);
+   test_assert(strstr(caught_in_stderr(), "keeping 100 bp") != NULL);
+
+   free(y);
+   free(ChIP);
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_autowin[] = {
+   {"autowin/sample_ChIP",     test_sample_ChIP},
+   {"autowin/auto_window",     test_auto_window},
+   {NULL, NULL},
+};
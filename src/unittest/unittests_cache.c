@@ -0,0 +1,152 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "unittest.h"
+#include "cache.c"
+
+void
+test_cache_key
+(void)
+{
+
+   FILE *f = fopen("test_cache_key.tmp", "w");
+   test_assert_critical(f != NULL);
+   fprintf(f, "chr1\t100\n");
+   fclose(f);
+
+   char *fnames[] = {"test_cache_key.tmp", NULL};
+   zerone_parser_args_t args = { .window = 300, .minmapq = 20 };
+
+   char *key1 = cache_key(fnames, args);
+   char *key2 = cache_key(fnames, args);
+   test_assert_critical(key1 != NULL && key2 != NULL);
+   test_assert(strcmp(key1, key2) == 0);
+   free(key2);
+
+   // The options are part of the key.
+   args.window = 200;
+   key2 = cache_key(fnames, args);
+   test_assert_critical(key2 != NULL);
+   test_assert(strcmp(key1, key2) != 0);
+   free(key2);
+
+   // So is the content (the size is the same).
+   args.window = 300;
+   f = fopen("test_cache_key.tmp", "w");
+   test_assert_critical(f != NULL);
+   fprintf(f, "chr1\t101\n");
+   fclose(f);
+   struct utimbuf times = { 0, 0 };
+   utime("test_cache_key.tmp", &times);
+   key2 = cache_key(fnames, args);
+   test_assert_critical(key2 != NULL);
+   test_assert(strcmp(key1, key2) != 0);
+   free(key2);
+
+   unlink("test_cache_key.tmp");
+
+   redirect_stderr();
+   key2 = cache_key(fnames, args);
+   unredirect_stderr();
+   test_assert(key2 == NULL);
+   test_assert_stderr("cannot open file test_cache_key.tmp\n");
+
+   free(key1);
+
+}
+
+
+void
+test_cache_put_get
+(void)
+{
+
+   system("rm -rf test_cache.tmp");
+
+   int y[5] = {1,0,3, 2,7};
+   uint size[2] = {3,2};
+   const char *names[2] = {"chr1", "chr2"};
+   ChIP_t *ChIP = new_ChIP(1, 2, y, names, size);
+   test_assert_critical(ChIP != NULL);
+   zinb_par_t par = { .a = 1.5, .p = .25, .pi = .75 };
+
+   zinb_par_t *par_ = NULL;
+   test_assert(cache_get("test_cache.tmp", "key1", &par_) == NULL);
+   test_assert(cache_put("test_cache.tmp", "key1", ChIP, &par, 0));
+   test_assert(cache_put("test_cache.tmp", "key2", ChIP, NULL, 0));
+
+   ChIP_t *ChIP_ = cache_get("test_cache.tmp", "key1", &par_);
+   test_assert_critical(ChIP_ != NULL);
+   test_assert_critical(par_ != NULL);
+   test_assert(par_->a == 1.5 && par_->p == .25 && par_->pi == .75);
+   test_assert(ChIP_->r == 1);
+   test_assert(ChIP_->nb == 2);
+   test_assert(strcmp(ChIP_->nm + 32, "chr2") == 0);
+   test_assert(ChIP_->sz[0] == 3 && ChIP_->sz[1] == 2);
+   for (int i = 0 ; i < 5 ; i++) test_assert(ChIP_->y[i] == y[i]);
+   free(par_);
+   free(ChIP_->y);
+   free(ChIP_);
+
+   // No fit in the second entry.
+   ChIP_ = cache_get("test_cache.tmp", "key2", &par_);
+   test_assert_critical(ChIP_ != NULL);
+   test_assert(par_ == NULL);
+   free(ChIP_->y);
+   free(ChIP_);
+
+   // Corrupt entry: a miss with a warning.
+   char *fname = entry_name("test_cache.tmp", "key2");
+   test_assert_critical(fname != NULL);
+   FILE *f = fopen(fname, "r+");
+   test_assert_critical(f != NULL);
+   fseek(f, -8, SEEK_END);
+   fputc(0xff, f);
+   fclose(f);
+   redirect_stderr();
+   test_assert(cache_get("test_cache.tmp", "key2", &par_) == NULL);
+   unredirect_stderr();
+   test_assert(strncmp(caught_in_stderr(), "corrupt or truncated file", 25) == 0);
+   free(fname);
+
+   // Eviction: only the entry just written fits.
+   struct stat st;
+   fname = entry_name("test_cache.tmp", "key1");
+   test_assert_critical(fname != NULL);
+   test_assert_critical(stat(fname, &st) == 0);
+   test_assert(cache_put("test_cache.tmp", "key3", ChIP, &par, st.st_size));
+   test_assert(access(fname, F_OK) != 0);
+   free(fname);
+   fname = entry_name("test_cache.tmp", "key3");
+   test_assert_critical(fname != NULL);
+   test_assert(access(fname, F_OK) == 0);
+   free(fname);
+
+   system("rm -rf test_cache.tmp");
+   free(ChIP);
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_cache[] = {
+   {"cache/cache_key",         test_cache_key},
+   {"cache/cache_put_get",     test_cache_put_get},
+   {NULL, NULL},
+};
@@ -0,0 +1,192 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "unittest.h"
+#include "checkpoint.c"
+
+void
+test_bins
+(void)
+{
+
+   int *y = malloc(15 * sizeof(int));
+   test_assert_critical(y != NULL);
+   for (int i = 0 ; i < 15 ; i++) y[i] = i;
+
+   const char *names[2] = {"chr1", "chrUn_KI270302v1"};
+   uint size[2] = {3,2};
+   ChIP_t *ChIP = new_ChIP(3, 2, y, names, size);
+   test_assert_critical(ChIP != NULL);
+
+   bins_info_t info = { .window = 200, .minmapq = 10, .nomock = 1 };
+   test_assert(write_bins("test_checkpoint.tmp", ChIP, info));
+
+   bins_info_t info_ = {0};
+   ChIP_t *ChIP_ = read_bins("test_checkpoint.tmp", &info_);
+   test_assert_critical(ChIP_ != NULL);
+
+   test_assert(info_.window == 200);
+   test_assert(info_.minmapq == 10);
+   test_assert(info_.nomock == 1);
+   test_assert(ChIP_->r == 3);
+   test_assert(ChIP_->nb == 2);
+   test_assert(ChIP_->sz[0] == 3);
+   test_assert(ChIP_->sz[1] == 2);
+   test_assert(strcmp(ChIP_->nm, "chr1") == 0);
+   test_assert(strcmp(ChIP_->nm + 32, "chrUn_KI270302v1") == 0);
+   for (int i = 0 ; i < 15 ; i++) test_assert(ChIP_->y[i] == i);
+
+   free(ChIP_->y);
+   free(ChIP_);
+
+   // Corrupt the file and make sure it is rejected.
+   FILE *f = fopen("test_checkpoint.tmp.bins", "r+");
+   test_assert_critical(f != NULL);
+   fseek(f, -8, SEEK_END);
+   fputc(0xff, f);
+   fclose(f);
+
+   redirect_stderr();
+   ChIP_ = read_bins("test_checkpoint.tmp", &info_);
+   unredirect_stderr();
+   test_assert(ChIP_ == NULL);
+   test_assert_stderr("corrupt or truncated file "
+         "test_checkpoint.tmp.bins\n");
+
+   unlink("test_checkpoint.tmp.bins");
+   free(y);
+   free(ChIP);
+
+}
+
+
+void
+test_checkpoint
+(void)
+{
+
+   int y[6] = {0};
+   uint size[1] = {2};
+   ChIP_t *ChIP = new_ChIP(3, 1, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   zerone_t *Z = new_zerone(3, ChIP);
+   zerone_t *Z_ = new_zerone(3, ChIP);
+   test_assert_critical(Z != NULL && Z_ != NULL);
+
+   double Q[9] = {.9,.05,.05, .05,.9,.05, .05,.05,.9};
+   double p[12] = {.1,.2,.3,.4, .2,.2,.3,.3, .4,.3,.2,.1};
+   set_zerone_par(Z, Q, 1.7, .6, p);
+   Z->iter = 3;
+   Z->l = -12.5;
+
+   double trace[BW_MAXITER] = {-14.0, -13.0, -12.5};
+   test_assert(write_checkpoint("test_checkpoint.tmp", Z, trace));
+
+   double trace_[BW_MAXITER] = {0};
+   test_assert(read_checkpoint("test_checkpoint.tmp", Z_, trace_));
+
+   test_assert(Z_->iter == 3);
+   test_assert(Z_->a == 1.7);
+   test_assert(Z_->pi == .6);
+   test_assert(Z_->l == -12.5);
+   for (int i = 0 ; i < 9 ; i++) test_assert(Z_->Q[i] == Q[i]);
+   for (int i = 0 ; i < 12 ; i++) test_assert(Z_->p[i] == p[i]);
+   for (int i = 0 ; i < 3 ; i++) test_assert(trace_[i] == trace[i]);
+
+   test_assert(Z_->vt == 0);
+
+   // Overwrite the checkpoint (during Viterbi training).
+   Z->iter = 4;
+   Z->vt = 4;
+   Z->polish = 2;
+   test_assert(write_checkpoint("test_checkpoint.tmp", Z, trace));
+   test_assert(read_checkpoint("test_checkpoint.tmp", Z_, trace_));
+   test_assert(Z_->iter == 4);
+   test_assert(Z_->vt == 4);
+   test_assert(Z_->polish == 2);
+
+   // A profile was added: warm start from the checkpoint.
+   int y4[8] = {0,0,0,4, 0,0,0,8};
+   ChIP_t *ChIP4 = new_ChIP(4, 1, y4, NULL, size);
+   test_assert_critical(ChIP4 != NULL);
+   zerone_t *Z4 = new_zerone(3, ChIP4);
+   test_assert_critical(Z4 != NULL);
+   test_assert(read_checkpoint("test_checkpoint.tmp", Z4, trace_));
+   test_assert(Z4->iter == 0);
+   test_assert(Z4->vt == 0);
+   test_assert(trace_[0] == 0);
+   for (int i = 0 ; i < 9 ; i++) test_assert(Z4->Q[i] == Q[i]);
+   for (int i = 0 ; i < 3 ; i++) {
+      double *pr = Z4->p + i*5;
+      test_assert(fabs(pr[1]/pr[0] - p[1+i*4]/p[0+i*4]) < 1e-12);
+      test_assert(fabs(pr[3]/pr[0] - p[3+i*4]/p[0+i*4]) < 1e-12);
+   }
+   // Other observations of the same size (e.g. a stale checkpoint
+   // of another run) do not match the checkpoint.
+   y4[1] = 1;
+   redirect_stderr();
+   test_assert(!read_checkpoint("test_checkpoint.tmp", Z4, trace_));
+   unredirect_stderr();
+   test_assert_stderr("checkpoint test_checkpoint.tmp "
+         "does not match the data\n");
+   free(ChIP4);
+   Z4->ChIP = NULL;
+   destroy_zerone_all(Z4);
+
+   int y1[6] = {0,0,0, 0,0,1};
+   ChIP_t *ChIP1 = new_ChIP(3, 1, y1, NULL, size);
+   test_assert_critical(ChIP1 != NULL);
+   Z_->ChIP = ChIP1;
+   redirect_stderr();
+   test_assert(!read_checkpoint("test_checkpoint.tmp", Z_, trace_));
+   unredirect_stderr();
+   test_assert_stderr("checkpoint test_checkpoint.tmp "
+         "does not match the data\n");
+   free(ChIP1);
+
+   // The checkpoint does not match the data.
+   uint size_[1] = {1};
+   ChIP_t *ChIP_ = new_ChIP(3, 1, y, NULL, size_);
+   test_assert_critical(ChIP_ != NULL);
+   Z_->ChIP = ChIP_;
+
+   redirect_stderr();
+   test_assert(!read_checkpoint("test_checkpoint.tmp", Z_, trace_));
+   unredirect_stderr();
+   test_assert_stderr("checkpoint test_checkpoint.tmp "
+         "does not match the data\n");
+
+   unlink("test_checkpoint.tmp");
+
+   free(ChIP);
+   free(ChIP_);
+   Z->ChIP = NULL;
+   Z_->ChIP = NULL;
+   destroy_zerone_all(Z);
+   destroy_zerone_all(Z_);
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_checkpoint[] = {
+   {"checkpoint/bins",         test_bins},
+   {"checkpoint/checkpoint",   test_checkpoint},
+   {NULL, NULL},
+};
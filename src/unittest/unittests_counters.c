@@ -0,0 +1,116 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "unittest.h"
+#include "counters.c"
+
+void *
+counters_thread
+(
+   void * arg
+)
+{
+   volatile double x = 0.0;
+   stage_begin(STAGE_FWDB);
+   for (int i = 0 ; i < 1000000 ; i++) x += i;
+   stage_end(STAGE_FWDB);
+   return NULL;
+}
+
+
+void
+test_counters
+(void)
+{
+
+   stage_t stage;
+
+   // Nothing is recorded when the counters are off.
+   stage_begin(STAGE_PARSE);
+   stage_end(STAGE_PARSE);
+   read_stage(STAGE_PARSE, &stage);
+   test_assert(stage.calls == 0);
+   test_assert(MYSTATE == NULL);
+
+   // Software events stand for the hardware counters,
+   // which are not available on every machine.
+   EVENTS[0][0] = EVENTS[1][0] = PERF_TYPE_SOFTWARE;
+   EVENTS[2][0] = EVENTS[3][0] = PERF_TYPE_SOFTWARE;
+   EVENTS[0][1] = PERF_COUNT_SW_TASK_CLOCK;
+   EVENTS[1][1] = PERF_COUNT_SW_TASK_CLOCK;
+   EVENTS[2][1] = PERF_COUNT_SW_CONTEXT_SWITCHES;
+   EVENTS[3][1] = PERF_COUNT_SW_PAGE_FAULTS;
+
+   start_counters();
+
+   // Four threads run the same stage.
+   pthread_t tid[4];
+   for (int i = 0 ; i < 4 ; i++) {
+      test_assert_critical(pthread_create(tid+i, NULL,
+               counters_thread, NULL) == 0);
+   }
+   for (int i = 0 ; i < 4 ; i++) pthread_join(tid[i], NULL);
+
+   stage_begin(STAGE_OUTPUT);
+   stage_end(STAGE_OUTPUT);
+
+   read_stage(STAGE_FWDB, &stage);
+   test_assert(stage.calls == 4);
+   test_assert(stage.ns > 0);
+   // Software events may not be available either.
+   if (stage.missed == 0) {
+      test_assert(stage.count[0] > 0);
+      test_assert(stage.count[1] > stage.count[0] / 2);
+      test_assert(stage.count[1] < stage.count[0] * 2);
+   }
+   else {
+      test_assert(stage.missed == 4);
+   }
+
+   read_stage(STAGE_OUTPUT, &stage);
+   test_assert(stage.calls == 1);
+   read_stage(STAGE_PARSE, &stage);
+   test_assert(stage.calls == 0);
+
+   // Only the stages that were run are reported.
+   FILE *f = tmpfile();
+   test_assert_critical(f != NULL);
+   print_counters(f);
+   rewind(f);
+   char line[256];
+   int nlines = 0;
+   int fwdb = 0;
+   while (fgets(line, sizeof(line), f) != NULL) {
+      nlines++;
+      if (strncmp(line, "# fwd/bwd", 9) == 0) fwdb = 1;
+      test_assert(strncmp(line, "# ingestion", 11) != 0);
+   }
+   fclose(f);
+   test_assert(fwdb);
+   test_assert(nlines == 3);
+
+   counters_on = 0;
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_counters[] = {
+   {"counters/counters",       test_counters},
+   {NULL, NULL},
+};
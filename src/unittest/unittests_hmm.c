@@ -782,6 +782,96 @@ test_block_viterbi_NA
 
 }
 
+void
+test_block_small_blocks
+(void)
+{
+
+   // Many short blocks (as in draft assemblies with thousands of
+   // small contigs) processed in one call must give the same
+   // results as processing every block on its own. There are
+   // runs of blocks of a single window (see 'block_fwdb()').
+   const unsigned int m = 2;
+   const unsigned int nblocks = 200;
+   double Q[4] = {
+      // transpose //
+      0.8, 0.1,
+      0.2, 0.9,
+   };
+   double init[2] = {.8, .2};
+
+   unsigned int size[200];
+   unsigned int n = 0;
+   for (int i = 0 ; i < nblocks ; i++) {
+      n += size[i] = i % 7 < 4 ? 1 : 2 + i % 3;
+   }
+
+   double *prob = malloc(m*n * sizeof(double));
+   double *copy = malloc(m*n * sizeof(double));
+   double *phi = malloc(m*n * sizeof(double));
+   double *phi_1 = malloc(m*n * sizeof(double));
+   int *path = malloc(n * sizeof(int));
+   int *path_1 = malloc(n * sizeof(int));
+   test_assert_critical(prob != NULL && copy != NULL && phi != NULL);
+   test_assert_critical(phi_1 != NULL && path != NULL && path_1 != NULL);
+
+   srand(123);
+   for (int i = 0 ; i < m*n ; i++) prob[i] = rand() / (1.0 + RAND_MAX);
+   memcpy(copy, prob, m*n * sizeof(double));
+
+   // Forward-backward.
+   double trans[4];
+   double l = block_fwdb(m, nblocks, size, Q, init, prob, phi, trans);
+
+   double l_1 = 0.0;
+   double T[4];
+   double trans_1[4] = {0};
+   size_t offset = 0;
+   for (int i = 0 ; i < nblocks ; i++) {
+      memcpy(prob, copy, m*n * sizeof(double));
+      l_1 += fwdb(m, size[i], Q, init, prob+offset, phi_1+offset, T);
+      for (int j = 0 ; j < m*m ; j++) trans_1[j] += T[j];
+      offset += m*size[i];
+   }
+
+   test_assert(fabs(l - l_1) < 1e-9);
+   for (int i = 0 ; i < m*n ; i++) {
+      test_assert(fabs(phi[i] - phi_1[i]) < 1e-12);
+   }
+   for (int i = 0 ; i < m*m ; i++) {
+      test_assert(fabs(trans[i] - trans_1[i]) < 1e-9);
+   }
+
+   // Viterbi.
+   memcpy(prob, copy, m*n * sizeof(double));
+   test_assert(block_viterbi(m, nblocks, size, Q, init, prob, path) == 0);
+
+   double log_Q[4];
+   double log_i[2];
+   for (int i = 0 ; i < m*m ; i++) log_Q[i] = log(Q[i]);
+   for (int i = 0 ; i < m ; i++) log_i[i] = log(init[i]);
+   for (int i = 0 ; i < m*n ; i++) copy[i] = log(copy[i]);
+   offset = 0;
+   for (int i = 0 ; i < nblocks ; i++) {
+      viterbi(m, size[i], log_Q, log_i, copy+m*offset, path_1+offset);
+      offset += size[i];
+   }
+
+   for (int i = 0 ; i < n ; i++) {
+      test_assert(path[i] == path_1[i]);
+   }
+
+   free(prob);
+   free(copy);
+   free(phi);
+   free(phi_1);
+   free(path);
+   free(path_1);
+
+   return;
+
+}
+
 // Test cases for export.
 const test_case_t test_cases_hmm[] = {
    {"hmm/fwdb",                test_fwdb},
@@ -792,5 +882,6 @@ const test_case_t test_cases_hmm[] = {
    {"hmm/viterbi",             test_viterbi},
    {"hmm/block_viterbi",       test_block_viterbi},
    {"hmm/block_viterbi (NAs)", test_block_viterbi_NA},
+   {"hmm/small blocks",        test_block_small_blocks},
    {NULL, NULL},
 };
@@ -0,0 +1,162 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include "unittest.h"
+#include "numa.c"
+
+void
+test_parse_cpulist
+(void)
+{
+
+   cpu_set_t set;
+   test_assert(parse_cpulist("0-3,8,10-11\n", &set));
+   test_assert(CPU_COUNT(&set) == 7);
+   test_assert(CPU_ISSET(0, &set) && CPU_ISSET(3, &set));
+   test_assert(!CPU_ISSET(4, &set) && CPU_ISSET(8, &set));
+   test_assert(CPU_ISSET(11, &set) && !CPU_ISSET(12, &set));
+   test_assert(parse_cpulist("5", &set));
+   test_assert(CPU_COUNT(&set) == 1 && CPU_ISSET(5, &set));
+
+   test_assert(!parse_cpulist("3-1", &set));
+   test_assert(!parse_cpulist("0,x", &set));
+   test_assert(!parse_cpulist("-2", &set));
+
+   // The CPUs of the process are all listed once.
+   int cpu[POOL_MAXTHREADS];
+   int node[POOL_MAXTHREADS];
+   int ncpu = numa_cpus(cpu, node, POOL_MAXTHREADS);
+   cpu_set_t allowed;
+   test_assert_critical(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+   test_assert(ncpu == CPU_COUNT(&allowed));
+   for (int i = 0 ; i < ncpu ; i++) {
+      test_assert(CPU_ISSET(cpu[i], &allowed));
+      test_assert(node[i] >= 0);
+   }
+
+}
+
+
+void
+test_pool
+(void)
+{
+
+   // Three blocks, the threads own one each. The second row of
+   // 'chr2' is a copy of a row of 'chr1' (another part).
+   int y[24] = {
+      2,2,2,  5,0,2,  3,3,2,
+      6,12,9, 5,0,2,  4,3,10,
+      0,0,0,  1,7,2,
+   };
+   unsigned size[3] = {3,3,2};
+   const char *names[3] = {"chr1", "chr2", "chr3"};
+
+   int *y1 = malloc(sizeof(y));
+   int *y2 = malloc(sizeof(y));
+   test_assert_critical(y1 != NULL && y2 != NULL);
+   memcpy(y1, y, sizeof(y));
+   memcpy(y2, y, sizeof(y));
+   ChIP_t *ChIP1 = new_ChIP(3, 3, y1, names, size);
+   ChIP_t *ChIP2 = new_ChIP(3, 3, y2, names, size);
+   test_assert_critical(ChIP1 != NULL && ChIP2 != NULL);
+
+   double p[12] = {
+      .30, .30, .20, .20,
+      .20, .20, .30, .30,
+      .10, .10, .40, .40,
+   };
+   double Q[9] = {
+      .90, .05, .05,
+      .05, .90, .05,
+      .05, .05, .90,
+   };
+
+   zerone_t *Z1 = new_zerone(3, ChIP1);
+   zerone_t *Z2 = new_zerone(3, ChIP2);
+   test_assert_critical(Z1 != NULL && Z2 != NULL);
+   set_zerone_par(Z1, Q, 1.2, .8, p);
+   set_zerone_par(Z2, Q, 1.2, .8, p);
+
+   redirect_stderr();
+   bw_t *bw1 = new_bw(Z1);
+   bw_t *bw2 = new_bw(Z2);
+   unredirect_stderr();
+   test_assert_critical(bw1 != NULL && bw2 != NULL);
+
+   bw2->pool = new_pool(Z2, bw2, 4);
+   test_assert_critical(bw2->pool != NULL);
+   test_assert(bw2->pool->nparts == 3);
+
+   // The observations of the caller are kept.
+   test_assert(Z2->ChIP->y == y2);
+   for (int i = 0 ; i < 24 ; i++) test_assert(y2[i] == y[i]);
+   test_assert(bw2->index[4] == 1);
+
+   // Same cycle with and without threads.
+   for (int iter = 0 ; iter < 3 ; iter++) {
+      test_assert(bw_iter(Z1, bw1) >= 0);
+      test_assert(bw_iter(Z2, bw2) >= 0);
+      test_assert(fabs(Z1->l - Z2->l) < 1e-9);
+      for (int i = 0 ; i < 9 ; i++) {
+         test_assert(fabs(Z1->Q[i] - Z2->Q[i]) < 1e-12);
+      }
+      for (int i = 0 ; i < 12 ; i++) {
+         test_assert(fabs(Z1->p[i] - Z2->p[i]) < 1e-12);
+      }
+   }
+
+   bw_finish(Z1, bw1);
+   bw_finish(Z2, bw2);
+   for (int i = 0 ; i < 24 ; i++) {
+      test_assert(fabs(Z1->pem[i] - Z2->pem[i]) < 1e-9);
+      test_assert(fabs(Z1->phi[i] - Z2->phi[i]) < 1e-9);
+   }
+
+   // A single block cannot be split.
+   unsigned size1[1] = {8};
+   int *y3 = malloc(sizeof(y));
+   test_assert_critical(y3 != NULL);
+   memcpy(y3, y, sizeof(y));
+   ChIP_t *ChIP3 = new_ChIP(3, 1, y3, names, size1);
+   test_assert_critical(ChIP3 != NULL);
+   zerone_t *Z3 = new_zerone(3, ChIP3);
+   test_assert_critical(Z3 != NULL);
+   set_zerone_par(Z3, Q, 1.2, .8, p);
+   redirect_stderr();
+   bw_t *bw3 = new_bw(Z3);
+   unredirect_stderr();
+   test_assert_critical(bw3 != NULL);
+   test_assert(new_pool(Z3, bw3, 4) == NULL);
+   test_assert(Z3->ChIP->y == y3);
+
+   destroy_bw(bw3);
+   destroy_zerone_all(Z1);
+   destroy_zerone_all(Z2);
+   destroy_zerone_all(Z3);
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_numa[] = {
+   {"numa/parse_cpulist",      test_parse_cpulist},
+   {"numa/pool",               test_pool},
+   {NULL, NULL},
+};
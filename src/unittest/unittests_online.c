@@ -0,0 +1,341 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "unittest.h"
+#include "online.c"
+
+void
+test_online
+(void)
+{
+
+   int y[36] = {
+      2,2,2,  5,0,2,  3,3,2,  0,0,0,  1,0,1,  2,1,0,
+      6,12,9, 2,1,2,  4,3,10, 0,0,0,  3,9,14, 1,1,1,
+   };
+   int y_[36];
+   memcpy(y_, y, 36 * sizeof(int));
+
+   const char *names[2] = {"chr1", "chr2"};
+   unsigned size[2] = {6,6};
+   ChIP_t *ChIP = new_ChIP(3, 2, y, names, size);
+   ChIP_t *ChIP_ = new_ChIP(3, 2, y_, names, size);
+   test_assert_critical(ChIP != NULL && ChIP_ != NULL);
+
+   double p[12] = {
+      .30, .30, .20, .20,
+      .20, .20, .30, .30,
+      .10, .10, .40, .40,
+   };
+   double Q[9] = {
+      .90, .05, .05,
+      .05, .90, .05,
+      .05, .05, .90,
+   };
+
+   zerone_t *Z1 = new_zerone(3, ChIP);
+   zerone_t *Z2 = new_zerone(3, ChIP_);
+   test_assert_critical(Z1 != NULL && Z2 != NULL);
+   set_zerone_par(Z1, Q, 1.2, .8, p);
+   set_zerone_par(Z2, Q, 1.2, .8, p);
+
+   // The first update is a full Baum-Welch cycle.
+   online_t *O = new_online(Z1);
+   test_assert_critical(O != NULL);
+   bw_t *bw = new_bw(Z2);
+   test_assert_critical(bw != NULL);
+
+   redirect_stderr();
+   test_assert(online_update(O) == 2);
+   test_assert(bw_iter(Z2, bw) == 0);
+   unredirect_stderr();
+
+   test_assert(fabs(Z1->l - Z2->l) < 1e-9);
+   for (int i = 0 ; i < 9 ; i++) test_assert(fabs(Z1->Q[i]-Z2->Q[i]) < 1e-9);
+   for (int i = 0 ; i < 12 ; i++) test_assert(fabs(Z1->p[i]-Z2->p[i]) < 1e-9);
+
+   // Nothing to do.
+   test_assert(online_update(O) == 0);
+
+   // New reads in the second block only.
+   int dy[6] = { 1,2,3,  0,0,0 };
+   const char *dnames[1] = {"chr2"};
+   unsigned dsize[1] = {2};
+   ChIP_t *delta = new_ChIP(3, 1, dy, dnames, dsize);
+   test_assert_critical(delta != NULL);
+
+   test_assert(online_add(O, delta) == 1);
+   test_assert(O->dirty[0] == 0);
+   test_assert(O->dirty[1] == 1);
+   test_assert(y[18] == 7 && y[19] == 14 && y[20] == 12);
+   test_assert(y[21] == 2 && y[22] == 1 && y[23] == 2);
+
+   // The statistics of the first block are untouched.
+   double stat[O->ssz];
+   memcpy(stat, O->stat, O->ssz * sizeof(double));
+   redirect_stderr();
+   test_assert(online_update(O) == 1);
+   unredirect_stderr();
+   test_assert(O->step == 2);
+   for (int j = 0 ; j < O->ssz ; j++) test_assert(O->stat[j] == stat[j]);
+
+   // Unknown blocks and blocks that are too long are rejected.
+   dnames[0] = "chrX";
+   ChIP_t *bad = new_ChIP(3, 1, dy, dnames, dsize);
+   test_assert_critical(bad != NULL);
+   redirect_stderr();
+   test_assert(online_add(O, bad) == -1);
+   unredirect_stderr();
+   test_assert_stderr("unknown block chrX in new reads\n");
+   test_assert(O->dirty[1] == 0);
+   free(bad);
+
+   // Blocks with reads further along are extended.
+   int gy[24] = {
+      0,0,0,  0,0,0,  0,0,0,  0,0,0,
+      0,0,0,  1,1,1,  0,0,0,  2,3,4,
+   };
+   dnames[0] = "chr1";
+   unsigned gsize[1] = {8};
+   ChIP_t *longer = new_ChIP(3, 1, gy, dnames, gsize);
+   test_assert_critical(longer != NULL);
+   // 'ChIP->y' is on the stack, move it to the heap.
+   int *heap = malloc(36 * sizeof(int));
+   test_assert_critical(heap != NULL);
+   memcpy(heap, y, 36 * sizeof(int));
+   ChIP->y = heap;
+   test_assert(online_add(O, longer) == 1);
+   test_assert(ChIP->sz[0] == 8 && ChIP->sz[1] == 6);
+   test_assert(O->off[0] == 0 && O->off[1] == 8);
+   test_assert(O->dirty[0] == 1 && O->dirty[1] == 0);
+   // The old windows of the first block, the new reads, the
+   // extension and the second block.
+   test_assert(memcmp(ChIP->y, y, 15 * sizeof(int)) == 0);
+   test_assert(ChIP->y[15] == y[15]+1 && ChIP->y[17] == y[17]+1);
+   test_assert(ChIP->y[18] == 0 && ChIP->y[19] == 0 && ChIP->y[20] == 0);
+   test_assert(ChIP->y[21] == 2 && ChIP->y[22] == 3 && ChIP->y[23] == 4);
+   test_assert(memcmp(ChIP->y + 24, y + 18, 18 * sizeof(int)) == 0);
+   free(longer);
+   redirect_stderr();
+   test_assert(online_update(O) == 1);
+   unredirect_stderr();
+
+   // Decode the current fit.
+   redirect_stderr();
+   zerone_t *D = online_decode(O);
+   unredirect_stderr();
+   test_assert_critical(D != NULL);
+   test_assert(D->path != NULL);
+   test_assert(D->p[0] >= D->p[4] && D->p[4] >= D->p[8]);
+   for (int k = 0 ; k < 14 ; k++) {
+      double sum = D->phi[0+k*3] + D->phi[1+k*3] + D->phi[2+k*3];
+      test_assert(fabs(sum - 1.0) < 1e-9);
+   }
+
+   destroy_online(O);
+   destroy_bw(bw);
+   free(delta);
+   free(ChIP->y);
+   free(ChIP);
+   free(ChIP_);
+   D->ChIP = NULL;
+   Z1->ChIP = NULL;
+   Z2->ChIP = NULL;
+   destroy_zerone_all(D);
+   destroy_zerone_all(Z1);
+   destroy_zerone_all(Z2);
+
+   return;
+
+}
+
+
+void
+test_online_zerone
+(void)
+{
+
+   int *y = malloc(3*120 * sizeof(int));
+   test_assert_critical(y != NULL);
+   unsigned int seed = 123;
+   for (int k = 0 ; k < 120 ; k++) {
+      int enriched = (k % 40) > 15 && (k % 40) < 25;
+      y[0+k*3] = rand_r(&seed) % 4;
+      y[1+k*3] = rand_r(&seed) % 3 + (enriched ? 12 : 0);
+      y[2+k*3] = rand_r(&seed) % 3 + (enriched ? 10 : 0);
+   }
+
+   const char *names[3] = {"chr1", "chr2", "chr3"};
+   unsigned size[3] = {40,40,40};
+   ChIP_t *ChIP = new_ChIP(3, 3, y, names, size);
+   test_assert_critical(ChIP != NULL);
+
+   // Fit and checkpoint the first wave of reads.
+   bins_info_t info = { .window = 300, .minmapq = 20 };
+   zerone_args_t args = { .checkpoint = "test_online.tmp" };
+   unlink("test_online.tmp.online");
+   test_assert(write_bins("test_online.tmp", ChIP, info));
+   redirect_stderr();
+   zerone_t *Z = do_zerone(ChIP, &args);
+   unredirect_stderr();
+   test_assert_critical(Z != NULL);
+   Z->ChIP = NULL;
+   destroy_zerone_all(Z);
+
+   // New reads in the second block, the first time without
+   // statistics (all the blocks are computed).
+   int dy[6] = { 1,0,2,  0,1,1 };
+   const char *dnames[1] = {"chr2"};
+   unsigned dsize[1] = {2};
+   ChIP_t *delta = new_ChIP(3, 1, dy, dnames, dsize);
+   test_assert_critical(delta != NULL);
+
+   redirect_stderr();
+   zerone_t *D = online_zerone(ChIP, delta, "test_online.tmp", info);
+   unredirect_stderr();
+   test_assert_critical(D != NULL);
+   test_assert_stderr("no block statistics, computing all the blocks\n"
+         "online EM step on 3 blocks\n");
+   test_assert(D->ChIP == ChIP);
+   test_assert(ChIP->y[120] == y[120]);
+   D->ChIP = NULL;
+   destroy_zerone_all(D);
+
+   // The second time only the block with new reads.
+   redirect_stderr();
+   D = online_zerone(ChIP, delta, "test_online.tmp", info);
+   unredirect_stderr();
+   test_assert_critical(D != NULL);
+   test_assert_stderr("online EM step on 1 blocks\n");
+   test_assert_critical(D->path != NULL);
+   int errors = 0;
+   for (int k = 0 ; k < 120 ; k++) {
+      int enriched = (k % 40) > 15 && (k % 40) < 25;
+      // The edges of the regions may be in the intermediate state.
+      errors += enriched != (D->path[k] > 0);
+   }
+   test_assert(errors <= 3);
+   D->ChIP = NULL;
+   destroy_zerone_all(D);
+
+   // The saved observations have the new reads.
+   bins_info_t info_;
+   ChIP_t *saved = read_bins("test_online.tmp", &info_);
+   test_assert_critical(saved != NULL);
+   test_assert(memcmp(saved->y, ChIP->y, 3*120 * sizeof(int)) == 0);
+   test_assert(info_.gen == 2);
+
+   // Simulate a crash after the checkpoint of the next update is
+   // written, but before the staged files are moved in place.
+   redirect_stderr();
+   D = online_zerone(ChIP, delta, "test_online.tmp", info);
+   unredirect_stderr();
+   test_assert_critical(D != NULL);
+   D->ChIP = NULL;
+   destroy_zerone_all(D);
+   test_assert(rename("test_online.tmp.bins",
+            "test_online.tmp.next.bins") == 0);
+   test_assert(rename("test_online.tmp.online",
+            "test_online.tmp.next.online") == 0);
+   test_assert(write_bins("test_online.tmp", saved, info_));
+
+   // The checkpoint is not of the generation of the bins.
+   Z = new_zerone(3, ChIP);
+   test_assert_critical(Z != NULL);
+   double trace[BW_MAXITER];
+   redirect_stderr();
+   test_assert(!read_checkpoint("test_online.tmp", Z, trace));
+   unredirect_stderr();
+   test_assert_stderr("checkpoint test_online.tmp "
+         "does not match the data\n");
+
+   // The update was committed: the staged files are moved in place.
+   test_assert(recover_checkpoint("test_online.tmp"));
+   test_assert(access("test_online.tmp.next.bins", F_OK) != 0);
+   test_assert(access("test_online.tmp.next.online", F_OK) != 0);
+   test_assert(read_checkpoint("test_online.tmp", Z, trace));
+   test_assert(Z->gen == 3);
+   free(saved->y);
+   free(saved);
+   saved = read_bins("test_online.tmp", &info_);
+   test_assert_critical(saved != NULL);
+   test_assert(info_.gen == 3);
+   test_assert(memcmp(saved->y, ChIP->y, 3*120 * sizeof(int)) == 0);
+
+   // Simulate a crash before the checkpoint is written: the staged
+   // files are removed and the blocks are not counted twice.
+   online_t *O = new_online(Z);
+   test_assert_critical(O != NULL);
+   Z->gen = 4;
+   test_assert(online_save(O, "test_online.tmp.next.online") == 0);
+   info_.gen = 4;
+   test_assert(write_bins("test_online.tmp.next", saved, info_));
+   test_assert(recover_checkpoint("test_online.tmp"));
+   test_assert(access("test_online.tmp.next.bins", F_OK) != 0);
+   test_assert(access("test_online.tmp.next.online", F_OK) != 0);
+   // The statistics of the previous generation are still in place.
+   Z->gen = 3;
+   test_assert(online_load(O, "test_online.tmp.online") == 1);
+   Z->gen = 4;
+   test_assert(online_load(O, "test_online.tmp.online") == 0);
+   destroy_online(O);
+   Z->ChIP = NULL;
+   destroy_zerone_all(Z);
+
+   redirect_stderr();
+   D = online_zerone(ChIP, delta, "test_online.tmp", info);
+   unredirect_stderr();
+   test_assert_critical(D != NULL);
+   test_assert_stderr("online EM step on 1 blocks\n");
+   D->ChIP = NULL;
+   destroy_zerone_all(D);
+   free(saved->y);
+   free(saved);
+
+   // The checkpoint no longer matches the observations
+   // of the first wave.
+   int *y0 = malloc(3*120 * sizeof(int));
+   test_assert_critical(y0 != NULL);
+   memcpy(y0, ChIP->y, 3*120 * sizeof(int));
+   y0[120] -= 2;
+   ChIP_t *old = new_ChIP(3, 3, y0, names, size);
+   test_assert_critical(old != NULL);
+   redirect_stderr();
+   test_assert(online_zerone(old, delta, "test_online.tmp", info) == NULL);
+   unredirect_stderr();
+   test_assert_stderr("checkpoint test_online.tmp "
+         "does not match the data\n");
+
+   unlink("test_online.tmp");
+   unlink("test_online.tmp.bins");
+   unlink("test_online.tmp.online");
+   free(y0);
+   free(old);
+   free(delta);
+   free(ChIP->y);
+   free(ChIP);
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_online[] = {
+   {"online/online",           test_online},
+   {"online/online_zerone",    test_online_zerone},
+   {NULL, NULL},
+};
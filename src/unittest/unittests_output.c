@@ -0,0 +1,125 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "unittest.h"
+#include "output.c"
+
+const char *
+skip_qc
+(
+   const char *buf
+)
+// Skip the QC report at the top of the output.
+{
+   while (*buf == '#') buf = strchr(buf, '\n') + 1;
+   return buf;
+}
+
+void
+test_print_output
+(void)
+{
+
+   // One block of 5 windows (the last is not printed).
+   int y[10] = {1,4, 0,9, 2,8, 1,0, 3,3};
+   uint size[1] = {5};
+   const char *names[1] = {"chr2"};
+   ChIP_t *ChIP = new_ChIP(2, 1, y, names, size);
+   test_assert_critical(ChIP != NULL);
+
+   zerone_t *Z = new_zerone(3, ChIP);
+   test_assert_critical(Z != NULL);
+
+   int path[5] = {0,2,2,0,2};
+   double phi[15] = {
+      .9,.05,.05,  .0,.1,.9,  .0,.2,.8,  .8,.1,.1,  .1,.1,.8,
+   };
+   Z->path = path;
+   Z->phi = phi;
+
+   output_args_t args = { .window = 100 };
+
+   char *buf = NULL;
+   size_t sz = 0;
+   FILE *f = open_memstream(&buf, &sz);
+   test_assert_critical(f != NULL);
+   print_output(f, Z, args);
+   fclose(f);
+   test_assert(strcmp(skip_qc(buf),
+         "chr2\t1\t100\t0\t1\t4\t0.05000\n"
+         "chr2\t101\t200\t1\t0\t9\t0.90000\n"
+         "chr2\t201\t300\t1\t2\t8\t0.80000\n"
+         "chr2\t301\t400\t0\t1\t0\t0.10000\n") == 0);
+   free(buf);
+
+   // Skip the mock column and filter on confidence.
+   args.nomock = 1;
+   args.minconf = .5;
+   f = open_memstream(&buf, &sz);
+   test_assert_critical(f != NULL);
+   print_output(f, Z, args);
+   fclose(f);
+   test_assert(strcmp(skip_qc(buf),
+         "chr2\t101\t200\t1\t9\t0.90000\n"
+         "chr2\t201\t300\t1\t8\t0.80000\n") == 0);
+   free(buf);
+
+   // List output.
+   args.list = 1;
+   args.minconf = 0.0;
+   f = open_memstream(&buf, &sz);
+   test_assert_critical(f != NULL);
+   print_output(f, Z, args);
+   fclose(f);
+   test_assert(strcmp(skip_qc(buf), "chr2\t101\t400\t0.90000\n") == 0);
+   free(buf);
+
+   // Several sinks in one pass.
+   char *buf2 = NULL;
+   size_t sz2 = 0;
+   f = open_memstream(&buf, &sz);
+   FILE *f2 = open_memstream(&buf2, &sz2);
+   test_assert_critical(f != NULL && f2 != NULL);
+   sink_t sinks[3] = {
+      { .f = f,  .list = 0, .minconf = .85 },
+      { .f = f2, .list = 1, .minconf = .0 },
+      { .f = f2, .list = 1, .minconf = .95 },
+   };
+   print_sinks(sinks, 3, Z, args);
+   fclose(f);
+   fclose(f2);
+   test_assert(strcmp(skip_qc(buf), "chr2\t101\t200\t1\t9\t0.90000\n") == 0);
+   test_assert(strcmp(skip_qc(buf2), "chr2\t101\t400\t0.90000\n") == 0);
+   free(buf);
+   free(buf2);
+
+   Z->path = NULL;
+   Z->phi = NULL;
+   Z->ChIP = NULL;
+   destroy_zerone_all(Z);
+   free(ChIP);
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_output[] = {
+   {"output/print_output",     test_print_output},
+   {NULL, NULL},
+};
@@ -16,6 +16,7 @@
    along with Zerone. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -283,10 +284,14 @@ test_merge_hashes
    test_assert(ChIP->sz[1] == 77);
    test_assert(ChIP->sz[2] == 9);
    test_assert(ChIP->sz[3] == 6);
-   // This should fill the arrays with 1s.
-   for (int i = 0 ; i < nobs(ChIP) ; i++) {
-      test_assert(ChIP->y[0+i*ChIP->r] == 1);
-   }
+   // The first profile is implicit: 'y' has one column.
+   test_assert(ChIP->nomock == 1);
+   int b = find_block(ChIP, "chr17", -1);
+   test_assert_critical(b >= 0);
+   size_t off = 0;
+   for (int i = 0 ; i < b ; i++) off += ChIP->sz[i];
+   test_assert(ChIP->sz[b] == 6);
+   test_assert(ChIP->y[off+5] == 1);
 
    // Manually destroy 'ChIP'.
    free(ChIP->y);
@@ -298,6 +303,116 @@ test_merge_hashes
 }
 
 
+link_t *
+find_link
+(
+   const char   * s,
+         hash_t * htab
+)
+// Same as 'lookup_or_insert()' without insertion.
+{
+   for (link_t *lnk = htab[hv(s)] ; lnk != NULL ; lnk = lnk->next) {
+      if (strcmp(s, lnk->seqname) == 0) return lnk;
+   }
+   return NULL;
+}
+
+
+void
+test_merge_hashes_mt
+(void)
+{
+
+   hash_t * hashes[4] = {0};
+   for (int i = 0 ; i < 4 ; i++) {
+      hashes[i] = calloc(HSIZE, sizeof(link_t *));
+      test_assert_critical(hashes[i] != NULL);
+   }
+
+   srand(123);
+
+   // Chromosome 'j' is missing from file 'i' when 'j % 4 == i'
+   // and some are longer than a tile of 'merge_blocks()'.
+   for (int j = 0 ; j < 40 ; j++) {
+      char name[32];
+      sprintf(name, "chr%d", j);
+      const int len = j % 7 == 0 ? 6000 + 97*j : 1 + 13*j;
+      for (int i = 0 ; i < 4 ; i++) {
+         if (j % 4 == i) continue;
+         link_t *lnk = lookup_or_insert(name, hashes[i]);
+         test_assert_critical(lnk != NULL);
+         // Files have different lengths.
+         for (int k = 0 ; k < len - 3*i ; k++) {
+            test_assert(add_to_rod(&lnk->counts, k, rand() % 5));
+         }
+      }
+   }
+
+   // Many small contigs (long lists in the hash tables).
+   for (int j = 0 ; j < 3000 ; j++) {
+      char name[32];
+      sprintf(name, "contig%d", j);
+      for (int i = 0 ; i < 4 ; i++) {
+         if (j % 5 == i) continue;
+         link_t *lnk = lookup_or_insert(name, hashes[i]);
+         test_assert_critical(lnk != NULL);
+         for (int k = 0 ; k < 1 + j % 3 ; k++) {
+            test_assert(add_to_rod(&lnk->counts, k, rand() % 5));
+         }
+      }
+   }
+
+   for (int no_mock = 0 ; no_mock < 2 ; no_mock++) {
+
+      ChIP_t *ChIP = merge_hashes(hashes, 4, no_mock);
+      test_assert_critical(ChIP != NULL);
+      test_assert(ChIP->nb == 3040);
+      test_assert(ChIP->nomock == no_mock);
+
+      // Compare with the rods.
+      const int s = 4 - no_mock;
+      size_t off = 0;
+      for (int b = 0 ; b < ChIP->nb ; b++) {
+         for (int i = no_mock ; i < 4 ; i++) {
+            link_t *lnk = find_link(ChIP->nm + 32*b, hashes[i]);
+            for (size_t k = 0 ; k < ChIP->sz[b] ; k++) {
+               int expected = lnk == NULL || k >= lnk->counts->sz ?
+                  0 : lnk->counts->array[k];
+               test_assert(ChIP->y[i-no_mock + s*(off+k)] == expected);
+            }
+         }
+         off += ChIP->sz[b];
+      }
+
+      // The merge does not insert blocks in the ChIP hashes.
+      test_assert(find_link("chr1", hashes[1]) == NULL);
+      test_assert(find_link("chr2", hashes[2]) == NULL);
+      test_assert(find_link("chr3", hashes[3]) == NULL);
+      test_assert(find_link("chr0", hashes[0]) != NULL);
+
+      // Same result on several threads.
+      int threads[4] = {2, 3, 8, 64};
+      for (int t = 0 ; t < 4 ; t++) {
+         ChIP_t *ChIP_ = merge_hashes_mt(hashes, 4, no_mock, threads[t]);
+         test_assert_critical(ChIP_ != NULL);
+         test_assert(ChIP_->nb == ChIP->nb);
+         test_assert(memcmp(ChIP_->sz, ChIP->sz,
+                  ChIP->nb * sizeof(unsigned int)) == 0);
+         test_assert(memcmp(ChIP_->y, ChIP->y, s*off*sizeof(int)) == 0);
+         free(ChIP_->y);
+         free(ChIP_);
+      }
+
+      free(ChIP->y);
+      free(ChIP);
+
+   }
+
+   for (int i = 0 ; i < 4 ; i++) destroy_hash(hashes[i]);
+
+}
+
+
 void
 test_choose_iterator
 (void)
@@ -941,6 +1056,154 @@ test_parse_input_files
 
 }
 
+void
+test_hash_from_ChIP
+(void)
+{
+
+   char *mock_fnames[] = { "test_file_good.map", NULL };
+   char *ChIP_fnames[] = { "test_file_good.bam", NULL };
+   char *none[] = { NULL };
+
+   zerone_parser_args_t args;
+   args.window = 300;
+   args.minmapq = 0;
+
+   ChIP_t *ref = parse_input_files(mock_fnames, ChIP_fnames, args);
+   test_assert_critical(ref != NULL);
+
+   // Rebuild the mock hash table from the mock profile.
+   hash_t *mock = parse_mock_files(mock_fnames, args);
+   test_assert_critical(mock != NULL);
+   ChIP_t *profile = parse_ChIP_files(mock, none, args, 0);
+   test_assert_critical(profile != NULL);
+   destroy_hash(mock);
+
+   mock = hash_from_ChIP(profile);
+   test_assert_critical(mock != NULL);
+   ChIP_t *ChIP = parse_ChIP_files(mock, ChIP_fnames, args, 0);
+   test_assert_critical(ChIP != NULL);
+
+   // Same blocks in the same order, same counts.
+   test_assert_critical(ChIP->nb == ref->nb);
+   for (int i = 0 ; i < ChIP->nb ; i++) {
+      test_assert(strcmp(ChIP->nm + 32*i, ref->nm + 32*i) == 0);
+      test_assert(ChIP->sz[i] == ref->sz[i]);
+   }
+   for (size_t i = 0 ; i < 2*nobs(ref) ; i++) {
+      test_assert(ChIP->y[i] == ref->y[i]);
+   }
+
+   destroy_hash(mock);
+   free(profile->y);
+   free(profile);
+   free(ChIP->y);
+   free(ChIP);
+   free(ref->y);
+   free(ref);
+
+}
+
+
+uint64_t
+hash_sum
+(
+   hash_t * htab
+)
+// Checksum of the names and the counts of a hash table.
+{
+   uint64_t sum = 0;
+   for (int i = 0 ; i < HSIZE ; i++) {
+      for (link_t *lnk = htab[i] ; lnk != NULL ; lnk = lnk->next) {
+         uint64_t h = djb2(lnk->seqname);
+         if (lnk->counts == NULL) continue;
+         for (size_t k = 0 ; k <= lnk->counts->mx ; k++) {
+            sum += h * (k+1) * lnk->counts->array[k];
+         }
+      }
+   }
+   return sum;
+}
+
+
+const char *CONCURRENT_FILES[] = {
+   "test_file_good.map.gz",
+   "test_file_good.bam",
+   "test_concurrent.wig",
+   "test_concurrent.wig.gz",
+};
+
+void *
+parse_concurrent
+(
+   void * arg
+)
+// Parse all the files 3 times, starting from a different one
+// in every thread, and add up the checksums.
+{
+   uint64_t *sum = arg;
+   const int first = *sum;
+   zerone_parser_args_t args = { .window = 300, .minmapq = 0 };
+   for (int i = 0 ; i < 12 ; i++) {
+      hash_t *htab = parse_file(CONCURRENT_FILES[(first + i) % 4], args);
+      if (htab == NULL) return NULL;
+      *sum += hash_sum(htab);
+      destroy_hash(htab);
+   }
+   return arg;
+}
+
+
+void
+test_parse_concurrent
+(void)
+{
+
+   // WIG files with both kinds of definition lines.
+   FILE *f = fopen("test_concurrent.wig", "w");
+   gzFile gz = gzopen("test_concurrent.wig.gz", "w");
+   test_assert_critical(f != NULL && gz != NULL);
+   for (int c = 1 ; c <= 4 ; c++) {
+      fprintf(f, "fixedStep\tchrom=chr%d\tstart=1\tstep=50\n", c);
+      gzprintf(gz, "variableStep\tchrom=chr%d\tspan=10\n", c);
+      for (int k = 0 ; k < 5000 ; k++) {
+         fprintf(f, "%d\n", (k*c) % 7);
+         gzprintf(gz, "%d\t%d\n", 1 + 40*k, (k+c) % 5);
+      }
+   }
+   fclose(f);
+   gzclose(gz);
+
+   // Reference checksums, one file at a time.
+   uint64_t ref = 0;
+   zerone_parser_args_t args = { .window = 300, .minmapq = 0 };
+   for (int i = 0 ; i < 4 ; i++) {
+      hash_t *htab = parse_file(CONCURRENT_FILES[i], args);
+      test_assert_critical(htab != NULL);
+      ref += hash_sum(htab);
+      destroy_hash(htab);
+   }
+
+   // The threads start with 0, 1, 2 and 3 (the first file).
+   pthread_t tid[8];
+   uint64_t sum[8];
+   for (int t = 0 ; t < 8 ; t++) {
+      sum[t] = t % 4;
+      test_assert_critical(pthread_create(tid + t, NULL,
+               parse_concurrent, sum + t) == 0);
+   }
+   for (int t = 0 ; t < 8 ; t++) {
+      void *ok = NULL;
+      pthread_join(tid[t], &ok);
+      test_assert(ok != NULL);
+      test_assert(sum[t] - t % 4 == 3 * ref);
+   }
+
+   unlink("test_concurrent.wig");
+   unlink("test_concurrent.wig.gz");
+
+}
+
 // Test cases for export.
 const test_case_t test_cases_parse[] = {
    {"parse/bitf",              test_bitf},
@@ -949,6 +1212,7 @@ const test_case_t test_cases_parse[] = {
    {"parse/lookup_or_insert",  test_lookup_or_insert},
    {"parse/stress_hash",       test_stress_hash},
    {"parse/merge_hashes",      test_merge_hashes},
+   {"parse/merge_hashes_mt",   test_merge_hashes_mt},
    {"parse/choose_iterator",   test_choose_iterator},
    {"parse/parse_gem",         test_parse_gem},
    {"parse/parse_sam",         test_parse_sam},
@@ -958,6 +1222,8 @@ const test_case_t test_cases_parse[] = {
    {"parse/getgzline",         test_getgzline},
    {"parse/getgzline_err",     test_getgzline_err},
    {"parse/parse_input_files", test_parse_input_files},
+   {"parse/hash_from_ChIP",    test_hash_from_ChIP},
+   {"parse/parse_concurrent",  test_parse_concurrent},
    {NULL, NULL},
 };
 
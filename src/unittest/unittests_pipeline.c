@@ -0,0 +1,97 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "unittest.h"
+#include "pipeline.c"
+
+void
+test_load_input
+(void)
+{
+
+   char *mock_fnames[2] = {"test_file_good.map", NULL};
+   char *ChIP_fnames[3] = {"test_file_good.map", "test_file_good.bam", NULL};
+   zerone_parser_args_t args = { .window = 300, .minmapq = 0 };
+
+   // Reference: sequential processing.
+   ChIP_t *ChIP = parse_input_files(mock_fnames, ChIP_fnames, args);
+   test_assert_critical(ChIP != NULL);
+   const size_t n = nobs(ChIP);
+   int *mock = malloc(n * sizeof(int));
+   test_assert_critical(mock != NULL);
+   for (size_t i = 0 ; i < n ; i++) mock[i] = ChIP->y[0+i*ChIP->r];
+   zinb_par_t *par = mle_zinb(mock, n);
+   test_assert_critical(par != NULL);
+
+   // The last two runs use the cache (miss, then hit).
+   system("rm -rf test_cache.tmp");
+   for (int run = 0 ; run < 5 ; run++) {
+      load_args_t largs = { .threads = run < 3 ? run+1 : 2 };
+      if (run >= 3) largs.cache = "test_cache.tmp";
+      input_t input;
+      test_assert(load_input(mock_fnames, ChIP_fnames, args,
+               largs, &input) == 0);
+      test_assert_critical(input.ChIP != NULL);
+      test_assert(input.ChIP->r == ChIP->r);
+      test_assert(input.ChIP->nb == ChIP->nb);
+      test_assert_critical(nobs(input.ChIP) == n);
+      for (size_t i = 0 ; i < n * ChIP->r ; i++) {
+         test_assert(input.ChIP->y[i] == ChIP->y[i]);
+      }
+      test_assert_critical(input.par != NULL);
+      test_assert(input.par->a == par->a);
+      test_assert(input.par->p == par->p);
+      test_assert(input.par->pi == par->pi);
+      int *index = malloc(n * sizeof(int));
+      test_assert_critical(index != NULL);
+      test_assert(input.i0 == indexts(n, ChIP->r, ChIP->y, index));
+      for (size_t i = 0 ; i < n ; i++) {
+         test_assert(input.index[i] == index[i]);
+      }
+      free(index);
+      free(input.ChIP->y);
+      free(input.ChIP);
+      free(input.par);
+      free(input.index);
+   }
+
+   // Parse error.
+   char *bad[2] = {"no_such_file.map", NULL};
+   input_t input;
+   redirect_stderr();
+   load_args_t largs = { .threads = 2 };
+   test_assert(load_input(mock_fnames, bad, args, largs, &input) == -1);
+   unredirect_stderr();
+   test_assert_stderr("cannot open file no_such_file.map\n");
+   test_assert(input.ChIP == NULL);
+
+   system("rm -rf test_cache.tmp");
+   free(mock);
+   free(par);
+   free(ChIP->y);
+   free(ChIP);
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_pipeline[] = {
+   {"pipeline/load_input",     test_load_input},
+   {NULL, NULL},
+};
@@ -0,0 +1,274 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "unittest.h"
+#include "refine.c"
+
+void
+test_coarsen_ChIP
+(void)
+{
+
+   // Mock and one ChIP profile, two blocks.
+   int y[14] = {
+      1,0,  2,3,  0,1,  4,4,  5,0,
+      1,1,  -1,2,
+   };
+   const char *names[2] = {"chr1", "chr2"};
+   uint size[2] = {5,2};
+   ChIP_t *ChIP = new_ChIP(2, 2, y, names, size);
+   test_assert_critical(ChIP != NULL);
+
+   ChIP_t *C = coarsen_ChIP(ChIP, 2);
+   test_assert_critical(C != NULL);
+
+   // The last coarse window of a block may be shorter.
+   test_assert(C->r == 2);
+   test_assert(C->nb == 2);
+   test_assert(C->sz[0] == 3);
+   test_assert(C->sz[1] == 1);
+   test_assert(C->seg == NULL);
+   test_assert(strcmp(C->nm + 32, "chr2") == 0);
+
+   int sum[6] = {3,3,  4,5,  5,0};
+   for (int i = 0 ; i < 6 ; i++) test_assert(C->y[i] == sum[i]);
+   // A coarse window with an NA is invalid.
+   test_assert(is_invalid(C->y, 3, 2));
+
+   free(C->y);
+   free(C);
+   free(ChIP);
+
+}
+
+
+void
+test_fine_par
+(void)
+{
+
+   int y[6] = {0};
+   uint size[1] = {3};
+   ChIP_t *ChIP = new_ChIP(2, 1, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   zerone_t *Z = new_zerone(3, ChIP);
+   test_assert_critical(Z != NULL);
+
+   double Q[9] = {.8,.1,.1, .1,.8,.1, .1,.1,.8};
+   double p[9] = {.5,.3,.2, .4,.4,.2, .2,.2,.6};
+   set_zerone_par(Z, Q, 2.0, .5, p);
+
+   // Same mock fit: the means of the profiles are divided by 4.
+   zinb_par_t par = { .a = 2.0, .p = .5, .pi = .5 };
+   double Qf[9];
+   double pf[9];
+   fine_par(Z, 4, &par, Qf, pf);
+
+   for (int i = 0 ; i < 3 ; i++) {
+      double sumQ = 0.0;
+      double sump = 0.0;
+      for (int j = 0 ; j < 3 ; j++) {
+         sumQ += Qf[i+j*3];
+         sump += pf[j+i*3];
+         if (i != j) test_assert(fabs(Qf[i+j*3] - Q[i+j*3]/4) < 1e-12);
+      }
+      test_assert(fabs(sumQ - 1.0) < 1e-12);
+      test_assert(fabs(sump - 1.0) < 1e-12);
+      for (int j = 1 ; j < 3 ; j++) {
+         double ratio = pf[j+i*3] / pf[0+i*3];
+         test_assert(fabs(ratio - p[j+i*3] / p[0+i*3] / 4) < 1e-12);
+      }
+   }
+
+   // Half the shape: the 'p' are unchanged.
+   par.a = 0.5;
+   fine_par(Z, 4, &par, Qf, pf);
+   for (int i = 0 ; i < 9 ; i++) test_assert(fabs(pf[i] - p[i]) < 1e-12);
+
+   // Coarser windows: the transitions out of a state are capped.
+   fine_par(Z, .1, &par, Qf, pf);
+   for (int i = 0 ; i < 3 ; i++) {
+      test_assert(fabs(Qf[i+i*3] - (1-REFINE_MAXLEAVE)) < 1e-12);
+      for (int j = 0 ; j < 3 ; j++) {
+         if (i != j) test_assert(fabs(Qf[i+j*3] - .25) < 1e-12);
+      }
+   }
+
+   // The implicit profile has the same mean in every window.
+   ChIP->nomock = 1;
+   par.a = 2.0;
+   fine_par(Z, 4, &par, Qf, pf);
+   for (int i = 0 ; i < 3 ; i++) {
+      double ratio = pf[1+i*3] / pf[0+i*3];
+      test_assert(fabs(ratio - p[1+i*3] / p[0+i*3]) < 1e-12);
+   }
+
+   Z->ChIP = NULL;
+   destroy_zerone_all(Z);
+   free(ChIP);
+
+}
+
+
+void
+test_find_regions
+(void)
+{
+
+   int y[14] = {0};
+   uint size[2] = {9,5};
+   ChIP_t *ChIP = new_ChIP(1, 2, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   ChIP_t *C = coarsen_ChIP(ChIP, 2);
+   test_assert_critical(C != NULL);
+   test_assert(C->sz[0] == 5 && C->sz[1] == 3);
+
+   // Candidates: coarse windows 2 (posterior) and 7 (path).
+   double phi[24] = {0};
+   int path[8] = {0,0,0,0,0, 0,0,2};
+   for (int c = 0 ; c < 8 ; c++) phi[0+c*3] = 1.0;
+   phi[2+2*3] = .5;
+
+   size_t start[8];
+   uint len[8];
+   test_assert(find_regions(3, C, phi, path, 2, ChIP, NULL, start, len) == 2);
+   // Coarse windows 1-3 of the first block.
+   test_assert(start[0] == 2 && len[0] == 6);
+   // Coarse windows 6-7 of the second block (the last is short).
+   test_assert(start[1] == 11 && len[1] == 3);
+
+   free(C->y);
+   free(C);
+   free(ChIP);
+
+}
+
+
+void
+test_refine_zerone
+(void)
+{
+
+   // Three blocks with enriched regions.
+   int *y = malloc(3*240 * sizeof(int));
+   test_assert_critical(y != NULL);
+   unsigned int seed = 123;
+   for (int k = 0 ; k < 240 ; k++) {
+      int enriched = (k % 80) > 30 && (k % 80) < 50;
+      y[0+k*3] = rand_r(&seed) % 4;
+      y[1+k*3] = rand_r(&seed) % 3 + (enriched ? 12 : 0);
+      y[2+k*3] = rand_r(&seed) % 3 + (enriched ? 10 : 0);
+   }
+
+   unsigned size[3] = {80,100,60};
+   ChIP_t *ChIP = new_ChIP(3, 3, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   zerone_args_t args = { .refine = 3 };
+   redirect_stderr();
+   zerone_t *Z = do_zerone(ChIP, &args);
+   unredirect_stderr();
+   test_assert_critical(Z != NULL);
+
+   // The fit is on the windows.
+   test_assert(Z->ChIP == ChIP);
+   test_assert_critical(Z->path != NULL);
+   test_assert_critical(Z->phi != NULL && Z->pem != NULL);
+
+   // The enriched windows are called at their resolution (the
+   // first window of a region may be in the intermediate state).
+   int errors = 0;
+   for (int k = 0 ; k < 240 ; k++) {
+      int enriched = (k % 80) > 30 && (k % 80) < 50;
+      errors += enriched != (Z->path[k] == 2);
+      double sum = 0.0;
+      for (int j = 0 ; j < 3 ; j++) sum += Z->phi[j+k*3];
+      test_assert(fabs(sum - 1.0) < 1e-9);
+   }
+   test_assert(errors <= 3);
+
+   free(y);
+   free(ChIP);
+   Z->ChIP = NULL;
+   destroy_zerone_all(Z);
+
+}
+
+
+void
+test_refine_plain
+(void)
+{
+
+   // Narrow targets (2 windows) that are diluted in the coarse
+   // windows, as the peaks of transcription factors.
+   const int n = 3*600;
+   int *y = malloc(3*n * sizeof(int));
+   test_assert_critical(y != NULL);
+   unsigned int seed = 321;
+   for (int k = 0 ; k < n ; k++) {
+      int enriched = (k % 50) == 21 || (k % 50) == 22;
+      y[0+k*3] = rand_r(&seed) % 3;
+      y[1+k*3] = rand_r(&seed) % 3 + (enriched ? 6 : 0);
+      y[2+k*3] = rand_r(&seed) % 3 + (enriched ? 5 : 0);
+   }
+
+   unsigned size[3] = {600,600,600};
+   ChIP_t *ChIP = new_ChIP(3, 3, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   zerone_args_t args = {0};
+   redirect_stderr();
+   zerone_t *P = do_zerone(ChIP, &args);
+   args.refine = 4;
+   zerone_t *Z = do_zerone(ChIP, &args);
+   unredirect_stderr();
+   test_assert_critical(P != NULL && P->path != NULL);
+   test_assert_critical(Z != NULL && Z->path != NULL);
+
+   // The refined calls are those of the windows.
+   int targets = 0;
+   int errors = 0;
+   for (int k = 0 ; k < n ; k++) {
+      targets += P->path[k] == 2;
+      errors += (P->path[k] == 2) != (Z->path[k] == 2);
+   }
+   test_assert(targets >= 60);
+   test_assert(errors <= targets / 20);
+
+   free(y);
+   free(ChIP);
+   P->ChIP = NULL;
+   Z->ChIP = NULL;
+   destroy_zerone_all(P);
+   destroy_zerone_all(Z);
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_refine[] = {
+   {"refine/coarsen_ChIP",     test_coarsen_ChIP},
+   {"refine/fine_par",         test_fine_par},
+   {"refine/find_regions",     test_find_regions},
+   {"refine/refine_zerone",    test_refine_zerone},
+   {"refine/refine_plain",     test_refine_plain},
+   {NULL, NULL},
+};
@@ -0,0 +1,198 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "unittest.h"
+#include "segment.c"
+
+void
+test_segment_ChIP
+(void)
+{
+
+   // Mock and two ChIP profiles, two blocks.
+   int y[27] = {
+      0,0,0,  1,0,1,  0,0,0,  5,9,2,  0,1,0,  -1,0,0,
+      0,0,0,  0,0,0,  1,1,1,
+   };
+   uint size[2] = {6,3};
+   ChIP_t *ChIP = new_ChIP(3, 2, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   ChIP_t *S = segment_ChIP(ChIP, 2);
+   test_assert_critical(S != NULL);
+
+   // Segments do not span blocks, high counts and NAs.
+   test_assert(S->r == 3);
+   test_assert(S->nb == 2);
+   test_assert(S->sz[0] == 4);
+   test_assert(S->sz[1] == 1);
+
+   uint len[5] = {3,1,1,1,3};
+   uint nzero[5] = {2,0,0,0,2};
+   int sum[15] = {1,0,1,  5,9,2,  0,1,0,  -1,0,0,  1,1,1};
+   for (int k = 0 ; k < 5 ; k++) {
+      test_assert(S->seg->len[k] == len[k]);
+      test_assert(S->seg->nzero[k] == nzero[k]);
+   }
+   for (int i = 0 ; i < 15 ; i++) test_assert(S->y[i] == sum[i]);
+
+   destroy_segments(S);
+
+   // Segments are capped at 'SEG_MAXLEN' windows.
+   int *y0 = calloc(3*(2*SEG_MAXLEN+1), sizeof(int));
+   test_assert_critical(y0 != NULL);
+   uint size0[1] = {2*SEG_MAXLEN+1};
+   ChIP_t *ChIP0 = new_ChIP(3, 1, y0, NULL, size0);
+   test_assert_critical(ChIP0 != NULL);
+
+   S = segment_ChIP(ChIP0, 1);
+   test_assert_critical(S != NULL);
+   test_assert(S->sz[0] == 3);
+   test_assert(S->seg->len[0] == SEG_MAXLEN);
+   test_assert(S->seg->len[1] == SEG_MAXLEN);
+   test_assert(S->seg->len[2] == 1);
+
+   destroy_segments(S);
+   free(ChIP0);
+   free(y0);
+   free(ChIP);
+
+}
+
+
+void
+test_seg_prob
+(void)
+{
+
+   int y[30] = {
+      0,0,0,  1,0,1,  0,0,0,  5,9,2,  0,1,0,
+      2,0,1,  0,0,0,  1,1,1,  3,7,8,  0,0,0,
+   };
+   uint size[2] = {5,5};
+   ChIP_t *ChIP = new_ChIP(3, 2, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   ChIP_t *S = segment_ChIP(ChIP, 3);
+   test_assert_critical(S != NULL);
+
+   double Q[9] = {.8,.1,.1, .1,.8,.1, .05,.15,.8};
+   double p[12] = {.5,.3,.1,.1, .4,.3,.2,.1, .1,.1,.4,.4};
+
+   zerone_t *Z = new_zerone(3, ChIP);
+   zerone_t *ZS = new_zerone(3, S);
+   test_assert_critical(Z != NULL && ZS != NULL);
+   set_zerone_par(Z, Q, 1.3, .7, p);
+   set_zerone_par(ZS, Q, 1.3, .7, p);
+
+   int index[10];
+   index_ChIP(ChIP, index);
+   double pem[30];
+   zinm_prob(Z, index, 5, pem);
+
+   double pems[30];
+   seg_prob(ZS, 5, pems);
+
+   // The emission of a segment is that of its windows times
+   // 'Q(i,i)^(L-1)', up to a constant.
+   for (size_t k = 0, w = 0 ; k < nobs(S) ; k++) {
+      const uint L = S->seg->len[k];
+      double e[3] = {0};
+      for (size_t l = 0 ; l < L ; l++, w++) {
+         for (int i = 0 ; i < 3 ; i++) e[i] += pem[i+w*3];
+      }
+      for (int i = 0 ; i < 3 ; i++) e[i] += (L-1) * log(Q[i+i*3]);
+      for (int i = 1 ; i < 3 ; i++) {
+         test_assert(fabs((pems[i+k*3]-pems[0+k*3]) - (e[i]-e[0])) < 1e-9);
+      }
+   }
+
+   ZS->ChIP = NULL;
+   destroy_zerone_all(ZS);
+   destroy_segments(S);
+   Z->ChIP = NULL;
+   destroy_zerone_all(Z);
+   free(ChIP);
+
+}
+
+
+void
+test_seg_stats
+(void)
+{
+
+   int y[30] = {
+      0,0,0,  1,0,1,  0,0,0,  5,9,2,  0,1,0,
+      2,0,1,  0,0,0,  1,1,1,  3,7,8,  0,0,0,
+   };
+   uint size[2] = {5,5};
+   ChIP_t *ChIP = new_ChIP(3, 2, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   ChIP_t *S = segment_ChIP(ChIP, 3);
+   test_assert_critical(S != NULL);
+
+   // Posterior probabilities of the segments and of their windows.
+   const size_t ns = nobs(S);
+   double phis[30];
+   double phi[30];
+   unsigned int seed = 123;
+   for (size_t k = 0, w = 0 ; k < ns ; k++) {
+      double sum = 0.0;
+      for (int i = 0 ; i < 3 ; i++) sum += phis[i+k*3] = rand_r(&seed) + 1.0;
+      for (int i = 0 ; i < 3 ; i++) phis[i+k*3] /= sum;
+      for (size_t l = 0 ; l < S->seg->len[k] ; l++, w++) {
+         memcpy(phi+w*3, phis+k*3, 3 * sizeof(double));
+      }
+   }
+
+   int index[10];
+   int i0 = index_ChIP(ChIP, index);
+   double suff[15];
+   suff_stats(3, ChIP, index, i0, phi, suff);
+
+   double suffs[15];
+   seg_stats(3, S, phis, suffs);
+   for (int i = 0 ; i < 15 ; i++) test_assert(fabs(suff[i]-suffs[i]) < 1e-9);
+
+   // Transitions inside the segments.
+   double trans[9] = {0};
+   seg_trans(3, S, phis, trans);
+   for (int i = 0 ; i < 3 ; i++) {
+      double expected = 0.0;
+      for (size_t k = 0 ; k < ns ; k++) {
+         expected += (S->seg->len[k]-1) * phis[i+k*3];
+      }
+      test_assert(fabs(trans[i+i*3] - expected) < 1e-9);
+      for (int j = 0 ; j < 3 ; j++) if (j != i) test_assert(trans[i+j*3] == 0);
+   }
+
+   destroy_segments(S);
+   free(ChIP);
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_segment[] = {
+   {"segment/segment_ChIP",    test_segment_ChIP},
+   {"segment/seg_prob",        test_seg_prob},
+   {"segment/seg_stats",       test_seg_stats},
+   {NULL, NULL},
+};
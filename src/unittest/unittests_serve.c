@@ -0,0 +1,231 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "unittest.h"
+#include "serve.c"
+
+void
+test_parse_job
+(void)
+{
+
+   job_t job;
+   const char *err = NULL;
+
+   test_assert(parse_job("{\"mock\": [\"/m.bam\"], "
+         "\"chip\": [\"/c1.bam\", \"/c\\\"2.bam\"], \"window\": 200, "
+         "\"quality\": 0, \"list\": true, \"confidence\": 0.9, "
+         "\"early-qc\": false, \"workers\": 2, \"memory\": 512, "
+         "\"output\": \"\\/out\\/file\\n\"}\n", &job, &err));
+   test_assert(strcmp(job.mock[0], "/m.bam") == 0);
+   test_assert(job.mock[1] == NULL);
+   test_assert(strcmp(job.chip[0], "/c1.bam") == 0);
+   test_assert(strcmp(job.chip[1], "/c\"2.bam") == 0);
+   test_assert(job.chip[2] == NULL);
+   test_assert(strcmp(job.output, "/out/file\n") == 0);
+   test_assert(job.window == 200);
+   test_assert(job.minmapq == 0);
+   test_assert(job.list == 1);
+   test_assert(job.minconf == 0.9);
+   test_assert(job.earlyqc == 0);
+   test_assert(job.workers == 2);
+   test_assert(job.memory == 512);
+   destroy_job(&job);
+
+   // Defaults.
+   test_assert(parse_job("{\"chip\":[\"/c.bam\"],\"no-mock\":true}",
+            &job, &err));
+   test_assert(job.mock[0] == NULL);
+   test_assert(job.output == NULL);
+   test_assert(job.window == 300);
+   test_assert(job.minmapq == 20);
+   test_assert(job.workers == 1);
+   test_assert(job.nomock == 1);
+   destroy_job(&job);
+
+   // Errors.
+   test_assert(!parse_job("[1]", &job, &err));
+   test_assert(strcmp(err, "request is not a JSON object") == 0);
+   destroy_job(&job);
+   test_assert(!parse_job("{\"chip\": [\"c\"], \"foo\": 1}", &job, &err));
+   test_assert(strcmp(err, "unknown key") == 0);
+   destroy_job(&job);
+   test_assert(!parse_job("{\"chip\": [\"c\"], \"window\": 2.5}",
+            &job, &err));
+   test_assert(strcmp(err, "invalid value") == 0);
+   destroy_job(&job);
+   test_assert(!parse_job("{\"chip\": \"c\"}", &job, &err));
+   test_assert(strcmp(err, "invalid value") == 0);
+   destroy_job(&job);
+   test_assert(!parse_job("{\"chip\": [\"c\"]} x", &job, &err));
+   test_assert(strcmp(err, "invalid request") == 0);
+   destroy_job(&job);
+   test_assert(!parse_job("{\"chip\": [\"c\"]}", &job, &err));
+   test_assert(strcmp(err,
+            "specify a file for mock control experiment") == 0);
+   destroy_job(&job);
+   test_assert(!parse_job("{\"mock\": [\"m\"]}", &job, &err));
+   test_assert(strcmp(err, "specify a file for ChIP-seq experiment") == 0);
+   destroy_job(&job);
+   test_assert(!parse_job("{\"mock\": [\"/m\"], \"chip\": [\"c\"]}",
+            &job, &err));
+   test_assert(strcmp(err, "file names must be absolute") == 0);
+   destroy_job(&job);
+   test_assert(!parse_job("{\"mock\": [\"/m\"], \"chip\": [\"/c\"], "
+            "\"output\": \"out\"}", &job, &err));
+   test_assert(strcmp(err, "file names must be absolute") == 0);
+   destroy_job(&job);
+
+}
+
+
+void
+test_get_mock
+(void)
+{
+
+   mock_t cache[SERVE_MAXMOCKS] = {{0}};
+   job_t job;
+   const char *err = NULL;
+
+   char cwd[1024];
+   char req[4096];
+   test_assert_critical(getcwd(cwd, sizeof(cwd)) != NULL);
+   snprintf(req, sizeof(req), "{\"mock\": [\"%s/test_file_good.map\"], "
+            "\"chip\": [\"%s/test_file_good.map\"]}", cwd, cwd);
+   test_assert_critical(parse_job(req, &job, &err));
+
+   // The files are loaded by a thread.
+   mock_t *mock = get_mock(cache, &job);
+   test_assert_critical(mock != NULL);
+   test_assert(mock->loading);
+   test_assert(collect_mocks(cache, 1) == 1);
+   test_assert(!mock->loading);
+   test_assert(mock->done);
+   test_assert(mock->hash != NULL);
+   test_assert(mock->n > 0);
+
+   // Found in cache.
+   test_assert(get_mock(cache, &job) == mock);
+   test_assert(collect_mocks(cache, 1) == 0);
+
+   // Different options give a different entry.
+   job.window = 100;
+   mock_t *mock_ = get_mock(cache, &job);
+   test_assert(mock_ != NULL);
+   test_assert(mock_ != mock);
+   collect_mocks(cache, 1);
+   test_assert(mock_->n > mock->n);
+
+   // Entries that are loading are not replaced.
+   for (int i = 0 ; i < SERVE_MAXMOCKS ; i++) cache[i].loading = 1;
+   job.window = 50;
+   redirect_stderr();
+   test_assert(get_mock(cache, &job) == NULL);
+   unredirect_stderr();
+   test_assert_stderr("too many mock files in use\n");
+   for (int i = 0 ; i < SERVE_MAXMOCKS ; i++) cache[i].loading = 0;
+
+   // Nor are the entries used by the jobs of the queue.
+   for (int i = 0 ; i < SERVE_MAXMOCKS ; i++) cache[i].nwait = 1;
+   redirect_stderr();
+   test_assert(get_mock(cache, &job) == NULL);
+   unredirect_stderr();
+   test_assert_stderr("too many mock files in use\n");
+   for (int i = 0 ; i < SERVE_MAXMOCKS ; i++) cache[i].nwait = 0;
+
+   // Missing file.
+   free(job.mock[0]);
+   job.mock[0] = strdup("no_such_file.map");
+   redirect_stderr();
+   test_assert(get_mock(cache, &job) == NULL);
+   unredirect_stderr();
+   test_assert_stderr("cannot open file no_such_file.map\n");
+
+   destroy_job(&job);
+   for (int i = 0 ; i < SERVE_MAXMOCKS ; i++) destroy_mock(cache + i);
+
+}
+
+
+void
+test_start_job
+(void)
+{
+
+   mock_t mock = {0};
+   wait_t queue[SERVE_MAXQUEUE] = {{{{0}}}};
+   slot_t slots[1] = {{0}};
+   serve_args_t args = { .maxjobs = 1 };
+   int nrun = 1;
+   const char *err = NULL;
+
+   int sv[2];
+   test_assert_critical(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+   wait_t *w = queue;
+   test_assert_critical(parse_job("{\"chip\":[\"/c.bam\"],"
+            "\"no-mock\":true}", &w->job, &err));
+   w->mock = &mock;
+   w->id = 7;
+   w->fd = sv[0];
+   mock.nwait = 1;
+   // Any non-NULL value: the job is not forked.
+   mock.hash = (hash_t *) &mock;
+
+   // No free slot: the job stays in the queue.
+   test_assert(start_job(w, queue, slots, &nrun, -1, args) == 0);
+   test_assert(w->mock == &mock);
+   test_assert(mock.nwait == 1);
+
+   // Nothing is started when the daemon is stopping.
+   nrun = 0;
+   SERVE_STOP = 1;
+   test_assert(start_job(w, queue, slots, &nrun, -1, args) == 0);
+   test_assert(w->mock == &mock);
+   SERVE_STOP = 0;
+
+   // The job fails without a slot if the mock files are missing.
+   nrun = 1;
+   mock.hash = NULL;
+   redirect_stderr();
+   test_assert(start_job(w, queue, slots, &nrun, -1, args) == 1);
+   unredirect_stderr();
+   test_assert_stderr("job 7: cannot read mock files\n");
+   test_assert(w->mock == NULL);
+   test_assert(mock.nwait == 0);
+   test_assert(nrun == 1);
+
+   char buf[256] = {0};
+   test_assert(read(sv[1], buf, sizeof(buf)-1) > 0);
+   test_assert(strcmp(buf, "{\"job\": 7, \"status\": \"error\", "
+            "\"message\": \"cannot read mock files\"}\n") == 0);
+   close(sv[1]);
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_serve[] = {
+   {"serve/parse_job",         test_parse_job},
+   {"serve/get_mock",          test_get_mock},
+   {"serve/start_job",         test_start_job},
+   {NULL, NULL},
+};
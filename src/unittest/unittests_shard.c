@@ -0,0 +1,111 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "unittest.h"
+#include "shard.c"
+
+void
+test_split_shards
+(void)
+{
+
+   int y[10] = {0};
+   unsigned size[4] = {4,1,3,2};
+   ChIP_t *ChIP = new_ChIP(1, 4, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   shard_t shards[8];
+
+   test_assert(split_shards(ChIP, 2, shards) == 2);
+   test_assert(shards[0].b0 == 0 && shards[0].nb == 2);
+   test_assert(shards[0].off == 0 && shards[0].n == 5);
+   test_assert(shards[1].b0 == 2 && shards[1].nb == 2);
+   test_assert(shards[1].off == 5 && shards[1].n == 5);
+
+   // Every block in its own shard.
+   test_assert(split_shards(ChIP, 8, shards) == 4);
+   for (int i = 0 ; i < 4 ; i++) {
+      test_assert(shards[i].b0 == i && shards[i].nb == 1);
+      test_assert(shards[i].n == size[i]);
+   }
+
+   test_assert(split_shards(ChIP, 1, shards) == 1);
+   test_assert(shards[0].nb == 4 && shards[0].n == 10);
+
+   free(ChIP);
+
+}
+
+
+void
+test_shard_zerone
+(void)
+{
+
+   // Three blocks with enriched regions.
+   int *y = malloc(3*120 * sizeof(int));
+   test_assert_critical(y != NULL);
+   unsigned int seed = 123;
+   for (int k = 0 ; k < 120 ; k++) {
+      int enriched = (k % 40) > 15 && (k % 40) < 25;
+      y[0+k*3] = rand_r(&seed) % 4;
+      y[1+k*3] = rand_r(&seed) % 3 + (enriched ? 8 : 0);
+      y[2+k*3] = rand_r(&seed) % 3 + (enriched ? 6 : 0);
+   }
+
+   unsigned size[3] = {40,50,30};
+   ChIP_t *ChIP = new_ChIP(3, 3, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   // The distributed run must give the same fit.
+   zerone_args_t args = { .workers = 1 };
+   redirect_stderr();
+   zerone_t *Z1 = do_zerone(ChIP, &args);
+   args.workers = 3;
+   zerone_t *Z2 = do_zerone(ChIP, &args);
+   unredirect_stderr();
+   test_assert_critical(Z1 != NULL && Z2 != NULL);
+
+   test_assert(Z1->iter == Z2->iter);
+   test_assert(fabs(Z1->l - Z2->l) < 1e-9);
+   test_assert(Z2->pem == NULL);
+   for (int i = 0 ; i < 9 ; i++) test_assert(fabs(Z1->Q[i]-Z2->Q[i]) < 1e-9);
+   for (int i = 0 ; i < 12 ; i++) test_assert(fabs(Z1->p[i]-Z2->p[i]) < 1e-9);
+   for (int i = 0 ; i < 120 ; i++) {
+      test_assert(Z1->path[i] == Z2->path[i]);
+      for (int j = 0 ; j < 3 ; j++) {
+         test_assert(fabs(Z1->phi[j+i*3] - Z2->phi[j+i*3]) < 1e-9);
+      }
+   }
+
+   free(y);
+   free(ChIP);
+   Z1->ChIP = NULL;
+   Z2->ChIP = NULL;
+   destroy_zerone_all(Z1);
+   destroy_zerone_all(Z2);
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_shard[] = {
+   {"shard/split_shards",      test_split_shards},
+   {"shard/shard_zerone",      test_shard_zerone},
+   {NULL, NULL},
+};
@@ -0,0 +1,106 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "unittest.h"
+#include "tasks.c"
+
+int
+record
+(
+   void * arg
+)
+{
+   // Append the task number to the log (under a lock
+   // because tasks may run concurrently).
+   static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+   int *log = ((int **) arg)[0];
+   int id = *((int **) arg)[1];
+   pthread_mutex_lock(&lock);
+   log[++log[0]] = id;
+   pthread_mutex_unlock(&lock);
+   return id == 99 ? -1 : 0;
+}
+
+
+void
+test_run_tasks
+(void)
+{
+
+   // Diamond: 0 -> (1, 2) -> 3.
+   int log[8] = {0};
+   int ids[4] = {0,1,2,3};
+   void *args[4][2];
+   task_t *tasks[4];
+   for (int i = 0 ; i < 4 ; i++) {
+      args[i][0] = log;
+      args[i][1] = ids+i;
+      tasks[i] = new_task(record, args[i]);
+      test_assert_critical(tasks[i] != NULL);
+   }
+   test_assert(task_after(tasks[1], tasks[0]) == 0);
+   test_assert(task_after(tasks[2], tasks[0]) == 0);
+   test_assert(task_after(tasks[3], tasks[1]) == 0);
+   test_assert(task_after(tasks[3], tasks[2]) == 0);
+
+   test_assert(run_tasks(tasks, 4, 3) == 0);
+   test_assert(log[0] == 4);
+   test_assert(log[1] == 0);
+   test_assert(log[4] == 3);
+   test_assert(log[2] + log[3] == 3);
+
+   for (int i = 0 ; i < 4 ; i++) free(tasks[i]);
+
+   // Failure: the dependent task is skipped.
+   memset(log, 0, sizeof(log));
+   ids[0] = 99;
+   for (int i = 0 ; i < 2 ; i++) {
+      tasks[i] = new_task(record, args[i]);
+      test_assert_critical(tasks[i] != NULL);
+   }
+   test_assert(task_after(tasks[1], tasks[0]) == 0);
+   test_assert(run_tasks(tasks, 2, 1) == -1);
+   test_assert(log[0] == 1);
+   test_assert(log[1] == 99);
+
+   // Cycle: nothing can run.
+   free(tasks[0]);
+   free(tasks[1]);
+   memset(log, 0, sizeof(log));
+   ids[0] = 0;
+   for (int i = 0 ; i < 2 ; i++) {
+      tasks[i] = new_task(record, args[i]);
+      test_assert_critical(tasks[i] != NULL);
+   }
+   test_assert(task_after(tasks[1], tasks[0]) == 0);
+   test_assert(task_after(tasks[0], tasks[1]) == 0);
+   test_assert(run_tasks(tasks, 2, 2) == -1);
+   test_assert(log[0] == 0);
+
+   free(tasks[0]);
+   free(tasks[1]);
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_tasks[] = {
+   {"tasks/run_tasks",         test_run_tasks},
+   {NULL, NULL},
+};
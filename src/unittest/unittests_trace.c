@@ -0,0 +1,109 @@
+/* Copyright 2015, 2016 Pol Cusco and Guillaume Filion
+
+   This file is part of Zerone.
+
+   Zerone is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Zerone is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Zerone. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "unittest.h"
+#include "trace.c"
+
+void *
+trace_thread
+(
+   void * arg
+)
+{
+   for (int i = 0 ; i < TRACE_CHUNK ; i++) {
+      trace_begin("fwd/bwd", NULL, i);
+      trace_end("fwd/bwd", NULL, i);
+   }
+   return NULL;
+}
+
+
+void
+test_trace
+(void)
+{
+
+   // Nothing is recorded when tracing is off.
+   trace_begin("parse", "off.sam", -1);
+   test_assert(ALLBUFS == NULL);
+
+   start_trace();
+   trace_begin("parse", "a \"b\".sam", -1);
+   trace_end("parse", "a \"b\".sam", -1);
+
+   // Two threads fill more than one chunk each.
+   pthread_t tid[2];
+   for (int i = 0 ; i < 2 ; i++) {
+      test_assert_critical(pthread_create(tid+i, NULL,
+               trace_thread, NULL) == 0);
+   }
+   for (int i = 0 ; i < 2 ; i++) pthread_join(tid[i], NULL);
+
+   test_assert(NTIDS == 3);
+   int nbufs = 0;
+   for (tbuf_t *buf = ALLBUFS ; buf != NULL ; buf = buf->next) {
+      nbufs++;
+      if (buf == MYBUF) {
+         test_assert(buf->head->n == 2);
+         test_assert(buf->head->next == NULL);
+      }
+      else {
+         test_assert(buf->head->n == TRACE_CHUNK);
+         test_assert(buf->tail->n == TRACE_CHUNK);
+         test_assert(buf->head->next == buf->tail);
+      }
+   }
+   test_assert(nbufs == 3);
+
+   test_assert(write_trace("test_trace.tmp") == 0);
+   test_assert(!trace_on);
+   test_assert(ALLBUFS == NULL);
+   test_assert(MYBUF == NULL);
+
+   FILE *f = fopen("test_trace.tmp", "r");
+   test_assert_critical(f != NULL);
+   char line[512];
+   int nB = 0;
+   int nE = 0;
+   int nfile = 0;
+   while (fgets(line, sizeof(line), f) != NULL) {
+      if (strstr(line, "\"ph\":\"B\"") != NULL) nB++;
+      if (strstr(line, "\"ph\":\"E\"") != NULL) nE++;
+      if (strstr(line, "\"file\":\"a \\\"b\\\".sam\"") != NULL) nfile++;
+   }
+   fclose(f);
+   unlink("test_trace.tmp");
+
+   test_assert(nB == 1 + 2*TRACE_CHUNK);
+   test_assert(nE == 1 + 2*TRACE_CHUNK);
+   test_assert(nfile == 1);
+
+   // The trace file cannot be opened.
+   redirect_stderr();
+   test_assert(write_trace("no/such/dir/trace.json") < 0);
+   unredirect_stderr();
+   test_assert_stderr("cannot open trace file no/such/dir/trace.json\n");
+
+}
+
+
+// Test cases for export.
+const test_case_t test_cases_trace[] = {
+   {"trace/trace",             test_trace},
+   {NULL, NULL},
+};
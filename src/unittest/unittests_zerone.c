@@ -266,6 +266,72 @@ test_zinm_prob
 }
 
 
+void
+test_zinm_prob_mt
+(void)
+{
+
+   // Enough rows for 4 threads, many of them repeated.
+   const uint n = 4*ZINM_MINROWS + 17;
+   int *y = malloc(3*n * sizeof(int));
+   int *index = malloc(n * sizeof(int));
+   double *pem = malloc(3*n * sizeof(double));
+   double *pem_mt = malloc(3*n * sizeof(double));
+   test_assert_critical(y != NULL && index != NULL);
+   test_assert_critical(pem != NULL && pem_mt != NULL);
+
+   unsigned int seed = 123;
+   for (int k = 0 ; k < 3*n ; k++) y[k] = rand_r(&seed) % 5;
+   // Missing values and underflow.
+   y[3*1000] = -1;
+   y[3*(n-1)] = -1;
+   y[3*2000+1] = 1500;
+
+   ChIP_t *ChIP = new_ChIP(3, 1, y, NULL, &n);
+   test_assert_critical(ChIP != NULL);
+
+   double Q[9] = {0};
+   const double p[12] = {
+      2.5, 1.0, 1.0, 1.0,
+      2.5, 1.0, 2.0, 1.0,
+      2.5, 1.0, 0.2, 0.1,
+   };
+   zerone_t *Z = new_zerone(3, ChIP);
+   test_assert_critical(Z != NULL);
+   set_zerone_par(Z, Q, 1.2, .8, p);
+   index_ChIP(ChIP, index);
+
+   // Same output as the serial function, bit for bit.
+   int otypes[5] = {0,1,2,4,8};
+   int threads[4] = {1,2,3,7};
+   for (int i = 0 ; i < 5 ; i++) {
+      redirect_stderr();
+      zinm_prob(Z, index, otypes[i], pem);
+      unredirect_stderr();
+      for (int j = 0 ; j < 4 ; j++) {
+         memset(pem_mt, 0, 3*n * sizeof(double));
+         redirect_stderr();
+         zinm_prob_mt(Z, index, otypes[i], pem_mt, threads[j]);
+         unredirect_stderr();
+         test_assert(memcmp(pem, pem_mt, 3*n * sizeof(double)) == 0);
+         // The warning is issued once (unless suppressed).
+         if ((otypes[i] & 4) == 0) {
+            test_assert_stderr("warning: renormalizing 'p'\n");
+         }
+      }
+   }
+
+   free(y);
+   free(index);
+   free(pem);
+   free(pem_mt);
+   free(ChIP);
+   Z->ChIP = NULL;
+   destroy_zerone_all(Z);
+
+}
+
+
 void
 test_bw_zinm
 (void)
@@ -333,6 +399,303 @@ test_bw_zinm
 }
 
 
+void
+test_bw_iter
+(void)
+{
+
+   // Running the cycles one by one must give the same
+   // result as 'bw_zinm()'.
+   int y[18] = {
+      2,2,2,  5,0,2,  3,3,2,
+      6,12,9, 2,1,2,  4,3,10,
+   };
+
+   unsigned size[2] = {3,3};
+   ChIP_t *ChIP = new_ChIP(3, 2, y, NULL, size);
+
+   double p[12] = {
+      .30, .30, .20, .20,
+      .20, .20, .30, .30,
+      .10, .10, .40, .40,
+   };
+   double Q[9] = {
+      .90, .05, .05,
+      .05, .90, .05,
+      .05, .05, .90,
+   };
+
+   zerone_t *Z1 = new_zerone(3, ChIP);
+   zerone_t *Z2 = new_zerone(3, ChIP);
+   test_assert_critical(Z1 != NULL && Z2 != NULL);
+   set_zerone_par(Z1, Q, 1.2, .8, p);
+   set_zerone_par(Z2, Q, 1.2, .8, p);
+
+   redirect_stderr();
+   bw_zinm(Z1);
+
+   bw_t *bw = new_bw(Z2);
+   test_assert_critical(bw != NULL);
+   for (Z2->iter = 1 ; Z2->iter < BW_MAXITER ; Z2->iter++) {
+      if (bw_iter(Z2, bw)) break;
+   }
+   bw_finish(Z2, bw);
+   unredirect_stderr();
+
+   test_assert(Z1->iter == Z2->iter);
+   test_assert(Z1->l == Z2->l);
+   for (int i = 0 ; i < 9 ; i++) test_assert(Z1->Q[i] == Z2->Q[i]);
+   for (int i = 0 ; i < 12 ; i++) test_assert(Z1->p[i] == Z2->p[i]);
+   for (int i = 0 ; i < 18 ; i++) {
+      test_assert(Z1->phi[i] == Z2->phi[i]);
+      test_assert(Z1->pem[i] == Z2->pem[i]);
+   }
+
+   // The state with highest 'p0' comes first.
+   int map[3];
+   get_state_map(Z1, map);
+   test_assert(Z1->p[map[0]*4] >= Z1->p[map[1]*4]);
+   test_assert(Z1->p[map[1]*4] >= Z1->p[map[2]*4]);
+
+   free(ChIP);
+   Z1->ChIP = NULL;
+   Z2->ChIP = NULL;
+   destroy_zerone_all(Z1);
+   destroy_zerone_all(Z2);
+
+   return;
+
+}
+
+
+void
+test_implicit_mock
+(void)
+{
+
+   // The implicit profile must give the same fit as
+   // an explicit column of 1s.
+   int y[18] = {
+      1,2,2,  1,0,2,  1,3,2,
+      1,12,9, 1,1,2,  1,3,10,
+   };
+   int y_[12] = {
+      2,2,  0,2,  3,2,
+      12,9, 1,2,  3,10,
+   };
+
+   unsigned size[2] = {3,3};
+   ChIP_t *ChIP = new_ChIP(3, 2, y, NULL, size);
+   ChIP_t *ChIP_ = new_ChIP(3, 2, y_, NULL, size);
+   test_assert_critical(ChIP != NULL && ChIP_ != NULL);
+   ChIP_->nomock = 1;
+
+   double p[12] = {
+      .30, .30, .20, .20,
+      .20, .20, .30, .30,
+      .10, .10, .40, .40,
+   };
+   double Q[9] = {
+      .90, .05, .05,
+      .05, .90, .05,
+      .05, .05, .90,
+   };
+
+   zerone_t *Z1 = new_zerone(3, ChIP);
+   zerone_t *Z2 = new_zerone(3, ChIP_);
+   test_assert_critical(Z1 != NULL && Z2 != NULL);
+   set_zerone_par(Z1, Q, 1.2, .8, p);
+   set_zerone_par(Z2, Q, 1.2, .8, p);
+
+   redirect_stderr();
+   bw_zinm(Z1);
+   bw_zinm(Z2);
+   unredirect_stderr();
+
+   test_assert(Z1->iter == Z2->iter);
+   test_assert(Z1->l == Z2->l);
+   for (int i = 0 ; i < 9 ; i++) test_assert(Z1->Q[i] == Z2->Q[i]);
+   for (int i = 0 ; i < 12 ; i++) test_assert(Z1->p[i] == Z2->p[i]);
+   for (int i = 0 ; i < 18 ; i++) {
+      test_assert(Z1->phi[i] == Z2->phi[i]);
+      test_assert(Z1->pem[i] == Z2->pem[i]);
+   }
+
+   int index[6];
+   test_assert(index_ChIP(ChIP, index) == -1);
+   test_assert(index_ChIP(ChIP_, index) == -1);
+
+   free(ChIP);
+   free(ChIP_);
+   Z1->ChIP = NULL;
+   Z2->ChIP = NULL;
+   destroy_zerone_all(Z1);
+   destroy_zerone_all(Z2);
+
+   return;
+
+}
+
+
+void
+test_multi_start
+(void)
+{
+
+   int y[36] = {
+      2,2,2,  5,0,2,  3,3,2,  0,0,0,  1,0,1,  2,1,0,
+      6,12,9, 2,1,2,  4,3,10, 0,0,0,  3,9,14, 1,1,1,
+   };
+
+   unsigned size[2] = {6,6};
+   ChIP_t *ChIP = new_ChIP(3, 2, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   zinb_par_t par = { .a = 1.2, .pi = .8, .p = .4 };
+
+   // Start 0 is the default initialization.
+   double Q[9];
+   double p[12];
+   init_par(&par, 3, 0, Q, p);
+   for (int i = 0 ; i < 3 ; i++) {
+      test_assert(Q[i+i*3] == .95);
+      test_assert(p[0+i*4] == .4);
+      test_assert(p[2+i*4] == i + .5);
+   }
+
+   // Other starts are perturbed (deterministically).
+   double Q_[9];
+   double p_[12];
+   init_par(&par, 3, 1, Q, p);
+   init_par(&par, 3, 1, Q_, p_);
+   test_assert(Q[0] != .95);
+   for (int i = 0 ; i < 9 ; i++) test_assert(Q[i] == Q_[i]);
+   for (int i = 0 ; i < 12 ; i++) test_assert(p[i] == p_[i]);
+
+   // Workspaces share the index.
+   zerone_t *Z1 = new_zerone(3, ChIP);
+   zerone_t *Z2 = new_zerone(3, ChIP);
+   test_assert_critical(Z1 != NULL && Z2 != NULL);
+   set_zerone_par(Z1, Q, 1.2, .8, p);
+   set_zerone_par(Z2, Q, 1.2, .8, p);
+   bw_t *bw1 = new_bw(Z1);
+   bw_t *bw2 = share_bw(Z2, bw1);
+   test_assert_critical(bw1 != NULL && bw2 != NULL);
+   test_assert(bw2->index == bw1->index);
+   test_assert(bw2->i0 == bw1->i0);
+   test_assert(bw2->shared);
+   test_assert(!bw1->shared);
+   destroy_bw(bw2);
+   destroy_bw(bw1);
+
+   // Keep the best of several starts.
+   zerone_t *Z = NULL;
+   bw_t *bw = NULL;
+   double trace[BW_MAXITER] = {0};
+   redirect_stderr();
+   int status = multi_start(ChIP, &par, 4, &Z, &bw, trace);
+   unredirect_stderr();
+   test_assert_critical(status >= 0);
+   test_assert_critical(Z != NULL && bw != NULL);
+   test_assert(!bw->shared);
+   test_assert(Z->iter > 0);
+   test_assert(trace[Z->iter-1] == Z->l);
+
+   destroy_bw(bw);
+
+   // Multi-start run of 'do_zerone()'.
+   zerone_args_t args = { .starts = 4 };
+   redirect_stderr();
+   zerone_t *Z3 = do_zerone(ChIP, &args);
+   unredirect_stderr();
+   test_assert_critical(Z3 != NULL);
+   test_assert(Z3->path != NULL);
+   test_assert(Z3->p[0] >= Z3->p[4] && Z3->p[4] >= Z3->p[8]);
+
+   free(ChIP);
+   Z->ChIP = NULL;
+   Z1->ChIP = NULL;
+   Z2->ChIP = NULL;
+   Z3->ChIP = NULL;
+   destroy_zerone_all(Z);
+   destroy_zerone_all(Z1);
+   destroy_zerone_all(Z2);
+   destroy_zerone_all(Z3);
+
+   return;
+
+}
+
+
+void
+test_append_ChIP
+(void)
+{
+
+   int *y = malloc(10 * sizeof(int));
+   test_assert_critical(y != NULL);
+   int y0[10] = { 1,2, 3,4, 5,6,  7,8, 9,10 };
+   memcpy(y, y0, 10 * sizeof(int));
+
+   const char *names[2] = {"chr1", "chr2"};
+   unsigned size[2] = {3,2};
+   ChIP_t *ChIP = new_ChIP(2, 2, y, names, size);
+   test_assert_critical(ChIP != NULL);
+
+   // Blocks in a different order, one of them shorter
+   // and one that does not exist.
+   int ynew[12] = { 1,20,21,  1,30,31,  1,40,41,  1,50,51 };
+   const char *newnames[3] = {"chr2", "chrX", "chr1"};
+   unsigned newsize[3] = {1,1,2};
+   ChIP_t *new = new_ChIP(3, 3, ynew, newnames, newsize);
+   test_assert_critical(new != NULL);
+
+   redirect_stderr();
+   test_assert(append_ChIP(ChIP, new) == 0);
+   unredirect_stderr();
+   test_assert_stderr("warning: block chrX ignored\n");
+
+   int expected[20] = {
+      1,2,40,41,  3,4,50,51,  5,6,0,0,
+      7,8,20,21,  9,10,0,0,
+   };
+   test_assert(ChIP->r == 4);
+   for (int i = 0 ; i < 20 ; i++) test_assert(ChIP->y[i] == expected[i]);
+
+   // Extend the parameters to the new profiles.
+   zerone_t *Z = new_zerone(3, ChIP);
+   test_assert_critical(Z != NULL);
+   double p[9] = {
+      .5, .3, .2,
+      .4, .2, .4,
+      .3, .1, .6,
+   };
+   memcpy(Z->p, p, 9 * sizeof(double));
+   extend_par(Z, 2);
+
+   for (int i = 0 ; i < 3 ; i++) {
+      double *pr = Z->p + i*5;
+      double sum = 0.0;
+      for (int j = 0 ; j < 5 ; j++) sum += pr[j];
+      test_assert(fabs(sum - 1.0) < 1e-12);
+      // Ratios of the old terms are preserved.
+      test_assert(fabs(pr[1]/pr[0] - p[1+i*3]/p[0+i*3]) < 1e-12);
+      test_assert(fabs(pr[2]/pr[0] - p[2+i*3]/p[0+i*3]) < 1e-12);
+      // New terms are scaled by read counts (110/30 and 113/30).
+      test_assert(fabs(pr[3]/pr[2] - 110.0/30) < 1e-12);
+      test_assert(fabs(pr[4]/pr[2] - 113.0/30) < 1e-12);
+   }
+
+   Z->ChIP = NULL;
+   destroy_zerone_all(Z);
+   free(ChIP->y);
+   free(ChIP);
+   free(new);
+
+   return;
+
+}
+
 
 void
 test_update_trans
@@ -384,13 +747,216 @@ test_eval_bw_f
 
 }
 
+void
+test_vt_stats
+(void)
+{
+
+   // With one-hot posteriors, the statistics of the path must be
+   // those of 'suff_stats()', with and without a mock profile.
+   int y[24] = {
+      2,2,2,  5,0,2,  0,0,0,  6,12,9,
+      0,1,2,  0,0,0,  4,3,10, 1,0,0,
+   };
+   int y_[16] = {
+      2,2,  0,2,  0,0,  12,9,
+      1,2,  0,0,  3,10, 0,0,
+   };
+   int path[8] = {0,1,0,2,1,0,2,1};
+   double phi[24] = {0};
+   for (int k = 0 ; k < 8 ; k++) phi[path[k]+k*3] = 1.0;
+
+   unsigned size[2] = {5,3};
+   ChIP_t *ChIP = new_ChIP(3, 2, y, NULL, size);
+   ChIP_t *ChIP_ = new_ChIP(3, 2, y_, NULL, size);
+   test_assert_critical(ChIP != NULL && ChIP_ != NULL);
+   ChIP_->nomock = 1;
+
+   ChIP_t *list[2] = {ChIP, ChIP_};
+   for (int c = 0 ; c < 2 ; c++) {
+      int index[8];
+      int i0 = index_ChIP(list[c], index);
+      double suff1[15];
+      double suff2[15];
+      suff_stats(3, list[c], index, i0, phi, suff1);
+      vt_stats(3, list[c], index, i0, path, suff2);
+      for (int i = 0 ; i < 15 ; i++) test_assert(suff1[i] == suff2[i]);
+   }
+
+   free(ChIP);
+   free(ChIP_);
+
+}
+
+
+void
+test_hard_em
+(void)
+{
+
+   // Two blocks with enriched regions.
+   int *y = malloc(3*240 * sizeof(int));
+   test_assert_critical(y != NULL);
+   unsigned int seed = 123;
+   for (int k = 0 ; k < 240 ; k++) {
+      int enriched = (k % 80) > 30 && (k % 80) < 50;
+      y[0+k*3] = rand_r(&seed) % 4;
+      y[1+k*3] = rand_r(&seed) % 3 + (enriched ? 12 : 0);
+      y[2+k*3] = rand_r(&seed) % 3 + (enriched ? 10 : 0);
+   }
+
+   unsigned size[2] = {160,80};
+   ChIP_t *ChIP = new_ChIP(3, 2, y, NULL, size);
+   test_assert_critical(ChIP != NULL);
+
+   // Viterbi training alone, then with Baum-Welch polishing.
+   int polish[2] = {0,5};
+   for (int t = 0 ; t < 2 ; t++) {
+      zerone_args_t args = { .hardem = 1, .polish = polish[t] };
+      redirect_stderr();
+      zerone_t *Z = do_zerone(ChIP, &args);
+      unredirect_stderr();
+      test_assert_critical(Z != NULL);
+      test_assert_critical(Z->path != NULL);
+      test_assert_critical(Z->phi != NULL && Z->pem != NULL);
+
+      int errors = 0;
+      for (int k = 0 ; k < 240 ; k++) {
+         int enriched = (k % 80) > 30 && (k % 80) < 50;
+         errors += enriched != (Z->path[k] == 2);
+         double sum = 0.0;
+         for (int j = 0 ; j < 3 ; j++) sum += Z->phi[j+k*3];
+         test_assert(fabs(sum - 1.0) < 1e-9);
+      }
+      test_assert(errors <= 3);
+      test_assert(Z->vt > 0);
+      test_assert(Z->iter <= Z->vt + polish[t] + 1);
+
+      Z->ChIP = NULL;
+      destroy_zerone_all(Z);
+   }
+
+   // The fit is that of Baum-Welch once polished until convergence
+   // (the default), and close to it after a few EM cycles.
+   zerone_args_t bwargs = {0};
+   redirect_stderr();
+   zerone_t *B = do_zerone(ChIP, &bwargs);
+   unredirect_stderr();
+   test_assert_critical(B != NULL);
+   for (int t = 0 ; t < 3 ; t++) {
+      int pol[3] = {BW_MAXITER, 5, 0};
+      zerone_args_t args = { .hardem = 1, .polish = pol[t] };
+      redirect_stderr();
+      zerone_t *Z = do_zerone(ChIP, &args);
+      unredirect_stderr();
+      test_assert_critical(Z != NULL);
+      double dQ = 0.0, dm = 0.0;
+      for (int i = 0 ; i < 9 ; i++) {
+         if (fabs(Z->Q[i]-B->Q[i]) > dQ) dQ = fabs(Z->Q[i]-B->Q[i]);
+      }
+      for (int i = 0 ; i < 3 ; i++) {
+         for (int j = 1 ; j < 4 ; j++) {
+            // Relative gap of the means ('a * p(i,j) / p(i,0)').
+            double mz = Z->p[j+i*4] / Z->p[0+i*4];
+            double mb = B->p[j+i*4] / B->p[0+i*4];
+            if (fabs(mz/mb - 1) > dm) dm = fabs(mz/mb - 1);
+         }
+      }
+      if (pol[t] == BW_MAXITER) {
+         test_assert(dQ < 1e-4);
+         test_assert(dm < 1e-4);
+         test_assert(fabs(Z->l - B->l) < 1e-3);
+      }
+      else if (pol[t] > 0) {
+         test_assert(dQ < 0.1);
+         test_assert(dm < 0.05);
+      }
+      // Viterbi training alone is not bounded, but never
+      // does better than Baum-Welch.
+      test_assert(Z->l <= B->l + 1e-3);
+      Z->ChIP = NULL;
+      destroy_zerone_all(Z);
+   }
+   B->ChIP = NULL;
+   destroy_zerone_all(B);
+
+   // Resumed runs keep the engine and the phase of the
+   // checkpoint, whatever the options.
+   const char *ckpt = "test_hard_em.tmp";
+   zerone_args_t args = { .hardem = 1, .polish = 5, .checkpoint = ckpt };
+   redirect_stderr();
+   zerone_t *Z = do_zerone(ChIP, &args);
+   unredirect_stderr();
+   test_assert_critical(Z != NULL);
+
+   zerone_args_t resume = { .resume = 1, .checkpoint = ckpt };
+   redirect_stderr();
+   zerone_t *Z_ = do_zerone(ChIP, &resume);
+   unredirect_stderr();
+   test_assert_critical(Z_ != NULL);
+   test_assert(Z_->vt == Z->vt);
+   test_assert(Z_->polish == 5);
+   test_assert(Z_->iter == Z->iter);
+   for (int i = 0 ; i < 9 ; i++) test_assert(Z_->Q[i] == Z->Q[i]);
+   for (int k = 0 ; k < 240 ; k++) test_assert(Z_->path[k] == Z->path[k]);
+   Z_->ChIP = NULL;
+   destroy_zerone_all(Z_);
+
+   // Checkpoint during Viterbi training: the run goes on with
+   // Viterbi training (which has converged), then polishes.
+   double trace[BW_MAXITER] = {0};
+   Z->iter = Z->vt = 3;
+   test_assert_critical(write_checkpoint(ckpt, Z, trace));
+   redirect_stderr();
+   Z_ = do_zerone(ChIP, &resume);
+   unredirect_stderr();
+   test_assert_critical(Z_ != NULL);
+   test_assert(Z_->vt == 4);
+   test_assert(Z_->iter > 4 && Z_->iter <= 4 + 5 + 1);
+   Z_->ChIP = NULL;
+   destroy_zerone_all(Z_);
+
+   // Viterbi training used all the iterations: no cycle is left
+   // to polish, but the posteriors are computed.
+   Z->iter = Z->vt = BW_MAXITER-1;
+   test_assert_critical(write_checkpoint(ckpt, Z, trace));
+   redirect_stderr();
+   Z_ = do_zerone(ChIP, &resume);
+   unredirect_stderr();
+   test_assert_critical(Z_ != NULL);
+   test_assert(Z_->vt == BW_MAXITER-1);
+   for (int k = 0 ; k < 240 ; k++) {
+      double sum = 0.0;
+      for (int j = 0 ; j < 3 ; j++) sum += Z_->phi[j+k*3];
+      test_assert(fabs(sum - 1.0) < 1e-9);
+      test_assert(Z_->path[k] == Z->path[k]);
+   }
+   Z_->ChIP = NULL;
+   destroy_zerone_all(Z_);
+
+   unlink(ckpt);
+   Z->ChIP = NULL;
+   destroy_zerone_all(Z);
+   free(y);
+   free(ChIP);
+
+}
+
+
 // Test cases for export.
 const test_case_t test_cases_zerone[] = {
    {"zerone/reorder",          test_reorder},
    {"zerone/zinm_prob",        test_zinm_prob},
+   {"zerone/zinm_prob_mt",     test_zinm_prob_mt},
    {"zerone/bw_zinm",          test_bw_zinm},
+   {"zerone/bw_iter",          test_bw_iter},
+   {"zerone/implicit_mock",    test_implicit_mock},
+   {"zerone/multi_start",      test_multi_start},
+   {"zerone/append_ChIP",      test_append_ChIP},
    {"zerone/update_trans",     test_update_trans},
    {"zerone/eval_bw_f",        test_eval_bw_f},
+   {"zerone/vt_stats",         test_vt_stats},
+   {"zerone/hard_em",          test_hard_em},
    {NULL, NULL}
 };
 
@@ -508,6 +508,40 @@ test_mle_zinb
 
 }
 
+void
+test_pad_zinb
+(void)
+{
+
+   // Same sample as 'x1' in 'test_mle_zinb()' plus 60 zeros.
+   int x[160] = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+      0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+      0,3,7,4,5,3,5,1,5,7,3,6,1,2,9,1,10,6,2,2,2,3,2,1,1,5,0,2,3,
+      9,4,2,9,3,5,7,3,5,2,1,0,6,1,4,2,3,4,5,8,1 };
+
+   zinb_par_t *par = mle_zinb(x, 100);
+   zinb_par_t *ref = mle_zinb(x, 160);
+   test_assert_critical(par != NULL);
+   test_assert_critical(ref != NULL);
+
+   test_assert(pad_zinb(par, 100, 60));
+   test_assert(fabs(par->a - ref->a) < 1e-6);
+   test_assert(fabs(par->p - ref->p) < 1e-6);
+   test_assert(fabs(par->pi - ref->pi) < 1e-6);
+   test_assert(fabs(par->pi - 0.5110*100/160) < 1e-3);
+
+   // The estimate of 'pi' is lost when it is clipped.
+   par->pi = 1.0;
+   test_assert(!pad_zinb(par, 100, 60));
+   test_assert(par->pi == 1.0);
+
+   free(par);
+   free(ref);
+
+   return;
+
+}
+
 void
 test_fail_mle_nb
 (void)
@@ -721,6 +755,7 @@ const test_case_t test_cases_zinm[] = {
    {"zinm/nb_est_alpha",       test_nb_est_alpha},
    {"zinm/mle_nb",             test_mle_nb},
    {"zinm/mle_zinb",           test_mle_zinb},
+   {"zinm/pad_zinb",           test_pad_zinb},
    {"zinm/fail_mle_nb",        test_fail_mle_nb},
    {"zinm/fail_mle_zinb",      test_fail_mle_zinb},
    {"zinm/err_handler",        test_err_handler},
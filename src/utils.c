@@ -21,8 +21,9 @@
 
 #define U32 uint32_t
 
-// Globals variable.
-U32 *xxhash;
+// Globals variable (one per thread because 'indexts()' is called
+// by the threads of the pipeline and of the pool).
+__thread U32 *xxhash;
 
 int
 stblcmp
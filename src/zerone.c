@@ -16,7 +16,18 @@
    along with Zerone. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <float.h>
+#include <pthread.h>
+
+#include "checkpoint.h"
+#include "counters.h"
 #include "debug.h"
+#include "numa.h"
+#include "predict.h"
+#include "refine.h"
+#include "segment.h"
+#include "shard.h"
+#include "trace.h"
 #include "zerone.h"
 
 #define sq(x) ((x)*(x))
@@ -78,15 +89,15 @@ reorder
    }
    memcpy(Z->p, p, 3*(r+1) * sizeof(double));
 
-   // Reorder 'phi'.
+   // Reorder 'phi' (if already computed).
    double buffer[3] = {0};
-   for (int i = 0 ; i < n ; i++) {
+   for (int i = 0 ; Z->phi != NULL && i < n ; i++) {
       for (int j = 0 ; j < 3 ; j++) buffer[j] = Z->phi[map[j]+i*3];
       memcpy(Z->phi + 3*i, buffer, 3 * sizeof(double));
    }
 
-   // Reorder 'pem'.
-   for (int i = 0 ; i < n ; i++) {
+   // Reorder 'pem' (if already computed).
+   for (int i = 0 ; Z->pem != NULL && i < n ; i++) {
       for (int j = 0 ; j < 3 ; j++) buffer[j] = Z->pem[map[j]+i*3];
       memcpy(Z->pem + 3*i, buffer, 3 * sizeof(double));
    }
@@ -96,61 +107,133 @@ reorder
 }
 
 
-zerone_t *
-do_zerone
+void
+get_state_map
 (
-   ChIP_t * ChIP
+   const zerone_t * Z,
+         int      * map
 )
+// SYNOPSIS:
+//   Find the order of the states in case they got scrambled.
+//   We use the value of p0 as a sort key (high p0 means low
+//   average signal and vice versa).
 {
 
-   // The number of state in Zerone is an important constant.
-   // So much depends on it that it may be frozen in the code.
-   const unsigned int m = 3;
+   const unsigned int r = Z->ChIP->r;
 
-   int        * mock = NULL; // The mock ChIP profile.
-   int        * path = NULL; // The Viterbi path.
-   zinb_par_t * par  = NULL; // The parameter estimates.
-   zerone_t   * Z    = NULL; // The Zerone instance.
+   map[0] = 0; map[1] = 1; map[2] = 2;
+   for (int i = 1 ; i < 3 ; i++) {
+      if (Z->p[i*(r+1)] > Z->p[map[0]*(r+1)]) map[0] = i;
+      if (Z->p[(i-1)*(r+1)] < Z->p[map[2]*(r+1)]) map[2] = i-1;
+   }
+   // The middle state is the remaining one.
+   map[1] = 3-map[0]-map[2];
 
-   // Extract the dimensions of the observations.
-   const unsigned int r = ChIP->r;
-   const unsigned int n = nobs(ChIP);
+   return;
 
-   if (r > 63) {
-      fprintf(stderr, "maximum number of profiles exceeded\n");
-      goto clean_and_return;
-   }
+}
 
-   // Extract the first ChIP profile (the sum of mock controls).
-   mock = malloc(n * sizeof(int));
-   if (mock == NULL) {
+
+int
+early_reject
+(
+   zerone_t * Z,
+   bw_t     * bw
+)
+// SYNOPSIS:
+//   Run the quality control on the current state of the Baum-Welch
+//   algorithm, using the most likely state of every window in place
+//   of the Viterbi path. If the QC score is confidently negative,
+//   the posterior probabilities are transferred from 'bw' to 'Z',
+//   which becomes a provisional fit flagged as rejected.
+//
+// RETURN:
+//   1 if the dataset is rejected, 0 if not and -1 in case of
+//   failure.
+{
+
+   const unsigned int r = Z->ChIP->r;
+   const unsigned int n = nobs(Z->ChIP);
+
+   int map[3];
+   get_state_map(Z, map);
+
+   int *path = malloc(n * sizeof(int));
+   if (path == NULL) {
       fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
-      goto clean_and_return;
+      return -1;
    }
 
-   // Copy data to 'mock'.
-   for (size_t i = 0 ; i < n ; i++) {
-      mock[i] = ChIP->y[0+i*r];
+   // Most likely state of every window (in sorted state order).
+   for (size_t k = 0 ; k < n ; k++) {
+      path[k] = 0;
+      for (int j = 1 ; j < 3 ; j++) {
+         if (bw->phi[map[j]+k*3] > bw->phi[map[path[k]]+k*3]) path[k] = j;
+      }
    }
 
-   par = mle_zinb(mock, n);
-   if (par == NULL) {
-// TODO: Change parametrization so that failure does not happen. //
-      fprintf(stderr, "zerone failure %s:%d\n", __FILE__, __LINE__);
-      apologize();
-      goto clean_and_return;
+   // Work on a copy of the parameters because the Baum-Welch
+   // algorithm goes on if the dataset is not rejected.
+   double Q[9];
+   double p[3*64];
+   zerone_t proxy = *Z;
+   proxy.Q = memcpy(Q, Z->Q, 9 * sizeof(double));
+   proxy.p = memcpy(p, Z->p, 3*(r+1) * sizeof(double));
+   proxy.phi = NULL;
+   proxy.pem = NULL;
+   proxy.path = path;
+   reorder(&proxy, map);
+
+   // NB: the score is NAN with only one ChIP profile, in
+   // which case the dataset is never rejected.
+   double feat[5];
+   double QC = zerone_qc(&proxy, feat);
+   debug_print("early QC (iter %d): %.3f\n", Z->iter, QC);
+
+   if (!(QC < EARLYQC_MAX)) {
+      free(path);
+      return 0;
    }
 
-   free(mock);
-   mock = NULL;
+   Z->phi = bw->phi;
+   Z->pem = bw->pem;
+   bw->phi = NULL;
+   bw->pem = NULL;
+   reorder(Z, map);
 
-   double Q[9] = {0};
-   double p[3*64] = {0};
+   Z->path = path;
+   Z->early = 1;
+
+   return 1;
+
+}
+
+
+void
+init_par
+(
+   const zinb_par_t   * par,
+         unsigned int   r,
+         int            start,
+         double       * Q,
+         double       * p
+)
+// SYNOPSIS:
+//   Set the initial values of 'Q' and 'p' from the fit of the
+//   mock profile. Start 0 is the default initialization, the
+//   other starts are deterministic perturbations of it.
+{
+
+   // Seed of the perturbations (not used for start 0).
+   unsigned int seed = start;
+   #define unif(lo,hi) ((lo) + ((hi)-(lo)) * rand_r(&seed) / RAND_MAX)
+
+   double diag = start == 0 ? .95 : unif(.80, .99);
 
    // Set initial values of 'Q'.
    for (size_t i = 0 ; i < 3 ; i++) {
    for (size_t j = 0 ; j < 3 ; j++) {
-      Q[i+j*3] = (i==j) ? .95 : .025;
+      Q[i+j*3] = (i==j) ? diag : (1-diag) / 2;
    }
    }
 
@@ -160,233 +243,776 @@ do_zerone
       p[0+i*(r+1)] = par->p;
       p[1+i*(r+1)] = 1 - par->p;
       for (size_t j = 2 ; j < r+1 ; j++) {
-         p[j+i*(r+1)] = i + 0.5;
+         p[j+i*(r+1)] = start == 0 ? i + 0.5 : unif(.25, 3.0);
       }
    }
 
-   Z = new_zerone(3, ChIP);
+   #undef unif
 
-   if (Z == NULL) {
-      // TODO: handle this case properly. //
-      fprintf(stderr, "error in function '%s()' %s:%d\n",
-            __func__, __FILE__, __LINE__);
-      goto clean_and_return;
-   }
+   return;
 
-   set_zerone_par(Z, Q, par->a, par->pi, p);
+}
 
-   // Run the Baum-Welch algorithm.
-   bw_zinm(Z);
 
-   // Reorder the states in case they got scrambled.
-   // We use the value of p0 as a sort key (high p0
-   // means low average signal and vice versa).
-   int map[3] = {0,1,2};
-   for (int i = 1 ; i < 3 ; i++) {
-      if (Z->p[i*(r+1)] > Z->p[map[0]*(r+1)]) map[0] = i;
-      if (Z->p[(i-1)*(r+1)] < Z->p[map[2]*(r+1)]) map[2] = i-1;
+void *
+run_start
+(
+   void *arg
+)
+// SYNOPSIS:
+//   Thread function of 'multi_start()'. Run up to 'MS_ROUND'
+//   cycles of the Baum-Welch algorithm for one start.
+{
+
+   start_t *s = (start_t *) arg;
+
+   for (int i = 0 ; i < MS_ROUND ; i++) {
+      if (s->status != 0 || s->Z->iter+1 >= BW_MAXITER) break;
+      s->Z->iter++;
+      s->status = bw_iter(s->Z, s->bw);
+      if (s->status >= 0) s->trace[s->Z->iter-1] = s->Z->l;
    }
-   // The middle state is the remaining one.
-   map[1] = 3-map[0]-map[2];
-   debug_print("map: [%d, %d, %d]\n", map[0], map[1], map[2]);
 
-   if (map[0] != 0 || map[1] != 1 || map[2] != 2) reorder(Z, map);
+   return NULL;
 
-   // Run the Viterbi algorithm.
-   double log_Q[9] = {0};
-   double initp[3] = {0};
+}
 
-   path = malloc(n * sizeof(int));
-   if (path == NULL) {
+
+int
+multi_start
+(
+         ChIP_t     *  ChIP,
+   const zinb_par_t *  par,
+         int           nstarts,
+   // output //
+         zerone_t   ** Z,
+         bw_t       ** bw,
+         double     *  trace
+)
+// SYNOPSIS:
+//   Run the Baum-Welch algorithm from 'nstarts' initializations
+//   in parallel (one thread per start). All the starts share the
+//   observations and the index of the time series. Every 'MS_ROUND'
+//   cycles, the starts whose log-likelihood lags behind the best
+//   by more than 'MS_PRUNE_GAP' per window are abandoned. This goes
+//   on until a single start is left or until all the starts have
+//   converged, in which case the one with highest log-likelihood
+//   is kept.
+//
+// RETURN:
+//   The status of the remaining start as returned by 'bw_iter()'.
+//   If it is 0, the Baum-Welch algorithm must be resumed from '*Z'
+//   and '*bw'; if it is 1, the algorithm has converged. In case of
+//   failure, the function returns -1.
+//
+// SIDE EFFECTS:
+//   '*Z' and '*bw' are set to the fit and the workspace of the
+//   remaining start. The log-likelihood of every cycle is copied
+//   to 'trace'.
+{
+
+   const unsigned int r = ChIP->r;
+   const unsigned int n = nobs(ChIP);
+
+   int status = -1;
+   start_t *starts = calloc(nstarts, sizeof(start_t));
+   if (starts == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return -1;
+   }
+
+   for (int i = 0 ; i < nstarts ; i++) {
+      double Q[9] = {0};
+      double p[3*64] = {0};
+      init_par(par, r, i, Q, p);
+      starts[i].Z = new_zerone(3, ChIP);
+      if (starts[i].Z == NULL) goto clean_and_return;
+      set_zerone_par(starts[i].Z, Q, par->a, par->pi, p);
+      // The first start indexes the time series.
+      starts[i].bw = i == 0 ? new_bw(starts[i].Z) :
+                        share_bw(starts[i].Z, starts[0].bw);
+      if (starts[i].bw == NULL) goto clean_and_return;
+   }
+
+   pthread_t *tid = malloc(nstarts * sizeof(pthread_t));
+   if (tid == NULL) {
       fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
       goto clean_and_return;
    }
 
-   for (size_t i = 0 ; i < 3 ; i++) initp[i] = log(1.0/3);
-   for (size_t i = 0 ; i < 9 ; i++) log_Q[i] = log(Z->Q[i]);
+   int best;
+   while (1) {
+
+      // Run one round of cycles for the starts still running.
+      // 'thread' is 1 for the starts run in their own thread.
+      int running = 0;
+      int thread[nstarts];
+      for (int i = 0 ; i < nstarts ; i++) {
+         thread[i] = 0;
+         if (starts[i].Z == NULL || starts[i].status != 0) continue;
+         if (starts[i].Z->iter+1 >= BW_MAXITER) continue;
+         running++;
+         thread[i] = pthread_create(tid+i, NULL, run_start, starts+i) == 0;
+         // Run the round in the current thread if needed.
+         if (!thread[i]) run_start(starts+i);
+      }
 
-   // Find Viterbi path.
-   block_viterbi(m, ChIP->nb, ChIP->sz, log_Q, initp, Z->pem, path);
+      if (running == 0) break;
 
-   Z->path = path;
+      for (int i = 0 ; i < nstarts ; i++) {
+         if (thread[i]) pthread_join(tid[i], NULL);
+      }
+
+      // Find the best start (failed starts do not count).
+      best = -1;
+      for (int i = 0 ; i < nstarts ; i++) {
+         if (starts[i].Z == NULL || starts[i].status < 0) continue;
+         if (best < 0 || starts[i].Z->l > starts[best].Z->l) best = i;
+      }
+
+      if (best < 0) {
+         fprintf(stderr, "cannot complete Baum-Welch algorithm\n");
+         free(tid);
+         goto clean_and_return;
+      }
+
+      // Prune the starts that lag behind.
+      int alive = 0;
+      for (int i = 0 ; i < nstarts ; i++) {
+         if (starts[i].Z == NULL) continue;
+         if (starts[i].status >= 0 &&
+               starts[i].Z->l > starts[best].Z->l - MS_PRUNE_GAP * n) {
+            alive++;
+            continue;
+         }
+         debug_print("prune start %d (iter %d)\n", i, starts[i].Z->iter);
+         if (!starts[i].bw->shared) {
+            // Hand the index over to the best start.
+            starts[i].bw->shared = 1;
+            starts[best].bw->shared = 0;
+         }
+         destroy_bw(starts[i].bw);
+         starts[i].bw = NULL;
+         starts[i].Z->ChIP = NULL;
+         destroy_zerone_all(starts[i].Z);
+         starts[i].Z = NULL;
+      }
+
+      if (alive == 1) break;
+
+   }
+
+   free(tid);
+
+   // Keep the best start.
+   best = -1;
+   for (int i = 0 ; i < nstarts ; i++) {
+      if (starts[i].Z == NULL) continue;
+      if (best < 0 || starts[i].Z->l > starts[best].Z->l) best = i;
+   }
+
+   debug_print("best start: %d (l = %.3f)\n", best, starts[best].Z->l);
+
+   for (int i = 0 ; i < nstarts ; i++) {
+      if (starts[i].Z == NULL || i == best) continue;
+      if (!starts[i].bw->shared) {
+         starts[i].bw->shared = 1;
+         starts[best].bw->shared = 0;
+      }
+   }
+
+   *Z = starts[best].Z;
+   *bw = starts[best].bw;
+   memcpy(trace, starts[best].trace, BW_MAXITER * sizeof(double));
+   status = starts[best].status;
+   starts[best].Z = NULL;
+   starts[best].bw = NULL;
 
 clean_and_return:
-// TODO: Do the cleaning if necessary. //
-   return Z;
+   for (int i = 0 ; i < nstarts ; i++) {
+      if (starts[i].bw != NULL) destroy_bw(starts[i].bw);
+      if (starts[i].Z == NULL) continue;
+      starts[i].Z->ChIP = NULL;
+      destroy_zerone_all(starts[i].Z);
+   }
+   free(starts);
+   return status;
 
 }
 
 
 int
-is_invalid
+find_block
 (
-    const int * y,
-          int   k,
-          int   r
+   const ChIP_t * ChIP,
+   const char   * name,
+         int      hint
 )
 // SYNOPSIS:
-//   Helper function. NAs of type 'int' is the largest negative
-//   value. More generally, any negative value in 'y' is invalid.
+//   Find the block called 'name'. The block 'hint' is tried
+//   first, so that series with the same blocks in the same
+//   order are matched in linear time.
+//
+// RETURN:
+//   The index of the block, or -1 if it is not found.
 {
-   for (int i = 0 ; i < r ; i++) if (y[i + k*r] < 0) return 1;
-   return 0;
+
+   if (hint >= 0 && hint < ChIP->nb &&
+         strcmp(name, ChIP->nm + 32*hint) == 0) return hint;
+
+   for (int i = 0 ; i < ChIP->nb ; i++) {
+      if (strcmp(name, ChIP->nm + 32*i) == 0) return i;
+   }
+
+   return -1;
+
 }
 
+
 int
-is_all_zero
+index_ChIP
 (
-   const int * y,
-         int   k,
-         int   r
+   const ChIP_t * ChIP,
+         int    * index
 )
 // SYNOPSIS:
-//   Helper function for `zinm_prob`. Returns 1 if and only if all
-//   the observations are 0.
+//   Index the observations with 'indexts()'. The implicit profile
+//   is not hashed because it is the same in every window.
+//
+// RETURN:
+//   The index of the first all-0 observation, or -1 if there is
+//   none (always the case if the first profile is implicit).
 {
-   for (int i = 0 ; i < r ; i++) if (y[i + k*r] != 0) return 0;
-   return 1;
+
+   const size_t n = nobs(ChIP);
+   const size_t s = ChIP->r - ChIP->nomock;
+
+   stage_begin(STAGE_INDEX);
+   int i0 = indexts(n, s, ChIP->y, index);
+   stage_end(STAGE_INDEX);
+   return ChIP->nomock ? -1 : i0;
+
 }
 
 
-void
-zinm_prob
+int
+append_ChIP
 (
-         zerone_t * restrict zerone,
-   const int      * restrict index,
-   // call control //
-         int                otype,
-   // output //
-         double   * restrict pem
+         ChIP_t * ChIP,
+   const ChIP_t * new
 )
 // SYNOPSIS:
-//   Compute emission probabilities with a mixture negative multinomial
-//   model. Since those are up to a multiplicative constant in the
-//   forward-backward algorithm, we can drop the multiplicative terms
-//   that do not depend on the state of the HMM.
-//   Since the negative nultinomial takes discrete values, we can cache
-//   the results for reuse in order to save computation. This is done
-//   by indexing the series.
-//
-//   My parametrization is of the form:
-//
-//        p_0(i)^a * p_1(i)^y_1 * p_2(i)^y_2 * ... * p_r+1(i)^y_r
-//
-//   And in the case that all emissions are 0
-//
-//                      pi * p_0(i)^a + (1-pi)
-//
-// NUMERICAL STABILITY:
-//   Each term of the sum above is computed in log space, the result is
-//   the computed as the sum of two exponentials. NA emissions are
-//   allowed and yield NA for the whole line of emissions.
-//
-// ARGUMENTS:
-//   'ChIP': struct of observations
-//   'par': struct of parameters for the ZINM distribution
-//   'index': a precomputed index of the ChIP data
-//   'otype': the type of output to produce (see below)
-//   'pem': (n_obs,n_states) emission probability
+//   Append the ChIP profiles of 'new' (all the columns but the
+//   first, which is the mock) to the observations of 'ChIP'.
+//   Either may have an implicit first profile (see 'ChIP_t').
+//   The blocks are matched by name. Windows that are absent from
+//   'new' are set to 0 and blocks absent from 'ChIP' are ignored.
 //
 // RETURN:
-//   'void'
-//
-// SIDE EFFECTS:
-//   Update 'pem' in place.
-//
-// OUTPUT:
-//   The output type for 'pem' can be the emission probability in
-//   log space (1), the same emission probability in linear space (2),
-//   or in linear by default and in log space in case of underflow (0).
-//   'otype' also controls the verbosity. If the third bit is set,
-//   i.e. the value is set to 4, 5 or 6, the function will suppress
-//   warnings. Setting the fourth bit of 'otype' forces to compute
-//   the constant terms in emission probabilities.
+//   0 upon success, -1 in case of failure (in which case 'ChIP'
+//   is not modified).
 {
 
-   ChIP_t *ChIP = zerone->ChIP;
-   unsigned int temp = 0;
-   for (size_t i = 0 ; i < ChIP->nb ; i++) {
-      temp += ChIP->sz[i];
+   const size_t r = ChIP->r;
+   const size_t k = new->r - 1;
+   const size_t n = nobs(ChIP);
+   // Number of columns of 'ChIP->y' and 'new->y'.
+   const size_t s = r - ChIP->nomock;
+   const size_t ns = k + 1 - new->nomock;
+
+   if (r+k > 63) {
+      fprintf(stderr, "maximum number of profiles exceeded\n");
+      return -1;
    }
 
-   const unsigned int   r  = ChIP->r;
-   const int          * y  = ChIP->y;
-   const unsigned int   m  = zerone->m;
-   const double         a  = zerone->a;
-   const double         pi = zerone->pi;
-   const double       * p  = zerone->p;
-   const unsigned int   n  = temp;
+   int *y = realloc(ChIP->y, n*(s+k) * sizeof(int));
+   if (y == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return -1;
+   }
 
-   char *depends   = "compute in lin space, log space if underflow";
-   char *log_space = "always compute in log space";
-   char *lin_space = "always compute in linear space";
-   char *cases[3] = {depends, log_space, lin_space};
-   char *output_type = cases[otype & 3];
+   // Spread the rows from the end (they do not overlap
+   // with the rows that are yet to be moved).
+   for (size_t i = n ; i-- > 0 ; ) {
+      memmove(y + i*(s+k), y + i*s, s * sizeof(int));
+      memset(y + i*(s+k) + s, 0, k * sizeof(int));
+   }
 
-   int compute_constant_terms = (otype >> 3) & 1;
+   ChIP->y = y;
+   ChIP->r = r+k;
 
-   double *logp = malloc((r+1)*m * sizeof(double));
-   if (logp == NULL) {
-      fprintf(stderr, "memory error (%s:%d)\n", __FILE__, __LINE__);
-      return;
+   size_t noff = 0;
+   for (int b = 0 ; b < new->nb ; b++) {
+      const char *name = new->nm + 32*b;
+      int c = find_block(ChIP, name, b);
+      if (c < 0) {
+         fprintf(stderr, "warning: block %s ignored\n", name);
+         noff += new->sz[b];
+         continue;
+      }
+      size_t off = 0;
+      for (int i = 0 ; i < c ; i++) off += ChIP->sz[i];
+      size_t sz = new->sz[b] < ChIP->sz[c] ? new->sz[b] : ChIP->sz[c];
+      for (size_t i = 0 ; i < sz ; i++) {
+         memcpy(y + (off+i)*(s+k) + s, new->y + (noff+i)*ns + ns-k,
+               k * sizeof(int));
+      }
+      noff += new->sz[b];
    }
 
-   // If the third bit of 'otype' is set, suppress warnings
-   // by setting 'warned' to 1.
-   int warned = (otype >> 2) & 1;
+   return 0;
 
-   // Make sure that 'p' defines a probability.
-   for (size_t i = 0 ; i < m ; i++) {
-      double sump = 0.0;
-      for (size_t j = 0 ; j < r+1 ; j++) {
-         // Cannot normalize negative values. Sorry folks.
-         if (p[j+i*(r+1)] < 0) {
-            fprintf(stderr, "error: 'p' negative\n");
-            return;
-         }
-         sump += p[j+i*(r+1)];
+}
+
+
+void
+extend_par
+(
+   zerone_t     * Z,
+   unsigned int   r_old
+)
+// SYNOPSIS:
+//   Extend the emission parameters of 'Z' (which contains the
+//   parameters of the first 'r_old' profiles) to the profiles
+//   that were appended to the observations. The parameter of a
+//   new profile in a given state is the average of the old ChIP
+//   profiles in that state, scaled by the ratio of read counts.
+//   The terms of every state are renormalized to sum to 1, which
+//   preserves the ratios between the old parameters.
+{
+
+   const unsigned int m = Z->m;
+   const unsigned int r = Z->ChIP->r;
+   const unsigned int n = nobs(Z->ChIP);
+   const int *y = Z->ChIP->y;
+   double *p = Z->p;
+
+   // Total number of reads per profile (the implicit
+   // profile is not used below, so it is left to 0).
+   const unsigned int o = Z->ChIP->nomock;
+   const unsigned int s = r - o;
+   double tot[64] = {0};
+   for (size_t k = 0 ; k < n ; k++) {
+      if (is_invalid(y, k, s)) continue;
+      for (size_t j = 0 ; j < s ; j++) tot[j+o] += y[j+k*s];
+   }
+
+   for (int i = m-1 ; i >= 0 ; i--) {
+      // Move the old terms in place (from the end).
+      memmove(p + i*(r+1), p + i*(r_old+1), (r_old+1) * sizeof(double));
+      double *pr = p + i*(r+1);
+      for (size_t j = r_old+1 ; j < r+1 ; j++) {
+         double sum = 0.0;
+         int nterms = 0;
+         for (size_t jj = 2 ; jj < r_old+1 ; jj++) {
+            if (tot[jj-1] == 0) continue;
+            sum += pr[jj] * tot[j-1] / tot[jj-1];
+            nterms++;
+         }
+         pr[j] = nterms > 0 ? sum / nterms : pr[0];
       }
-      int p_normalized_no = fabs(sump - 1.0) > DBL_EPSILON;
-      if (!warned && p_normalized_no) {
-         fprintf(stderr, "warning: renormalizing 'p'\n");
-         warned = 1;
+      double sump = 0.0;
+      for (size_t j = 0 ; j < r+1 ; j++) sump += pr[j];
+      for (size_t j = 0 ; j < r+1 ; j++) pr[j] /= sump;
+   }
+
+   return;
+
+}
+
+
+zerone_t *
+do_zerone
+(
+         ChIP_t        * ChIP,
+   const zerone_args_t * args
+)
+// SYNOPSIS:
+//   Fit the Zerone model to the data and find the Viterbi path.
+//   Pass 'NULL' as 'args' to use the default options.
+//
+// SIDE EFFECTS:
+//   The returned instance owns 'ChIP'.
+{
+
+   // The number of state in Zerone is an important constant.
+   // So much depends on it that it may be frozen in the code.
+   const unsigned int m = 3;
+
+   int        * mock = NULL; // The mock ChIP profile.
+   zinb_par_t * par  = NULL; // The parameter estimates.
+   zerone_t   * Z    = NULL; // The Zerone instance.
+   bw_t       * bw   = NULL; // The Baum-Welch workspace.
+   ChIP_t     * windows = ChIP; // The windows (see 'segment.h'
+                                // and 'refine.h').
+
+   const zerone_args_t defaults = {0};
+   if (args == NULL) args = &defaults;
+
+   // Extract the dimensions of the observations.
+   const unsigned int r = ChIP->r;
+
+   if (r > 63) {
+      fprintf(stderr, "maximum number of profiles exceeded\n");
+      goto clean_and_return;
+   }
+
+   if (args->adaptive > 0) {
+      // Run the HMM on segments of windows, which are sequential
+      // and not indexed with the input.
+      ChIP = segment_ChIP(windows, args->adaptive);
+      if (ChIP == NULL) {
+         ChIP = windows;
+         goto clean_and_return;
       }
-      for (int j = 0 ; j < r+1 ; j++) {
-         logp[j+i*(r+1)] = log(p[j+i*(r+1)] / sump);
+   }
+   else if (args->refine > 1) {
+      // Fit the model on coarse windows and refine the targets.
+      ChIP = coarsen_ChIP(windows, args->refine);
+      if (ChIP == NULL) {
+         ChIP = windows;
+         goto clean_and_return;
       }
    }
 
-   // The following variable 'row_of_na' comes in handy to write
-   // full lines of NAs in the emissions.
-   double *row_of_na = malloc(m * sizeof(double));
-   if (row_of_na == NULL) {
-      fprintf(stderr, "memory error (%s:%d)\n", __FILE__, __LINE__);
+   // Segments are fitted with the mock of the windows, coarse
+   // windows with their own mock.
+   const ChIP_t *obs = ChIP->seg == NULL ? ChIP : windows;
+
+   // Log-likelihood of every cycle (saved in checkpoints).
+   double trace[BW_MAXITER] = {0};
+   int status = 0;
+   int posteriors = 0; // 'bw->phi' holds the posteriors of 'Z' //
+
+   if (args->resume) {
+      // Parameters are restored from the checkpoint.
+      Z = new_zerone(m, ChIP);
+      if (Z == NULL) {
+         fprintf(stderr, "error in function '%s()' %s:%d\n",
+               __func__, __FILE__, __LINE__);
+         goto clean_and_return;
+      }
+      if (!read_checkpoint(args->checkpoint, Z, trace)) goto fail;
+      // No iteration means that profiles were added.
+      if (Z->iter == 0) fprintf(stderr, "warm start from checkpoint\n");
+      else fprintf(stderr, "resuming after %d iterations%s\n", Z->iter,
+            Z->vt > 0 ? " (Viterbi training)" : "");
+      goto run_baum_welch;
+   }
+
+   if (args->mockpar != NULL && obs == windows) {
+      // The mock profile was fitted by the caller.
+      par = malloc(sizeof(zinb_par_t));
+      if (par == NULL) {
+         fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+         goto clean_and_return;
+      }
+      *par = *args->mockpar;
+      goto fit_ChIP;
+   }
+
+   // Extract the first ChIP profile (the sum of mock controls).
+   const size_t nm = nobs(obs);
+   mock = malloc(nm * sizeof(int));
+   if (mock == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   // Copy data to 'mock'.
+   for (size_t i = 0 ; i < nm ; i++) {
+      mock[i] = obs->nomock ? 1 : obs->y[0+i*r];
+   }
+
+   par = mle_zinb(mock, nm);
+   if (par == NULL) {
+// TODO: Change parametrization so that failure does not happen. //
+      fprintf(stderr, "zerone failure %s:%d\n", __FILE__, __LINE__);
+      apologize();
+      goto clean_and_return;
+   }
+
+   free(mock);
+   mock = NULL;
+
+fit_ChIP:
+
+   if (args->starts > 1 && args->workers <= 1) {
+      // Keep the best of several starts, then proceed as usual.
+      status = multi_start(ChIP, par, args->starts, &Z, &bw, trace);
+      if (status < 0) goto clean_and_return;
+      posteriors = 1;
+      goto run_baum_welch;
+   }
+
+   double Q[9] = {0};
+   double p[3*64] = {0};
+   if (args->warm != NULL && ChIP == windows) {
+      // Same windows, fitted on a subsample (see 'autowin.h').
+      fine_par(args->warm, 1, par, Q, p);
+   }
+   else init_par(par, r, 0, Q, p);
+
+   Z = new_zerone(m, ChIP);
+
+   if (Z == NULL) {
+      // TODO: handle this case properly. //
+      fprintf(stderr, "error in function '%s()' %s:%d\n",
+            __func__, __FILE__, __LINE__);
+      goto clean_and_return;
+   }
+
+   set_zerone_par(Z, Q, par->a, par->pi, p);
+
+run_baum_welch:
+   // Run the Baum-Welch algorithm. Resumed runs start
+   // after the last checkpointed cycle.
+   if (args->workers > 1 && ChIP->seg == NULL) {
+      // Distributed run (without early QC).
+      if (shard_zerone(Z, args, trace) < 0) goto fail;
+      goto clean_and_return;
+   }
+
+   if (bw == NULL && args->index != NULL && ChIP == windows) {
+      // The time series was indexed with the input.
+      const bw_t indexed = { .index = args->index, .i0 = args->i0 };
+      bw = share_bw(Z, &indexed);
+   }
+   if (bw == NULL) bw = new_bw(Z);
+   if (bw == NULL) goto fail;
+
+   // Threads are optional (the E-step is sequential without).
+   if (args->threads > 1 && ChIP->seg == NULL) {
+      bw->pool = new_pool(Z, bw, args->threads);
+   }
+
+   // Resumed runs keep the engine and the phase of the checkpoint
+   // (Viterbi training is over when 'Z->iter' exceeds 'Z->vt').
+   if (Z->iter == 0 && status == 0) {
+      Z->vt = 0;
+      Z->polish = args->polish;
+   }
+   const int hard = Z->iter == 0 ?
+      args->hardem && ChIP->seg == NULL && status == 0 : Z->vt > 0;
+
+   int maxiter = BW_MAXITER;
+   if (hard) {
+      // Viterbi training (without early QC), then polish
+      // with at most 'Z->polish' Baum-Welch cycles.
+      while (status == 0 && Z->iter == Z->vt && Z->iter+1 < BW_MAXITER) {
+         Z->vt = ++Z->iter;
+         status = vt_iter(Z, bw);
+         if (status < 0) goto fail;
+         trace[Z->iter-1] = Z->l;
+         if (status == 0 && args->checkpoint != NULL) {
+            write_checkpoint(args->checkpoint, Z, trace);
+         }
+      }
+      status = 0;
+      if (Z->vt + Z->polish + 1 < maxiter) {
+         maxiter = Z->vt + Z->polish + 1;
+      }
+   }
+
+   while (status == 0 && ++Z->iter < maxiter) {
+      status = bw_iter(Z, bw);
+      if (status < 0) goto fail;
+      posteriors = 1;
+      trace[Z->iter-1] = Z->l;
+      if (status > 0) break;
+      // Failure to write is not fatal (the function warns). The
+      // last cycle is not saved: a resumed run does it again to
+      // get the same posteriors as the uninterrupted run.
+      if (args->checkpoint != NULL && Z->iter+1 < maxiter) {
+         write_checkpoint(args->checkpoint, Z, trace);
+      }
+      // Give up on hopeless datasets (without Viterbi path).
+      if (args->earlyqc && Z->iter % EARLYQC_ITER == 0) {
+         if (early_reject(Z, bw) == 1) goto clean_and_return;
+      }
+   }
+
+   // No Baum-Welch cycle was run after Viterbi training, or
+   // the run was resumed with no cycle left.
+   if (!posteriors && bw_estep(Z, bw) < 0) goto fail;
+
+   bw_finish(Z, bw);
+   bw = NULL;
+
+   // Reorder the states and find the Viterbi path.
+   zerone_viterbi(Z);
+
+clean_and_return:
+   if (bw != NULL) destroy_bw(bw);
+   if (ChIP != windows) {
+      // Transfer the fit to the windows.
+      if (Z != NULL && (ChIP->seg != NULL ?
+               expand_segments(Z, windows, args->threads) :
+               refine_zerone(Z, windows, args->refine, args->mockpar,
+                  args->threads)) < 0) {
+         Z->ChIP = NULL;
+         destroy_zerone_all(Z);
+         Z = NULL;
+      }
+      if (ChIP->seg != NULL) destroy_segments(ChIP);
+      else {
+         free(ChIP->y);
+         free(ChIP);
+      }
+   }
+   free(mock);
+   free(par);
+   return Z;
+
+fail:
+   // The caller keeps ownership of 'ChIP'.
+   Z->ChIP = NULL;
+   destroy_zerone_all(Z);
+   Z = NULL;
+   goto clean_and_return;
+
+}
+
+
+void
+zerone_viterbi
+(
+   zerone_t * Z
+)
+// SYNOPSIS:
+//   Reorder the states in case they got scrambled and find the
+//   Viterbi path from the emission probabilities in log space.
+//   'Z->path' is left to 'NULL' in case of memory error.
+{
+
+   const unsigned int m = Z->m;
+   const unsigned int n = nobs(Z->ChIP);
+
+   int map[3];
+   get_state_map(Z, map);
+   debug_print("map: [%d, %d, %d]\n", map[0], map[1], map[2]);
+
+   if (map[0] != 0 || map[1] != 1 || map[2] != 2) reorder(Z, map);
+
+   // Run the Viterbi algorithm.
+   double log_Q[9] = {0};
+   double initp[3] = {0};
+
+   int *path = malloc(n * sizeof(int));
+   if (path == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
       return;
    }
-   for (int i = 0 ; i < m ; i++) row_of_na[i] = NAN;
 
-   for (int k = 0 ; k < n ; k++) {
+   for (size_t i = 0 ; i < 3 ; i++) initp[i] = log(1.0/3);
+   for (size_t i = 0 ; i < 9 ; i++) log_Q[i] = log(Z->Q[i]);
+   // A transition of probability 1 (possible with segments) would
+   // read as linear space in 'block_viterbi()'.
+   for (size_t i = 0 ; i < 9 ; i++) if (log_Q[i] == 0) log_Q[i] = -DBL_MIN;
+
+   // Find Viterbi path.
+   stage_begin(STAGE_VITERBI);
+   block_viterbi(m, Z->ChIP->nb, Z->ChIP->sz, log_Q, initp, Z->pem, path);
+   stage_end(STAGE_VITERBI);
+
+   Z->path = path;
+
+   return;
+
+}
+
+
+int
+is_invalid
+(
+    const int * y,
+          int   k,
+          int   r
+)
+// SYNOPSIS:
+//   Helper function. NAs of type 'int' is the largest negative
+//   value. More generally, any negative value in 'y' is invalid.
+{
+   for (int i = 0 ; i < r ; i++) if (y[i + k*r] < 0) return 1;
+   return 0;
+}
+
+int
+is_all_zero
+(
+   const int * y,
+         int   k,
+         int   r
+)
+// SYNOPSIS:
+//   Helper function for `zinm_prob`. Returns 1 if and only if all
+//   the observations are 0.
+{
+   for (int i = 0 ; i < r ; i++) if (y[i + k*r] != 0) return 0;
+   return 1;
+}
+
+
+void
+zinm_rows
+(
+   const zinm_part_t * part
+)
+// SYNOPSIS:
+//   Compute the rows of the emission probabilities of 'part' (see
+//   'zinm_prob()' and 'zinm_prob_mt()'). A row is computed if it
+//   is the first occurrence of its value in the index, otherwise
+//   it is copied from the first occurrence.
+{
+
+   const zerone_t     * zerone = part->Z;
+   const ChIP_t       * ChIP   = zerone->ChIP;
+   const int          * index  = part->index;
+   const double       * logp   = part->logp;
+   double             * pem    = part->pem;
+
+   const unsigned int   r  = ChIP->r;
+   const int          * y  = ChIP->y;
+   const unsigned int   m  = zerone->m;
+   const double         a  = zerone->a;
+   const double         pi = zerone->pi;
+   // The implicit profile 'o' is 1 everywhere, so there are only
+   // 's' columns in 'y' and no emission is ever all 0.
+   const unsigned int   o  = ChIP->nomock;
+   const unsigned int   s  = r - o;
+
+   const int output_type = part->otype & 3;
+   const int compute_constant_terms = (part->otype >> 3) & 1;
+
+   for (int k = part->k0 ; k < part->k1 ; k++) {
       // Indexing allows to compute the terms only once. If the term
       // has been computed before, copy the value and move on.
       if (index[k] < k) {
+         if (part->pass == 1) continue;
+         // In the second pass, the source may be a copy that
+         // another thread has not made yet: go to the first
+         // occurrence.
+         int src = index[k];
+         if (part->pass == 2) while (index[src] < src) src = index[src];
          // TODO: bypass the cache for writing. This would save
          // some time when tere are a lot of observations.
          // This would require reformattnig 'pem' and using
          // _mm_stream_pd(double *p, __m128d a)
-         memcpy(pem + k*m, pem + index[k]*m, m * sizeof(double));
+         memcpy(pem + k*m, pem + src*m, m * sizeof(double));
          continue;
       }
+      if (part->pass == 2) continue;
 
       // This is the firt occurrence of the emission in the times
       // series. We need to compute the emission probability.
       // Test the presence of invalid/NA emissions in the row.
       // If so, fill the row with NAs and move on.
-      if (is_invalid(y, k, r)) {
-         memcpy(pem + k*m, row_of_na, m * sizeof(double));
+      if (is_invalid(y, k, s)) {
+         for (int i = 0 ; i < m ; i++) pem[i+k*m] = NAN;
          continue;
       }
 
-      if (is_all_zero(y, k, r)) {
+      if (!o && is_all_zero(y, k, r)) {
          // Emissions are all zeros, use the zero-inflated
          // term from the zinm model.
          for (int i = 0 ; i < m ; i++) {
@@ -397,17 +1023,20 @@ zinm_prob
          // Otherwise use the standard probability.
          for (int i = 0 ; i < m ; i++) {
             pem[i+k*m] = a * logp[0+i*(r+1)];
-            for (int j = 0 ; j < r ; j++) {
-               pem[i+k*m] += y[j+k*r] * logp[(j+1)+i*(r+1)];
+            if (o) pem[i+k*m] += logp[1+i*(r+1)];
+            for (int j = 0 ; j < s ; j++) {
+               pem[i+k*m] += y[j+k*s] * logp[(j+o+1)+i*(r+1)];
             }
          }
       }
 
       if (compute_constant_terms) {
          double c_term = -lgamma(a);
-         double sum = a;
-         for (int j = 0 ; j < r ; j++) {
-            int term = y[j+k*r];
+         // The implicit profile adds 1 to the sum
+         // and 'lgamma(2) = 0' to the constant.
+         double sum = a + o;
+         for (int j = 0 ; j < s ; j++) {
+            int term = y[j+k*s];
             sum += term;
             c_term -= lgamma(term+1);
          }
@@ -417,19 +1046,224 @@ zinm_prob
          }
       }
 
-      if (output_type == log_space) continue;
+      // Always compute in log space.
+      if (output_type == 1) continue;
 
       double sum = 0.0;
       double lin[m];
       for (int i = 0 ; i < m ; i++) sum += lin[i] = exp(pem[i+k*m]);
-      if (sum > 0 || output_type == lin_space) {
+      // Compute in linear space (always, or if no underflow).
+      if (sum > 0 || output_type == 2) {
          memcpy(pem+k*m, lin, m * sizeof(double));
       }
 
    }
 
+   return;
+
+}
+
+
+void *
+run_zinm_rows
+(
+   void *arg
+)
+// SYNOPSIS:
+//   Thread function of 'zinm_prob_mt()'.
+{
+   zinm_rows((const zinm_part_t *) arg);
+   return NULL;
+}
+
+
+void
+zinm_prob
+(
+         zerone_t * restrict zerone,
+   const int      * restrict index,
+   // call control //
+         int                otype,
+   // output //
+         double   * restrict pem
+)
+// SYNOPSIS:
+//   Compute emission probabilities with a mixture negative multinomial
+//   model. Since those are up to a multiplicative constant in the
+//   forward-backward algorithm, we can drop the multiplicative terms
+//   that do not depend on the state of the HMM.
+//   Since the negative nultinomial takes discrete values, we can cache
+//   the results for reuse in order to save computation. This is done
+//   by indexing the series.
+//
+//   My parametrization is of the form:
+//
+//        p_0(i)^a * p_1(i)^y_1 * p_2(i)^y_2 * ... * p_r+1(i)^y_r
+//
+//   And in the case that all emissions are 0
+//
+//                      pi * p_0(i)^a + (1-pi)
+//
+// NUMERICAL STABILITY:
+//   Each term of the sum above is computed in log space, the result is
+//   the computed as the sum of two exponentials. NA emissions are
+//   allowed and yield NA for the whole line of emissions.
+//
+// ARGUMENTS:
+//   'ChIP': struct of observations
+//   'par': struct of parameters for the ZINM distribution
+//   'index': a precomputed index of the ChIP data
+//   'otype': the type of output to produce (see below)
+//   'pem': (n_obs,n_states) emission probability
+//
+// RETURN:
+//   'void'
+//
+// SIDE EFFECTS:
+//   Update 'pem' in place.
+//
+// OUTPUT:
+//   The output type for 'pem' can be the emission probability in
+//   log space (1), the same emission probability in linear space (2),
+//   or in linear by default and in log space in case of underflow (0).
+//   'otype' also controls the verbosity. If the third bit is set,
+//   i.e. the value is set to 4, 5 or 6, the function will suppress
+//   warnings. Setting the fourth bit of 'otype' forces to compute
+//   the constant terms in emission probabilities.
+{
+
+   zinm_prob_mt(zerone, index, otype, pem, 1);
+
+}
+
+
+int
+zinm_logp
+(
+   const zerone_t * zerone,
+         int        otype,
+         double   * logp
+)
+// SYNOPSIS:
+//   Normalize the parameters 'p' of every state and store them
+//   in log space in 'logp' (see 'zinm_rows()'). A warning is
+//   printed if 'p' is not normalized, unless the third bit of
+//   'otype' is set.
+//
+// RETURN:
+//   0 upon success, -1 if 'p' has negative values.
+{
+
+   const unsigned int   r  = zerone->ChIP->r;
+   const unsigned int   m  = zerone->m;
+   const double       * p  = zerone->p;
+
+   // If the third bit of 'otype' is set, suppress warnings
+   // by setting 'warned' to 1.
+   int warned = (otype >> 2) & 1;
+
+   // Make sure that 'p' defines a probability.
+   for (size_t i = 0 ; i < m ; i++) {
+      double sump = 0.0;
+      for (size_t j = 0 ; j < r+1 ; j++) {
+         // Cannot normalize negative values. Sorry folks.
+         if (p[j+i*(r+1)] < 0) {
+            fprintf(stderr, "error: 'p' negative\n");
+            return -1;
+         }
+         sump += p[j+i*(r+1)];
+      }
+      int p_normalized_no = fabs(sump - 1.0) > DBL_EPSILON;
+      if (!warned && p_normalized_no) {
+         fprintf(stderr, "warning: renormalizing 'p'\n");
+         warned = 1;
+      }
+      for (int j = 0 ; j < r+1 ; j++) {
+         logp[j+i*(r+1)] = log(p[j+i*(r+1)] / sump);
+      }
+   }
+
+   return 0;
+
+}
+
+
+void
+zinm_prob_mt
+(
+         zerone_t * restrict zerone,
+   const int      * restrict index,
+   // call control //
+         int                otype,
+   // output //
+         double   * restrict pem,
+         int                nthreads
+)
+// SYNOPSIS:
+//   Same as 'zinm_prob()' with up to 'nthreads' threads, each on
+//   a contiguous part of at least 'ZINM_MINROWS' rows. The first
+//   occurrences of the rows are all computed before the other
+//   rows are copied, so the output does not depend on the number
+//   of threads.
+{
+
+   ChIP_t *ChIP = zerone->ChIP;
+   if (ChIP->seg != NULL) {
+      // The observations are segments of windows.
+      seg_prob(zerone, otype, pem);
+      return;
+   }
+
+   const unsigned int   r  = ChIP->r;
+   const unsigned int   m  = zerone->m;
+   const size_t         n  = nobs(ChIP);
+
+   double *logp = malloc((r+1)*m * sizeof(double));
+   if (logp == NULL) {
+      fprintf(stderr, "memory error (%s:%d)\n", __FILE__, __LINE__);
+      return;
+   }
+
+   if (zinm_logp(zerone, otype, logp) < 0) {
+      free(logp);
+      return;
+   }
+
+   // Do not start threads for small parts.
+   size_t nparts = nthreads > 1 ? nthreads : 1;
+   if (nparts > n / ZINM_MINROWS) nparts = n / ZINM_MINROWS;
+   if (nparts < 2) {
+      const zinm_part_t all = { .Z = zerone, .index = index,
+         .logp = logp, .otype = otype, .k0 = 0, .k1 = n, .pass = 0,
+         .pem = pem };
+      zinm_rows(&all);
+      free(logp);
+      return;
+   }
+
+   zinm_part_t parts[nparts];
+   pthread_t tid[nparts];
+   int thread[nparts];
+   for (size_t t = 0 ; t < nparts ; t++) {
+      parts[t] = (zinm_part_t) { .Z = zerone, .index = index,
+         .logp = logp, .otype = otype, .k0 = t*n / nparts,
+         .k1 = (t+1)*n / nparts, .pem = pem };
+   }
+
+   for (int pass = 1 ; pass <= 2 ; pass++) {
+      for (size_t t = 0 ; t < nparts ; t++) {
+         parts[t].pass = pass;
+         thread[t] = pthread_create(tid+t, NULL,
+               run_zinm_rows, parts+t) == 0;
+         // Compute the part in the current thread if needed.
+         if (!thread[t]) zinm_rows(parts+t);
+      }
+      for (size_t t = 0 ; t < nparts ; t++) {
+         if (thread[t]) pthread_join(tid[t], NULL);
+      }
+   }
+
    free(logp);
-   free(row_of_na);
    return;
 
 }
@@ -626,16 +1460,58 @@ eval_bw_dfdp0
    double term3 = B * (subterm3a - subterm3b) / sq(pi*pow(p0,a)+1-pi);
    double term4 = (D + a*A) / sq(p0);
 
-   return 1 - E/sq(term1 + term2) * (term3-term4);
+   return 1 - E/sq(term1 + term2) * (term3-term4);
+
+}
+
+
+bw_t *
+alloc_bw
+(
+   zerone_t *zerone
+)
+// SYNOPSIS:
+//   Allocate the workspace of the Baum-Welch algorithm, except
+//   the index of the time series.
+{
+
+   const size_t n = nobs(zerone->ChIP);
+   const size_t m = zerone->m;
+   const size_t r = zerone->ChIP->r;
+
+   bw_t *bw = calloc(1, sizeof(bw_t));
+   if (bw == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      return NULL;
+   }
+
+   bw->R = (zerone->p[1]) / zerone->p[0];
+   bw->pem = malloc(n*m * sizeof(double));
+   bw->phi = malloc(n*m * sizeof(double));
+   bw->trans = malloc(m*m * sizeof(double));
+   bw->suff = malloc(m*(r+2) * sizeof(double));
+   bw->newp = malloc(m*(r+1) * sizeof(double));
+   if (bw->pem == NULL || bw->phi == NULL || bw->trans == NULL ||
+         bw->suff == NULL || bw->newp == NULL) {
+      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+      destroy_bw(bw);
+      return NULL;
+   }
+
+   return bw;
 
 }
 
 
-void
-bw_zinm
+bw_t *
+new_bw
 (
    zerone_t *zerone
 )
+// SYNOPSIS:
+//   Allocate the workspace of the Baum-Welch algorithm and index
+//   the time series. The cycles are run with 'bw_iter()' and the
+//   results are transferred to 'zerone' by 'bw_finish()'.
 {
 
    // Unpack parameters.
@@ -650,8 +1526,6 @@ bw_zinm
    const size_t         m    = zerone->m;
    const size_t         r    = ChIP->r;
    const unsigned int   nb   = ChIP->nb;
-   const unsigned int * size = ChIP->sz;
-   const int          * y    = ChIP->y;
    const double         a    = zerone->a;
    const double         pi   = zerone->pi;
    const double         R    = (zerone->p[1]) / zerone->p[0];
@@ -668,10 +1542,6 @@ bw_zinm
       debug_print("| R: %.3f\n", R);
    }
 
-   // Variables optimized by the Baum-Welch algorithm.
-   double *p = zerone->p;
-   double *Q = zerone->Q;
-
    // Check the input.
    for (size_t i = 1 ; i < m ; i++) {
       double ratio = zerone->p[1+i*(r+1)] /  zerone->p[0+i*(r+1)];
@@ -680,158 +1550,595 @@ bw_zinm
       }
    }
 
-   int *index = malloc(n * sizeof(int));
-   double *pem = malloc(n*m * sizeof(double));
-   double *phi = malloc(n*m * sizeof(double));
-   if (index == NULL || pem == NULL || phi == NULL) {
-      fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
-      return;
-   }
+   bw_t *bw = alloc_bw(zerone);
+   if (bw == NULL) return NULL;
 
-   double *trans = malloc(m*m * sizeof(double));
-   double *ystar = malloc(r * sizeof(double));
-   double *prob = malloc(m * sizeof(double));
-   if (trans == NULL || ystar == NULL || prob == NULL) {
+   bw->index = malloc(n * sizeof(int));
+   if (bw->index == NULL) {
       fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
-      return;
+      destroy_bw(bw);
+      return NULL;
    }
 
-   double *newp = malloc(m*(r+1) * sizeof(double));
-
-   for (size_t i = 0 ; i < m ; i++) prob[i] = 1.0 / m;
-
    // Index the time series now. This would be done by
    // 'zinm_prob()' anyway, but we will need the index of
    // the first all-0 emission later.
-   int i0 = indexts(n, r, y, index);
+   bw->i0 = index_ChIP(ChIP, bw->index);
 
-   // Start Baum-Welch cycles.
-   for (zerone->iter = 1 ; zerone->iter < BW_MAXITER ; zerone->iter++) {
+   return bw;
 
-#ifdef DEBUG
-fprintf(stderr, "iter: %d\r", zerone->iter);
-#endif
+}
+
+
+bw_t *
+share_bw
+(
+         zerone_t * zerone,
+   const bw_t     * bw
+)
+// SYNOPSIS:
+//   Allocate the workspace of the Baum-Welch algorithm for another
+//   fit of the same data, reusing the index of 'bw'. The index is
+//   not copied, so 'bw' must outlive the new workspace (ownership
+//   is passed by swapping the 'shared' flags).
+{
+
+   bw_t *new = alloc_bw(zerone);
+   if (new == NULL) return NULL;
+
+   new->index = bw->index;
+   new->i0 = bw->i0;
+   new->shared = 1;
+
+   return new;
+
+}
+
+
+void
+destroy_bw
+(
+   bw_t *bw
+)
+{
+
+   if (bw->pool != NULL) destroy_pool(bw->pool);
+   if (!bw->shared) free(bw->index);
+   free(bw->pem);
+   free(bw->phi);
+   free(bw->trans);
+   free(bw->suff);
+   free(bw->newp);
+   free(bw->path);
+   free(bw);
 
-      // Update emission probabilities and run the block
-      // forward backward algorithm.
-      unsigned int lin_space_no_warn = 4;
-      zinm_prob(zerone, index, lin_space_no_warn, pem);
-      zerone->l = block_fwdb(m, nb, size, Q, prob, pem, phi, trans);
+   return;
+
+}
+
+
+void
+suff_stats
+(
+         size_t   m,
+   const ChIP_t * ChIP,
+   const int    * index,
+         int      i0,
+   const double * phi,
+   // output //
+         double * suff
+)
+// SYNOPSIS:
+//   Compute the expected sufficient statistics of the emission
+//   parameters from the posterior probabilities 'phi'. For every
+//   state, 'suff' holds the expected number of windows with
+//   at least one read (A), of windows with no read (B), of mock
+//   reads (D) and of reads in every ChIP profile (r-1 terms).
+//   These statistics are additive, so the statistics of several
+//   blocks can be summed.
+{
 
-      // Update 'Q'.
-      update_trans(m, Q, trans);
+   const size_t r = ChIP->r;
+   const size_t n = nobs(ChIP);
+   const int *y = ChIP->y;
 
-      // Update 'p'.
+   if (ChIP->seg != NULL) {
+      // The observations are segments of windows.
+      seg_stats(m, ChIP, phi, suff);
+      return;
+   }
+
+   if (ChIP->nomock) {
+      // The implicit profile is 1 in every window, so there is
+      // no all-0 window and the mock reads are counted in 'A'.
+      const size_t c = r-1;
       for (size_t i = 0 ; i < m ; i++) {
-         // Compute the constants.
-         double A = 0.0;
-         double B = 0.0;
-         double C = 1+R;
-         double D = 0.0;
-         double E = 0.0;
-         memset(ystar, 0, r * sizeof(double));
+         double *s = suff + i*(r+2);
+         memset(s, 0, (r+2) * sizeof(double));
          for (size_t k = 0 ; k < n; k++) {
-            if (index[k] == i0) {
-               B += phi[i+k*m];
-            }
-            else {
-               // Skip invalid entries.
-               if (is_invalid(y, k, r)) continue;
-               A += phi[i+k*m];
-               D += phi[i+k*m] * y[0+k*r];
-               for (size_t j = 1 ; j < r ; j++) {
-                  ystar[j] += phi[i+k*m] * y[j+k*r];
-               }
+            if (is_invalid(y, k, c)) continue;
+            s[0] += phi[i+k*m];
+            for (size_t j = 0 ; j < c ; j++) {
+               s[j+3] += phi[i+k*m] * y[j+k*c];
             }
          }
-         for (size_t j = 1 ; j < r ; j++) {
-            E += ystar[j];
-         }
+         s[2] = s[0];
+      }
+      return;
+   }
 
-         // Find upper and lower bound for 'p0'.
-         double p0 = .5;
-         double p0_lo;
-         double p0_hi;
-         if (eval_bw_f(a, pi, p0, A, B, C, D, E) < 0) {
-            p0 *= 2;
-            while (eval_bw_f(a, pi, p0, A, B, C, D, E) < 0) p0 *= 2;
-            p0_lo = p0/2;
-            p0_hi = p0;
+   for (size_t i = 0 ; i < m ; i++) {
+      double *s = suff + i*(r+2);
+      memset(s, 0, (r+2) * sizeof(double));
+      for (size_t k = 0 ; k < n; k++) {
+         if (index[k] == i0) {
+            s[1] += phi[i+k*m];
          }
          else {
-            p0 /= 2;
-            while (eval_bw_f(a, pi, p0, A, B, C, D, E) > 0) p0 /= 2;
-            p0_lo = p0;
-            p0_hi = p0*2;
+            // Skip invalid entries.
+            if (is_invalid(y, k, r)) continue;
+            s[0] += phi[i+k*m];
+            s[2] += phi[i+k*m] * y[0+k*r];
+            for (size_t j = 1 ; j < r ; j++) {
+               s[j+2] += phi[i+k*m] * y[j+k*r];
+            }
          }
+      }
+   }
 
-         if (p0_lo > 1.0 || p0_hi < 0.0) {
-            fprintf(stderr, "cannot complete Baum-Welch algorithm\n");
-            free(index);
-            free(newp);
-            free(pem);
-            free(phi);
-            free(prob);
-            free(trans);
-            free(ystar);
-            return;
-         }
+   return;
 
-         double new_p0 = (p0_lo + p0_hi) / 2;
-         for (int j = 0 ; j < BT_MAXITER ; j++) {
-            p0 = (new_p0 < p0_lo || new_p0 > p0_hi) ?
-               (p0_lo + p0_hi) / 2 :
-               new_p0;
-            double f = eval_bw_f(a, pi, p0, A, B, C, D, E);
-            if (f > 0) p0_hi = p0; else p0_lo = p0;
-            if ((p0_hi - p0_lo) < TOLERANCE) break;
-            double dfdp0 = eval_bw_dfdp0(a, pi, p0, A, B, C, D, E);
-            new_p0 = p0 - f / dfdp0;
-         }
+}
 
-         // Update the state-independent parameters.
-         newp[0+i*(r+1)] = p0;
-         newp[1+i*(r+1)] = p0 * R;
-         // Now update the state-dependent parameters.
-         double term1 = (D + a*A) / p0;
-         double term2 = B * pi*a*pow(p0,a-1) / (pi*pow(p0,a)+1-pi);
-         double normconst = (term1 + term2) / C;
-         for (size_t j = 1 ; j < r ; j++) {
-            newp[(j+1)+i*(r+1)] = ystar[j] / normconst;
-         }
 
+void
+vt_stats
+(
+         size_t   m,
+   const ChIP_t * ChIP,
+   const int    * index,
+         int      i0,
+   const int    * path,
+   // output //
+         double * suff
+)
+// SYNOPSIS:
+//   Same as 'suff_stats()' when every window is assigned to its
+//   state on 'path' (hard assignments), in one pass over the
+//   windows. Segments of windows are not supported.
+{
+
+   const size_t r = ChIP->r;
+   const size_t n = nobs(ChIP);
+   const int *y = ChIP->y;
+
+   memset(suff, 0, m*(r+2) * sizeof(double));
+
+   if (ChIP->nomock) {
+      // See 'suff_stats()'.
+      const size_t c = r-1;
+      for (size_t k = 0 ; k < n; k++) {
+         if (is_invalid(y, k, c)) continue;
+         double *s = suff + path[k]*(r+2);
+         s[0]++;
+         for (size_t j = 0 ; j < c ; j++) s[j+3] += y[j+k*c];
+      }
+      for (size_t i = 0 ; i < m ; i++) suff[2+i*(r+2)] = suff[0+i*(r+2)];
+      return;
+   }
+
+   for (size_t k = 0 ; k < n; k++) {
+      double *s = suff + path[k]*(r+2);
+      if (index[k] == i0) {
+         s[1]++;
+      }
+      else {
+         // Skip invalid entries.
+         if (is_invalid(y, k, r)) continue;
+         s[0]++;
+         s[2] += y[0+k*r];
+         for (size_t j = 1 ; j < r ; j++) s[j+2] += y[j+k*r];
+      }
+   }
+
+   return;
+
+}
+
+
+int
+update_p
+(
+   const zerone_t * zerone,
+         double     R,
+   const double   * suff,
+   // output //
+         double   * newp
+)
+// SYNOPSIS:
+//   Find the emission parameters that maximize the expected
+//   log-likelihood given the sufficient statistics 'suff' (see
+//   'suff_stats()'). The statistics need only be known up to a
+//   multiplicative constant.
+//
+// RETURN:
+//   0 upon success, -1 in case of failure.
+{
+
+   const size_t m  = zerone->m;
+   const size_t r  = zerone->ChIP->r;
+   const double a  = zerone->a;
+   const double pi = zerone->pi;
+
+   for (size_t i = 0 ; i < m ; i++) {
+      // Compute the constants.
+      const double * s = suff + i*(r+2);
+      const double * ystar = s+2;
+      double A = s[0];
+      double B = s[1];
+      double C = 1+R;
+      double D = s[2];
+      double E = 0.0;
+      for (size_t j = 1 ; j < r ; j++) {
+         E += ystar[j];
+      }
+
+      // Find upper and lower bound for 'p0'.
+      double p0 = .5;
+      double p0_lo;
+      double p0_hi;
+      if (eval_bw_f(a, pi, p0, A, B, C, D, E) < 0) {
+         p0 *= 2;
+         while (eval_bw_f(a, pi, p0, A, B, C, D, E) < 0) p0 *= 2;
+         p0_lo = p0/2;
+         p0_hi = p0;
+      }
+      else {
+         p0 /= 2;
+         while (eval_bw_f(a, pi, p0, A, B, C, D, E) > 0) p0 /= 2;
+         p0_lo = p0;
+         p0_hi = p0*2;
+      }
+
+      if (p0_lo > 1.0 || p0_hi < 0.0) {
+         fprintf(stderr, "cannot complete Baum-Welch algorithm\n");
+         return -1;
+      }
+
+      double new_p0 = (p0_lo + p0_hi) / 2;
+      for (int j = 0 ; j < BT_MAXITER ; j++) {
+         p0 = (new_p0 < p0_lo || new_p0 > p0_hi) ?
+            (p0_lo + p0_hi) / 2 :
+            new_p0;
+         double f = eval_bw_f(a, pi, p0, A, B, C, D, E);
+         if (f > 0) p0_hi = p0; else p0_lo = p0;
+         if ((p0_hi - p0_lo) < TOLERANCE) break;
+         double dfdp0 = eval_bw_dfdp0(a, pi, p0, A, B, C, D, E);
+         new_p0 = p0 - f / dfdp0;
+      }
+
+      // Update the state-independent parameters.
+      newp[0+i*(r+1)] = p0;
+      newp[1+i*(r+1)] = p0 * R;
+      // Now update the state-dependent parameters.
+      double term1 = (D + a*A) / p0;
+      double term2 = B * pi*a*pow(p0,a-1) / (pi*pow(p0,a)+1-pi);
+      double normconst = (term1 + term2) / C;
+      for (size_t j = 1 ; j < r ; j++) {
+         newp[(j+1)+i*(r+1)] = ystar[j] / normconst;
+      }
+
+   }
+
+   return 0;
+
+}
+
+
+int
+bw_estep
+(
+   zerone_t * zerone,
+   bw_t     * bw
+)
+// SYNOPSIS:
+//   E-step of the Baum-Welch algorithm: update the emission
+//   probabilities and run the block forward-backward algorithm.
+//   The posterior probabilities, the expected transitions and the
+//   sufficient statistics are stored in 'bw', the log-likelihood
+//   in 'zerone->l'.
+//
+// RETURN:
+//   0 upon success, -1 in case of failure.
+{
+
+   // Unpack parameters.
+   ChIP_t *ChIP = zerone->ChIP;
+
+   // Constants.
+   const size_t         m    = zerone->m;
+   const unsigned int   nb   = ChIP->nb;
+   const unsigned int * size = ChIP->sz;
+
+   double prob[m];
+   for (size_t i = 0 ; i < m ; i++) prob[i] = 1.0 / m;
+
+   if (bw->pool != NULL) {
+      // Same on the parts of the threads.
+      return pool_estep(bw->pool) < 0 ? -1 : 0;
+   }
+
+   // Update emission probabilities and run the block
+   // forward backward algorithm.
+   trace_begin("E-step", NULL, -1);
+   unsigned int lin_space_no_warn = 4;
+   stage_begin(STAGE_EMISSION);
+   zinm_prob(zerone, bw->index, lin_space_no_warn, bw->pem);
+   stage_end(STAGE_EMISSION);
+   stage_begin(STAGE_FWDB);
+   zerone->l = block_fwdb(m, nb, size, zerone->Q, prob, bw->pem,
+         bw->phi, bw->trans);
+   if (ChIP->seg != NULL) seg_trans(m, ChIP, bw->phi, bw->trans);
+   stage_end(STAGE_FWDB);
+   stage_begin(STAGE_MSTEP);
+   suff_stats(m, ChIP, bw->index, bw->i0, bw->phi, bw->suff);
+   stage_end(STAGE_MSTEP);
+   trace_end("E-step", NULL, -1);
+
+   return 0;
+
+}
+
+
+int
+bw_iter
+(
+   zerone_t * zerone,
+   bw_t     * bw
+)
+// SYNOPSIS:
+//   Run one cycle of the Baum-Welch algorithm: update emission
+//   probabilities, run the block forward-backward algorithm and
+//   update 'Q' and 'p' in place.
+//
+// RETURN:
+//   1 if the parameters have converged (in which case 'p' is not
+//   updated), 0 if they have not and -1 in case of failure.
+{
+
+   // Constants.
+   const size_t         m    = zerone->m;
+   const size_t         r    = zerone->ChIP->r;
+
+   // Workspace.
+   double             * trans = bw->trans;
+   double             * suff  = bw->suff;
+   double             * newp  = bw->newp;
+
+   // Variables optimized by the Baum-Welch algorithm.
+   double *p = zerone->p;
+   double *Q = zerone->Q;
+
+#ifdef DEBUG
+fprintf(stderr, "iter: %d\r", zerone->iter);
+#endif
+
+   if (bw_estep(zerone, bw) < 0) return -1;
+
+   // Update 'Q'.
+   stage_begin(STAGE_MSTEP);
+   update_trans(m, Q, trans);
+
+   // Update 'p'.
+   trace_begin("M-step", NULL, -1);
+   int status = update_p(zerone, bw->R, suff, newp);
+   trace_end("M-step", NULL, -1);
+   stage_end(STAGE_MSTEP);
+   if (status < 0) return -1;
+
+   // Check convergence
+   double maxd = 0.0;
+   for (size_t i = 0 ; i < m*(r+1) ; i++) {
+      double thisd = fabs(newp[i]-p[i]);
+      maxd = thisd > maxd ? thisd : maxd;
+   }
+
+   if (maxd < TOLERANCE) return 1;
+   memcpy(p, newp, m*(r+1) * sizeof(double));
+
+   return 0;
+
+}
+
+
+int
+vt_iter
+(
+   zerone_t * zerone,
+   bw_t     * bw
+)
+// SYNOPSIS:
+//   Run one cycle of Viterbi training (hard EM): update emission
+//   probabilities in log space, find the Viterbi path and update
+//   'Q' and 'p' in place as if every window was in its state on the
+//   path. The transitions are counted along the path, plus
+//   'VT_PSEUDOCOUNT' so that none gets probability 0. A cycle costs
+//   a single pass of the Viterbi algorithm instead of the forward
+//   and backward passes of 'bw_iter()'. 'zerone->l' is set to the
+//   log-probability of the path (not the log-likelihood).
+//
+// RETURN:
+//   1 if the parameters have converged or if a state is not on the
+//   path (in both cases 'Q' and 'p' are not updated), 0 if they
+//   have not converged and -1 in case of failure.
+{
+
+   // Unpack parameters.
+   ChIP_t *ChIP = zerone->ChIP;
+
+   // Constants.
+   const size_t         m    = zerone->m;
+   const size_t         r    = ChIP->r;
+   const unsigned int   nb   = ChIP->nb;
+   const unsigned int * size = ChIP->sz;
+
+   // Workspace.
+   double             * pem   = bw->pem;
+   double             * trans = bw->trans;
+   double             * suff  = bw->suff;
+   double             * newp  = bw->newp;
+
+   // Variables optimized by Viterbi training.
+   double *p = zerone->p;
+   double *Q = zerone->Q;
+
+   if (bw->path == NULL) {
+      bw->path = malloc(nobs(ChIP) * sizeof(int));
+      if (bw->path == NULL) {
+         fprintf(stderr, "memory error %s:%d\n", __FILE__, __LINE__);
+         return -1;
       }
+   }
+   int *path = bw->path;
+
+   trace_begin("Viterbi step", NULL, -1);
+
+   // Update emission probabilities (in log space).
+   unsigned int log_space_no_warn = 5;
+   stage_begin(STAGE_EMISSION);
+   if (bw->pool == NULL || pool_prob(bw->pool, log_space_no_warn) < 0) {
+      zinm_prob(zerone, bw->index, log_space_no_warn, pem);
+   }
+   stage_end(STAGE_EMISSION);
+
+   double log_Q[m*m];
+   double initp[m];
+   for (size_t i = 0 ; i < m ; i++) initp[i] = log(1.0/m);
+   for (size_t i = 0 ; i < m*m ; i++) log_Q[i] = log(Q[i]);
+   // See 'zerone_viterbi()'.
+   for (size_t i = 0 ; i < m*m ; i++) if (log_Q[i] == 0) log_Q[i] = -DBL_MIN;
+
+   stage_begin(STAGE_VITERBI);
+   int err = block_viterbi(m, nb, size, log_Q, initp, pem, path);
+   stage_end(STAGE_VITERBI);
+   if (err) {
+      trace_end("Viterbi step", NULL, -1);
+      return -1;
+   }
 
-      // Check convergence
-      double maxd = 0.0;
-      for (size_t i = 0 ; i < m*(r+1) ; i++) {
-         double thisd = fabs(newp[i]-p[i]);
-         maxd = thisd > maxd ? thisd : maxd;
+   // Log-probability of the path and transitions along it.
+   stage_begin(STAGE_MSTEP);
+   for (size_t i = 0 ; i < m*m ; i++) trans[i] = VT_PSEUDOCOUNT;
+   double l = 0.0;
+   size_t k = 0;
+   for (size_t b = 0 ; b < nb ; b++) {
+      for (size_t t = 0 ; t < size[b] ; t++, k++) {
+         l += pem[path[k]+k*m];
+         if (t == 0) {
+            l += initp[path[k]];
+            continue;
+         }
+         l += log_Q[path[k-1]+path[k]*m];
+         trans[path[k-1]+path[k]*m]++;
       }
+   }
+   zerone->l = l;
+
+   vt_stats(m, ChIP, bw->index, bw->i0, path, suff);
+   trace_end("Viterbi step", NULL, -1);
 
-      if (maxd < TOLERANCE) break;
-      memcpy(p, newp, m*(r+1) * sizeof(double));
+   // A state that is not on the path cannot be updated.
+   for (size_t i = 0 ; i < m ; i++) {
+      if (suff[0+i*(r+2)] + suff[1+i*(r+2)] == 0) {
+         debug_print("state %zu not on the Viterbi path\n", i);
+         stage_end(STAGE_MSTEP);
+         return 1;
+      }
+   }
 
+   // Update 'Q'.
+   update_trans(m, Q, trans);
+
+   // Update 'p'.
+   trace_begin("M-step", NULL, -1);
+   int status = update_p(zerone, bw->R, suff, newp);
+   trace_end("M-step", NULL, -1);
+   stage_end(STAGE_MSTEP);
+   if (status < 0) return -1;
+
+   // Check convergence
+   double maxd = 0.0;
+   for (size_t i = 0 ; i < m*(r+1) ; i++) {
+      double thisd = fabs(newp[i]-p[i]);
+      maxd = thisd > maxd ? thisd : maxd;
    }
 
+   if (maxd < TOLERANCE) return 1;
+   memcpy(p, newp, m*(r+1) * sizeof(double));
+
+   return 0;
+
+}
+
+
+void
+bw_finish
+(
+   zerone_t * zerone,
+   bw_t     * bw
+)
+// SYNOPSIS:
+//   Compute the final emission probabilities in log space, transfer
+//   them to 'zerone' together with the posterior probabilities and
+//   destroy the workspace.
+{
+
 #ifdef DEBUG
 fprintf(stderr, "\n");
 #endif
 
-   free(newp);
-   free(prob);
-   free(trans);
-   free(ystar);
-
    // Compute final emission probs in log space.
    unsigned int log_space_no_warn = 5;
-   zinm_prob(zerone, index, log_space_no_warn, pem);
-
-   free(index);
+   if (bw->pool == NULL || pool_prob(bw->pool, log_space_no_warn) < 0) {
+      stage_begin(STAGE_EMISSION);
+      zinm_prob(zerone, bw->index, log_space_no_warn, bw->pem);
+      stage_end(STAGE_EMISSION);
+   }
 
    // 'Q','p' and 'l' have been updated in-place.
-   zerone->phi = phi;
-   zerone->pem = pem;
+   zerone->phi = bw->phi;
+   zerone->pem = bw->pem;
+
+   bw->phi = NULL;
+   bw->pem = NULL;
+   destroy_bw(bw);
+
+   return;
+
+}
+
+
+void
+bw_zinm
+(
+   zerone_t *zerone
+)
+{
+
+   bw_t *bw = new_bw(zerone);
+   if (bw == NULL) return;
+
+   // Start Baum-Welch cycles.
+   for (zerone->iter = 1 ; zerone->iter < BW_MAXITER ; zerone->iter++) {
+      int status = bw_iter(zerone, bw);
+      if (status < 0) {
+         destroy_bw(bw);
+         return;
+      }
+      if (status > 0) break;
+   }
+
+   bw_finish(zerone, bw);
 
    return;
 
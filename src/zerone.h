@@ -27,22 +27,42 @@
 #define BW_MAXITER 100     // BW iterations //
 #define BT_MAXITER 20      // Backtrack iterations //
 #define TOLERANCE 1e-6
+#define EARLYQC_ITER 5     // BW iterations between early QC //
+#define EARLYQC_MAX -1.0   // Early rejection QC score //
+#define MS_ROUND 5         // BW iterations between pruning rounds //
+#define MS_PRUNE_GAP 1e-3  // Log-likelihood lag (per window) to prune //
+#define ZINM_MINROWS 16384 // Min rows per thread of 'zinm_prob_mt()' //
+#define VT_PSEUDOCOUNT 1.0 // Added to the transitions of 'vt_iter()' //
 
+struct bw_t;
 struct ChIP_t;
+struct seg_t;
+struct pool_t;
+struct start_t;
 struct zerone_t;
+struct zinm_part_t;
+struct zerone_args_t;
 struct zerone_parser_args_t;
 
 typedef unsigned int uint;
+typedef struct bw_t bw_t;
 typedef struct ChIP_t ChIP_t;
+typedef struct start_t start_t;
 typedef struct zerone_t zerone_t;
+typedef struct zinm_part_t zinm_part_t;
+typedef struct zerone_args_t zerone_args_t;
 typedef struct zerone_parser_args_t zerone_parser_args_t;
 
 
+// Without mock control, the first profile is a constant (1 in
+// every window). It is implicit: 'y' has only 'r-nomock' columns.
 struct ChIP_t {
    size_t  r;       // number of dimensions of 'y' //
    int     nb;      // number of blocks (chromosomes) //
+   int     nomock;  // first profile is implicit (1) //
    int   * y;       // observations //
    char  * nm;      // block names //
+   struct seg_t * seg; // segments of windows (or NULL) //
    uint    sz[];    // block sizes //
 };
 
@@ -59,6 +79,64 @@ struct zerone_t {
    double   l;      // log-likelihood //
    int    * path;   // Viterbi path //
    int      iter;   // number of BW iterations //
+   int      vt;     // iterations of Viterbi training (hard EM) //
+   int      polish; // max BW iterations after Viterbi training //
+                    // ('BW_MAXITER': until convergence) //
+   int      early;  // rejected by early QC (1) //
+   int      gen;    // generation of the checkpoint //
+};
+
+struct bw_t {
+   int    * index;  // index of the time series //
+   int      i0;     // index of first all-0 observation //
+   double * pem;    // emission probs //
+   double * phi;    // posterior probs //
+   double * trans;  // expected transitions //
+   double * suff;   // sufficient statistics //
+   double * newp;   // updated emission par //
+   double   R;      // mock emission ratio //
+   int      shared; // 'index' owned by another workspace (1) //
+   struct pool_t * pool; // threads of the E-step (or NULL) //
+   int    * path;   // Viterbi path (see 'vt_iter()') //
+};
+
+struct start_t {
+   zerone_t * Z;      // the fit //
+   bw_t     * bw;     // Baum-Welch workspace //
+   int        status; // see 'bw_iter()' //
+   double     trace[BW_MAXITER]; // log-likelihood of every cycle //
+};
+
+// Rows of the emission probabilities computed by one thread.
+// The first pass computes the first occurrences of the rows
+// (see 'indexts()'), the second copies the other rows.
+struct zinm_part_t {
+   const zerone_t * Z;      // the fit //
+   const int      * index;  // index of the time series //
+   const double   * logp;   // normalized 'p' in log space //
+         int        otype;  // output type (see 'zinm_prob()') //
+         size_t     k0;     // first row //
+         size_t     k1;     // last row (excluded) //
+         int        pass;   // 1 or 2 (0 for both in one pass) //
+         double   * pem;    // emission probabilities //
+};
+
+struct zerone_args_t {
+   int          earlyqc;     // reject hopeless datasets during BW
+   const char * checkpoint;  // checkpoint file (or NULL)
+   int          resume;      // resume from checkpoint
+   int          starts;      // number of EM initializations
+   int          workers;     // number of worker processes
+   int          threads;     // number of threads of the E-step
+   const zinb_par_t * mockpar; // fit of the mock profile (or NULL)
+   int        * index;       // index of the time series (or NULL)
+   int          i0;          // first all-0 emission (with 'index')
+   int          adaptive;    // merge windows with counts below (or 0)
+   int          refine;      // windows per coarse window (or 0)
+   const zerone_t * warm;    // fit used as a warm start (or NULL)
+   int          hardem;      // fit by Viterbi training (see 'vt_iter()')
+   int          polish;      // max BW cycles after Viterbi training
+                             // ('BW_MAXITER': until convergence)
 };
 
 struct zerone_parser_args_t {
@@ -66,16 +144,43 @@ struct zerone_parser_args_t {
    int minmapq;     // minimum mapping quality
 };
 
+int        append_ChIP(ChIP_t *, const ChIP_t *);
+void       bw_finish(zerone_t *, bw_t *);
+int        bw_estep(zerone_t *, bw_t *);
+int        bw_iter(zerone_t *, bw_t *);
 void       bw_zinm(zerone_t *);
+void       destroy_bw(bw_t *);
 void       destroy_zerone_all(zerone_t *);
-zerone_t * do_zerone(ChIP_t *);
+zerone_t * do_zerone(ChIP_t *, const zerone_args_t *);
+int        early_reject(zerone_t *, bw_t *);
+void       extend_par(zerone_t *, uint);
+int        find_block(const ChIP_t *, const char *, int);
+int        index_ChIP(const ChIP_t *, int *);
+void       get_state_map(const zerone_t *, int *);
+void       init_par(const zinb_par_t *, uint, int, double *, double *);
+int        is_invalid(const int *, int, int);
+int        multi_start(ChIP_t *, const zinb_par_t *, int,
+               zerone_t **, bw_t **, double *);
+bw_t     * new_bw(zerone_t *);
 ChIP_t   * new_ChIP(uint, uint, int *, const char **, const uint *);
 zerone_t * new_zerone(uint, ChIP_t *);
 uint       nobs(const ChIP_t *);
 ChIP_t   * read_file(FILE *);
+void       reorder(zerone_t *, int *);
 void       set_zerone_par(zerone_t *, const double *,
                double, double, const double *);
+bw_t     * share_bw(zerone_t *, const bw_t *);
+void       suff_stats(size_t, const ChIP_t *, const int *, int,
+               const double *, double *);
+int        update_p(const zerone_t *, double, const double *, double *);
 void       update_trans(size_t, double *, const double *);
+int        vt_iter(zerone_t *, bw_t *);
+void       vt_stats(size_t, const ChIP_t *, const int *, int,
+               const int *, double *);
+int        zinm_logp(const zerone_t *, int, double *);
 void       zinm_prob(zerone_t *, const int *, int, double *);
+void       zinm_prob_mt(zerone_t *, const int *, int, double *, int);
+void       zinm_rows(const zinm_part_t *);
+void       zerone_viterbi(zerone_t *);
 
 #endif
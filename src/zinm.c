@@ -283,6 +283,38 @@ mle_zinb
 
 }
 
+int
+pad_zinb
+(
+   zinb_par_t *par,
+   size_t nobs,
+   size_t nzero
+)
+// SYNOPSIS:
+//   Update the estimate of 'mle_zinb()' on a sample of size 'nobs'
+//   for the same sample with 'nzero' more 0s. The estimates of 'a'
+//   and 'p' depend only on the positive values, so only 'pi' is
+//   rescaled. When 'pi' was clipped to 1 its estimate is lost and
+//   the padded sample must be fitted again.
+//
+// PARAMETERS:
+//   par: estimate on the sample (updated)
+//   nobs: sample size
+//   nzero: number of 0s added to the sample
+//
+// RETURN:
+//   1 if 'par' was updated, 0 otherwise.
+//
+// SIDE EFFECTS:
+//   None.
+{
+
+   if (nobs == 0 || par->pi >= 1.0) return 0;
+   par->pi *= (double) nobs / (nobs + nzero);
+   return 1;
+
+}
+
 
 
 // ---- Private functions (used only internally) ---- //
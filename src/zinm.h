@@ -63,6 +63,8 @@ tab_t   * compress_histo (histo_t *);
 // ZINB distributions, and return the paramters.
 zinb_par_t * mle_nb   (int *, size_t);
 zinb_par_t * mle_zinb (int *, size_t);
+// Update the ZINB estimate for 0s added to the sample.
+int          pad_zinb (zinb_par_t *, size_t, size_t);
 // Change the default error handler. Pass a NULL argument
 // to rest to default behavior.
 void         set_zinb_err_handler(zinb_err_handler_t);